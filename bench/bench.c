@@ -0,0 +1,714 @@
+/**
+ * bench.c - Benchmarks on a Generated Repository
+ *
+ * This program generates a synthetic repository in a temporary directory
+ * and times the operations that dominate real workloads, printing the
+ * results as JSON on stdout:
+ *   - write_tree: hashing a new work tree into blobs and trees, then
+ *     re-running it on the unchanged tree (write_tree_cached) and after
+ *     each history commit (write_tree_incremental)
+ *   - repack: packing the generated history with delta compression
+ *   - read_object: reading every packed object in random order
+ *   - index_pack: storing and indexing that pack in an empty repository
+ *     (process_pack_file(), what clone and fetch do with a received pack)
+ *   - checkout: writing the head tree into an empty directory
+ *
+ * The generator lays out --files files in directories --depth levels
+ * deep, with sizes spread log-uniformly between --min-size and
+ * --max-size, and then makes --commits commits that each edit --churn
+ * files by inserting a line, so the repacked history is mostly deltas.
+ * Content is text drawn from a seeded generator, so runs with the same
+ * options are comparable.
+ *
+ * Each result reports the number of timed operations, their throughput
+ * and the min/p50/p90/p99/max latency of one operation. The object cache
+ * is disabled (unless --object-cache is given) so that repeated passes
+ * measure the same work instead of memory copies.
+ *
+ * Build and run with:
+ *   cmake --build build --target bench && build/bench > bench_output.txt
+ */
+
+#define _GNU_SOURCE  // nftw()
+
+#include "git.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+
+/*
+ * ============================================================================
+ * Options and Random Numbers
+ * ============================================================================
+ */
+
+/**
+ * Benchmark Options Structure
+ */
+struct bench_options {
+  size_t files;        // Files in the generated tree
+  int depth;           // Directory levels below the top
+  size_t min_size;     // Smallest file size in bytes
+  size_t max_size;     // Largest file size in bytes
+  int commits;         // Commits in the generated history
+  size_t churn;        // Files edited per commit
+  int iterations;      // Samples for each repeatable benchmark
+  uint64_t seed;       // Generator seed
+  int keep;            // Keep the temporary directory
+  int object_cache;    // Leave the object cache enabled
+};
+
+static uint64_t rng_state;
+
+/**
+ * Next number of a xorshift64* sequence.
+ */
+static uint64_t rng_next(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Random number in [0, n).
+ */
+static size_t rng_below(size_t n) {
+  return n ? rng_next() % n : 0;
+}
+
+/**
+ * Random size between min and max, log-uniformly distributed: every
+ * power-of-two range between them is equally likely, so small files are
+ * common and large ones rare, as in real trees.
+ */
+static size_t random_size(size_t min, size_t max) {
+  if (min < 1)
+    min = 1;
+  if (max <= min)
+    return min;
+  int lo = 63 - __builtin_clzll(min);
+  int hi = 63 - __builtin_clzll(max);
+  int bits = lo + rng_below(hi - lo + 1);
+  size_t size = ((size_t)1 << bits) + rng_below((size_t)1 << bits);
+  return size < min ? min : size > max ? max : size;
+}
+
+/*
+ * ============================================================================
+ * Repository Generation
+ * ============================================================================
+ */
+
+static const char *const words[] = {
+    "int",    "return", "struct", "static", "const",  "char",   "size_t",
+    "if",     "else",   "for",    "while",  "break",  "object", "tree",
+    "commit", "blob",   "pack",   "delta",  "index",  "ref",    "hash",
+    "buffer", "length", "offset", "count",  "entry",  "path",   "mode",
+    "free",   "malloc", "error",  "result", "data",   "next",   "value",
+};
+
+#define NR_WORDS (sizeof(words) / sizeof(words[0]))
+
+/**
+ * Append random lines of text until a buffer holds at least len bytes.
+ *
+ * @param buf Output buffer (len + 128 bytes)
+ * @param len Bytes wanted
+ * @return Bytes written (len up to the end of the last line)
+ */
+static size_t fill_text(char *buf, size_t len) {
+  size_t pos = 0;
+  while (pos < len) {
+    if (rng_below(4) == 0)
+      buf[pos++] = ' ', buf[pos++] = ' ';
+    int nr = 1 + rng_below(10);
+    for (int i = 0; i < nr; i++)
+      pos += sprintf(buf + pos, "%s%s", i ? " " : "",
+                     words[rng_below(NR_WORDS)]);
+    buf[pos++] = '\n';
+  }
+  return pos;
+}
+
+/**
+ * Path of generated file i: "d<n>/.../f<i>.c", spreading the files
+ * evenly over fanout^depth leaf directories.
+ */
+static void file_path(const struct bench_options *opts, size_t fanout,
+                      size_t i, char *path, size_t path_size) {
+  size_t leaves = 1;
+  for (int d = 0; d < opts->depth; d++)
+    leaves *= fanout;
+  size_t per_leaf = (opts->files + leaves - 1) / leaves;
+  size_t leaf = i / per_leaf;
+
+  size_t pos = 0;
+  size_t div = leaves;
+  for (int d = 0; d < opts->depth; d++) {
+    div /= fanout;
+    pos += snprintf(path + pos, path_size - pos, "d%zu/", leaf / div % fanout);
+  }
+  snprintf(path + pos, path_size - pos, "f%zu.c", i);
+}
+
+/**
+ * Create the parent directories of a relative path.
+ */
+static void create_parent_dirs(const char *path) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", path);
+  for (char *p = strchr(dir, '/'); p; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    mkdir(dir, 0755);
+    *p = '/';
+  }
+}
+
+/**
+ * Write a file in full.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_file(const char *path, const char *data, size_t len) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  int result = write_in_full(fd, data, len);
+  if (close(fd) != 0)
+    result = 1;
+  return result;
+}
+
+/**
+ * Generate the work tree.
+ *
+ * @param bytes Output: total size of the files
+ * @return 0 on success, 1 on error
+ */
+static int generate_tree(const struct bench_options *opts, size_t fanout,
+                         size_t *bytes) {
+  char *buf = malloc(opts->max_size + 128);
+  *bytes = 0;
+  for (size_t i = 0; i < opts->files; i++) {
+    char path[PATH_MAX];
+    file_path(opts, fanout, i, path, sizeof(path));
+    create_parent_dirs(path);
+    size_t len = fill_text(buf, random_size(opts->min_size, opts->max_size));
+    if (write_file(path, buf, len) != 0) {
+      free(buf);
+      return 1;
+    }
+    *bytes += len;
+  }
+  free(buf);
+  return 0;
+}
+
+/**
+ * Edit a generated file by inserting a line of text at a random line
+ * boundary, the kind of change that leaves most of a blob intact.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int edit_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+  char *buf = malloc(st.st_size + 256);
+  ssize_t len = read(fd, buf, st.st_size);
+  close(fd);
+  if (len != st.st_size) {
+    free(buf);
+    return 1;
+  }
+
+  size_t at = rng_below(len);
+  while (at > 0 && buf[at - 1] != '\n')
+    at--;
+  char line[256];
+  size_t line_len = fill_text(line, 1);
+  memmove(buf + at + line_len, buf + at, len - at);
+  memcpy(buf + at, line, line_len);
+  int result = write_file(path, buf, len + line_len);
+  free(buf);
+  return result;
+}
+
+/*
+ * ============================================================================
+ * Timing and Results
+ * ============================================================================
+ */
+
+/**
+ * Benchmark Result Structure
+ * Latency samples of one operation and the data it processed.
+ */
+struct bench_result {
+  const char *name;
+  const char *unit;    // What one operation is, e.g. "object"
+  double *samples;     // Seconds per operation
+  size_t nr, alloc;
+  uint64_t bytes;      // Bytes processed by all operations
+};
+
+static struct bench_result *results;
+static size_t nr_results, alloc_results;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Start a new result.
+ */
+static struct bench_result *new_result(const char *name, const char *unit) {
+  if (nr_results == alloc_results) {
+    alloc_results = alloc_results ? alloc_results * 2 : 16;
+    results = realloc(results, alloc_results * sizeof(*results));
+  }
+  struct bench_result *r = &results[nr_results++];
+  *r = (struct bench_result){.name = name, .unit = unit};
+  return r;
+}
+
+/**
+ * Record one operation.
+ */
+static void add_sample(struct bench_result *r, double seconds,
+                       uint64_t bytes) {
+  if (r->nr == r->alloc) {
+    r->alloc = r->alloc ? r->alloc * 2 : 64;
+    r->samples = realloc(r->samples, r->alloc * sizeof(*r->samples));
+  }
+  r->samples[r->nr++] = seconds;
+  r->bytes += bytes;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Nearest-rank percentile of sorted samples, in microseconds.
+ */
+static double percentile_us(const struct bench_result *r, int p) {
+  size_t rank = (r->nr * p + 99) / 100;
+  return r->samples[rank ? rank - 1 : 0] * 1e6;
+}
+
+/**
+ * Print one result as a JSON object.
+ */
+static void print_result(struct bench_result *r, int last) {
+  double total = 0;
+  for (size_t i = 0; i < r->nr; i++)
+    total += r->samples[i];
+  qsort(r->samples, r->nr, sizeof(*r->samples), compare_doubles);
+
+  printf("    {\n");
+  printf("      \"name\": \"%s\",\n", r->name);
+  printf("      \"unit\": \"%s\",\n", r->unit);
+  printf("      \"ops\": %zu,\n", r->nr);
+  printf("      \"bytes\": %" PRIu64 ",\n", r->bytes);
+  printf("      \"seconds\": %.6f,\n", total);
+  printf("      \"ops_per_second\": %.1f,\n", total > 0 ? r->nr / total : 0);
+  printf("      \"mib_per_second\": %.1f,\n",
+         total > 0 ? r->bytes / total / (1024 * 1024) : 0);
+  if (r->nr) {
+    printf("      \"latency_us\": {\"min\": %.1f, \"p50\": %.1f, "
+           "\"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}\n",
+           r->samples[0] * 1e6, percentile_us(r, 50), percentile_us(r, 90),
+           percentile_us(r, 99), r->samples[r->nr - 1] * 1e6);
+  } else {
+    printf("      \"latency_us\": null\n");
+  }
+  printf("    }%s\n", last ? "" : ",");
+}
+
+/*
+ * ============================================================================
+ * Benchmarks
+ * ============================================================================
+ */
+
+/**
+ * Time write_working_tree() once.
+ *
+ * @param tree Output: hex ID of the tree (40 hex digits + NUL)
+ * @return 0 on success, 1 on error
+ */
+static int time_write_tree(struct bench_result *r, uint64_t bytes,
+                           char *tree) {
+  double start = now();
+  char *hex = write_working_tree(0);
+  double elapsed = now() - start;
+  if (!hex) {
+    fprintf(stderr, "write_working_tree failed\n");
+    return 1;
+  }
+  add_sample(r, elapsed, bytes);
+  memcpy(tree, hex, GIT_HASH_LENGTH + 1);
+  free(hex);
+  return 0;
+}
+
+/**
+ * Commit a tree onto refs/heads/main.
+ *
+ * @param parent Hex ID of the parent commit (updated), or "" for none
+ */
+static int commit_tree(const char *tree, char *parent) {
+  char *hex = create_commit_object(tree, *parent ? parent : NULL,
+                                   "Generated by bench\n");
+  struct object_id oid;
+  if (!hex || get_oid_hex(hex, &oid) != 0 ||
+      update_ref("refs/heads/main", &oid) != 0) {
+    fprintf(stderr, "Failed to commit %s\n", tree);
+    free(hex);
+    return 1;
+  }
+  memcpy(parent, hex, GIT_HASH_LENGTH + 1);
+  free(hex);
+  return 0;
+}
+
+/**
+ * Time reading every object of a pack, in random order.
+ */
+static void bench_read_object(const struct bench_options *opts,
+                              const struct packed_git *p) {
+  struct bench_result *r = new_result("read_object", "object");
+  struct object_id *oids = malloc(p->num_objects * sizeof(*oids));
+  for (uint32_t i = 0; i < p->num_objects; i++)
+    memcpy(oids[i].hash, p->shas + (size_t)i * SHA_DIGEST_LENGTH,
+           SHA_DIGEST_LENGTH);
+
+  for (int it = 0; it < opts->iterations; it++) {
+    for (size_t i = p->num_objects; i > 1; i--) {
+      size_t j = rng_below(i);
+      struct object_id tmp = oids[i - 1];
+      oids[i - 1] = oids[j];
+      oids[j] = tmp;
+    }
+    for (uint32_t i = 0; i < p->num_objects; i++) {
+      double start = now();
+      git_object *obj = odb_read_object(&oids[i]);
+      double elapsed = now() - start;
+      if (!obj) {
+        fprintf(stderr, "Failed to read a packed object\n");
+        continue;
+      }
+      add_sample(r, elapsed, obj->size);
+      free_git_object(obj);
+    }
+  }
+  free(oids);
+}
+
+/**
+ * Read a whole file into memory.
+ *
+ * @return Contents (caller must free), or NULL on error
+ */
+static char *read_whole_file(const char *path, size_t *len) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+  char *data = malloc(st.st_size ? st.st_size : 1);
+  ssize_t got = read(fd, data, st.st_size);
+  close(fd);
+  if (got != st.st_size) {
+    free(data);
+    return NULL;
+  }
+  *len = st.st_size;
+  return data;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  (void)st, (void)flag, (void)ftw;
+  return remove(path);
+}
+
+/**
+ * Remove a directory tree.
+ */
+static void remove_tree(const char *path) {
+  nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * Time storing and indexing a pack in a new empty repository, as a
+ * clone receiving it would.
+ *
+ * @param repo Top of the benchmark repository, returned to afterwards
+ * @param scratch Directory for the repositories (removed after each run)
+ */
+static int bench_index_pack(const struct bench_options *opts,
+                            const struct packed_git *p, const char *repo,
+                            const char *scratch) {
+  size_t len;
+  char *data = read_whole_file(p->pack_path, &len);
+  if (!data)
+    return 1;
+
+  struct bench_result *r = new_result("index_pack", "pack");
+  int result = 0;
+  for (int it = 0; it < opts->iterations && result == 0; it++) {
+    if (mkdir(scratch, 0755) != 0 || chdir(scratch) != 0 ||
+        mkdir(GIT_DIR, 0755) != 0 || mkdir(OBJECTS_DIR, 0755) != 0 ||
+        mkdir(PACK_DIR, 0755) != 0) {
+      fprintf(stderr, "Failed to create %s: %s\n", scratch, strerror(errno));
+      result = 1;
+      break;
+    }
+    double start = now();
+    result = process_pack_file(data, len);
+    double elapsed = now() - start;
+    if (chdir(repo) != 0)
+      result = 1;
+    if (result == 0)
+      add_sample(r, elapsed, len);
+    remove_tree(scratch);
+  }
+
+  // The packs loaded last were the scratch repository's
+  reprepare_packed_git();
+  free(data);
+  return result;
+}
+
+/**
+ * Time checking out a tree into a new empty directory.
+ *
+ * @param dir Directory to check out into (removed after each run)
+ */
+static int bench_checkout(const struct bench_options *opts, const char *tree,
+                          uint64_t bytes, const char *dir) {
+  struct bench_result *r = new_result("checkout", "checkout");
+  for (int it = 0; it < opts->iterations; it++) {
+    if (mkdir(dir, 0755) != 0) {
+      fprintf(stderr, "Failed to create %s: %s\n", dir, strerror(errno));
+      return 1;
+    }
+    double start = now();
+    int result = checkout_tree(tree, dir, 0);
+    double elapsed = now() - start;
+    remove_tree(dir);
+    if (result != 0) {
+      fprintf(stderr, "checkout_tree failed\n");
+      return 1;
+    }
+    add_sample(r, elapsed, bytes);
+  }
+  return 0;
+}
+
+/**
+ * Generate the repository and run every benchmark in it.
+ *
+ * @param stats Output: size of the generated repository, as JSON members
+ * @return 0 on success, 1 on error
+ */
+static int run_benchmarks(const struct bench_options *opts, const char *top,
+                          char *stats, size_t stats_size) {
+  char repo[PATH_MAX], scratch[PATH_MAX], checkout[PATH_MAX];
+  snprintf(repo, sizeof(repo), "%s/repo", top);
+  snprintf(scratch, sizeof(scratch), "%s/index-pack", top);
+  snprintf(checkout, sizeof(checkout), "%s/checkout", top);
+
+  if (mkdir(repo, 0755) != 0 || chdir(repo) != 0 ||
+      mkdir(GIT_DIR, 0755) != 0 || mkdir(OBJECTS_DIR, 0755) != 0 ||
+      mkdir(REFS_DIR, 0755) != 0 ||
+      create_symref("HEAD", "refs/heads/main") != 0) {
+    fprintf(stderr, "Failed to create %s: %s\n", repo, strerror(errno));
+    return 1;
+  }
+  if (!opts->object_cache && (config_set("core.objectCacheLimit", "0") != 0 ||
+                              config_set("core.blobCacheLimit", "0") != 0))
+    return 1;
+
+  size_t fanout = 1;
+  if (opts->depth > 0) {
+    for (;;) {
+      size_t leaves = 1;
+      for (int d = 0; d < opts->depth; d++)
+        leaves *= fanout;
+      if (leaves * 16 >= opts->files)
+        break;
+      fanout++;
+    }
+  }
+
+  size_t bytes;
+  if (generate_tree(opts, fanout, &bytes) != 0)
+    return 1;
+
+  char tree[GIT_HASH_LENGTH + 1], head[GIT_HASH_LENGTH + 1] = "";
+  struct bench_result *r = new_result("write_tree", "tree");
+  if (time_write_tree(r, bytes, tree) != 0 || commit_tree(tree, head) != 0)
+    return 1;
+
+  r = new_result("write_tree_cached", "tree");
+  for (int it = 0; it < opts->iterations; it++)
+    if (time_write_tree(r, bytes, tree) != 0)
+      return 1;
+
+  r = new_result("write_tree_incremental", "tree");
+  for (int c = 1; c < opts->commits; c++) {
+    for (size_t i = 0; i < opts->churn; i++) {
+      char path[PATH_MAX];
+      file_path(opts, fanout, rng_below(opts->files), path, sizeof(path));
+      if (edit_file(path) != 0)
+        return 1;
+    }
+    if (time_write_tree(r, bytes, tree) != 0 || commit_tree(tree, head) != 0)
+      return 1;
+  }
+
+  r = new_result("repack", "repack");
+  double start = now();
+  if (repack(REPACK_ALL | REPACK_DELETE, -1, -1, 0, 0) != 0)
+    return 1;
+  double elapsed = now() - start;
+  reprepare_packed_git();
+  struct packed_git *p = get_packed_git();
+  if (!p) {
+    fprintf(stderr, "repack left no pack\n");
+    return 1;
+  }
+  add_sample(r, elapsed, p->pack_size);
+  snprintf(stats, stats_size,
+           "\"fanout\": %zu, \"bytes\": %zu, \"objects\": %" PRIu32
+           ", \"pack_bytes\": %zu",
+           fanout, bytes, p->num_objects, p->pack_size);
+
+  bench_read_object(opts, p);
+  if (bench_index_pack(opts, p, repo, scratch) != 0 ||
+      bench_checkout(opts, tree, bytes, checkout) != 0)
+    return 1;
+  return 0;
+}
+
+/*
+ * ============================================================================
+ * Main
+ * ============================================================================
+ */
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [--files <n>] [--depth <n>] [--min-size <bytes>]\n"
+          "          [--max-size <bytes>] [--commits <n>] [--churn <n>]\n"
+          "          [--iterations <n>] [--seed <n>] [--object-cache]"
+          " [--keep]\n",
+          argv0);
+}
+
+int main(int argc, char *argv[]) {
+  struct bench_options opts = {
+      .files = 10000,
+      .depth = 3,
+      .min_size = 64,
+      .max_size = 64 * 1024,
+      .commits = 20,
+      .churn = 0,  // 1% of the files
+      .iterations = 5,
+      .seed = 1,
+  };
+  static const struct option longopts[] = {
+      {"files", required_argument, NULL, 'f'},
+      {"depth", required_argument, NULL, 'd'},
+      {"min-size", required_argument, NULL, 'm'},
+      {"max-size", required_argument, NULL, 'M'},
+      {"commits", required_argument, NULL, 'c'},
+      {"churn", required_argument, NULL, 'C'},
+      {"iterations", required_argument, NULL, 'i'},
+      {"seed", required_argument, NULL, 's'},
+      {"object-cache", no_argument, NULL, 'o'},
+      {"keep", no_argument, NULL, 'k'},
+      {NULL, 0, NULL, 0},
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+    switch (c) {
+    case 'f': opts.files = strtoull(optarg, NULL, 10); break;
+    case 'd': opts.depth = atoi(optarg); break;
+    case 'm': opts.min_size = strtoull(optarg, NULL, 10); break;
+    case 'M': opts.max_size = strtoull(optarg, NULL, 10); break;
+    case 'c': opts.commits = atoi(optarg); break;
+    case 'C': opts.churn = strtoull(optarg, NULL, 10); break;
+    case 'i': opts.iterations = atoi(optarg); break;
+    case 's': opts.seed = strtoull(optarg, NULL, 10); break;
+    case 'o': opts.object_cache = 1; break;
+    case 'k': opts.keep = 1; break;
+    default: usage(argv[0]); return 1;
+    }
+  }
+  if (optind != argc || opts.files == 0 || opts.depth < 0 ||
+      opts.depth > 16 || opts.min_size > opts.max_size || opts.commits < 1 ||
+      opts.iterations < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (opts.churn == 0)
+    opts.churn = opts.files / 100 ? opts.files / 100 : 1;
+  rng_state = opts.seed ? opts.seed : 1;
+
+  char top[] = "/tmp/git-bench-XXXXXX";
+  if (!mkdtemp(top)) {
+    fprintf(stderr, "Failed to create a temporary directory: %s\n",
+            strerror(errno));
+    return 1;
+  }
+
+  char stats[256] = "";
+  int result = run_benchmarks(&opts, top, stats, sizeof(stats));
+  if (chdir("/") != 0)
+    result = 1;
+  if (opts.keep)
+    fprintf(stderr, "Kept %s\n", top);
+  else
+    remove_tree(top);
+  if (result != 0)
+    return 1;
+
+  printf("{\n");
+  printf("  \"config\": {\"files\": %zu, \"depth\": %d, \"min_size\": %zu, "
+         "\"max_size\": %zu, \"commits\": %d, \"churn\": %zu, "
+         "\"iterations\": %d, \"seed\": %" PRIu64 ", \"object_cache\": %s, "
+         "\"workers\": %d},\n",
+         opts.files, opts.depth, opts.min_size, opts.max_size, opts.commits,
+         opts.churn, opts.iterations, opts.seed,
+         opts.object_cache ? "true" : "false", online_cpus());
+  printf("  \"repository\": {%s},\n", stats);
+  printf("  \"results\": [\n");
+  for (size_t i = 0; i < nr_results; i++) {
+    print_result(&results[i], i + 1 == nr_results);
+    free(results[i].samples);
+  }
+  printf("  ]\n}\n");
+  free(results);
+  return 0;
+}
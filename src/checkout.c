@@ -0,0 +1,516 @@
+/**
+ * checkout.c - Working Tree Checkout
+ *
+ * This file implements writing a tree object out to the working directory.
+ * Checkout runs in two phases:
+ *   1. Walk the tree recursively on the calling thread, creating every
+ *      directory and collecting the list of files to write
+ *   2. Read the blobs and write the files from a pool of worker threads
+ *
+ * Writing many small files is dominated by syscall latency (open, write,
+ * close), which overlaps well across threads. Workers pull entries from
+ * a shared atomic counter; no two workers touch the same path.
+ *
+ * In a partial clone, the blobs missing after phase 1 are fetched from
+ * the promisor remote in a single request before the workers start.
+ *
+ * switch_tree() moves an existing work tree to another tree instead. It
+ * diffs the two trees, so only the paths that differ are deleted or
+ * queued for the workers, and unchanged subtrees are never read.
+ */
+
+#include "git.h"
+#include <dirent.h>
+#include <fcntl.h>
+
+/**
+ * Checkout Entry Structure
+ * A file scheduled to be written during phase 2.
+ */
+struct checkout_entry {
+  char *path;            // Path relative to the working tree
+  struct object_id oid;  // Blob to write
+  unsigned int mode;     // Tree entry mode
+};
+
+/**
+ * Checkout State Structure
+ */
+struct checkout {
+  struct checkout_entry *entries;
+  size_t nr, alloc;
+  atomic_size_t next;   // Next entry to hand to a worker
+  atomic_int errors;    // Number of files that failed to write
+};
+
+/**
+ * Phase 1: create the directories of a tree and queue its files.
+ *
+ * @param co Checkout state
+ * @param tree_obj Tree object to check out (freed by this function)
+ * @param prefix Directory the tree is checked out into
+ * @return 0 on success, 1 on error
+ */
+static int collect_tree(struct checkout *co, git_object *tree_obj,
+                        const char *prefix) {
+  if (!tree_obj)
+    return 1;
+
+  tree_object *tree = parse_tree_object(tree_obj);
+  if (!tree) {
+    free_git_object(tree_obj);
+    return 1;
+  }
+
+  int result = 0;
+  for (size_t i = 0; i < tree->count && result == 0; i++) {
+    const tree_entry *te = &tree->entries[i];
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", prefix, te->name);
+
+    if (te->mode == TREE_MODE_DIR) {
+      mkdir(path, 0755);
+      result = collect_tree(co, odb_read_object(te->oid), path);
+      continue;
+    }
+    if (te->mode == TREE_MODE_GITLINK)
+      continue;  // Submodule commits are not checked out
+
+    if (co->nr == co->alloc) {
+      co->alloc = co->alloc ? co->alloc * 2 : 256;
+      co->entries = realloc(co->entries, co->alloc * sizeof(*co->entries));
+    }
+    struct checkout_entry *ce = &co->entries[co->nr++];
+    ce->path = strdup(path);
+    ce->oid = *te->oid;
+    ce->mode = te->mode;
+  }
+
+  free_tree_object(tree);
+  free_git_object(tree_obj);
+  return result;
+}
+
+/**
+ * Write one blob to its path.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_entry(const struct checkout_entry *ce) {
+  git_object *blob = odb_read_object_once(&ce->oid);
+  if (!blob) {
+    char hex[GIT_HASH_LENGTH + 1];
+    oid_to_hex(&ce->oid, hex);
+    fprintf(stderr, "Missing blob %s for %s\n", hex, ce->path);
+    return 1;
+  }
+
+  int result = 0;
+  if (ce->mode == TREE_MODE_SYMLINK) {
+    // Symlink targets are stored as the blob content
+    if (symlink(blob->content, ce->path) != 0)
+      result = 1;
+  } else {
+    int fd = open(ce->path, O_WRONLY | O_CREAT | O_TRUNC,
+                  ce->mode == TREE_MODE_EXEC ? 0777 : 0666);
+    if (fd < 0) {
+      result = 1;
+    } else {
+      result = write_in_full(fd, blob->content, blob->size);
+      if (close(fd) != 0)
+        result = 1;
+    }
+  }
+
+  if (result)
+    fprintf(stderr, "Failed to write %s: %s\n", ce->path, strerror(errno));
+  free_git_object(blob);
+  return result;
+}
+
+/**
+ * Fetch the blobs of a partial clone that are not present yet.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int prefetch_blobs(const struct checkout *co) {
+  struct object_id *missing = malloc((co->nr ? co->nr : 1) * sizeof(*missing));
+  size_t nr = 0;
+  struct oid_set seen;
+  oid_set_init(&seen);
+  for (size_t i = 0; i < co->nr; i++) {
+    const struct object_id *oid = &co->entries[i].oid;
+    if (!odb_has_object(oid) && oid_set_insert(&seen, oid))
+      missing[nr++] = *oid;
+  }
+  oid_set_clear(&seen);
+
+  int result = nr ? promisor_fetch_objects(missing, nr) : 0;
+  free(missing);
+  return result;
+}
+
+/**
+ * Phase 2 worker: write files until none are left.
+ */
+static void *checkout_worker(void *arg) {
+  struct checkout *co = arg;
+
+  for (;;) {
+    size_t i = atomic_fetch_add(&co->next, 1);
+    if (i >= co->nr)
+      break;
+    if (write_entry(&co->entries[i]) != 0)
+      atomic_fetch_add(&co->errors, 1);
+  }
+  return NULL;
+}
+
+/**
+ * Checkout a tree object to the working directory.
+ * Creates the directory structure, then writes all files using a pool of
+ * worker threads.
+ *
+ * @param tree_hash SHA-1 hash of the tree to checkout
+ * @param prefix Directory prefix for relative paths
+ * @param workers Number of writer threads (0 = online CPUs)
+ * @return 0 on success, 1 on error
+ */
+int checkout_tree(const char *tree_hash, const char *prefix, int workers) {
+  trace_region_enter("checkout", "checkout-tree");
+  struct checkout co = {0};
+
+  int result = collect_tree(&co, read_object(tree_hash), prefix);
+  if (result == 0 && has_promisor_remote())
+    result = prefetch_blobs(&co);
+  if (result == 0) {
+    if (workers <= 0)
+      workers = online_cpus();
+    if ((size_t)workers > co.nr)
+      workers = co.nr ? co.nr : 1;
+    trace_region_enter("checkout", "write-files");
+    run_parallel(workers, checkout_worker, &co);
+    trace_region_leave("checkout", "write-files");
+    result = atomic_load(&co.errors) != 0;
+  }
+
+  for (size_t i = 0; i < co.nr; i++)
+    free(co.entries[i].path);
+  free(co.entries);
+  trace_region_leave("checkout", "checkout-tree");
+  return result;
+}
+
+/*
+ * ============================================================================
+ * Switching Between Trees
+ * ============================================================================
+ */
+
+/**
+ * Tree Switch State
+ * The paths that differ between the tree checked out and its replacement.
+ */
+struct tree_switch {
+  struct diff_change *changes;  // In tree order; paths are owned
+  size_t nr, alloc;
+  const char **deleted;  // Hash table of the deleted paths (NULL = free)
+  size_t deleted_size;   // Number of slots (power of two), 0 if none
+};
+
+/**
+ * diff_trees() callback: keep a copy of each change. Submodules are not
+ * checked out, so a gitlink side counts as absent.
+ */
+static int record_change(const struct diff_change *change, void *data) {
+  struct tree_switch *ts = data;
+  struct diff_change c = *change;
+  if (c.old_mode == TREE_MODE_GITLINK)
+    c.old_mode = 0;
+  if (c.new_mode == TREE_MODE_GITLINK)
+    c.new_mode = 0;
+  if (!c.old_mode && !c.new_mode)
+    return 0;
+
+  if (ts->nr == ts->alloc) {
+    ts->alloc = ts->alloc ? ts->alloc * 2 : 64;
+    ts->changes = realloc(ts->changes, ts->alloc * sizeof(*ts->changes));
+  }
+  c.path = strdup(change->path);
+  ts->changes[ts->nr++] = c;
+  return 0;
+}
+
+/**
+ * Whether the work tree still holds a file as it was checked out: with
+ * the same type, executable bit and content. Content comes from the stat
+ * cache when it is valid and from hashing the file otherwise.
+ *
+ * @param st Result of lstat() on the file
+ */
+static int file_is_unchanged(const struct index_state *index, const char *path,
+                             const struct stat *st, unsigned mode,
+                             const struct object_id *oid) {
+  if (S_ISLNK(mode) ? !S_ISLNK(st->st_mode)
+                    : !S_ISREG(st->st_mode) ||
+                          !(st->st_mode & 0100) != !(mode & 0100))
+    return 0;
+
+  const struct index_entry *ie = index_find(index, path);
+  if (S_ISREG(st->st_mode) && ie && index_entry_uptodate(index, ie, st))
+    return oideq(&ie->oid, oid);
+  struct object_id work_oid;
+  return hash_blob_file(path, st, &work_oid) == 0 && oideq(&work_oid, oid);
+}
+
+/**
+ * Slot for a path in a table of the given (power of two) size (FNV-1a).
+ */
+static size_t path_slot(const char *path, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)path; *p; p++)
+    hash = (hash ^ *p) * 1099511628211ULL;
+  return hash & (size - 1);
+}
+
+/**
+ * Index the paths the switch deletes, so that is_deleted() need not scan
+ * every change (the changes are in tree order, not strcmp() order). The
+ * table is kept at most half full and points into ts->changes.
+ */
+static void index_deleted(struct tree_switch *ts) {
+  size_t nr = 0;
+  for (size_t i = 0; i < ts->nr; i++)
+    nr += ts->changes[i].old_mode && !ts->changes[i].new_mode;
+  if (!nr)
+    return;
+
+  ts->deleted_size = 64;
+  while (ts->deleted_size < 2 * nr)
+    ts->deleted_size *= 2;
+  ts->deleted = calloc(ts->deleted_size, sizeof(*ts->deleted));
+  for (size_t i = 0; i < ts->nr; i++) {
+    const struct diff_change *c = &ts->changes[i];
+    if (!c->old_mode || c->new_mode)
+      continue;
+    size_t slot = path_slot(c->path, ts->deleted_size);
+    while (ts->deleted[slot])
+      slot = (slot + 1) & (ts->deleted_size - 1);
+    ts->deleted[slot] = c->path;
+  }
+}
+
+/**
+ * Whether a path is deleted by the switch.
+ */
+static int is_deleted(const struct tree_switch *ts, const char *path) {
+  if (!ts->deleted_size)
+    return 0;
+  for (size_t i = path_slot(path, ts->deleted_size); ts->deleted[i];
+       i = (i + 1) & (ts->deleted_size - 1)) {
+    if (strcmp(ts->deleted[i], path) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Whether deleting the switch's files empties a directory, so that it
+ * can be replaced by a file: nothing untracked may be left in it.
+ */
+static int dir_is_emptied(const struct tree_switch *ts, const char *path) {
+  DIR *dir = opendir(path);
+  if (!dir)
+    return 0;
+  int emptied = 1;
+  struct dirent *de;
+  while (emptied && (de = readdir(dir))) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+    char sub[PATH_MAX];
+    struct stat st;
+    snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+    if (lstat(sub, &st) != 0)
+      continue;
+    emptied = S_ISDIR(st.st_mode) ? dir_is_emptied(ts, sub)
+                                  : is_deleted(ts, sub);
+  }
+  closedir(dir);
+  return emptied;
+}
+
+/**
+ * Refuse to switch if that would lose work: a file to be replaced or
+ * deleted that has local changes, or an untracked file where a new file
+ * is to be written (also inside a directory the new file replaces).
+ *
+ * @return 0 if the switch is safe, 1 (after listing the paths) if not
+ */
+static int check_work_tree(const struct tree_switch *ts,
+                           const struct index_state *index) {
+  int result = 0;
+  for (size_t i = 0; i < ts->nr; i++) {
+    const struct diff_change *c = &ts->changes[i];
+    struct stat st;
+    if (lstat(c->path, &st) != 0)
+      continue;  // Already gone, or a parent became a file
+
+    if (c->old_mode && !file_is_unchanged(index, c->path, &st, c->old_mode,
+                                          &c->old_oid)) {
+      fprintf(stderr, "Local changes to %s would be overwritten\n", c->path);
+      result = 1;
+    } else if (!c->old_mode &&
+               !(S_ISDIR(st.st_mode) && dir_is_emptied(ts, c->path))) {
+      fprintf(stderr, "Untracked %s would be overwritten\n", c->path);
+      result = 1;
+    }
+  }
+  return result;
+}
+
+/**
+ * Remove the directories above a deleted file that are left empty.
+ */
+static void remove_empty_parents(const char *path) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", path);
+  for (char *slash = strrchr(dir, '/'); slash; slash = strrchr(dir, '/')) {
+    *slash = '\0';
+    if (rmdir(dir) != 0)
+      break;  // Not empty: it still holds other files
+  }
+}
+
+/**
+ * Create the directories above a file to be written.
+ */
+static void create_parents(const char *path) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", path);
+  for (char *slash = strchr(dir, '/'); slash; slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(dir, 0755);  // OK if the directory already exists
+    *slash = '/';
+  }
+}
+
+/**
+ * Drop the index entries of the changed paths and record the stat data
+ * of the files just written, so that they are not hashed again.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int update_index(const struct tree_switch *ts, struct index_state *index,
+                        const struct checkout *co) {
+  struct index_state updated = {0};
+  updated.entries = malloc((index->nr + co->nr + 1) * sizeof(*updated.entries));
+  char *changed = calloc(index->nr + 1, 1);
+  for (size_t i = 0; i < ts->nr; i++) {
+    const struct index_entry *ie = index_find(index, ts->changes[i].path);
+    if (ie)
+      changed[ie - index->entries] = 1;
+  }
+  for (size_t i = 0; i < index->nr; i++) {
+    if (changed[i])
+      continue;
+    updated.entries[updated.nr++] = index->entries[i];
+    index->entries[i].path = NULL;  // Now owned by the new index
+  }
+  free(changed);
+
+  for (size_t i = 0; i < co->nr; i++) {
+    const struct checkout_entry *ce = &co->entries[i];
+    struct stat st;
+    if (lstat(ce->path, &st) != 0)
+      continue;
+    struct index_entry *ie = &updated.entries[updated.nr++];
+    fill_index_stat(ie, &st);
+    ie->oid = ce->oid;
+    ie->path = strdup(ce->path);
+  }
+
+  int result = write_index(&updated);
+  discard_index(&updated);
+  return result;
+}
+
+/**
+ * Switch the work tree from one tree to another, touching only the paths
+ * that differ between them: files only in the old tree are deleted (with
+ * the directories they leave empty), and new or changed files are
+ * written by a pool of worker threads. Nothing is touched if a file to be
+ * replaced or deleted has local changes, or an untracked file is in the
+ * way. Must be run from the top of the work tree.
+ *
+ * @param old_tree Tree checked out now, or NULL if there is none
+ * @param new_tree Tree to check out
+ * @param workers Number of writer threads (0 = online CPUs)
+ * @return 0 on success, 1 on error
+ */
+int switch_tree(const struct object_id *old_tree,
+                const struct object_id *new_tree, int workers) {
+  trace_region_enter("checkout", "switch-tree");
+  struct tree_switch ts = {0};
+  int result = diff_trees(old_tree, new_tree, DIFF_RECURSIVE, record_change,
+                          &ts);
+  struct index_state index = {0};
+  if (result == 0 && read_index(&index) != 0)
+    fprintf(stderr, "Ignoring unreadable %s\n", INDEX_FILE);
+  if (result == 0) {
+    index_deleted(&ts);
+    result = check_work_tree(&ts, &index);
+  }
+
+  // Delete before writing, so a file can replace a directory and back
+  struct checkout co = {0};
+  for (size_t i = 0; result == 0 && i < ts.nr; i++) {
+    const struct diff_change *c = &ts.changes[i];
+    if (c->old_mode && unlink(c->path) != 0 && errno != ENOENT &&
+        errno != ENOTDIR) {
+      fprintf(stderr, "Failed to remove %s: %s\n", c->path, strerror(errno));
+      result = 1;
+    }
+    if (c->old_mode && !c->new_mode)
+      remove_empty_parents(c->path);
+  }
+  for (size_t i = 0; result == 0 && i < ts.nr; i++) {
+    const struct diff_change *c = &ts.changes[i];
+    if (!c->new_mode)
+      continue;
+    create_parents(c->path);
+    if (co.nr == co.alloc) {
+      co.alloc = co.alloc ? co.alloc * 2 : 64;
+      co.entries = realloc(co.entries, co.alloc * sizeof(*co.entries));
+    }
+    struct checkout_entry *ce = &co.entries[co.nr++];
+    ce->path = strdup(c->path);
+    ce->oid = c->new_oid;
+    ce->mode = c->new_mode;
+  }
+
+  if (result == 0 && co.nr && has_promisor_remote())
+    result = prefetch_blobs(&co);
+  if (result == 0 && co.nr) {
+    if (workers <= 0)
+      workers = online_cpus();
+    if ((size_t)workers > co.nr)
+      workers = co.nr;
+    trace_region_enter("checkout", "write-files");
+    run_parallel(workers, checkout_worker, &co);
+    trace_region_leave("checkout", "write-files");
+    result = atomic_load(&co.errors) != 0;
+  }
+  if (result == 0 && ts.nr)
+    result = update_index(&ts, &index, &co);
+
+  for (size_t i = 0; i < co.nr; i++)
+    free(co.entries[i].path);
+  free(co.entries);
+  for (size_t i = 0; i < ts.nr; i++)
+    free((char *)ts.changes[i].path);
+  free(ts.changes);
+  free(ts.deleted);
+  discard_index(&index);
+  trace_region_leave("checkout", "switch-tree");
+  return result;
+}
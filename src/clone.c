@@ -1,24 +1,53 @@
 /**
- * clone.c - Git Clone and Pack File Processing
- * 
- * This file implements the Git clone functionality including:
- *   - HTTP communication with remote repositories
- *   - Git smart protocol implementation
- *   - Pack file parsing and object extraction
- *   - Working directory checkout
- * 
+ * clone.c - Git Clone/Fetch and Pack File Processing
+ *
+ * This file implements the network side of clone and fetch including:
+ *   - Requests to remote repositories over a shared HTTP transport
+ *     (transport.c)
+ *   - Git smart protocol implementation: ref discovery and want/have
+ *     negotiation, in protocol v2 where the server supports it and v0
+ *     otherwise
+ *   - Streaming the pack file into the pack parser and indexer (see pack.c)
+ *
+ * Every request asks for protocol v2 (the Git-Protocol header). A v2
+ * server answers info/refs with its capabilities only; refs are then
+ * listed by the ls-refs command, restricted to the prefixes the caller
+ * needs, so a remote with hundreds of thousands of refs costs no more
+ * than the few that are wanted. v2 fetch also supports shallow ("deepen")
+ * and partial ("filter") fetches. Servers that only speak v0 send the full
+ * ref advertisement, which is filtered by prefix on our side.
+ *
+ * Either way the pack arrives multiplexed over side-band channels (v0
+ * requests side-band-64k): the response is split into pkt-lines as it
+ * streams in, channel 1 goes straight to the pack parser, channel 2 is
+ * remote progress and channel 3 a fatal error.
+ *
+ * Negotiation is stateless (one HTTP request): every "want" is followed by
+ * a batch of local commits as "have" lines and "done". The server answers
+ * with a pack of only the objects the haves do not already reach; with the
+ * thin-pack capability this pack may delta against local objects, which
+ * the indexer resolves from the object database.
+ *
  * The Git pack file format is a compressed representation of multiple
  * Git objects, used for efficient network transfer during clone/fetch operations.
  */
 
 #include "git.h"
-#include <arpa/inet.h>
-#include <curl/curl.h>
-#include <openssl/sha.h>
-#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <time.h>
+
+/*
+ * Side-band channels: in a multiplexed response every pkt-line of output
+ * starts with the number of the channel it belongs to.
+ */
+#define SIDEBAND_DATA 1      // Pack data
+#define SIDEBAND_PROGRESS 2  // Progress messages for the user
+#define SIDEBAND_ERROR 3     // Fatal error message
 
 /**
- * Structure to hold HTTP response data from libcurl.
+ * Structure to hold HTTP request or response data.
  */
 struct ResponseData {
   char *data;   // Response data buffer
@@ -26,310 +55,1039 @@ struct ResponseData {
 };
 
 /**
- * Callback function for libcurl to write received data.
- * Called by libcurl whenever data is received from the server.
- * 
- * @param ptr Pointer to received data
- * @param size Size of each data element
- * @param nmemb Number of data elements
- * @param userdata User-provided pointer (ResponseData struct)
- * @return Number of bytes processed
+ * Append a pkt-line to a request body: 4 hex digits giving the length of
+ * the line (including themselves), then the payload.
+ *
+ * @param buf Request body
+ * @param fmt printf-style format of the payload
  */
-size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
-  size_t realsize = size * nmemb;
-  struct ResponseData *resp = (struct ResponseData *)userdata;
+static void packet_append(struct ResponseData *buf, const char *fmt, ...) {
+  char line[LARGE_PACKET_MAX];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(line + 4, sizeof(line) - 4, fmt, ap);
+  va_end(ap);
+  if (len < 0 || (size_t)len >= sizeof(line) - 4)
+    return;
 
-  // Expand buffer to accommodate new data
-  resp->data = realloc(resp->data, resp->size + realsize);
-  if (!resp->data)
-    return 0;
+  char prefix[5];
+  snprintf(prefix, sizeof(prefix), "%04x", len + 4);
+  memcpy(line, prefix, 4);
+  buf->data = realloc(buf->data, buf->size + len + 4);
+  memcpy(buf->data + buf->size, line, len + 4);
+  buf->size += len + 4;
+}
+
+/**
+ * Append a flush-pkt ("0000") to a request body.
+ */
+static void packet_flush(struct ResponseData *buf) {
+  buf->data = realloc(buf->data, buf->size + 4);
+  memcpy(buf->data + buf->size, "0000", 4);
+  buf->size += 4;
+}
+
+/**
+ * Append a delim-pkt ("0001"), which separates a v2 command from its
+ * arguments.
+ */
+static void packet_delim(struct ResponseData *buf) {
+  buf->data = realloc(buf->data, buf->size + 4);
+  memcpy(buf->data + buf->size, "0001", 4);
+  buf->size += 4;
+}
+
+/**
+ * Read the length prefix of a pkt-line.
+ *
+ * @return Length (0 for a flush-pkt), or -1 if the prefix is not valid
+ */
+static int packet_length(const char *p, size_t avail) {
+  if (avail < 4)
+    return -1;
+  int len = 0;
+  for (int i = 0; i < 4; i++) {
+    int c = (unsigned char)p[i];
+    int v = isdigit(c) ? c - '0' : isxdigit(c) ? (tolower(c) - 'a' + 10) : -1;
+    if (v < 0)
+      return -1;
+    len = len << 4 | v;
+  }
+  return len;
+}
+
+/**
+ * Pkt-line Types
+ * Besides lines with a payload, the protocol uses special packets with
+ * lengths below 4 as separators.
+ */
+enum packet_type {
+  PACKET_DATA,         // Line with a (possibly empty) payload
+  PACKET_FLUSH,        // "0000": end of a message
+  PACKET_DELIM,        // "0001": end of a section (v2)
+  PACKET_RESPONSE_END  // "0002": end of a response (v2)
+};
+
+/** Callback for one complete pkt-line; returning non-zero aborts. */
+typedef int (*packet_fn)(void *data, enum packet_type type, const char *line,
+                         size_t len);
+
+/**
+ * Packet Reader Structure
+ * Reassembles pkt-lines from a response received in arbitrary chunks.
+ */
+struct packet_reader {
+  char buf[LARGE_PACKET_MAX];  // Current packet, length prefix included
+  size_t have;   // Bytes of the current packet received so far
+  int len;       // Length of the current packet, or -1 until known
+  packet_fn fn;  // Called for every complete packet
+  void *data;    // Passed through to fn
+  int error;     // Set once the input is malformed or fn has failed
+};
+
+static void packet_reader_init(struct packet_reader *r, packet_fn fn,
+                               void *data) {
+  r->have = 0;
+  r->len = -1;
+  r->fn = fn;
+  r->data = data;
+  r->error = 0;
+}
 
-  // Append new data to buffer
-  memcpy(resp->data + resp->size, ptr, realsize);
-  resp->size += realsize;
+/**
+ * Feed received bytes to a packet reader, calling its callback for every
+ * packet completed by them.
+ *
+ * @return 0 on success, 1 if the input is malformed or the callback failed
+ */
+static int packet_reader_feed(struct packet_reader *r, const char *p,
+                              size_t n) {
+  while (n && !r->error) {
+    size_t want = (r->len < 0 ? 4 : (size_t)r->len) - r->have;
+    size_t take = n < want ? n : want;
+    memcpy(r->buf + r->have, p, take);
+    r->have += take;
+    p += take;
+    n -= take;
+    if (take < want)
+      break;
+
+    if (r->len < 0) {
+      r->len = packet_length(r->buf, 4);
+      if (r->len < 0 || r->len == 3 || r->len > LARGE_PACKET_MAX) {
+        r->error = 1;
+        break;
+      }
+      if (r->len > 4)
+        continue;  // Payload still to come
+    }
 
-  printf("Received %zu bytes of data\n", realsize);
+    enum packet_type type = r->len == 0   ? PACKET_FLUSH
+                            : r->len == 1 ? PACKET_DELIM
+                            : r->len == 2 ? PACKET_RESPONSE_END
+                                          : PACKET_DATA;
+    size_t payload = type == PACKET_DATA ? (size_t)r->len - 4 : 0;
+    r->error = r->fn(r->data, type, r->buf + 4, payload) != 0;
+    r->have = 0;
+    r->len = -1;
+  }
+  return r->error;
+}
+
+/**
+ * Callback function for libcurl to stream a pkt-line response into a
+ * packet reader.
+ *
+ * @param userdata User-provided pointer (packet_reader struct)
+ * @return Number of bytes processed (anything else aborts the transfer)
+ */
+static size_t packet_write_callback(char *ptr, size_t size, size_t nmemb,
+                                    void *userdata) {
+  size_t realsize = size * nmemb;
+  if (packet_reader_feed(userdata, ptr, realsize) != 0)
+    return 0;
   return realsize;
 }
 
 /**
- * Read a variable-length size from pack file data.
- * Git uses a variable-length encoding where the MSB indicates
- * if more bytes follow.
- * 
- * @param data Pack file data
- * @param pos Current position (updated by this function)
- * @param size Output size value
- * @return The decoded size
+ * Length of a pkt-line payload without its trailing newline.
  */
-size_t read_size(const char *data, size_t *pos, size_t *size) {
-  size_t shift = 0;
-  unsigned char byte;
-  *size = 0;
+static size_t chomp(const char *line, size_t len) {
+  return len && line[len - 1] == '\n' ? len - 1 : len;
+}
 
-  // Read bytes until we find one without the continuation bit (0x80)
-  do {
-    byte = data[*pos];
-    *size |= ((byte & 0x7f) << shift);  // Take lower 7 bits
-    shift += 7;
-    (*pos)++;
-  } while (byte & 0x80);  // Continue if MSB is set
+/**
+ * Whether a payload is exactly the given string.
+ */
+static int line_is(const char *line, size_t len, const char *str) {
+  return len == strlen(str) && memcmp(line, str, len) == 0;
+}
+
+/**
+ * Whether a ref is one the caller asked for.
+ */
+static int ref_wanted(const struct fetch_options *opts, const char *name,
+                      size_t len) {
+  if (!opts->ref_prefixes)
+    return 1;
+  for (const char *const *prefix = opts->ref_prefixes; *prefix; prefix++) {
+    size_t plen = strlen(*prefix);
+    if (len >= plen && memcmp(name, *prefix, plen) == 0)
+      return 1;
+  }
+  return 0;
+}
 
-  return *size;
+/**
+ * Add a ref to an advertisement.
+ */
+static void add_remote_ref(struct remote_refs *remote, const char *name,
+                           size_t name_len, const struct object_id *oid) {
+  if (remote->nr == remote->alloc) {
+    remote->alloc = remote->alloc ? remote->alloc * 2 : 16;
+    remote->refs = realloc(remote->refs, remote->alloc * sizeof(*remote->refs));
+  }
+  struct remote_ref *ref = &remote->refs[remote->nr++];
+  ref->name = strndup(name, name_len);
+  ref->oid = *oid;
 }
 
 /**
- * Process a Git pack file and extract all objects.
- * Pack files contain a header followed by compressed Git objects.
- * Format: "PACK" + version(4) + num_objects(4) + objects...
- * 
- * @param pack_data Pack file data
- * @param pack_size Size of pack file
- * @return 0 on success, 1 on error
+ * Append a line to a v2 capability list.
  */
-int process_pack_file(const char *pack_data, size_t pack_size) {
-  printf("Processing pack file of size %zu\n", pack_size);
+static void add_capability(struct remote_refs *remote, const char *line,
+                           size_t len) {
+  size_t old = remote->capabilities ? strlen(remote->capabilities) : 0;
+  remote->capabilities = realloc(remote->capabilities, old + len + 2);
+  if (old)
+    remote->capabilities[old++] = '\n';
+  memcpy(remote->capabilities + old, line, len);
+  remote->capabilities[old + len] = '\0';
+}
 
-  // Locate the pack file signature
-  const char *pack_start = strstr(pack_data, "PACK");
-  if (!pack_start) {
-    printf("Invalid pack signature\n");
+/**
+ * Ref Discovery State
+ * Parser state for the info/refs response.
+ */
+struct discovery {
+  struct remote_refs *remote;
+  const struct fetch_options *opts;
+  int lines;  // Lines seen, not counting "# service=" ones
+};
+
+/**
+ * Handle one pkt-line of the info/refs response. Either protocol version
+ * may start with a "# service=git-upload-pack" line and a flush, then:
+ *   v2: "version 2" and one capability per line, then a flush
+ *   v0: one line per ref ("<oid> <name>", the first followed by NUL and
+ *       the capability list), then a flush. Peeled tags ("^{}") and refs
+ *       the caller did not ask for are skipped.
+ *
+ * @return 0 on success, 1 if the response is malformed
+ */
+static int discovery_line(void *data, enum packet_type type, const char *line,
+                          size_t len) {
+  struct discovery *d = data;
+  struct remote_refs *remote = d->remote;
+  if (type != PACKET_DATA)
+    return type != PACKET_FLUSH;
+
+  len = chomp(line, len);
+  if (len && line[0] == '#')
+    return 0;  // "# service=git-upload-pack"
+  if (d->lines++ == 0 && line_is(line, len, "version 2")) {
+    remote->version = 2;
+    return 0;
+  }
+  if (remote->version == 2) {
+    add_capability(remote, line, len);
+    return 0;
+  }
+
+  const char *nul = memchr(line, '\0', len);
+  size_t ref_len = nul ? (size_t)(nul - line) : len;
+  if (nul && !remote->capabilities)
+    remote->capabilities = strndup(nul + 1, len - ref_len - 1);
+
+  struct object_id oid;
+  if (ref_len < GIT_HASH_LENGTH + 2 || line[GIT_HASH_LENGTH] != ' ' ||
+      get_oid_hex(line, &oid) != 0)
     return 1;
+  const char *name = line + GIT_HASH_LENGTH + 1;
+  size_t name_len = ref_len - GIT_HASH_LENGTH - 1;
+  if (name_len >= 3 && memcmp(name + name_len - 3, "^{}", 3) == 0)
+    return 0;  // Peeled tag, or "capabilities^{}" of an empty repository
+  if (ref_wanted(d->opts, name, name_len))
+    add_remote_ref(remote, name, name_len, &oid);
+  return 0;
+}
+
+/**
+ * Handle one pkt-line of an ls-refs response:
+ * "<oid> <name>[ <attribute>]..." per ref, then a flush. The attribute
+ * "symref-target:<target>" on HEAD names the branch it points at.
+ *
+ * @return 0 on success, 1 if the response is malformed
+ */
+static int ls_refs_line(void *data, enum packet_type type, const char *line,
+                        size_t len) {
+  static const char symref_target[] = "symref-target:";
+  struct remote_refs *remote = data;
+  if (type != PACKET_DATA)
+    return type != PACKET_FLUSH;
+
+  len = chomp(line, len);
+  struct object_id oid;
+  if (len < GIT_HASH_LENGTH + 2 || line[GIT_HASH_LENGTH] != ' ' ||
+      get_oid_hex(line, &oid) != 0)
+    return 1;
+  const char *name = line + GIT_HASH_LENGTH + 1;
+  const char *end = line + len;
+  const char *attr = memchr(name, ' ', end - name);
+  size_t name_len = (attr ? attr : end) - name;
+  add_remote_ref(remote, name, name_len, &oid);
+
+  while (attr) {
+    attr++;
+    const char *next = memchr(attr, ' ', end - attr);
+    size_t attr_len = (next ? next : end) - attr;
+    size_t tlen = strlen(symref_target);
+    if (line_is(name, name_len, "HEAD") && !remote->head &&
+        attr_len > tlen && memcmp(attr, symref_target, tlen) == 0)
+      remote->head = strndup(attr + tlen, attr_len - tlen);
+    attr = next;
   }
+  return 0;
+}
 
-  // Parse pack header (network byte order)
-  uint32_t version = ntohl(*(uint32_t *)(pack_start + 4));
-  uint32_t num_objects = ntohl(*(uint32_t *)(pack_start + 8));
-  size_t pos = 12;  // Start after header
-
-  // Process each object in the pack file
-  for (uint32_t i = 0; i < num_objects; i++) {
-    // Read object type and initial size from first byte
-    unsigned char type_byte = pack_start[pos];
-    unsigned char type = (type_byte >> 4) & 7;  // Bits 4-6: object type
-    size_t obj_size = type_byte & 0x0f;         // Bits 0-3: initial size
-    pos++;
-
-    // Read remaining size bytes (variable-length encoding)
-    int shift = 4;
-    while (type_byte & 0x80) {  // MSB indicates more bytes
-      type_byte = pack_start[pos++];
-      obj_size |= ((type_byte & 0x7f) << shift);
-      shift += 7;
-    }
+/**
+ * POST a request to the remote's upload-pack service.
+ *
+ * @param remote Advertisement (selects the transport and protocol version)
+ * @param request Request body (pkt-lines)
+ * @param write_fn Callback receiving the response
+ * @param userdata Passed through to write_fn
+ * @return 0 on success, 1 on error
+ */
+static int upload_pack_request(const struct remote_refs *remote,
+                               const struct ResponseData *request,
+                               transport_write_fn write_fn, void *userdata) {
+  const char *headers[] = {
+      "Content-Type: application/x-git-upload-pack-request",
+      "Accept: application/x-git-upload-pack-result",
+      remote->version == 2 ? GIT_PROTOCOL_VERSION : NULL, NULL};
+  return transport_request(remote->transport, "/" GIT_UPLOAD_PACK_SERVICE,
+                           headers, request->data, request->size, write_fn,
+                           userdata);
+}
 
-    // Initialize zlib for decompression
-    z_stream strm = {0};
-    if (inflateInit(&strm) != Z_OK) {
-      continue;
-    }
+/**
+ * List the remote's refs with the v2 ls-refs command. Only refs matching
+ * opts->ref_prefixes are requested, so the server filters them.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int ls_refs(const char *url, const struct fetch_options *opts,
+                   struct remote_refs *remote) {
+  struct ResponseData request = {NULL, 0};
+  packet_append(&request, "command=ls-refs\n");
+  packet_delim(&request);
+  packet_append(&request, "symrefs\n");
+  for (const char *const *prefix = opts->ref_prefixes; prefix && *prefix;
+       prefix++)
+    packet_append(&request, "ref-prefix %s\n", *prefix);
+  packet_flush(&request);
 
-    // Handle different Git object types
-    switch (type) {
-    case OBJ_COMMIT:
-    case OBJ_TREE:
-    case OBJ_BLOB:
-    case OBJ_TAG: {
-      // Decompress the object data using zlib
-      unsigned char *obj_data = malloc(obj_size);
-      strm.next_in = (unsigned char *)pack_start + pos;
-      strm.avail_in = pack_size - pos;
-      strm.next_out = obj_data;
-      strm.avail_out = obj_size;
-
-      // Decompress the object
-      if (inflate(&strm, Z_FINISH) != Z_STREAM_END) {
-        free(obj_data);
-        inflateEnd(&strm);
-        continue;
-      }
+  struct packet_reader reader;
+  packet_reader_init(&reader, ls_refs_line, remote);
+  int result =
+      upload_pack_request(remote, &request, packet_write_callback, &reader);
+  free(request.data);
+  if (reader.error || (result == 0 && reader.have)) {
+    fprintf(stderr, "Invalid ls-refs response from %s\n", url);
+    result = 1;
+  }
+  return result;
+}
 
-      // Map pack object type to Git object type string
-      const char *type_str = type == OBJ_COMMIT ? "commit"
-                             : type == OBJ_TREE ? "tree"
-                             : type == OBJ_BLOB ? "blob"
-                                                : "tag";
-
-      char header[100];
-      int header_len = sprintf(header, "%s %zu", type_str, obj_size);
-      header[header_len++] = '\0';
-
-      // Combine header and content (standard Git object format)
-      size_t total_len = header_len + obj_size;
-      char *full_data = malloc(total_len);
-      memcpy(full_data, header, header_len);
-      memcpy(full_data + header_len, obj_data, obj_size);
-
-      // Calculate SHA-1 hash for object identification
-      unsigned char hash[SHA_DIGEST_LENGTH];
-      SHA1((unsigned char *)full_data, total_len, hash);
-      char hex_hash[41];
-      for (int j = 0; j < 20; j++) {
-        sprintf(hex_hash + (j * 2), "%02x", hash[j]);
-      }
-      hex_hash[40] = '\0';
+/**
+ * Find the value of a capability the remote advertised with one, such as
+ * "object-format=sha1".
+ *
+ * @return Value (caller must free), or NULL if it was not advertised
+ */
+static char *remote_capability_value(const struct remote_refs *remote,
+                                     const char *capability) {
+  const char *sep = remote->version == 2 ? "\n" : " ";
+  size_t len = strlen(capability);
+  for (const char *p = remote->capabilities; p && *p;) {
+    size_t n = strcspn(p, sep);
+    if (n > len && memcmp(p, capability, len) == 0 && p[len] == '=')
+      return strndup(p + len + 1, n - len - 1);
+    p += n;
+    p += strspn(p, sep);
+  }
+  return NULL;
+}
 
-      // Store the object in .git/objects
-      store_object(hex_hash, full_data, total_len);
+/**
+ * Request the ref advertisement, and the refs themselves from a protocol
+ * v2 server (get_remote_refs() without the trace region).
+ */
+static int discover_refs(const char *url, const struct fetch_options *opts,
+                         struct remote_refs *remote) {
+  memset(remote, 0, sizeof(*remote));
+  if (opts->verbosity > 0)
+    fprintf(stderr, "Getting refs from %s%s\n", url, GIT_INFO_REFS_PATH);
 
-      free(full_data);
-      free(obj_data);
-      break;
-    }
+  remote->transport = transport_get(url);
+  if (!remote->transport)
+    return 1;
 
-    case OBJ_REF_DELTA:
-      // Delta objects reference another object for compression
-      pos += 20; // Skip 20-byte base object SHA-1
-      break;
-    }
+  // Ask for protocol v2; servers that do not know it ignore the header
+  static const char *const headers[] = {GIT_PROTOCOL_VERSION, NULL};
+  struct discovery d = {remote, opts, 0};
+  struct packet_reader reader;
+  packet_reader_init(&reader, discovery_line, &d);
+  int result = transport_request(remote->transport, GIT_INFO_REFS_PATH,
+                                 headers, NULL, 0, packet_write_callback,
+                                 &reader);
+  if (reader.error || (result == 0 && reader.have)) {
+    fprintf(stderr, "Invalid ref advertisement from %s\n", url);
+    result = 1;
+  }
+  if (result) {
+    free_remote_refs(remote);
+    return 1;
+  }
 
-    // Clean up zlib stream
-    inflateEnd(&strm);
-    pos += strm.total_in;  // Advance position by compressed size
+  // Object IDs of another length could not even be parsed
+  char *format = remote_capability_value(remote, "object-format");
+  result = check_object_format(format, url);
+  free(format);
+  if (result) {
+    free_remote_refs(remote);
+    return 1;
   }
 
+  if (remote->version == 2) {
+    if (ls_refs(url, opts, remote) != 0) {
+      free_remote_refs(remote);
+      return 1;
+    }
+  } else if (remote->capabilities) {
+    // "symref=HEAD:refs/heads/main" names the branch HEAD points at
+    const char *symref = strstr(remote->capabilities, "symref=HEAD:");
+    if (symref) {
+      symref += strlen("symref=HEAD:");
+      remote->head = strndup(symref, strcspn(symref, " "));
+    }
+  }
+  if (opts->verbosity > 0)
+    fprintf(stderr, "Received %zu refs (protocol v%d)\n", remote->nr,
+            remote->version);
   return 0;
 }
 
 /**
  * Fetch remote repository references (branches, tags) via HTTP.
- * Uses the Git smart protocol to query available refs.
- * 
+ * Uses the Git smart protocol to query available refs, with ls-refs when
+ * the server speaks protocol v2.
+ *
  * @param url Repository URL
- * @return Response data containing refs, or NULL on error (caller must free)
+ * @param opts Options; ref_prefixes selects the refs to list
+ * @param remote Output advertisement (free with free_remote_refs())
+ * @return 0 on success, 1 on error
  */
-char *get_remote_refs(const char *url) {
-  printf("Getting refs from: %s\n", url);
+int get_remote_refs(const char *url, const struct fetch_options *opts,
+                    struct remote_refs *remote) {
+  trace_region_enter("network", "ref-discovery");
+  int result = discover_refs(url, opts, remote);
+  trace_region_leave("network", "ref-discovery");
+  return result;
+}
 
-  // Initialize libcurl for HTTP request
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    printf("Failed to initialize curl\n");
-    return NULL;
+/**
+ * Free a ref advertisement.
+ *
+ * @param remote Advertisement to free
+ */
+void free_remote_refs(struct remote_refs *remote) {
+  for (size_t i = 0; i < remote->nr; i++)
+    free(remote->refs[i].name);
+  free(remote->refs);
+  free(remote->capabilities);
+  free(remote->head);
+  memset(remote, 0, sizeof(*remote));
+}
+
+/**
+ * Check whether the remote advertised a capability. For protocol v2,
+ * capabilities with a value ("fetch=shallow filter") match by name.
+ *
+ * @param remote Advertisement
+ * @param capability Capability name, e.g. "thin-pack"
+ * @return 1 if supported, 0 otherwise
+ */
+int remote_supports(const struct remote_refs *remote, const char *capability) {
+  const char *sep = remote->version == 2 ? "\n" : " ";
+  size_t len = strlen(capability);
+  for (const char *p = remote->capabilities; p && *p;) {
+    size_t n = strcspn(p, sep);
+    const char *eq = memchr(p, '=', n);
+    size_t name_len = eq ? (size_t)(eq - p) : n;
+    if (name_len == len && memcmp(p, capability, len) == 0)
+      return 1;
+    p += n;
+    p += strspn(p, sep);
   }
+  return 0;
+}
 
-  // Build the info/refs endpoint URL (Git smart protocol)
-  char full_url[URL_BUFFER_SIZE];
-  snprintf(full_url, sizeof(full_url), "%s/info/refs?service=git-upload-pack",
-           url);
-  printf("Full URL: %s\n", full_url);
+/**
+ * Check whether a protocol v2 command supports a feature, as listed in
+ * the value of its capability line ("fetch=shallow filter").
+ *
+ * @param remote Advertisement
+ * @param command Command name, e.g. "fetch"
+ * @param feature Feature name, e.g. "filter"
+ * @return 1 if supported, 0 otherwise (always 0 for protocol v0)
+ */
+int remote_command_supports(const struct remote_refs *remote,
+                            const char *command, const char *feature) {
+  if (remote->version != 2)
+    return 0;
+  size_t clen = strlen(command), flen = strlen(feature);
+  for (const char *line = remote->capabilities; line && *line;) {
+    size_t n = strcspn(line, "\n");
+    if (n > clen && memcmp(line, command, clen) == 0 && line[clen] == '=') {
+      for (const char *p = line + clen + 1; p < line + n;) {
+        size_t m = strcspn(p, " \n");
+        if (m == flen && memcmp(p, feature, flen) == 0)
+          return 1;
+        p += m;
+        p += strspn(p, " ");
+      }
+    }
+    line += n;
+    line += strspn(line, "\n");
+  }
+  return 0;
+}
 
-  // Set up response buffer and curl options
-  struct ResponseData response = {NULL, 0};
-  curl_easy_setopt(curl, CURLOPT_URL, full_url);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+/**
+ * Find an advertised ref by name.
+ *
+ * @return Ref, or NULL if the remote does not have it
+ */
+const struct remote_ref *find_remote_ref(const struct remote_refs *remote,
+                                         const char *name) {
+  for (size_t i = 0; i < remote->nr; i++) {
+    if (strcmp(remote->refs[i].name, name) == 0)
+      return &remote->refs[i];
+  }
+  return NULL;
+}
 
-  printf("Sending HTTP request...\n");
-  CURLcode res = curl_easy_perform(curl);
-  curl_easy_cleanup(curl);
+/**
+ * Find the branch the remote HEAD points at.
+ * Servers that do not advertise the HEAD symref are matched by object ID,
+ * preferring master. Without a HEAD at all, master is used.
+ *
+ * @return Branch ref, the detached HEAD ref, or NULL if neither exists
+ */
+const struct remote_ref *find_remote_head(const struct remote_refs *remote) {
+  const struct remote_ref *head = find_remote_ref(remote, "HEAD");
+  const struct remote_ref *master = find_remote_ref(remote, "refs/heads/master");
+  if (remote->head && find_remote_ref(remote, remote->head))
+    return find_remote_ref(remote, remote->head);
+  if (!head)
+    return master;
+  if (master && oideq(&master->oid, &head->oid))
+    return master;
 
-  if (res != CURLE_OK) {
-    printf("Curl request failed: %s\n", curl_easy_strerror(res));
-    free(response.data);
-    return NULL;
+  for (size_t i = 0; i < remote->nr; i++) {
+    const struct remote_ref *ref = &remote->refs[i];
+    if (strncmp(ref->name, "refs/heads/", 11) == 0 &&
+        oideq(&ref->oid, &head->oid))
+      return ref;
   }
+  return head;
+}
 
-  printf("Successfully received refs\n");
-  return response.data;
+/**
+ * Read the commits listed in .git/shallow: those whose parents were cut
+ * off by a shallow fetch and are not present.
+ *
+ * @param shallow Output set (initialized by this function)
+ * @return Number of shallow commits
+ */
+size_t read_shallow(struct oid_set *shallow) {
+  oid_set_init(shallow);
+  FILE *f = fopen(SHALLOW_FILE, "r");
+  if (!f)
+    return 0;
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    struct object_id oid;
+    if (get_oid_hex(line, &oid) == 0)
+      oid_set_insert(shallow, &oid);
+  }
+  fclose(f);
+  return shallow->nr;
 }
 
 /**
- * Extract the commit hash from the refs response.
- * Parses the Git protocol response to find the master/HEAD commit.
- * 
- * @param refs Refs response data
- * @return 40-character commit hash, or NULL if not found (caller must free)
+ * Apply a v2 shallow-info section to .git/shallow: commits the server
+ * reports as "shallow" are added, and "unshallow" ones (whose parents
+ * have now been fetched) removed. The file is replaced through
+ * shallow.lock, or deleted once no commit is shallow.
+ *
+ * @return 0 on success, 1 on error
  */
-char *get_commit_hash_from_refs(const char *refs) {
-  // Search for master branch or HEAD reference
-  const char *line = strstr(refs, "refs/heads/master");
-  if (!line) {
-    // Fallback to HEAD if master not found
-    line = strstr(refs, "HEAD");
-    if (!line)
-      return NULL;
-    line -= 41; // Hash is 40 chars + space before ref name
+static int update_shallow(const struct oid_set *added,
+                          const struct oid_set *removed) {
+  struct oid_set shallow;
+  read_shallow(&shallow);
+  for (size_t i = 0; i < added->size; i++) {
+    if (added->used[i])
+      oid_set_insert(&shallow, &added->oids[i]);
+  }
+
+  struct ResponseData out = {NULL, 0};
+  for (size_t i = 0; i < shallow.size; i++) {
+    if (!shallow.used[i] || oid_set_contains(removed, &shallow.oids[i]))
+      continue;
+    out.data = realloc(out.data, out.size + GIT_HASH_LENGTH + 2);
+    oid_to_hex(&shallow.oids[i], out.data + out.size);
+    out.data[out.size + GIT_HASH_LENGTH] = '\n';
+    out.size += GIT_HASH_LENGTH + 1;
+  }
+  oid_set_clear(&shallow);
+
+  int result = 0;
+  if (!out.size) {
+    if (unlink(SHALLOW_FILE) != 0 && errno != ENOENT)
+      result = 1;
   } else {
-    line -= 41; // Hash is 40 chars + space before ref name
+    const char *lock = SHALLOW_FILE ".lock";
+    int fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+      fprintf(stderr, "Unable to lock %s: %s\n", SHALLOW_FILE,
+              strerror(errno));
+      free(out.data);
+      return 1;
+    }
+    result = write_in_full(fd, out.data, out.size);
+    result |= close(fd) != 0;
+    if (result == 0 && rename(lock, SHALLOW_FILE) != 0)
+      result = 1;
+    if (result)
+      unlink(lock);
   }
+  if (result)
+    fprintf(stderr, "Failed to update %s: %s\n", SHALLOW_FILE,
+            strerror(errno));
+  free(out.data);
+  return result;
+}
+
+/**
+ * History Walk State
+ * Breadth-first walk from the local refs, collecting commits to offer.
+ */
+struct have_walk {
+  struct object_id *queue;  // Commits found, in visiting order
+  size_t nr, alloc;
+  struct oid_set seen;
+};
 
-  // Extract the 40-character hash
-  char *hash = malloc(41);
-  strncpy(hash, line, 40);
-  hash[40] = '\0';
+static void have_walk_push(struct have_walk *w, const struct object_id *oid) {
+  if (w->nr >= FETCH_MAX_HAVES || !oid_set_insert(&w->seen, oid))
+    return;
+  if (w->nr == w->alloc) {
+    w->alloc = w->alloc ? w->alloc * 2 : 64;
+    w->queue = realloc(w->queue, w->alloc * sizeof(*w->queue));
+  }
+  w->queue[w->nr++] = *oid;
+}
 
-  return hash;
+static int have_walk_ref(const char *name, const struct object_id *oid,
+                         void *data) {
+  (void)name;
+  have_walk_push(data, oid);
+  return 0;
 }
 
 /**
- * Fetch a pack file from a remote repository.
- * Performs a two-step process:
- *   1. Get remote refs to find the commit hash
- *   2. Request pack file for that commit
- * 
- * @param url Repository URL
- * @return PackFile structure with data and commit hash, or NULL on error
+ * Collect local commits to send as "have" lines: the tips of all local
+ * refs, then their ancestors, breadth first, up to FETCH_MAX_HAVES. Tips
+ * are normally enough; the ancestors let negotiation still find common
+ * history when the remote has rewritten a branch. The walk stops at
+ * shallow commits, whose parents are not here.
+ *
+ * @param haves Output array of commit IDs (caller must free)
+ * @return Number of haves
+ */
+size_t collect_haves(struct object_id **haves) {
+  struct have_walk w = {0};
+  oid_set_init(&w.seen);
+  for_each_ref("refs", have_walk_ref, &w);
+  struct oid_set shallow;
+  read_shallow(&shallow);
+
+  // The queue doubles as the output; non-commits and missing objects are
+  // dropped from it as they are visited
+  size_t out = 0;
+  for (size_t i = 0; i < w.nr; i++) {
+    struct object_id oid = w.queue[i];
+    struct commit_info info;
+    if (read_commit_info(&oid, &info) != 0)
+      continue;
+    w.queue[out++] = oid;
+    if (!oid_set_contains(&shallow, &oid)) {
+      for (size_t p = 0; p < info.nr_parents; p++)
+        have_walk_push(&w, commit_parent(&info, p));
+    }
+    commit_info_release(&info);
+  }
+
+  oid_set_clear(&shallow);
+  oid_set_clear(&w.seen);
+  *haves = w.queue;
+  return out;
+}
+
+/**
+ * Fetch Response Sections
+ * A v2 response is a series of named sections; a v0 response is the
+ * acknowledgments followed by the side-band multiplexed pack.
+ */
+enum fetch_section {
+  SECTION_ACKS,          // v0: "ACK <oid>" / "NAK" lines before the pack
+  SECTION_HEADER,        // v2: expecting a section name
+  SECTION_SHALLOW_INFO,  // "shallow <oid>" / "unshallow <oid>" lines
+  SECTION_OTHER,         // A section we do not use (e.g. acknowledgments)
+  SECTION_PACKFILE,      // Side-band multiplexed pack data
+  SECTION_DONE           // Flush after the pack: response complete
+};
+
+/**
+ * Fetch Response State
+ * Parser state for a fetch response. Pack data on side-band channel 1 is
+ * fed straight to the pack parser as each packet completes.
+ */
+struct fetch_response {
+  struct pack_stream *ps;     // Parser receiving the pack
+  enum fetch_section section;
+  struct oid_set shallow;     // Commits the server made shallow
+  struct oid_set unshallow;   // Commits that are no longer shallow
+  int show_progress;          // Copy remote progress messages to stderr
+  int mid_progress_line;      // Progress output ended without "\r"/"\n"
+};
+
+/**
+ * Copy remote progress output to stderr, prefixing each line (ended by
+ * "\r" or "\n") with "remote: ". Lines may span packets.
  */
-struct PackFile *fetch_pack(const char *url) {
-  printf("Starting fetch from %s\n", url);
+static void show_progress(struct fetch_response *fr, const char *msg,
+                          size_t len) {
+  while (len) {
+    size_t n = 0;
+    while (n < len && msg[n] != '\r' && msg[n] != '\n')
+      n++;
+    if (n < len)
+      n++;  // Include the line terminator
+    fprintf(stderr, "%s%.*s", fr->mid_progress_line ? "" : "remote: ",
+            (int)n, msg);
+    fr->mid_progress_line = msg[n - 1] != '\r' && msg[n - 1] != '\n';
+    msg += n;
+    len -= n;
+  }
+}
 
-  // Step 1: Get remote references to find the commit to clone
-  char *refs = get_remote_refs(url);
-  if (!refs)
-    return NULL;
+/**
+ * Handle one side-band packet of the packfile section.
+ *
+ * @return 0 on success, 1 on a remote error or bad pack data
+ */
+static int demux_sideband(struct fetch_response *fr, const char *line,
+                          size_t len) {
+  if (!len)
+    return 1;
+  switch (line[0]) {
+  case SIDEBAND_DATA:
+    return pack_stream_feed(fr->ps, (const unsigned char *)line + 1, len - 1);
+  case SIDEBAND_PROGRESS:
+    if (fr->show_progress)
+      show_progress(fr, line + 1, len - 1);
+    return 0;
+  case SIDEBAND_ERROR:
+    fprintf(stderr, "remote error: %.*s\n", (int)chomp(line + 1, len - 1),
+            line + 1);
+    return 1;
+  }
+  return 1;
+}
 
-  // Extract the commit hash from refs response
-  char *commit_hash = get_commit_hash_from_refs(refs);
-  free(refs);
+/**
+ * Handle one pkt-line of a fetch response. In v2 these are sections, each
+ * a name line followed by its content, separated by delim-pkts and ended
+ * by a flush; in v0, the answer to "done" followed by the pack. Either
+ * way the pack is a run of side-band packets ended by a flush.
+ *
+ * @return 0 on success, 1 if the response is malformed or reports an error
+ */
+static int fetch_response_line(void *data, enum packet_type type,
+                               const char *line, size_t len) {
+  struct fetch_response *fr = data;
+  if (type == PACKET_DELIM) {
+    fr->section = SECTION_HEADER;
+    return 0;
+  }
+  if (type != PACKET_DATA) {
+    // Only the end of the pack may end the response
+    if (fr->section != SECTION_PACKFILE)
+      return 1;
+    fr->section = SECTION_DONE;
+    return 0;
+  }
+
+  struct object_id oid;
+  switch (fr->section) {
+  case SECTION_ACKS: {
+    // Acknowledgments, then the pack; side-band packets never start with
+    // a letter, so the first packet that is not an ACK or NAK begins it
+    size_t n = chomp(line, len);
+    if (n >= 4 && memcmp(line, "ERR ", 4) == 0) {
+      fprintf(stderr, "remote error: %.*s\n", (int)n - 4, line + 4);
+      return 1;
+    }
+    if (line_is(line, n, "NAK") || (n >= 4 && memcmp(line, "ACK ", 4) == 0))
+      return 0;
+    fr->section = SECTION_PACKFILE;
+    return demux_sideband(fr, line, len);
+  }
+  case SECTION_HEADER:
+    len = chomp(line, len);
+    if (len >= 4 && memcmp(line, "ERR ", 4) == 0) {
+      fprintf(stderr, "remote error: %.*s\n", (int)len - 4, line + 4);
+      return 1;
+    }
+    fr->section = line_is(line, len, "shallow-info") ? SECTION_SHALLOW_INFO
+                  : line_is(line, len, "packfile")   ? SECTION_PACKFILE
+                                                     : SECTION_OTHER;
+    return 0;
+  case SECTION_SHALLOW_INFO:
+    len = chomp(line, len);
+    if (len == 8 + GIT_HASH_LENGTH && memcmp(line, "shallow ", 8) == 0 &&
+        get_oid_hex(line + 8, &oid) == 0)
+      oid_set_insert(&fr->shallow, &oid);
+    else if (len == 10 + GIT_HASH_LENGTH &&
+             memcmp(line, "unshallow ", 10) == 0 &&
+             get_oid_hex(line + 10, &oid) == 0)
+      oid_set_insert(&fr->unshallow, &oid);
+    else
+      return 1;
+    return 0;
+  case SECTION_OTHER:
+    return 0;
+  case SECTION_PACKFILE:
+    return demux_sideband(fr, line, len);
+  case SECTION_DONE:
+    break;
+  }
+  return 1;  // Data after the end of the response
+}
 
-  if (!commit_hash)
-    return NULL;
+/**
+ * Build a v2 fetch request: the command, then one argument per line.
+ * Existing shallow commits are sent so that the server does not assume
+ * we have their parents.
+ */
+static void build_fetch_request(struct ResponseData *request,
+                                const struct remote_refs *remote,
+                                const struct object_id *wants, size_t nr_wants,
+                                const struct object_id *haves, size_t nr_haves,
+                                const struct fetch_options *opts) {
+  char hex[GIT_HASH_LENGTH + 1];
+  packet_append(request, "command=fetch\n");
+  packet_delim(request);
+  packet_append(request, "ofs-delta\n");
+  if (nr_haves)
+    packet_append(request, "thin-pack\n");
+  if (!opts->progress)
+    packet_append(request, "no-progress\n");
+  for (size_t i = 0; i < nr_wants; i++)
+    packet_append(request, "want %s\n", oid_to_hex(&wants[i], hex));
 
-  // Initialize curl for pack file request
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    free(commit_hash);
-    return NULL;
+  if (remote_command_supports(remote, "fetch", "shallow")) {
+    struct oid_set shallow;
+    read_shallow(&shallow);
+    for (size_t i = 0; i < shallow.size; i++) {
+      if (shallow.used[i])
+        packet_append(request, "shallow %s\n",
+                      oid_to_hex(&shallow.oids[i], hex));
+    }
+    oid_set_clear(&shallow);
   }
+  if (opts->depth)
+    packet_append(request, "deepen %d\n", opts->depth);
+  if (opts->filter)
+    packet_append(request, "filter %s\n", opts->filter);
+
+  for (size_t i = 0; i < nr_haves; i++)
+    packet_append(request, "have %s\n", oid_to_hex(&haves[i], hex));
+  packet_append(request, "done\n");
+  packet_flush(request);
+}
 
-  // Build upload-pack endpoint URL
-  struct ResponseData resp = {NULL, 0};
-  char upload_pack_url[URL_BUFFER_SIZE];
-  snprintf(upload_pack_url, sizeof(upload_pack_url), "%s/git-upload-pack", url);
+/**
+ * Mark a pack as fetched from a promisor remote, so objects it refers to
+ * but lacks are known to be obtainable later (pack-<name>.promisor, as in
+ * Git).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_promisor_file(const char *pack_name) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/pack-%s.promisor", PACK_DIR, pack_name);
+  FILE *f = fopen(path, "w");
+  if (!f || fclose(f) != 0) {
+    fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
 
-  // Set HTTP headers for Git protocol
-  struct curl_slist *headers = curl_slist_append(
-      NULL, "Content-Type: application/x-git-upload-pack-request");
+/**
+ * Fetch a pack from a remote repository.
+ * Sends the wants (with the capabilities we use) and haves in a single
+ * upload-pack request, writing the pack to .git/objects/pack as it arrives
+ * and indexing it once complete. Shallow and filtered fetches need a
+ * protocol v2 server.
+ *
+ * @param url Repository URL
+ * @param remote The remote's ref advertisement (for its capabilities)
+ * @param wants Objects to fetch
+ * @param nr_wants Number of wants (at least one)
+ * @param haves Local commits the server may leave out of the pack
+ * @param nr_haves Number of haves
+ * @param opts Fetch options (indexing threads, depth, filter)
+ * @return 0 on success, 1 on error
+ */
+int fetch_pack(const char *url, const struct remote_refs *remote,
+               const struct object_id *wants, size_t nr_wants,
+               const struct object_id *haves, size_t nr_haves,
+               const struct fetch_options *opts) {
+  if (opts->verbosity > 0)
+    fprintf(stderr, "Fetching from %s: %zu wants, %zu haves\n", url,
+            nr_wants, nr_haves);
 
-  // Build Git protocol request: "want <hash>" + "done"
-  char post_data[100];
-  snprintf(post_data, sizeof(post_data), "0032want %s\n00000009done\n",
-           commit_hash);
+  if ((opts->depth || opts->filter) && remote->version != 2) {
+    fprintf(stderr, "%s needs a server that speaks protocol v2\n",
+            opts->depth ? "--depth" : "--filter");
+    return 1;
+  }
+  if (opts->depth && !remote_command_supports(remote, "fetch", "shallow")) {
+    fprintf(stderr, "Server does not support shallow fetches\n");
+    return 1;
+  }
+  if (opts->filter && !remote_command_supports(remote, "fetch", "filter")) {
+    fprintf(stderr, "Server does not support object filters\n");
+    return 1;
+  }
 
-  // Configure curl for POST request with pack file request
-  curl_easy_setopt(curl, CURLOPT_URL, upload_pack_url);
-  curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
+  struct pack_stream ps;
+  if (pack_stream_init(&ps) != 0) {
+    pack_stream_release(&ps);
+    return 1;
+  }
+  ps.threads = opts->threads;
+  ps.show_progress = opts->progress;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
 
-  CURLcode res = curl_easy_perform(curl);
-  curl_slist_free_all(headers);
-  curl_easy_cleanup(curl);
+  struct ResponseData request = {NULL, 0};
+  if (remote->version == 2) {
+    build_fetch_request(&request, remote, wants, nr_wants, haves, nr_haves,
+                        opts);
+  } else {
+    // Capabilities go on the first want line; only ask for what the
+    // server offers. The pack must be multiplexed, so that it can be
+    // told apart from progress messages and errors.
+    char caps[96] = "";
+    if (remote_supports(remote, "side-band-64k"))
+      strcat(caps, " side-band-64k");
+    else if (remote_supports(remote, "side-band"))
+      strcat(caps, " side-band");
+    else {
+      fprintf(stderr, "Server does not support side-band\n");
+      pack_stream_release(&ps);
+      return 1;
+    }
+    if (remote_supports(remote, "ofs-delta"))
+      strcat(caps, " ofs-delta");
+    if (nr_haves && remote_supports(remote, "thin-pack"))
+      strcat(caps, " thin-pack");
+    if (!opts->progress && remote_supports(remote, "no-progress"))
+      strcat(caps, " no-progress");
 
-  if (res != CURLE_OK) {
-    free(resp.data);
-    free(commit_hash);
-    return NULL;
+    // Build Git protocol request: wants, flush, haves, "done"
+    for (size_t i = 0; i < nr_wants; i++) {
+      char hex[GIT_HASH_LENGTH + 1];
+      packet_append(&request, "want %s%s\n", oid_to_hex(&wants[i], hex),
+                    i == 0 ? caps : "");
+    }
+    packet_flush(&request);
+    for (size_t i = 0; i < nr_haves; i++) {
+      char hex[GIT_HASH_LENGTH + 1];
+      packet_append(&request, "have %s\n", oid_to_hex(&haves[i], hex));
+    }
+    packet_append(&request, "done\n");
   }
 
-  // Package the response into a PackFile structure
-  struct PackFile *pack = malloc(sizeof(struct PackFile));
-  pack->data = resp.data;
-  pack->size = resp.size;
-  pack->commit_hash = commit_hash;
+  // Objects are parsed and stored as each side-band packet arrives
+  trace_region_enter("network", "fetch-pack");
+  struct fetch_response fr = {
+      .ps = &ps,
+      .section = remote->version == 2 ? SECTION_HEADER : SECTION_ACKS,
+      .show_progress = opts->progress,
+  };
+  oid_set_init(&fr.shallow);
+  oid_set_init(&fr.unshallow);
+  struct packet_reader reader;
+  packet_reader_init(&reader, fetch_response_line, &fr);
+  int result =
+      upload_pack_request(remote, &request, packet_write_callback, &reader);
+  if (result == 0 && (fr.section != SECTION_DONE || reader.have)) {
+    fprintf(stderr, "Incomplete fetch response from %s\n", url);
+    result = 1;
+  }
+  result = result || pack_stream_finish(&ps);
+  if (result == 0 && (fr.shallow.nr || fr.unshallow.nr))
+    result = update_shallow(&fr.shallow, &fr.unshallow);
+  oid_set_clear(&fr.shallow);
+  oid_set_clear(&fr.unshallow);
+  free(request.data);
 
-  return pack;
+  if (result == 0 && opts->promisor)
+    result = write_promisor_file(ps.pack_name);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (opts->stats) {
+    opts->stats->bytes_received = ps.offset + SHA_DIGEST_LENGTH;
+    opts->stats->objects = ps.objects_done;
+    opts->stats->deltas = ps.nr_deltas;
+    opts->stats->thin_objects = ps.nr_thin;
+    opts->stats->elapsed_ns = (uint64_t)(end.tv_sec - start.tv_sec) *
+                                  1000000000u +
+                              end.tv_nsec - start.tv_nsec;
+  }
+  if (result == 0 && opts->verbosity > 0)
+    fprintf(stderr,
+            "Indexed %u objects (%u deltas, %u local) into pack-%s\n",
+            ps.objects_done, ps.nr_deltas, ps.nr_thin, ps.pack_name);
+  pack_stream_release(&ps);
+  trace_region_leave("network", "fetch-pack");
+  return result;
 }
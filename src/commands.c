@@ -11,21 +11,23 @@
  *   - hash-object: Object creation and hashing
  *   - ls-tree: Tree listing
  *   - commit-tree: Commit creation
+ *   - commit-graph, rev-list, merge-base: History walks
  *   - clone: Remote repository cloning
+ *   - fetch: Incremental update from a remote
  */
 
 #include "git.h"
+#include <ctype.h>
 #include <dirent.h> // For DIR, struct dirent
 #include <limits.h> // For PATH_MAX
 
 /**
- * Initialize a new Git repository.
- * Creates the .git directory structure including objects, refs directories
- * and the HEAD file pointing to refs/heads/main.
- * 
+ * Create the .git directory structure including objects, refs directories
+ * and the HEAD file pointing to refs/heads/main, without reporting it.
+ *
  * @return 0 on success, 1 on error
  */
-int handle_init(void) {
+static int init_git_dir(void) {
   // Create the core Git directory structure
   if (mkdir(GIT_DIR, 0755) == -1 || mkdir(OBJECTS_DIR, 0755) == -1 ||
       mkdir(REFS_DIR, 0755) == -1) {
@@ -41,23 +43,105 @@ int handle_init(void) {
   }
   fprintf(head, "ref: refs/heads/main\n");
   fclose(head);
+  return 0;
+}
 
+/**
+ * Initialize a new Git repository.
+ * Creates the .git directory structure including objects, refs directories
+ * and the HEAD file pointing to refs/heads/main.
+ * 
+ * @return 0 on success, 1 on error
+ */
+int handle_init(void) {
+  if (init_git_dir() != 0)
+    return 1;
   printf("Initialized git directory\n");
   return 0;
 }
 
+/**
+ * Answer object queries read from stdin, one object name per line.
+ * Each object is answered with "<oid> <type> <size>\n", followed by its
+ * content and a newline if contents is set; names that do not resolve are
+ * answered with "<name> missing\n". Replies are flushed after every
+ * object unless buffered is set, so a caller can interleave requests and
+ * replies over a pipe.
+ *
+ * @param contents Non-zero for --batch, zero for --batch-check
+ * @param buffered Non-zero to flush only at the end (--buffer)
+ * @return 0 on success, 1 on a write error
+ */
+static int cat_file_batch(int contents, int buffered) {
+  // Give stdout a large full buffer so each reply costs one write (or,
+  // with --buffer, one write per buffer) not several, even on a terminal
+  static char outbuf[65536];
+  setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+  char *line = NULL;
+  size_t alloc = 0;
+  ssize_t len;
+
+  while ((len = getline(&line, &alloc, stdin)) != -1) {
+    if (len > 0 && line[len - 1] == '\n')
+      line[--len] = '\0';
+
+    struct object_id oid;
+    const char *type;
+    size_t size;
+    git_object *obj = NULL;
+    int found = len == GIT_HASH_LENGTH && get_oid_hex(line, &oid) == 0;
+    if (found && contents) {
+      obj = odb_read_object(&oid);
+      found = obj != NULL;
+    } else if (found) {
+      found = odb_read_object_info(&oid, &type, &size) == 0;
+    }
+
+    if (!found) {
+      printf("%s missing\n", line);
+    } else if (obj) {
+      printf("%s %s %zu\n", line, obj->type, obj->size);
+      fwrite(obj->content, 1, obj->size, stdout);
+      putchar('\n');
+      free_git_object(obj);
+    } else {
+      printf("%s %s %zu\n", line, type, size);
+    }
+    if (!buffered && fflush(stdout) != 0)
+      break;
+  }
+  free(line);
+
+  if (fflush(stdout) != 0 || ferror(stdout)) {
+    fprintf(stderr, "Failed to write output: %s\n", strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
 /**
  * Display the contents of a Git object.
  * Reads a blob, tree, or commit object from the object database
- * and prints its contents to stdout.
+ * and prints its contents to stdout. With --batch or --batch-check, object
+ * names are read from stdin instead and many objects are answered by one
+ * process.
  * 
  * @param argc Argument count
- * @param argv Arguments: [-p] <object-hash>
+ * @param argv Arguments: -p <object-hash> | (--batch | --batch-check)
+ *             [--buffer]
  * @return 0 on success, 1 on error
  */
 int handle_cat_file(int argc, char *argv[]) {
+  if (argc >= 2 && (strcmp(argv[1], "--batch") == 0 ||
+                    strcmp(argv[1], "--batch-check") == 0)) {
+    int buffered = argc >= 3 && strcmp(argv[2], "--buffer") == 0;
+    return cat_file_batch(strcmp(argv[1], "--batch") == 0, buffered);
+  }
   if (argc < 3 || strcmp(argv[1], "-p") != 0) {
-    fprintf(stderr, "Usage: cat-file -p <object>\n");
+    fprintf(stderr,
+            "Usage: cat-file -p <object>\n"
+            "       cat-file (--batch | --batch-check) [--buffer]\n");
     return 1;
   }
 
@@ -68,8 +152,8 @@ int handle_cat_file(int argc, char *argv[]) {
     return 1;
   }
 
-  // Print content without adding a trailing newline
-  printf("%s", obj->content);
+  // Print content without adding a trailing newline (binary safe)
+  fwrite(obj->content, 1, obj->size, stdout);
 
   free_git_object(obj);
   return 0;
@@ -145,15 +229,16 @@ int handle_ls_tree(int argc, char *argv[]) {
 
   // Display tree entries based on output format
   for (size_t i = 0; i < tree->count; i++) {
+    const tree_entry *te = &tree->entries[i];
     if (name_only) {
       // Simple name-only output
-      printf("%s\n", tree->entries[i].name);
+      printf("%s\n", te->name);
     } else {
       // Full format with mode, type, hash, and name
-      printf("%s %s %s\t%s\n", tree->entries[i].mode,
-             strcmp(tree->entries[i].mode, GIT_MODE_TREE) == 0 ? "tree"
-                                                               : "blob",
-             tree->entries[i].hash, tree->entries[i].name);
+      char hex[GIT_HASH_LENGTH + 1];
+      oid_to_hex(te->oid, hex);
+      printf("%06o %s %s\t%s\n", te->mode, tree_entry_type(te->mode), hex,
+             te->name);
     }
   }
 
@@ -213,6 +298,510 @@ int handle_commit_tree(int argc, char *argv[]) {
   return 0;
 }
 
+/**
+ * Write the commit-graph file for all commits reachable from the refs.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: write
+ * @return 0 on success, 1 on error
+ */
+int handle_commit_graph(int argc, char *argv[]) {
+  if (argc != 2 || strcmp(argv[1], "write") != 0) {
+    fprintf(stderr, "Usage: commit-graph write\n");
+    return 1;
+  }
+  return write_commit_graph();
+}
+
+/**
+ * Resolve a revision to the commit it names. The name may end in any
+ * number of "~<n>" (n-th first-parent ancestor) and "^<n>" (n-th parent)
+ * suffixes, with n defaulting to 1.
+ *
+ * @return 0 on success, 1 (after reporting it) if it names no commit
+ */
+static int get_commit_arg(const char *name, struct object_id *oid) {
+  char base[PATH_MAX];
+  size_t len = strcspn(name, "~^");
+  snprintf(base, sizeof(base), "%.*s", (int)len, name);
+  int ok = resolve_revision(base, oid) == 0 && peel_to_commit(oid) == 0;
+
+  for (const char *p = name + len; ok && *p;) {
+    char op = *p++;
+    char *end;
+    unsigned long n = isdigit((unsigned char)*p) ? strtoul(p, &end, 10) : 1;
+    if (isdigit((unsigned char)*p))
+      p = end;
+    // "~n" takes the first parent n times; "^n" the n-th parent once
+    for (unsigned long step = 0; ok && step < (op == '~' ? n : 1); step++) {
+      size_t which = op == '~' ? 0 : n - 1;
+      struct commit_info info;
+      if (op == '^' && n == 0)
+        break;  // "^0" is the commit itself
+      ok = read_commit_info(oid, &info) == 0 && which < info.nr_parents;
+      if (ok)
+        *oid = *commit_parent(&info, which);
+      commit_info_release(&info);
+    }
+  }
+  if (!ok) {
+    fprintf(stderr, "Not a valid commit: %s\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * rev-list Output State
+ */
+struct rev_list_output {
+  long max_count;  // Commits left to show, or -1 for all
+  size_t count;    // Objects shown
+  int count_only;  // --count: print only the number of objects
+  int objects;     // --objects: list trees and blobs too
+};
+
+static int show_object(const struct object_id *oid, int type,
+                       const char *path, void *data) {
+  (void)type;
+  struct rev_list_output *out = data;
+  out->count++;
+  if (!out->count_only) {
+    char hex[GIT_HASH_LENGTH + 1];
+    if (path)
+      printf("%s %s\n", oid_to_hex(oid, hex), path);
+    else
+      printf("%s\n", oid_to_hex(oid, hex));
+  }
+  return 0;
+}
+
+static int show_commit(const struct object_id *oid,
+                       const struct commit_info *info, void *data) {
+  (void)info;
+  struct rev_list_output *out = data;
+  if (out->max_count >= 0 && out->count >= (size_t)out->max_count)
+    return 1;
+  return show_object(oid, OBJ_COMMIT, NULL, data);
+}
+
+/**
+ * List the commits reachable from the given commits, excluding those
+ * reachable from any commit given as ^<commit> (or as A in A..B), newest
+ * first. Uses the commit-graph where present.
+ *
+ * With --objects, the trees and blobs those commits bring in follow, with
+ * their paths. --use-bitmap-index answers from the reachability bitmaps
+ * where there are some, listing objects by type and pack order without
+ * paths; --count then costs a few bitmap operations instead of a walk.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: [--topo-order] [--max-count=<n>] [--count]
+ *             [--objects] [--use-bitmap-index] <commit>... [^<commit>...]
+ * @return 0 on success, 1 on error
+ */
+int handle_rev_list(int argc, char *argv[]) {
+  struct rev_list_output out = {-1, 0, 0, 0};
+  int flags = 0, use_bitmap = 0;
+  struct object_id *tips = calloc(argc * 2, sizeof(*tips));
+  struct object_id *excludes = calloc(argc * 2, sizeof(*excludes));
+  size_t nr_tips = 0, nr_excludes = 0;
+  int result = 0;
+
+  for (int i = 1; i < argc && !result; i++) {
+    const char *arg = argv[i];
+    const char *range = strstr(arg, "..");
+    if (strcmp(arg, "--topo-order") == 0) {
+      flags |= WALK_TOPO_ORDER;
+    } else if (strcmp(arg, "--count") == 0) {
+      out.count_only = 1;
+    } else if (strcmp(arg, "--objects") == 0) {
+      out.objects = 1;
+    } else if (strcmp(arg, "--use-bitmap-index") == 0) {
+      use_bitmap = 1;
+    } else if (strncmp(arg, "--max-count=", 12) == 0) {
+      out.max_count = atol(arg + 12);
+    } else if (arg[0] == '-') {
+      result = -1;
+    } else if (arg[0] == '^') {
+      result = get_commit_arg(arg + 1, &excludes[nr_excludes++]);
+    } else if (range) {
+      // A..B is ^A B
+      char left[PATH_MAX];
+      snprintf(left, sizeof(left), "%.*s", (int)(range - arg), arg);
+      result = get_commit_arg(*left ? left : "HEAD", &excludes[nr_excludes++]) ||
+               get_commit_arg(range[2] ? range + 2 : "HEAD", &tips[nr_tips++]);
+    } else {
+      result = get_commit_arg(arg, &tips[nr_tips++]);
+    }
+  }
+  if (result < 0 || (result == 0 && !nr_tips) ||
+      (out.objects && out.max_count >= 0)) {
+    fprintf(stderr, "Usage: rev-list [--topo-order] [--max-count=<n>] "
+                    "[--count] [--objects] [--use-bitmap-index] "
+                    "<commit>... [^<commit>...]\n");
+    result = 1;
+  }
+
+  // Bitmaps know what is reachable, but not in which order
+  struct bitmap *objects = NULL;
+  if (result == 0 && use_bitmap && !(flags & WALK_TOPO_ORDER) &&
+      out.max_count < 0)
+    objects = bitmap_find_reachable(tips, nr_tips, excludes, nr_excludes);
+  if (objects) {
+    int type = out.objects ? 0 : OBJ_COMMIT;
+    if (out.count_only)
+      out.count = bitmap_count_objects(objects, type);
+    else
+      bitmap_for_each_object(objects, type, show_object, &out);
+    bitmap_free(objects);
+  } else if (result == 0 && out.objects) {
+    result = walk_objects(tips, nr_tips, excludes, nr_excludes, flags,
+                          show_object, &out);
+  } else if (result == 0) {
+    result = walk_commits(tips, nr_tips, excludes, nr_excludes, flags,
+                          show_commit, &out);
+    // Stopping at --max-count is not an error
+    if (out.max_count >= 0 && out.count == (size_t)out.max_count)
+      result = 0;
+  }
+  if (result == 0 && out.count_only)
+    printf("%zu\n", out.count);
+  free(tips);
+  free(excludes);
+  return result;
+}
+
+/**
+ * Check whether one commit is an ancestor of another. Generation numbers
+ * from the commit-graph bound the walk, so the answer normally costs a
+ * few lookups rather than a walk of the whole history.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: --is-ancestor <commit> <commit>
+ * @return 0 if the first commit is an ancestor of the second, 1 if not or
+ *         on error
+ */
+int handle_merge_base(int argc, char *argv[]) {
+  if (argc != 4 || strcmp(argv[1], "--is-ancestor") != 0) {
+    fprintf(stderr, "Usage: merge-base --is-ancestor <commit> <commit>\n");
+    return 1;
+  }
+  struct object_id a, b;
+  if (get_commit_arg(argv[2], &a) != 0 || get_commit_arg(argv[3], &b) != 0)
+    return 1;
+  return is_ancestor(&a, &b) == 1 ? 0 : 1;
+}
+
+/**
+ * Resolve a tree-ish (a tree, or a commit or tag naming one) given by the
+ * user. Ancestry suffixes ("~<n>", "^<n>") are followed as for commits.
+ *
+ * @return 0 on success, 1 (after reporting it) if it names no tree
+ */
+static int get_tree_arg(const char *name, struct object_id *oid) {
+  if (name[strcspn(name, "~^")])
+    return get_commit_arg(name, oid) || peel_to_tree(oid);
+  if (resolve_revision(name, oid) != 0 || peel_to_tree(oid) != 0) {
+    fprintf(stderr, "Not a valid tree-ish: %s\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * diff-tree Output Format
+ */
+enum diff_format {
+  DIFF_FORMAT_RAW,          // ":<modes> <ids> <status>\t<path>"
+  DIFF_FORMAT_NAME_ONLY,    // --name-only
+  DIFF_FORMAT_NAME_STATUS   // --name-status
+};
+
+static int show_diff_change(const struct diff_change *change, void *data) {
+  enum diff_format format = *(const enum diff_format *)data;
+  char old_hex[GIT_HASH_LENGTH + 1], new_hex[GIT_HASH_LENGTH + 1];
+  if (format == DIFF_FORMAT_NAME_ONLY)
+    printf("%s\n", change->path);
+  else if (format == DIFF_FORMAT_NAME_STATUS)
+    printf("%c\t%s\n", change->status, change->path);
+  else
+    printf(":%06o %06o %s %s %c\t%s\n", change->old_mode, change->new_mode,
+           oid_to_hex(&change->old_oid, old_hex),
+           oid_to_hex(&change->new_oid, new_hex), change->status,
+           change->path);
+  return 0;
+}
+
+/**
+ * Compare two trees and list the paths that differ, in Git's raw diff
+ * format (":<old mode> <new mode> <old id> <new id> <status>\t<path>").
+ * Subtrees with the same ID on both sides are skipped without being read.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: [-r] [--name-only | --name-status] <tree-ish>
+ *             <tree-ish>
+ * @return 0 on success, 1 on error
+ */
+int handle_diff_tree(int argc, char *argv[]) {
+  enum diff_format format = DIFF_FORMAT_RAW;
+  int flags = 0;
+  const char *args[2];
+  int nr_args = 0;
+  for (int i = 1; i < argc && nr_args >= 0; i++) {
+    if (strcmp(argv[i], "-r") == 0)
+      flags |= DIFF_RECURSIVE;
+    else if (strcmp(argv[i], "--name-only") == 0)
+      format = DIFF_FORMAT_NAME_ONLY;
+    else if (strcmp(argv[i], "--name-status") == 0)
+      format = DIFF_FORMAT_NAME_STATUS;
+    else if (argv[i][0] != '-' && nr_args < 2)
+      args[nr_args++] = argv[i];
+    else
+      nr_args = -1;
+  }
+  if (nr_args != 2) {
+    fprintf(stderr, "Usage: diff-tree [-r] [--name-only | --name-status] "
+                    "<tree-ish> <tree-ish>\n");
+    return 1;
+  }
+  struct object_id a, b;
+  if (get_tree_arg(args[0], &a) != 0 || get_tree_arg(args[1], &b) != 0)
+    return 1;
+  return diff_trees(&a, &b, flags, show_diff_change, &format);
+}
+
+/**
+ * Find the tree of the commit HEAD points at.
+ *
+ * @param has_head Output: 0 if HEAD names no commit yet (an unborn branch)
+ * @return 0 on success, 1 (after reporting it) if HEAD is not a commit
+ */
+static int get_head_tree(struct object_id *tree, int *has_head) {
+  *has_head = read_ref("HEAD", tree) == 0;
+  if (*has_head && peel_to_tree(tree) != 0) {
+    fprintf(stderr, "HEAD does not name a commit\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * status Output State
+ * Untracked paths are listed after the changes, as Git does.
+ */
+struct status_output {
+  char **untracked;
+  size_t nr_untracked, alloc_untracked;
+};
+
+static int show_status_change(const struct diff_change *change, void *data) {
+  struct status_output *out = data;
+  if (change->status != '?') {
+    printf(" %c %s\n", change->status, change->path);
+    return 0;
+  }
+  if (out->nr_untracked == out->alloc_untracked) {
+    out->alloc_untracked = out->alloc_untracked ? out->alloc_untracked * 2 : 16;
+    out->untracked = realloc(out->untracked,
+                             out->alloc_untracked * sizeof(*out->untracked));
+  }
+  out->untracked[out->nr_untracked++] = strdup(change->path);
+  return 0;
+}
+
+/**
+ * Show how the work tree differs from the commit HEAD points at, in the
+ * format of git status --short: " M", " D" or " T" before changed tracked
+ * paths, then "??" before untracked ones. Files whose stat data matches
+ * .git/index are not read. Must be run from the top of the work tree.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: [-s | --short | --porcelain]
+ * @return 0 on success, 1 on error
+ */
+int handle_status(int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") != 0 && strcmp(argv[i], "--short") != 0 &&
+        strcmp(argv[i], "--porcelain") != 0) {
+      fprintf(stderr, "Usage: status [-s | --short | --porcelain]\n");
+      return 1;
+    }
+  }
+
+  // Before the first commit everything is untracked
+  struct object_id tree;
+  int has_head;
+  if (get_head_tree(&tree, &has_head) != 0)
+    return 1;
+
+  struct status_output out = {0};
+  int result = diff_worktree(has_head ? &tree : NULL, show_status_change, &out);
+  for (size_t i = 0; i < out.nr_untracked; i++) {
+    if (result == 0)
+      printf("?? %s\n", out.untracked[i]);
+    free(out.untracked[i]);
+  }
+  free(out.untracked);
+  return result;
+}
+
+/**
+ * Switch the work tree to another commit and point HEAD at it. Only the
+ * files that differ between the two commits' trees are deleted or
+ * written. A branch name attaches HEAD to the branch; any other commit
+ * detaches it. Local changes to the files that would be touched, or
+ * untracked files in the way, abort the checkout before anything is
+ * changed. Must be run from the top of the work tree.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: [-q] <commit>
+ * @return 0 on success, 1 on error
+ */
+int handle_checkout(int argc, char *argv[]) {
+  int quiet = argc == 3 && strcmp(argv[1], "-q") == 0;
+  if (argc != 2 + quiet || argv[argc - 1][0] == '-') {
+    fprintf(stderr, "Usage: checkout [-q] <commit>\n");
+    return 1;
+  }
+  const char *name = argv[argc - 1];
+
+  struct object_id commit, old_tree, new_tree;
+  int has_head;
+  if (get_commit_arg(name, &commit) != 0 ||
+      get_head_tree(&old_tree, &has_head) != 0)
+    return 1;
+  new_tree = commit;
+  if (peel_to_tree(&new_tree) != 0 ||
+      switch_tree(has_head ? &old_tree : NULL, &new_tree, 0) != 0) {
+    fprintf(stderr, "Checkout of %s failed\n", name);
+    return 1;
+  }
+
+  char branch[PATH_MAX];
+  struct object_id tip;
+  snprintf(branch, sizeof(branch), "refs/heads/%s", name);
+  if (read_ref(branch, &tip) == 0 && oideq(&tip, &commit)) {
+    if (create_symref("HEAD", branch) != 0)
+      return 1;
+    if (!quiet)
+      fprintf(stderr, "Switched to branch '%s'\n", name);
+    return 0;
+  }
+  if (update_ref("HEAD", &commit) != 0)
+    return 1;
+  if (!quiet) {
+    char hex[GIT_HASH_LENGTH + 1];
+    fprintf(stderr, "HEAD is now at %.7s\n", oid_to_hex(&commit, hex));
+  }
+  return 0;
+}
+
+/**
+ * Switch the work tree from one tree to another, as checkout does but
+ * without touching HEAD. The index here caches stat data rather than
+ * staging content, so only the two-tree form with -m -u is supported.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: -m -u <tree-ish> <tree-ish>
+ * @return 0 on success, 1 on error
+ */
+int handle_read_tree(int argc, char *argv[]) {
+  int merge = 0, update = 0;
+  const char *args[2];
+  int nr_args = 0;
+  for (int i = 1; i < argc && nr_args >= 0; i++) {
+    if (strcmp(argv[i], "-m") == 0)
+      merge = 1;
+    else if (strcmp(argv[i], "-u") == 0)
+      update = 1;
+    else if (argv[i][0] != '-' && nr_args < 2)
+      args[nr_args++] = argv[i];
+    else
+      nr_args = -1;
+  }
+  if (!merge || !update || nr_args != 2) {
+    fprintf(stderr, "Usage: read-tree -m -u <tree-ish> <tree-ish>\n");
+    return 1;
+  }
+  struct object_id a, b;
+  if (get_tree_arg(args[0], &a) != 0 || get_tree_arg(args[1], &b) != 0)
+    return 1;
+  return switch_tree(&a, &b, 0);
+}
+
+/**
+ * Pack the loose objects that are not in a pack yet into a new pack, with
+ * delta compression, and delete them. With -a every reachable object is
+ * packed instead, and with -A unreachable ones as well; -d then deletes
+ * the packs they replace, and -b writes reachability bitmaps for the
+ * single pack left.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: [-a | -A] [-d] [-b] [-q] [--window=<n>] [--depth=<n>]
+ *             [--threads=<n>]
+ * @return 0 on success, 1 on error
+ */
+int handle_repack(int argc, char *argv[]) {
+  int flags = 0, write_bitmap = 0, quiet = 0;
+  int window = -1, depth = -1, threads = 0;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "-a") == 0) {
+      flags |= REPACK_ALL;
+    } else if (strcmp(arg, "-A") == 0) {
+      flags |= REPACK_ALL | REPACK_KEEP_UNREACHABLE;
+    } else if (strcmp(arg, "-d") == 0) {
+      flags |= REPACK_DELETE;
+    } else if (strcmp(arg, "-b") == 0) {
+      write_bitmap = 1;
+    } else if (strcmp(arg, "-q") == 0 || strcmp(arg, "--quiet") == 0) {
+      quiet = 1;
+    } else if (strncmp(arg, "--window=", 9) == 0) {
+      window = atoi(arg + 9);
+    } else if (strncmp(arg, "--depth=", 8) == 0) {
+      depth = atoi(arg + 8);
+    } else if (strncmp(arg, "--threads=", 10) == 0) {
+      threads = atoi(arg + 10);
+    } else {
+      window = depth = threads = -2;
+    }
+  }
+  if (window < -1 || depth < -1 || threads < 0) {
+    fprintf(stderr, "Usage: repack [-a | -A] [-d] [-b] [-q] [--window=<n>] "
+                    "[--depth=<n>] [--threads=<n>]\n");
+    return 1;
+  }
+  int result = repack(flags, window, depth, threads,
+                      !quiet && isatty(STDERR_FILENO));
+  return result || (write_bitmap && write_pack_bitmap());
+}
+
+/**
+ * Tidy up the repository: repack every object into one pack (reachable
+ * ones first; unreachable ones are kept, as nothing here expires them),
+ * delete the old packs and the packed loose objects, and rewrite the
+ * commit-graph and reachability bitmaps. A partial clone only packs its
+ * loose objects.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: [-q]
+ * @return 0 on success, 1 on error
+ */
+int handle_gc(int argc, char *argv[]) {
+  int quiet = argc == 2 && (strcmp(argv[1], "-q") == 0 ||
+                            strcmp(argv[1], "--quiet") == 0);
+  if (argc > 2 || (argc == 2 && !quiet)) {
+    fprintf(stderr, "Usage: gc [-q]\n");
+    return 1;
+  }
+  int flags = REPACK_ALL | REPACK_KEEP_UNREACHABLE | REPACK_DELETE;
+  if (has_promisor_remote())
+    flags = 0;
+  return repack(flags, -1, -1, 0, !quiet && isatty(STDERR_FILENO)) ||
+         write_commit_graph() || write_pack_bitmap();
+}
+
 /**
  * Recursively print a visual tree representation of a directory.
  * Used for debugging and visualization purposes.
@@ -248,23 +837,88 @@ void print_directory_tree(const char *basePath, int level) {
   closedir(dir);
 }
 
+/**
+ * Parse "[-q | -v] [--[no-]progress] [--threads <n>] [--depth <n>]
+ * [--filter <spec>] <args>..." for clone and fetch. "--filter=<spec>" is
+ * accepted as well. Progress is shown by default when stderr is a
+ * terminal and --quiet was not given.
+ *
+ * @param argc Argument count
+ * @param argv Arguments (argv[0] is the command name)
+ * @param opts Output options
+ * @param args Output positional arguments
+ * @param max_args Maximum number of positional arguments
+ * @return Number of positional arguments, or -1 on a usage error
+ */
+static int parse_fetch_args(int argc, char *argv[], struct fetch_options *opts,
+                            const char **args, int max_args) {
+  int nr = 0;
+  opts->progress = -1;
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    if (strcmp(opt, "-q") == 0 || strcmp(opt, "--quiet") == 0) {
+      opts->verbosity = -1;
+    } else if (strcmp(opt, "-v") == 0 || strcmp(opt, "--verbose") == 0) {
+      opts->verbosity = 1;
+    } else if (strcmp(opt, "--progress") == 0) {
+      opts->progress = 1;
+    } else if (strcmp(opt, "--no-progress") == 0) {
+      opts->progress = 0;
+    } else if (strncmp(opt, "--filter=", 9) == 0) {
+      opts->filter = opt + 9;
+    } else if (strcmp(opt, "--threads") == 0 || strcmp(opt, "--depth") == 0 ||
+               strcmp(opt, "--filter") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Missing value for %s\n", opt);
+        return -1;
+      }
+      const char *value = argv[++i];
+      if (strcmp(opt, "--threads") == 0)
+        opts->threads = atoi(value);
+      else if (strcmp(opt, "--depth") == 0)
+        opts->depth = atoi(value);
+      else
+        opts->filter = value;
+    } else if (nr < max_args) {
+      args[nr++] = opt;
+    } else {
+      return -1;
+    }
+  }
+  if (opts->progress < 0)
+    opts->progress = opts->verbosity >= 0 && isatty(STDERR_FILENO);
+  if (opts->depth < 0 || (opts->filter && !*opts->filter))
+    return -1;
+  return opts->threads < 0 ? -1 : nr;
+}
+
 /**
  * Clone a remote Git repository.
- * Fetches remote refs, downloads pack file, extracts objects,
- * and checks out the working tree.
+ * Fetches remote refs, downloads the pack for the remote HEAD and every
+ * branch, records the remote, a remote-tracking ref per branch and the
+ * local branch of the remote HEAD, writes the commit-graph and reachability
+ * bitmaps, and checks out the working tree.
+ * With --depth only the newest commits are fetched (a shallow clone); with
+ * --filter=blob:none blobs are left on the remote (a partial clone) and
+ * fetched when checkout or a later read needs them.
  * 
  * @param argc Argument count
- * @param argv Arguments: <repository-url> <directory>
+ * @param argv Arguments: [-q | -v] [--[no-]progress] [--threads <n>]
+ *             [--depth <n>] [--filter <spec>] <repository-url> <directory>
  * @return 0 on success, 1 on error
  */
 int handle_clone(int argc, char *argv[]) {
-  if (argc != 3) {
-    fprintf(stderr, "Usage: clone <url> <directory>\n");
+  static const char *const clone_prefixes[] = {"HEAD", "refs/heads/", NULL};
+  struct fetch_options opts = {0};
+  const char *args[2];
+  if (parse_fetch_args(argc, argv, &opts, args, 2) != 2) {
+    fprintf(stderr, "Usage: clone [-q | -v] [--[no-]progress] [--threads <n>] "
+                    "[--depth <n>] [--filter <spec>] <url> <directory>\n");
     return 1;
   }
-
-  const char *url = argv[1];
-  const char *dir = argv[2];
+  opts.ref_prefixes = clone_prefixes;
+  const char *url = args[0];
+  const char *dir = args[1];
 
   // Create target directory and change to it
   if (mkdir(dir, 0755) == -1 || chdir(dir) == -1) {
@@ -272,29 +926,96 @@ int handle_clone(int argc, char *argv[]) {
     return 1;
   }
 
-  // Initialize a new Git repository in the target directory
-  if (handle_init() != 0) {
+  // Initialize a new Git repository in the target directory, remembering
+  // where it came from for later fetches
+  if (init_git_dir() != 0)
+    return 1;
+  if (opts.verbosity >= 0) {
+    // Flushed now, or the line would follow the errors of a failed clone
+    printf("Initialized git directory\n");
+    fflush(stdout);
+  }
+  if (config_set("remote.origin.url", url) != 0 ||
+      config_set("remote.origin.fetch", REMOTE_FETCH_REFSPEC) != 0) {
     return 1;
   }
 
-  // Fetch the pack file from the remote repository
-  struct PackFile *pack = fetch_pack(url);
-  if (!pack) {
-    fprintf(stderr, "Failed to fetch pack\n");
+  // A partial clone records the remote as the promisor of the objects the
+  // filter leaves out, the way Git does
+  if (opts.filter) {
+    if (config_set("core.repositoryformatversion", "1") != 0 ||
+        config_set("extensions.partialclone", "origin") != 0 ||
+        config_set("remote.origin.promisor", "true") != 0 ||
+        config_set("remote.origin.partialclonefilter", opts.filter) != 0)
+      return 1;
+    opts.promisor = 1;
+  }
+
+  struct remote_refs remote;
+  if (get_remote_refs(url, &opts, &remote) != 0)
+    return 1;
+  const struct remote_ref *head = find_remote_head(&remote);
+  if (!head) {
+    fprintf(stderr, "Remote has no HEAD to clone\n");
+    free_remote_refs(&remote);
     return 1;
   }
 
-  // Process and extract all objects from the pack file
-  if (process_pack_file(pack->data, pack->size) != 0) {
-    fprintf(stderr, "Failed to write pack file\n");
-    free(pack->data);
-    free(pack->commit_hash);
-    free(pack);
+  // Want the remote HEAD and every branch tip, so each branch the fetch
+  // refspec maps gets its remote-tracking ref now rather than showing up
+  // as a new branch on the first fetch
+  struct oid_set wanted;
+  oid_set_init(&wanted);
+  struct object_id *wants = malloc((remote.nr + 1) * sizeof(*wants));
+  size_t nr_wants = 0;
+  oid_set_insert(&wanted, &head->oid);
+  wants[nr_wants++] = head->oid;
+  for (size_t i = 0; i < remote.nr; i++) {
+    const struct remote_ref *ref = &remote.refs[i];
+    if (skip_prefix(ref->name, "refs/heads/") &&
+        oid_set_insert(&wanted, &ref->oid))
+      wants[nr_wants++] = ref->oid;
+  }
+  oid_set_clear(&wanted);
+
+  // Fetch the pack file from the remote repository; objects are
+  // extracted while the pack streams in
+  int fetched = fetch_pack(url, &remote, wants, nr_wants, NULL, 0, &opts);
+  free(wants);
+  if (fetched != 0) {
+    fprintf(stderr, "Failed to fetch pack\n");
+    free_remote_refs(&remote);
     return 1;
   }
 
+  // Record every remote branch as a remote-tracking ref
+  int result = 0;
+  for (size_t i = 0; i < remote.nr && result == 0; i++) {
+    const struct remote_ref *ref = &remote.refs[i];
+    const char *name = skip_prefix(ref->name, "refs/heads/");
+    if (!name)
+      continue;
+    char tracking[PATH_MAX];
+    snprintf(tracking, sizeof(tracking), REMOTE_REFS_PREFIX "%s", name);
+    result = update_ref(tracking, &ref->oid);
+  }
+
+  // Check out the branch the remote HEAD points at as a local branch
+  const char *branch = skip_prefix(head->name, "refs/heads/");
+  if (branch) {
+    result = result || update_ref(head->name, &head->oid) ||
+             create_symref("HEAD", head->name);
+  } else {
+    result = result || update_ref("HEAD", &head->oid);  // Detached HEAD
+  }
+
+  // Index the fetched history so later walks need not inflate commits,
+  // and record what each commit reaches in the single pack just received
+  result = result || write_commit_graph() || write_pack_bitmap();
+
   // Read the commit object to extract the tree hash
-  git_object *commit_obj = read_object(pack->commit_hash);
+  git_object *commit_obj = odb_read_object(&head->oid);
+  free_remote_refs(&remote);
   if (!commit_obj) {
     fprintf(stderr, "Failed to read commit object\n");
     return 1;
@@ -305,11 +1026,117 @@ int handle_clone(int argc, char *argv[]) {
   sscanf(commit_obj->content, "tree %40s", tree_hash);
 
   // Checkout the tree to populate the working directory
-  checkout_tree(tree_hash, ".");
+  if (checkout_tree(tree_hash, ".", opts.threads) != 0) {
+    fprintf(stderr, "Checkout of %s was incomplete\n", tree_hash);
+    result = 1;
+  }
 
-  free(pack->data);
-  free(pack->commit_hash);
-  free(pack);
+  free_git_object(commit_obj);
+  return result;
+}
 
-  return 0;
+/**
+ * Fetch new objects from a remote and update the remote-tracking refs.
+ * Every remote branch is mapped to refs/remotes/origin/<branch>. Local
+ * commits are offered as haves, so only objects that are new to this
+ * repository are transferred. --depth limits the history fetched from
+ * each new tip; a partial clone keeps fetching with its clone's filter.
+ *
+ * @param argc Argument count
+ * @param argv Arguments: [-q | -v] [--[no-]progress] [--threads <n>]
+ *             [--depth <n>] [<repository-url>]
+ * @return 0 on success, 1 on error
+ */
+int handle_fetch(int argc, char *argv[]) {
+  static const char *const fetch_prefixes[] = {"refs/heads/", NULL};
+  struct fetch_options opts = {0};
+  const char *args[1];
+  int nr_args = parse_fetch_args(argc, argv, &opts, args, 1);
+  if (nr_args < 0 || opts.filter) {
+    fprintf(stderr, "Usage: fetch [-q | -v] [--[no-]progress] [--threads <n>] "
+                    "[--depth <n>] [<url>]\n");
+    return 1;
+  }
+  opts.ref_prefixes = fetch_prefixes;
+  char *url = nr_args ? strdup(args[0]) : config_get("remote.origin.url");
+  if (!url) {
+    fprintf(stderr, "No remote URL given and remote.origin.url is not set\n");
+    return 1;
+  }
+
+  // Fetches into a partial clone keep using the clone's filter
+  char *filter = NULL;
+  if (has_promisor_remote()) {
+    filter = config_get("remote.origin.partialclonefilter");
+    opts.filter = filter;
+    opts.promisor = 1;
+  }
+
+  struct remote_refs remote;
+  if (get_remote_refs(url, &opts, &remote) != 0) {
+    free(filter);
+    free(url);
+    return 1;
+  }
+
+  // Want every branch tip that is not already here
+  struct oid_set wanted;
+  oid_set_init(&wanted);
+  struct object_id *wants = malloc((remote.nr + 1) * sizeof(*wants));
+  size_t nr_wants = 0;
+  for (size_t i = 0; i < remote.nr; i++) {
+    const struct remote_ref *ref = &remote.refs[i];
+    if (skip_prefix(ref->name, "refs/heads/") && !odb_has_object(&ref->oid) &&
+        oid_set_insert(&wanted, &ref->oid))
+      wants[nr_wants++] = ref->oid;
+  }
+  oid_set_clear(&wanted);
+
+  int result = 0;
+  if (nr_wants) {
+    struct object_id *haves;
+    size_t nr_haves = collect_haves(&haves);
+    result = fetch_pack(url, &remote, wants, nr_wants, haves, nr_haves, &opts);
+    free(haves);
+  }
+  free(wants);
+
+  // Move the remote-tracking refs once their objects are all present
+  for (size_t i = 0; i < remote.nr && result == 0; i++) {
+    const struct remote_ref *ref = &remote.refs[i];
+    const char *branch = skip_prefix(ref->name, "refs/heads/");
+    if (!branch)
+      continue;
+
+    char tracking[PATH_MAX];
+    snprintf(tracking, sizeof(tracking), REMOTE_REFS_PREFIX "%s", branch);
+    struct object_id old;
+    int is_new = read_ref(tracking, &old) != 0;
+    if (!is_new && oideq(&old, &ref->oid))
+      continue;
+    if (!odb_has_object(&ref->oid)) {
+      fprintf(stderr, "Fetched pack is missing %s\n", ref->name);
+      result = 1;
+      break;
+    }
+    result = update_ref(tracking, &ref->oid);
+
+    char old_hex[GIT_HASH_LENGTH + 1], new_hex[GIT_HASH_LENGTH + 1];
+    oid_to_hex(&ref->oid, new_hex);
+    if (opts.verbosity < 0)
+      continue;
+    if (is_new)
+      printf(" * [new branch]      %s -> origin/%s\n", branch, branch);
+    else
+      printf("   %.7s..%.7s  %s -> origin/%s\n", oid_to_hex(&old, old_hex),
+             new_hex, branch, branch);
+  }
+
+  if (result == 0)
+    result = write_commit_graph();
+
+  free_remote_refs(&remote);
+  free(filter);
+  free(url);
+  return result;
 }
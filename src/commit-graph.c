@@ -0,0 +1,605 @@
+/**
+ * commit-graph.c - Commit-Graph File
+ *
+ * This file implements Git's commit-graph file (.git/objects/info/
+ * commit-graph): every commit reachable from the refs, with its root
+ * tree, parents, committer date and generation number, in a table that
+ * is memory-mapped and used in place. read_commit_info() consults it
+ * before inflating a commit, so history walks over covered commits touch
+ * no object at all.
+ *
+ * File format (version 1, as written by Git):
+ *   - Header: "CGPH", version 1, hash version 1 (SHA-1), number of
+ *     chunks, number of base graphs (0)
+ *   - Chunk table: (4-byte ID, 8-byte offset) per chunk, then a
+ *     terminating entry with ID 0 whose offset is the end of the last chunk
+ *   - OIDF: fanout table, 256 cumulative counts by first byte
+ *   - OIDL: sorted commit IDs
+ *   - CDAT: per commit, its tree ID, two parent positions and 8 bytes of
+ *     generation (top 30 bits) and committer date (34 bits)
+ *   - EDGE: parents beyond the first of octopus merges (optional)
+ *   - Trailer: SHA-1 of everything preceding it
+ * All integers are in network byte order.
+ *
+ * The graph is written after clone and fetch and by "commit-graph write".
+ * It is not used in shallow repositories, whose commits' parents change
+ * as history is deepened.
+ */
+
+#include "git.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define GRAPH_SIGNATURE 0x43475048  // "CGPH"
+#define GRAPH_VERSION 1
+#define GRAPH_HASH_VERSION 1  // SHA-1
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNK_ENTRY_SIZE 12
+#define GRAPH_FANOUT_SIZE (256 * 4)
+#define GRAPH_DATA_SIZE (SHA_DIGEST_LENGTH + 16)  // CDAT record
+
+#define GRAPH_CHUNK_OIDF 0x4f494446  // "OIDF"
+#define GRAPH_CHUNK_OIDL 0x4f49444c  // "OIDL"
+#define GRAPH_CHUNK_CDAT 0x43444154  // "CDAT"
+#define GRAPH_CHUNK_EDGE 0x45444745  // "EDGE"
+
+#define GRAPH_PARENT_NONE 0x70000000    // No such parent
+#define GRAPH_EXTRA_EDGES 0x80000000    // Second parent field: EDGE index
+#define GRAPH_LAST_EDGE 0x80000000      // Last entry of an EDGE list
+#define GRAPH_DATE_MAX 0x3ffffffffULL   // 34-bit committer date
+
+/**
+ * Commit-Graph Structure
+ * A mapped graph file; table pointers refer into the mapping.
+ */
+struct commit_graph {
+  const unsigned char *map;
+  size_t size;
+  uint32_t num_commits;
+  const unsigned char *fanout;  // OIDF
+  const unsigned char *oids;    // OIDL
+  const unsigned char *data;    // CDAT
+  const unsigned char *edges;   // EDGE, or NULL
+  size_t nr_edges;
+};
+
+static struct commit_graph *the_graph;
+static int graph_prepared;
+static pthread_mutex_t graph_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t get_be32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return ntohl(v);
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+  v = htonl(v);
+  memcpy(p, &v, 4);
+}
+
+/*
+ * ============================================================================
+ * Reading
+ * ============================================================================
+ */
+
+static void free_commit_graph(struct commit_graph *g) {
+  if (g) {
+    munmap((void *)g->map, g->size);
+    free(g);
+  }
+}
+
+/**
+ * Map the graph file and check its layout.
+ *
+ * @return Graph, or NULL if there is none or it is invalid
+ */
+static struct commit_graph *load_commit_graph(void) {
+  int fd = open(COMMIT_GRAPH_FILE, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < GRAPH_HEADER_SIZE + GRAPH_CHUNK_ENTRY_SIZE +
+                               GRAPH_FANOUT_SIZE + SHA_DIGEST_LENGTH) {
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  struct commit_graph *g = calloc(1, sizeof(*g));
+  g->map = map;
+  g->size = st.st_size;
+  const unsigned char *p = g->map;
+  if (get_be32(p) != GRAPH_SIGNATURE || p[4] != GRAPH_VERSION ||
+      p[5] != GRAPH_HASH_VERSION || p[7] != 0) {
+    fprintf(stderr, "Ignoring unsupported %s\n", COMMIT_GRAPH_FILE);
+    free_commit_graph(g);
+    return NULL;
+  }
+
+  // Locate the chunks; each one ends where the next begins
+  unsigned nr_chunks = p[6];
+  size_t table_end = GRAPH_HEADER_SIZE +
+                     (nr_chunks + 1) * (size_t)GRAPH_CHUNK_ENTRY_SIZE;
+  size_t data_end = g->size - SHA_DIGEST_LENGTH;
+  size_t oidl_size = 0, cdat_size = 0, edge_size = 0, oidf_size = 0;
+  int valid = table_end <= data_end;
+  for (unsigned i = 0; valid && i < nr_chunks; i++) {
+    const unsigned char *entry = p + GRAPH_HEADER_SIZE +
+                                 i * GRAPH_CHUNK_ENTRY_SIZE;
+    uint32_t id = get_be32(entry);
+    uint64_t start = (uint64_t)get_be32(entry + 4) << 32 |
+                     get_be32(entry + 8);
+    uint64_t end = (uint64_t)get_be32(entry + 16) << 32 | get_be32(entry + 20);
+    if (start < table_end || end < start || end > data_end) {
+      valid = 0;
+      break;
+    }
+    const unsigned char *chunk = p + start;
+    size_t size = end - start;
+    switch (id) {
+    case GRAPH_CHUNK_OIDF:
+      g->fanout = chunk;
+      oidf_size = size;
+      break;
+    case GRAPH_CHUNK_OIDL:
+      g->oids = chunk;
+      oidl_size = size;
+      break;
+    case GRAPH_CHUNK_CDAT:
+      g->data = chunk;
+      cdat_size = size;
+      break;
+    case GRAPH_CHUNK_EDGE:
+      g->edges = chunk;
+      edge_size = size;
+      break;
+    }
+  }
+
+  if (valid && g->fanout && g->oids && g->data &&
+      oidf_size == GRAPH_FANOUT_SIZE) {
+    g->num_commits = get_be32(g->fanout + 255 * 4);
+    g->nr_edges = edge_size / 4;
+    valid = oidl_size == (size_t)g->num_commits * SHA_DIGEST_LENGTH &&
+            cdat_size == (size_t)g->num_commits * GRAPH_DATA_SIZE;
+    for (unsigned b = 1; valid && b < 256; b++)
+      valid = get_be32(g->fanout + (b - 1) * 4) <= get_be32(g->fanout + b * 4);
+  } else {
+    valid = 0;
+  }
+  if (!valid) {
+    fprintf(stderr, "Ignoring corrupt %s\n", COMMIT_GRAPH_FILE);
+    free_commit_graph(g);
+    return NULL;
+  }
+  return g;
+}
+
+/**
+ * Get the graph, loading it on first use (thread-safe).
+ */
+static struct commit_graph *prepare_commit_graph(void) {
+  pthread_mutex_lock(&graph_lock);
+  if (!graph_prepared) {
+    struct stat st;
+    if (stat(SHALLOW_FILE, &st) != 0)
+      the_graph = load_commit_graph();
+    graph_prepared = 1;
+  }
+  struct commit_graph *g = the_graph;
+  pthread_mutex_unlock(&graph_lock);
+  return g;
+}
+
+/**
+ * Unmap the graph, so that the next lookup loads the file again. Must not
+ * race with lookups.
+ */
+void close_commit_graph(void) {
+  pthread_mutex_lock(&graph_lock);
+  free_commit_graph(the_graph);
+  the_graph = NULL;
+  graph_prepared = 0;
+  pthread_mutex_unlock(&graph_lock);
+}
+
+/**
+ * Find a commit's position in the graph by binary search within its
+ * fanout bucket.
+ *
+ * @return 0 if found, 1 otherwise
+ */
+static int graph_find(const struct commit_graph *g,
+                      const struct object_id *oid, uint32_t *pos) {
+  unsigned first = oid->hash[0];
+  uint32_t lo = first ? get_be32(g->fanout + (first - 1) * 4) : 0;
+  uint32_t hi = get_be32(g->fanout + first * 4);
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    int cmp = memcmp(g->oids + (size_t)mid * SHA_DIGEST_LENGTH, oid->hash,
+                     SHA_DIGEST_LENGTH);
+    if (cmp == 0) {
+      *pos = mid;
+      return 0;
+    }
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return 1;
+}
+
+static int graph_parent(const struct commit_graph *g, uint32_t pos,
+                        struct object_id *oid) {
+  if (pos >= g->num_commits)
+    return 1;
+  memcpy(oid->hash, g->oids + (size_t)pos * SHA_DIGEST_LENGTH,
+         SHA_DIGEST_LENGTH);
+  return 0;
+}
+
+/**
+ * Look up a commit in the commit-graph.
+ *
+ * @param oid Commit ID
+ * @param info Output (release with commit_info_release())
+ * @return 0 if the graph has the commit, 1 otherwise
+ */
+int commit_graph_lookup(const struct object_id *oid, struct commit_info *info) {
+  struct commit_graph *g = prepare_commit_graph();
+  uint32_t pos;
+  if (!g || graph_find(g, oid, &pos) != 0)
+    return 1;
+
+  const unsigned char *rec = g->data + (size_t)pos * GRAPH_DATA_SIZE;
+  memset(info, 0, sizeof(*info));
+  memcpy(info->tree.hash, rec, SHA_DIGEST_LENGTH);
+  uint32_t p1 = get_be32(rec + SHA_DIGEST_LENGTH);
+  uint32_t p2 = get_be32(rec + SHA_DIGEST_LENGTH + 4);
+  uint32_t gen = get_be32(rec + SHA_DIGEST_LENGTH + 8);
+  info->generation = gen >> 2;
+  info->date = (uint64_t)(gen & 3) << 32 |
+               get_be32(rec + SHA_DIGEST_LENGTH + 12);
+
+  int bad = 0;
+  if (p1 != GRAPH_PARENT_NONE)
+    bad |= graph_parent(g, p1, &info->parents[info->nr_parents++]);
+  if (p2 & GRAPH_EXTRA_EDGES) {
+    // Octopus merge: parents two and up are listed in EDGE
+    size_t alloc = 0;
+    for (size_t e = p2 & ~GRAPH_EXTRA_EDGES; !bad; e++) {
+      if (e >= g->nr_edges) {
+        bad = 1;
+        break;
+      }
+      uint32_t edge = get_be32(g->edges + e * 4);
+      struct object_id parent;
+      bad |= graph_parent(g, edge & ~GRAPH_LAST_EDGE, &parent);
+      if (info->nr_parents < 2) {
+        info->parents[info->nr_parents] = parent;
+      } else {
+        size_t extra = info->nr_parents - 2;
+        if (extra == alloc) {
+          alloc = alloc ? alloc * 2 : 4;
+          info->more_parents = realloc(info->more_parents,
+                                       alloc * sizeof(*info->more_parents));
+        }
+        info->more_parents[extra] = parent;
+      }
+      info->nr_parents++;
+      if (edge & GRAPH_LAST_EDGE)
+        break;
+    }
+  } else if (p2 != GRAPH_PARENT_NONE) {
+    bad |= graph_parent(g, p2, &info->parents[info->nr_parents++]);
+  }
+  if (bad) {
+    commit_info_release(info);
+    return 1;  // Fall back to the object
+  }
+  return 0;
+}
+
+/*
+ * ============================================================================
+ * Writing
+ * ============================================================================
+ */
+
+/**
+ * Graph Writer Entry
+ */
+struct graph_commit {
+  struct object_id oid;
+  struct commit_info info;
+  uint32_t generation;
+};
+
+/**
+ * Graph Writer State
+ */
+struct graph_writer {
+  struct object_id *tips;        // Commits the refs point at
+  size_t nr_tips, alloc_tips;
+  struct oid_set seen_tips;
+  struct graph_commit *commits;  // Sorted by ID once collection is done
+  size_t nr, alloc;
+};
+
+static int graph_collect(const struct object_id *oid,
+                         const struct commit_info *info, void *data) {
+  struct graph_writer *w = data;
+  if (w->nr == w->alloc) {
+    w->alloc = w->alloc ? w->alloc * 2 : 1024;
+    w->commits = realloc(w->commits, w->alloc * sizeof(*w->commits));
+  }
+  struct graph_commit *c = &w->commits[w->nr++];
+  c->oid = *oid;
+  c->info = *info;
+  c->generation = 0;
+  // The walk releases its copy; keep our own list of extra parents
+  if (info->nr_parents > 2) {
+    size_t n = (info->nr_parents - 2) * sizeof(*info->more_parents);
+    c->info.more_parents = malloc(n);
+    memcpy(c->info.more_parents, info->more_parents, n);
+  }
+  return 0;
+}
+
+static int collect_ref_tip(const char *name, const struct object_id *oid,
+                           void *data) {
+  (void)name;
+  struct graph_writer *w = data;
+  struct object_id commit = *oid;
+  // Refs may also name trees, blobs or tags of them
+  if (peel_to_commit(&commit) == 0 && oid_set_insert(&w->seen_tips, &commit)) {
+    if (w->nr_tips == w->alloc_tips) {
+      w->alloc_tips = w->alloc_tips ? w->alloc_tips * 2 : 64;
+      w->tips = realloc(w->tips, w->alloc_tips * sizeof(*w->tips));
+    }
+    w->tips[w->nr_tips++] = commit;
+  }
+  return 0;
+}
+
+static int compare_graph_commits(const void *a, const void *b) {
+  return oidcmp(&((const struct graph_commit *)a)->oid,
+                &((const struct graph_commit *)b)->oid);
+}
+
+/**
+ * Position of a commit in the sorted writer list.
+ *
+ * @return Position, or GRAPH_PARENT_NONE if it is not in the list
+ */
+static uint32_t graph_writer_pos(const struct graph_writer *w,
+                                 const struct object_id *oid) {
+  size_t lo = 0, hi = w->nr;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = oidcmp(&w->commits[mid].oid, oid);
+    if (cmp == 0)
+      return (uint32_t)mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return GRAPH_PARENT_NONE;
+}
+
+/**
+ * Compute generation numbers without recursion: a commit is finished once
+ * all of its parents are.
+ *
+ * @return 0 on success, 1 if a parent is missing from the list
+ */
+static int compute_generations(struct graph_writer *w) {
+  uint32_t *stack = malloc((w->nr ? w->nr : 1) * sizeof(*stack));
+  for (size_t start = 0; start < w->nr; start++) {
+    if (w->commits[start].generation)
+      continue;
+    size_t nr = 0;
+    stack[nr++] = (uint32_t)start;
+    while (nr) {
+      struct graph_commit *c = &w->commits[stack[nr - 1]];
+      uint32_t max = 0;
+      int pending = 0;
+      for (size_t p = 0; p < c->info.nr_parents; p++) {
+        uint32_t pos = graph_writer_pos(w, commit_parent(&c->info, p));
+        if (pos == GRAPH_PARENT_NONE) {
+          free(stack);
+          return 1;
+        }
+        uint32_t gen = w->commits[pos].generation;
+        if (!gen) {
+          stack[nr++] = pos;  // A commit is never pushed twice at once
+          pending = 1;
+          break;
+        }
+        if (gen > max)
+          max = gen;
+      }
+      if (pending)
+        continue;
+      c->generation = max < GENERATION_NUMBER_MAX ? max + 1
+                                                  : GENERATION_NUMBER_MAX;
+      nr--;
+    }
+  }
+  free(stack);
+  return 0;
+}
+
+/**
+ * Write a buffer to the graph file and hash it.
+ */
+static int graph_write(int fd, struct git_hash_ctx *ctx, const void *buf,
+                       size_t len) {
+  git_hash_update(ctx, buf, len);
+  return write_in_full(fd, buf, len);
+}
+
+/**
+ * Write the graph file for the commits collected by a writer (sorted).
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_graph_file(struct graph_writer *w, const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0444);
+  if (fd < 0)
+    return 1;
+
+  // Octopus merges list parents two and up in EDGE
+  uint32_t *edges = NULL;
+  size_t nr_edges = 0, alloc_edges = 0;
+  for (size_t i = 0; i < w->nr; i++) {
+    const struct commit_info *info = &w->commits[i].info;
+    if (info->nr_parents <= 2)
+      continue;
+    for (size_t p = 1; p < info->nr_parents; p++) {
+      if (nr_edges == alloc_edges) {
+        alloc_edges = alloc_edges ? alloc_edges * 2 : 64;
+        edges = realloc(edges, alloc_edges * sizeof(*edges));
+      }
+      uint32_t pos = graph_writer_pos(w, commit_parent(info, p));
+      edges[nr_edges++] = pos | (p + 1 == info->nr_parents ? GRAPH_LAST_EDGE
+                                                           : 0);
+    }
+  }
+
+  unsigned nr_chunks = nr_edges ? 4 : 3;
+  uint32_t ids[4] = {GRAPH_CHUNK_OIDF, GRAPH_CHUNK_OIDL, GRAPH_CHUNK_CDAT,
+                     GRAPH_CHUNK_EDGE};
+  uint64_t sizes[4] = {GRAPH_FANOUT_SIZE, (uint64_t)w->nr * SHA_DIGEST_LENGTH,
+                       (uint64_t)w->nr * GRAPH_DATA_SIZE,
+                       (uint64_t)nr_edges * 4};
+
+  struct git_hash_ctx ctx;
+  git_hash_init(&ctx);
+  unsigned char header[GRAPH_HEADER_SIZE + 5 * GRAPH_CHUNK_ENTRY_SIZE];
+  put_be32(header, GRAPH_SIGNATURE);
+  header[4] = GRAPH_VERSION;
+  header[5] = GRAPH_HASH_VERSION;
+  header[6] = nr_chunks;
+  header[7] = 0;
+  uint64_t offset = GRAPH_HEADER_SIZE +
+                    (nr_chunks + 1) * (uint64_t)GRAPH_CHUNK_ENTRY_SIZE;
+  for (unsigned i = 0; i <= nr_chunks; i++) {
+    unsigned char *entry = header + GRAPH_HEADER_SIZE +
+                           i * GRAPH_CHUNK_ENTRY_SIZE;
+    put_be32(entry, i < nr_chunks ? ids[i] : 0);
+    put_be32(entry + 4, offset >> 32);
+    put_be32(entry + 8, (uint32_t)offset);
+    if (i < nr_chunks)
+      offset += sizes[i];
+  }
+  int err = graph_write(fd, &ctx, header,
+                        GRAPH_HEADER_SIZE +
+                            (nr_chunks + 1) * GRAPH_CHUNK_ENTRY_SIZE);
+
+  unsigned char fanout[GRAPH_FANOUT_SIZE];
+  size_t count = 0;
+  for (unsigned b = 0; b < 256; b++) {
+    while (count < w->nr && w->commits[count].oid.hash[0] == b)
+      count++;
+    put_be32(fanout + b * 4, (uint32_t)count);
+  }
+  err = err || graph_write(fd, &ctx, fanout, sizeof(fanout));
+  for (size_t i = 0; i < w->nr && !err; i++)
+    err = graph_write(fd, &ctx, w->commits[i].oid.hash, SHA_DIGEST_LENGTH);
+
+  size_t edge_pos = 0;
+  for (size_t i = 0; i < w->nr && !err; i++) {
+    const struct graph_commit *c = &w->commits[i];
+    unsigned char rec[GRAPH_DATA_SIZE];
+    memcpy(rec, c->info.tree.hash, SHA_DIGEST_LENGTH);
+    uint32_t p1 = c->info.nr_parents > 0
+                      ? graph_writer_pos(w, &c->info.parents[0])
+                      : GRAPH_PARENT_NONE;
+    uint32_t p2 = GRAPH_PARENT_NONE;
+    if (c->info.nr_parents == 2) {
+      p2 = graph_writer_pos(w, &c->info.parents[1]);
+    } else if (c->info.nr_parents > 2) {
+      p2 = GRAPH_EXTRA_EDGES | (uint32_t)edge_pos;
+      edge_pos += c->info.nr_parents - 1;
+    }
+    uint64_t date = c->info.date > GRAPH_DATE_MAX ? GRAPH_DATE_MAX
+                                                  : c->info.date;
+    put_be32(rec + SHA_DIGEST_LENGTH, p1);
+    put_be32(rec + SHA_DIGEST_LENGTH + 4, p2);
+    put_be32(rec + SHA_DIGEST_LENGTH + 8,
+             c->generation << 2 | (uint32_t)(date >> 32));
+    put_be32(rec + SHA_DIGEST_LENGTH + 12, (uint32_t)date);
+    err = graph_write(fd, &ctx, rec, sizeof(rec));
+  }
+  for (size_t i = 0; i < nr_edges && !err; i++) {
+    unsigned char be[4];
+    put_be32(be, edges[i]);
+    err = graph_write(fd, &ctx, be, sizeof(be));
+  }
+  free(edges);
+
+  unsigned char trailer[SHA_DIGEST_LENGTH];
+  git_hash_final(trailer, &ctx);
+  err = err || write_in_full(fd, trailer, sizeof(trailer));
+  err |= close(fd) != 0;
+  return err;
+}
+
+/**
+ * Write .git/objects/info/commit-graph for every commit reachable from
+ * the refs and HEAD, replacing any existing graph. Shallow repositories
+ * get no graph.
+ *
+ * @return 0 on success (or if the repository is shallow), 1 on error
+ */
+int write_commit_graph(void) {
+  struct stat st;
+  if (stat(SHALLOW_FILE, &st) == 0)
+    return 0;
+
+  struct graph_writer w = {0};
+  oid_set_init(&w.seen_tips);
+  struct object_id head;
+  if (read_ref("HEAD", &head) == 0)
+    collect_ref_tip("HEAD", &head, &w);
+  for_each_ref("refs", collect_ref_tip, &w);
+  int result =
+      walk_commits(w.tips, w.nr_tips, NULL, 0, 0, graph_collect, &w);
+  free(w.tips);
+  oid_set_clear(&w.seen_tips);
+
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.lock", COMMIT_GRAPH_FILE);
+  if (result == 0) {
+    qsort(w.commits, w.nr, sizeof(*w.commits), compare_graph_commits);
+    result = compute_generations(&w);
+  }
+  if (result == 0) {
+    mkdir(OBJECTS_DIR "/info", 0755);  // OK if it already exists
+    result = write_graph_file(&w, tmp_path);
+    if (result == 0 && rename(tmp_path, COMMIT_GRAPH_FILE) != 0)
+      result = 1;
+    if (result)
+      unlink(tmp_path);
+  }
+  if (result)
+    fprintf(stderr, "Failed to write %s\n", COMMIT_GRAPH_FILE);
+
+  for (size_t i = 0; i < w.nr; i++)
+    commit_info_release(&w.commits[i].info);
+  free(w.commits);
+  close_commit_graph();
+  return result;
+}
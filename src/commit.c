@@ -0,0 +1,669 @@
+/**
+ * commit.c - Commit Parsing and History Walks
+ *
+ * This file implements the commit-level view of history used by rev-list,
+ * merge-base and fetch negotiation:
+ *   - read_commit_info(): a commit's tree, parents, committer date and
+ *     generation number, answered from the commit-graph (commit-graph.c)
+ *     without inflating the commit when it is covered there, and by
+ *     parsing the commit object otherwise
+ *   - walk_commits(): the commits reachable from some tips but not from
+ *     others, newest first or in topological order
+ *   - is_ancestor(): reachability between two commits, using generation
+ *     numbers to stop the walk early
+ *   - walk_objects(): the commits of walk_commits() together with the
+ *     trees and blobs they bring in
+ *
+ * A generation number is 1 for a root commit and one more than the
+ * largest generation of its parents otherwise, so a commit can only reach
+ * commits with a smaller generation.
+ */
+
+#define _GNU_SOURCE  // memrchr()
+#include "git.h"
+
+/*
+ * Walk flags
+ */
+#define WALK_SEEN 0x1          // Queued or visited
+#define WALK_PARSED 0x2        // info is valid
+#define WALK_UNINTERESTING 0x4 // Reachable from an excluded commit
+#define WALK_DONE 0x8          // Popped from the queue
+
+#define WALK_SLOP 5  // Old uninteresting commits visited before stopping
+
+/**
+ * Parse the header of a commit object.
+ *
+ * @param buf Commit content (null-terminated)
+ * @param info Output (release with commit_info_release())
+ * @return 0 on success, 1 if the commit is malformed
+ */
+static int parse_commit_buffer(const char *buf, struct commit_info *info) {
+  memset(info, 0, sizeof(*info));
+  info->generation = GENERATION_NUMBER_INFINITY;
+
+  if (strncmp(buf, "tree ", 5) != 0 || get_oid_hex(buf + 5, &info->tree) != 0)
+    return 1;
+
+  size_t alloc = 0;
+  for (const char *line = buf; *line && *line != '\n';) {
+    struct object_id parent;
+    if (strncmp(line, "parent ", 7) == 0 &&
+        get_oid_hex(line + 7, &parent) == 0) {
+      if (info->nr_parents < 2) {
+        info->parents[info->nr_parents] = parent;
+      } else {
+        size_t extra = info->nr_parents - 2;
+        if (extra == alloc) {
+          alloc = alloc ? alloc * 2 : 4;
+          info->more_parents = realloc(info->more_parents,
+                                       alloc * sizeof(*info->more_parents));
+        }
+        info->more_parents[extra] = parent;
+      }
+      info->nr_parents++;
+    } else if (strncmp(line, "committer ", 10) == 0) {
+      // "committer Name <email> <timestamp> <tz>"; the message may
+      // contain '>' too, so look for it on this line only
+      const char *nl = strchr(line, '\n');
+      size_t len = nl ? (size_t)(nl - line) : strlen(line);
+      const char *email_end = memrchr(line, '>', len);
+      if (email_end)
+        info->date = strtoull(email_end + 1, NULL, 10);
+    }
+    const char *nl = strchr(line, '\n');
+    if (!nl)
+      break;
+    line = nl + 1;
+  }
+  return 0;
+}
+
+/**
+ * Read the parts of a commit needed to walk history, from the
+ * commit-graph if it covers the commit and from the object otherwise.
+ *
+ * @param oid Commit ID
+ * @param info Output (release with commit_info_release(), even on failure)
+ * @return 0 on success, 1 if the object is missing or not a commit
+ */
+int read_commit_info(const struct object_id *oid, struct commit_info *info) {
+  memset(info, 0, sizeof(*info));  // Safe to release even on failure
+  if (commit_graph_lookup(oid, info) == 0)
+    return 0;
+
+  git_object *obj = odb_read_object(oid);
+  if (!obj)
+    return 1;
+  int result = strcmp(obj->type, GIT_COMMIT) != 0 ||
+               parse_commit_buffer(obj->content, info);
+  free_git_object(obj);
+  return result;
+}
+
+/**
+ * Free the parent list of a commit info.
+ */
+void commit_info_release(struct commit_info *info) {
+  free(info->more_parents);
+  info->more_parents = NULL;
+}
+
+/**
+ * Follow annotated tags until a non-tag object is reached.
+ *
+ * @param oid Object ID; replaced by the commit it names
+ * @return 0 if oid now names a commit, 1 otherwise
+ */
+int peel_to_commit(struct object_id *oid) {
+  // The commit-graph only holds commits
+  struct commit_info info;
+  if (commit_graph_lookup(oid, &info) == 0) {
+    commit_info_release(&info);
+    return 0;
+  }
+
+  for (int depth = 0; depth < 32; depth++) {
+    git_object *obj = odb_read_object(oid);
+    if (!obj)
+      return 1;
+    int is_commit = strcmp(obj->type, GIT_COMMIT) == 0;
+    int peeled = !is_commit && strcmp(obj->type, "tag") == 0 &&
+                 strncmp(obj->content, "object ", 7) == 0 &&
+                 get_oid_hex(obj->content + 7, oid) == 0;
+    free_git_object(obj);
+    if (is_commit)
+      return 0;
+    if (!peeled)
+      return 1;
+  }
+  return 1;
+}
+
+/**
+ * Follow annotated tags, and then a commit, to the tree they name.
+ *
+ * @param oid Object ID; replaced by the tree it names
+ * @return 0 if oid now names a tree, 1 otherwise
+ */
+int peel_to_tree(struct object_id *oid) {
+  for (int depth = 0; depth < 32; depth++) {
+    git_object *obj = odb_read_object(oid);
+    if (!obj)
+      return 1;
+    int is_tree = strcmp(obj->type, GIT_TREE) == 0;
+    // Both tags and commits name their target in the first header line
+    const char *field = strcmp(obj->type, "tag") == 0     ? "object "
+                        : strcmp(obj->type, GIT_COMMIT) == 0 ? "tree "
+                                                             : NULL;
+    int peeled = field && strncmp(obj->content, field, strlen(field)) == 0 &&
+                 get_oid_hex(obj->content + strlen(field), oid) == 0;
+    free_git_object(obj);
+    if (is_tree)
+      return 0;
+    if (!peeled)
+      return 1;
+  }
+  return 1;
+}
+
+/*
+ * ============================================================================
+ * Walk State
+ * ============================================================================
+ */
+
+/**
+ * Walk Node Structure
+ * One commit met during a walk.
+ */
+struct walk_node {
+  struct object_id oid;
+  struct commit_info info;
+  unsigned flags;
+  size_t children;  // Unemitted children (topological order)
+};
+
+/**
+ * Walk Structure
+ * Commits are stored in an array and found by object ID through an
+ * open-addressing table of indexes into it. The queue is a max-heap of
+ * node indexes keyed by committer date (or generation).
+ */
+struct walk {
+  struct walk_node *nodes;
+  size_t nr, alloc;
+  size_t *slots;     // Node index + 1, or 0 for an empty slot
+  size_t nr_slots;   // Power of two
+  size_t *heap;
+  size_t heap_nr, heap_alloc;
+  int by_generation; // Order the heap by generation instead of date
+  struct oid_set shallow;  // Commits whose parents are not in the repository
+};
+
+static void walk_init(struct walk *w) {
+  memset(w, 0, sizeof(*w));
+  w->nr_slots = 1024;
+  w->slots = calloc(w->nr_slots, sizeof(*w->slots));
+  read_shallow(&w->shallow);
+}
+
+static void walk_release(struct walk *w) {
+  for (size_t i = 0; i < w->nr; i++) {
+    if (w->nodes[i].flags & WALK_PARSED)
+      commit_info_release(&w->nodes[i].info);
+  }
+  free(w->nodes);
+  free(w->slots);
+  free(w->heap);
+  oid_set_clear(&w->shallow);
+}
+
+static size_t walk_slot(const struct walk *w, const struct object_id *oid) {
+  uint32_t h;
+  memcpy(&h, oid->hash, sizeof(h));
+  size_t i = h & (w->nr_slots - 1);
+  while (w->slots[i] && !oideq(&w->nodes[w->slots[i] - 1].oid, oid))
+    i = (i + 1) & (w->nr_slots - 1);
+  return i;
+}
+
+/**
+ * Find the node for a commit, adding an empty one if it is new.
+ *
+ * @return Node index
+ */
+static size_t walk_node(struct walk *w, const struct object_id *oid) {
+  size_t slot = walk_slot(w, oid);
+  if (w->slots[slot])
+    return w->slots[slot] - 1;
+
+  if (w->nr == w->alloc) {
+    w->alloc = w->alloc ? w->alloc * 2 : 256;
+    w->nodes = realloc(w->nodes, w->alloc * sizeof(*w->nodes));
+  }
+  struct walk_node *n = &w->nodes[w->nr];
+  memset(n, 0, sizeof(*n));
+  n->oid = *oid;
+  w->slots[slot] = ++w->nr;
+
+  // Keep the table at most half full
+  if (w->nr * 2 > w->nr_slots) {
+    free(w->slots);
+    w->nr_slots *= 2;
+    w->slots = calloc(w->nr_slots, sizeof(*w->slots));
+    for (size_t i = 0; i < w->nr; i++)
+      w->slots[walk_slot(w, &w->nodes[i].oid)] = i + 1;
+  }
+  return w->nr - 1;
+}
+
+/**
+ * Read a node's commit if not done yet.
+ *
+ * @return 0 on success, 1 if the commit cannot be read
+ */
+static int walk_parse(struct walk *w, size_t i) {
+  struct walk_node *n = &w->nodes[i];
+  if (n->flags & WALK_PARSED)
+    return 0;
+  if (read_commit_info(&n->oid, &n->info) != 0) {
+    char hex[GIT_HASH_LENGTH + 1];
+    fprintf(stderr, "Failed to read commit %s\n", oid_to_hex(&n->oid, hex));
+    return 1;
+  }
+  n->flags |= WALK_PARSED;
+  if (oid_set_contains(&w->shallow, &n->oid)) {
+    commit_info_release(&n->info);
+    n->info.nr_parents = 0;  // History was cut here
+  }
+  return 0;
+}
+
+/** Whether node a comes out of the queue before node b. */
+static int walk_before(const struct walk *w, size_t a, size_t b) {
+  const struct commit_info *x = &w->nodes[a].info, *y = &w->nodes[b].info;
+  if (w->by_generation && x->generation != y->generation)
+    return x->generation > y->generation;
+  return x->date > y->date;
+}
+
+static void heap_push(struct walk *w, size_t node) {
+  if (w->heap_nr == w->heap_alloc) {
+    w->heap_alloc = w->heap_alloc ? w->heap_alloc * 2 : 64;
+    w->heap = realloc(w->heap, w->heap_alloc * sizeof(*w->heap));
+  }
+  size_t i = w->heap_nr++;
+  while (i && walk_before(w, node, w->heap[(i - 1) / 2])) {
+    w->heap[i] = w->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  w->heap[i] = node;
+}
+
+static size_t heap_pop(struct walk *w) {
+  size_t top = w->heap[0];
+  size_t last = w->heap[--w->heap_nr];
+  size_t i = 0;
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= w->heap_nr)
+      break;
+    if (child + 1 < w->heap_nr &&
+        walk_before(w, w->heap[child + 1], w->heap[child]))
+      child++;
+    if (!walk_before(w, w->heap[child], last))
+      break;
+    w->heap[i] = w->heap[child];
+    i = child;
+  }
+  if (w->heap_nr)
+    w->heap[i] = last;
+  return top;
+}
+
+/**
+ * Queue a commit (once), reading it so it can be ordered.
+ *
+ * @return 0 on success, 1 if the commit cannot be read
+ */
+static int walk_queue(struct walk *w, const struct object_id *oid,
+                      unsigned flags) {
+  size_t i = walk_node(w, oid);
+  w->nodes[i].flags |= flags;
+  if (w->nodes[i].flags & WALK_SEEN)
+    return 0;
+  w->nodes[i].flags |= WALK_SEEN;
+  if (walk_parse(w, i) != 0)
+    return 1;
+  heap_push(w, i);
+  return 0;
+}
+
+/**
+ * Mark a visited commit's known ancestors uninteresting. Ancestors not
+ * visited yet get the flag when they are queued.
+ */
+static void mark_parents_uninteresting(struct walk *w, size_t start) {
+  size_t *stack = NULL, nr = 0, alloc = 0;
+  size_t i = start;
+  for (;;) {
+    const struct commit_info *info = &w->nodes[i].info;
+    for (size_t p = 0; p < info->nr_parents; p++) {
+      size_t pi = walk_node(w, commit_parent(info, p));
+      info = &w->nodes[i].info;  // walk_node() may move the nodes
+      struct walk_node *parent = &w->nodes[pi];
+      if (parent->flags & WALK_UNINTERESTING)
+        continue;
+      parent->flags |= WALK_UNINTERESTING;
+      if (!(parent->flags & WALK_DONE))
+        continue;  // Flag passed on when it is visited
+      if (nr == alloc) {
+        alloc = alloc ? alloc * 2 : 64;
+        stack = realloc(stack, alloc * sizeof(*stack));
+      }
+      stack[nr++] = pi;
+    }
+    if (!nr)
+      break;
+    i = stack[--nr];
+  }
+  free(stack);
+}
+
+/**
+ * Whether any queued commit is still interesting.
+ */
+static int walk_has_interesting(const struct walk *w) {
+  for (size_t i = 0; i < w->heap_nr; i++) {
+    if (!(w->nodes[w->heap[i]].flags & WALK_UNINTERESTING))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Walk the commits reachable from tips but not from excludes, calling fn
+ * for each: newest first by committer date, or with WALK_TOPO_ORDER, no
+ * parent before all of its children.
+ *
+ * @param tips Commits to start from
+ * @param nr_tips Number of tips
+ * @param excludes Commits whose history is left out
+ * @param nr_excludes Number of excludes
+ * @param flags WALK_TOPO_ORDER or 0
+ * @param fn Called for each commit; returning non-zero stops the walk
+ * @param data Passed through to fn
+ * @return 0 on success, 1 if a commit could not be read or fn stopped
+ */
+int walk_commits(const struct object_id *tips, size_t nr_tips,
+                 const struct object_id *excludes, size_t nr_excludes,
+                 int flags, commit_fn fn, void *data) {
+  struct walk w;
+  walk_init(&w);
+  int result = 0;
+  for (size_t i = 0; i < nr_excludes && !result; i++)
+    result = walk_queue(&w, &excludes[i], WALK_UNINTERESTING);
+  for (size_t i = 0; i < nr_tips && !result; i++)
+    result = walk_queue(&w, &tips[i], 0);
+
+  // Visit newest first until only uninteresting commits are left queued.
+  // Those may still reach commits already visited if some committer dates
+  // are skewed, so as in Git, the walk stops only after WALK_SLOP of them
+  // in a row that are older than the last interesting commit.
+  size_t *order = NULL, nr_order = 0, alloc_order = 0;
+  uint64_t last_date = UINT64_MAX;
+  int slop = WALK_SLOP;
+  while (!result && w.heap_nr) {
+    size_t i = heap_pop(&w);
+    unsigned uninteresting = w.nodes[i].flags & WALK_UNINTERESTING;
+    w.nodes[i].flags |= WALK_DONE;
+    if (uninteresting) {
+      mark_parents_uninteresting(&w, i);
+    } else {
+      last_date = w.nodes[i].info.date;
+      if (nr_order == alloc_order) {
+        alloc_order = alloc_order ? alloc_order * 2 : 256;
+        order = realloc(order, alloc_order * sizeof(*order));
+      }
+      order[nr_order++] = i;
+    }
+
+    for (size_t p = 0; p < w.nodes[i].info.nr_parents && !result; p++) {
+      struct object_id parent = *commit_parent(&w.nodes[i].info, p);
+      result = walk_queue(&w, &parent, uninteresting);
+    }
+
+    if (uninteresting) {
+      if ((w.heap_nr && w.nodes[w.heap[0]].info.date >= last_date) ||
+          walk_has_interesting(&w))
+        slop = WALK_SLOP;
+      else if (--slop == 0)
+        break;
+    }
+  }
+
+  // Commits found uninteresting after they were visited (clock skew) are
+  // dropped here
+  size_t out = 0;
+  for (size_t k = 0; k < nr_order; k++) {
+    if (!(w.nodes[order[k]].flags & WALK_UNINTERESTING))
+      order[out++] = order[k];
+  }
+  nr_order = out;
+
+  if (!result && (flags & WALK_TOPO_ORDER)) {
+    // Kahn's algorithm with a stack, as Git does: a commit is ready once
+    // all of its children are out, and the most recently readied commit
+    // goes next, which keeps each line of history together
+    for (size_t k = 0; k < nr_order; k++) {
+      const struct commit_info *info = &w.nodes[order[k]].info;
+      for (size_t p = 0; p < info->nr_parents; p++)
+        w.nodes[w.slots[walk_slot(&w, commit_parent(info, p))] - 1]
+            .children++;
+    }
+    size_t *stack = malloc((nr_order ? nr_order : 1) * sizeof(*stack));
+    size_t nr_stack = 0;
+    for (size_t k = nr_order; k-- > 0;) {
+      if (!w.nodes[order[k]].children)
+        stack[nr_stack++] = order[k];  // Newest tip on top
+    }
+    nr_order = 0;
+    while (nr_stack) {
+      size_t i = stack[--nr_stack];
+      order[nr_order++] = i;
+      const struct commit_info *info = &w.nodes[i].info;
+      for (size_t p = 0; p < info->nr_parents; p++) {
+        size_t pi = w.slots[walk_slot(&w, commit_parent(info, p))] - 1;
+        if (!(w.nodes[pi].flags & WALK_UNINTERESTING) &&
+            --w.nodes[pi].children == 0)
+          stack[nr_stack++] = pi;
+      }
+    }
+    free(stack);
+  }
+
+  for (size_t k = 0; k < nr_order && !result; k++) {
+    const struct walk_node *n = &w.nodes[order[k]];
+    result = fn(&n->oid, &n->info, data) != 0;
+  }
+  free(order);
+  walk_release(&w);
+  return result;
+}
+
+/**
+ * Check whether commit a is reachable from commit b (or is b). The walk
+ * from b visits commits in decreasing generation order and gives up once
+ * it is below a's generation, which a commit-graph makes cheap; without
+ * one, generations are unknown and the whole history of b may be walked.
+ *
+ * @param a Possible ancestor
+ * @param b Descendant
+ * @return 1 if a is an ancestor of b, 0 if not, -1 on error
+ */
+int is_ancestor(const struct object_id *a, const struct object_id *b) {
+  if (oideq(a, b))
+    return 1;
+
+  struct commit_info target;
+  if (read_commit_info(a, &target) != 0)
+    return -1;
+  uint32_t min_generation = target.generation;
+  commit_info_release(&target);
+
+  struct walk w;
+  walk_init(&w);
+  w.by_generation = 1;
+  int result = walk_queue(&w, b, 0) ? -1 : 0;
+  while (result == 0 && w.heap_nr) {
+    size_t i = heap_pop(&w);
+    if (oideq(&w.nodes[i].oid, a)) {
+      result = 1;
+      break;
+    }
+    // A graph commit's parents have smaller generations; so does a
+    if (w.nodes[i].info.generation != GENERATION_NUMBER_INFINITY &&
+        min_generation != GENERATION_NUMBER_INFINITY &&
+        w.nodes[i].info.generation <= min_generation)
+      continue;
+    for (size_t p = 0; p < w.nodes[i].info.nr_parents && result == 0; p++) {
+      struct object_id parent = *commit_parent(&w.nodes[i].info, p);
+      if (walk_queue(&w, &parent, 0) != 0)
+        result = -1;
+    }
+  }
+  walk_release(&w);
+  return result;
+}
+
+/*
+ * ============================================================================
+ * Object Walks
+ * ============================================================================
+ */
+
+/**
+ * Object Walk Structure
+ */
+struct object_walk {
+  struct oid_set seen;      // Trees and blobs shown or reachable from excludes
+  object_fn fn;             // NULL while marking the excluded objects
+  void *data;
+  struct object_id *trees;  // Root trees of the commits shown, in order
+  size_t nr_trees, alloc_trees;
+};
+
+/**
+ * Visit a tree and everything below it that has not been seen yet, the
+ * tree itself before its entries.
+ *
+ * @param ow Walk state
+ * @param oid Tree to visit
+ * @param path Path of the tree ("" for a root tree); extended in place
+ * @param len Length of path
+ * @return 0 on success, 1 if a tree could not be read or fn stopped
+ */
+static int walk_tree(struct object_walk *ow, const struct object_id *oid,
+                     char *path, size_t len) {
+  if (!oid_set_insert(&ow->seen, oid))
+    return 0;
+  if (ow->fn && ow->fn(oid, OBJ_TREE, path, ow->data) != 0)
+    return 1;
+
+  git_object *obj = odb_read_object(oid);
+  tree_object *tree = parse_tree_object(obj);
+  if (!tree) {
+    char hex[GIT_HASH_LENGTH + 1];
+    fprintf(stderr, "Failed to read tree %s\n", oid_to_hex(oid, hex));
+    free_git_object(obj);
+    return 1;
+  }
+
+  int result = 0;
+  for (size_t i = 0; i < tree->count && !result; i++) {
+    const tree_entry *te = &tree->entries[i];
+    if (te->mode == TREE_MODE_GITLINK)
+      continue;  // Submodule commits live in another repository
+    if (len + te->name_len + 2 > PATH_MAX) {
+      fprintf(stderr, "Path too long: %s/%s\n", path, te->name);
+      result = 1;
+      break;
+    }
+    size_t sub_len = len;
+    if (len)
+      path[sub_len++] = '/';
+    memcpy(path + sub_len, te->name, te->name_len + 1);
+    sub_len += te->name_len;
+
+    if (te->mode == TREE_MODE_DIR)
+      result = walk_tree(ow, te->oid, path, sub_len);
+    else if (oid_set_insert(&ow->seen, te->oid) && ow->fn)
+      result = ow->fn(te->oid, OBJ_BLOB, path, ow->data) != 0;
+    path[len] = '\0';
+  }
+  free_tree_object(tree);
+  free_git_object(obj);
+  return result;
+}
+
+static int mark_commit_objects(const struct object_id *oid,
+                               const struct commit_info *info, void *data) {
+  (void)oid;
+  char path[PATH_MAX] = "";
+  return walk_tree(data, &info->tree, path, 0);
+}
+
+static int show_commit_object(const struct object_id *oid,
+                              const struct commit_info *info, void *data) {
+  struct object_walk *ow = data;
+  if (ow->nr_trees == ow->alloc_trees) {
+    ow->alloc_trees = ow->alloc_trees ? ow->alloc_trees * 2 : 64;
+    ow->trees = realloc(ow->trees, ow->alloc_trees * sizeof(*ow->trees));
+  }
+  ow->trees[ow->nr_trees++] = info->tree;
+  return ow->fn(oid, OBJ_COMMIT, NULL, ow->data);
+}
+
+/**
+ * Walk the objects reachable from tips but not from excludes: first the
+ * commits, in the order walk_commits() gives them, then the trees and
+ * blobs of each commit not listed before, with their paths.
+ *
+ * Every tree reachable from the excludes is read to leave out exactly
+ * what they reach, so this costs a walk of their whole history; the
+ * reachability bitmaps (pack-bitmap.c) answer the same question without
+ * one.
+ *
+ * @param tips Commits to start from
+ * @param nr_tips Number of tips
+ * @param excludes Commits whose objects are left out
+ * @param nr_excludes Number of excludes
+ * @param flags WALK_TOPO_ORDER or 0
+ * @param fn Called for each object (path is NULL for commits); returning
+ *           non-zero stops the walk
+ * @param data Passed through to fn
+ * @return 0 on success, 1 if an object could not be read or fn stopped
+ */
+int walk_objects(const struct object_id *tips, size_t nr_tips,
+                 const struct object_id *excludes, size_t nr_excludes,
+                 int flags, object_fn fn, void *data) {
+  struct object_walk ow = {0};
+  oid_set_init(&ow.seen);
+  ow.data = data;
+
+  int result = nr_excludes ? walk_commits(excludes, nr_excludes, NULL, 0, 0,
+                                          mark_commit_objects, &ow)
+                           : 0;
+  ow.fn = fn;
+  result = result || walk_commits(tips, nr_tips, excludes, nr_excludes,
+                                  flags, show_commit_object, &ow);
+
+  char path[PATH_MAX] = "";
+  for (size_t i = 0; i < ow.nr_trees && !result; i++)
+    result = walk_tree(&ow, &ow.trees[i], path, 0);
+  free(ow.trees);
+  oid_set_clear(&ow.seen);
+  return result;
+}
@@ -0,0 +1,228 @@
+/**
+ * compress.c - Compression Levels and Whole-Buffer zlib
+ *
+ * This file decides how objects are compressed, and inflates and deflates
+ * objects whose sizes are known up front:
+ *   - loose_compression_level() and pack_compression_level(): the levels
+ *     set by core.compression, core.looseCompression and pack.compression,
+ *     with Git's defaults (1 for loose objects, zlib's default for packs)
+ *   - compress_buffer() and uncompress_buffer(): one call per object, for
+ *     pack entries read from a mapped pack and objects written to a pack
+ *
+ * Built with libdeflate (cmake -DUSE_LIBDEFLATE=ON, the default when it is
+ * installed), the whole-buffer calls use it instead of zlib. libdeflate
+ * produces and accepts the same zlib format, but is considerably faster
+ * because it never has to stop in the middle of a buffer. Each thread
+ * keeps its own compressor and decompressor, which are costly to create.
+ * Data streamed in pieces (a pack being received, a large file being
+ * stored) always goes through zlib's streaming interface.
+ */
+
+#include "git.h"
+#include <pthread.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#define LOOSE_COMPRESSION_DEFAULT Z_BEST_SPEED
+#define PACK_COMPRESSION_DEFAULT Z_DEFAULT_COMPRESSION
+
+/*
+ * ============================================================================
+ * Compression Levels
+ * ============================================================================
+ */
+
+static int loose_level, pack_level;
+static pthread_once_t level_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Read a compression level from the config.
+ *
+ * @param key Config key
+ * @param def Level if the key is not set or not a level (-1 to 9)
+ */
+static int config_get_level(const char *key, int def) {
+  char *value = config_get(key);
+  if (!value)
+    return def;
+  char *end;
+  long level = strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || level < Z_DEFAULT_COMPRESSION ||
+      level > Z_BEST_COMPRESSION) {
+    fprintf(stderr, "Ignoring bad compression level %s = %s\n", key, value);
+    level = def;
+  }
+  free(value);
+  return level;
+}
+
+static void read_compression_levels(void) {
+  int core = config_get_level("core.compression", INT_MIN);
+  loose_level = config_get_level(
+      "core.looseCompression",
+      core != INT_MIN ? core : LOOSE_COMPRESSION_DEFAULT);
+  pack_level = config_get_level(
+      "pack.compression", core != INT_MIN ? core : PACK_COMPRESSION_DEFAULT);
+}
+
+/**
+ * zlib level for loose objects: core.looseCompression, else
+ * core.compression, else 1 (fastest).
+ */
+int loose_compression_level(void) {
+  pthread_once(&level_once, read_compression_levels);
+  return loose_level;
+}
+
+/**
+ * zlib level for pack entries: pack.compression, else core.compression,
+ * else zlib's default.
+ */
+int pack_compression_level(void) {
+  pthread_once(&level_once, read_compression_levels);
+  return pack_level;
+}
+
+/*
+ * ============================================================================
+ * Whole-Buffer Compression
+ * ============================================================================
+ */
+
+#ifdef HAVE_LIBDEFLATE
+/**
+ * libdeflate State Structure
+ * A thread's compressor (for one level) and decompressor.
+ */
+struct libdeflate_state {
+  struct libdeflate_compressor *compressor;
+  int level;  // Level the compressor was created for
+  struct libdeflate_decompressor *decompressor;
+};
+
+static pthread_key_t libdeflate_key;
+static pthread_once_t libdeflate_once = PTHREAD_ONCE_INIT;
+
+static void free_libdeflate_state(void *data) {
+  struct libdeflate_state *state = data;
+  libdeflate_free_compressor(state->compressor);
+  libdeflate_free_decompressor(state->decompressor);
+  free(state);
+}
+
+static void create_libdeflate_key(void) {
+  pthread_key_create(&libdeflate_key, free_libdeflate_state);
+}
+
+/**
+ * Get the calling thread's libdeflate state.
+ *
+ * @return State, or NULL if out of memory
+ */
+static struct libdeflate_state *get_libdeflate_state(void) {
+  pthread_once(&libdeflate_once, create_libdeflate_key);
+  struct libdeflate_state *state = pthread_getspecific(libdeflate_key);
+  if (!state) {
+    state = calloc(1, sizeof(*state));
+    if (state)
+      pthread_setspecific(libdeflate_key, state);
+  }
+  return state;
+}
+#endif
+
+/**
+ * Compress a buffer in zlib format.
+ *
+ * @param data Data to compress
+ * @param len Length of data
+ * @param level zlib level (-1 for the default, 0 to 9)
+ * @param out_len Output: length of the compressed data
+ * @return Compressed data (caller must free), or NULL on error
+ */
+unsigned char *compress_buffer(const void *data, size_t len, int level,
+                               size_t *out_len) {
+#ifdef HAVE_LIBDEFLATE
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;  // zlib's default, which libdeflate's levels also center on
+  struct libdeflate_state *state = get_libdeflate_state();
+  if (!state)
+    return NULL;
+  if (state->compressor && state->level != level) {
+    libdeflate_free_compressor(state->compressor);
+    state->compressor = NULL;
+  }
+  if (!state->compressor) {
+    state->compressor = libdeflate_alloc_compressor(level);
+    state->level = level;
+    if (!state->compressor)
+      return NULL;
+  }
+  size_t bound = libdeflate_zlib_compress_bound(state->compressor, len);
+  unsigned char *out = malloc(bound);
+  uint64_t start = trace_timer_start();
+  if (out)
+    *out_len =
+        libdeflate_zlib_compress(state->compressor, data, len, out, bound);
+  trace_timer_stop(TRACE_TIMER_DEFLATE, start);
+  if (out && *out_len == 0) {
+    free(out);
+    out = NULL;
+  }
+  return out;
+#else
+  uLongf zlen = compressBound(len);
+  unsigned char *out = malloc(zlen);
+  uint64_t start = trace_timer_start();
+  int ret = out ? compress2(out, &zlen, data, len, level) : Z_MEM_ERROR;
+  trace_timer_stop(TRACE_TIMER_DEFLATE, start);
+  if (ret != Z_OK) {
+    free(out);
+    return NULL;
+  }
+  *out_len = zlen;
+  return out;
+#endif
+}
+
+/**
+ * Inflate a zlib stream whose inflated size is known. The stream may be
+ * followed by other data (such as the next entry of a pack).
+ *
+ * @param in Start of the zlib stream
+ * @param in_len Bytes available at in
+ * @param out Output buffer
+ * @param out_len Size the stream must inflate to exactly
+ * @return 0 on success, 1 if the stream is corrupt or has another size
+ */
+int uncompress_buffer(const unsigned char *in, size_t in_len, void *out,
+                      size_t out_len) {
+#ifdef HAVE_LIBDEFLATE
+  struct libdeflate_state *state = get_libdeflate_state();
+  if (!state)
+    return 1;
+  if (!state->decompressor &&
+      !(state->decompressor = libdeflate_alloc_decompressor()))
+    return 1;
+  size_t used, got;
+  uint64_t start = trace_timer_start();
+  enum libdeflate_result ret = libdeflate_zlib_decompress_ex(
+      state->decompressor, in, in_len, out, out_len, &used, &got);
+  trace_timer_stop(TRACE_TIMER_INFLATE, start);
+  return ret != LIBDEFLATE_SUCCESS || got != out_len;
+#else
+  z_stream *strm = get_inflate_stream();
+  if (!strm)
+    return 1;
+  strm->next_in = (unsigned char *)in;
+  strm->avail_in = in_len > UINT_MAX ? UINT_MAX : in_len;
+  strm->next_out = out;
+  strm->avail_out = out_len;
+  // Z_STREAM_END only if the stream ends exactly when the output is full
+  uint64_t start = trace_timer_start();
+  int ret = inflate(strm, Z_FINISH);
+  trace_timer_stop(TRACE_TIMER_INFLATE, start);
+  return ret != Z_STREAM_END || strm->total_out != out_len;
+#endif
+}
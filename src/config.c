@@ -0,0 +1,376 @@
+/**
+ * config.c - Repository Configuration (.git/config)
+ *
+ * This file implements reading and updating single values in Git's
+ * config file format:
+ *
+ *   [core]
+ *           bare = false
+ *   [remote "origin"]
+ *           url = https://example.com/repo.git
+ *
+ * Keys are addressed as "section.key" or "section.subsection.key". Section
+ * and key names are case-insensitive; subsections are case-sensitive.
+ * Includes and multi-line values are not supported.
+ */
+
+#include "git.h"
+#include <ctype.h>
+#include <fcntl.h>
+
+#define CONFIG_FILE ".git/config"
+#define CONFIG_LOCK_FILE ".git/config.lock"
+
+/**
+ * Config Key Structure
+ * A key split into its parts (section and name lowercased).
+ */
+struct config_key {
+  char section[128];
+  char subsection[PATH_MAX];  // Empty if the key has no subsection
+  char name[128];
+};
+
+/**
+ * Split "section[.subsection].name" into its parts.
+ *
+ * @return 0 on success, 1 if the key is malformed
+ */
+static int split_key(const char *key, struct config_key *k) {
+  const char *first = strchr(key, '.');
+  const char *last = strrchr(key, '.');
+  if (!first || first == key || !last[1])
+    return 1;
+
+  size_t len = first - key;
+  if (len >= sizeof(k->section) || strlen(last + 1) >= sizeof(k->name))
+    return 1;
+  for (size_t i = 0; i < len; i++)
+    k->section[i] = tolower((unsigned char)key[i]);
+  k->section[len] = '\0';
+
+  len = first == last ? 0 : (size_t)(last - first - 1);
+  if (len >= sizeof(k->subsection))
+    return 1;
+  memcpy(k->subsection, first + 1, len);
+  k->subsection[len] = '\0';
+
+  for (size_t i = 0; last[i + 1]; i++)
+    k->name[i] = tolower((unsigned char)last[i + 1]);
+  k->name[strlen(last + 1)] = '\0';
+  return 0;
+}
+
+/**
+ * Parse a section header line ("[section]" or "[section "sub"]").
+ *
+ * @return 0 on success, 1 if the line is not a valid header
+ */
+static int parse_section(const char *line, struct config_key *k) {
+  const char *p = line + 1;
+  size_t len = 0;
+  while (*p && *p != ']' && !isspace((unsigned char)*p)) {
+    if (len + 1 >= sizeof(k->section))
+      return 1;
+    k->section[len++] = tolower((unsigned char)*p++);
+  }
+  k->section[len] = '\0';
+  k->subsection[0] = '\0';
+
+  while (isspace((unsigned char)*p))
+    p++;
+  if (*p == '"') {
+    len = 0;
+    for (p++; *p && *p != '"'; p++) {
+      if (*p == '\\' && p[1])
+        p++;
+      if (len + 1 >= sizeof(k->subsection))
+        return 1;
+      k->subsection[len++] = *p;
+    }
+    k->subsection[len] = '\0';
+    if (*p++ != '"')
+      return 1;
+  }
+  return *p == ']' ? 0 : 1;
+}
+
+/**
+ * Parse a "name = value" line.
+ *
+ * @param line Line with leading whitespace removed
+ * @param name Output name (lowercased)
+ * @param name_size Size of name buffer
+ * @param value Output value (caller must free); a name without "=" is a
+ *              boolean true
+ * @return 0 on success, 1 if the line has no valid name
+ */
+static int parse_variable(const char *line, char *name, size_t name_size,
+                          char **value) {
+  size_t len = 0;
+  const char *p = line;
+  while (isalnum((unsigned char)*p) || *p == '-') {
+    if (len + 1 >= name_size)
+      return 1;
+    name[len++] = tolower((unsigned char)*p++);
+  }
+  name[len] = '\0';
+  if (!len)
+    return 1;
+
+  while (*p == ' ' || *p == '\t')
+    p++;
+  if (*p != '=') {
+    *value = strdup("true");
+    return 0;
+  }
+  p++;
+  while (*p == ' ' || *p == '\t')
+    p++;
+
+  // Unquote, unescape and drop trailing comments and whitespace
+  char *out = malloc(strlen(p) + 1);
+  size_t n = 0, keep = 0;
+  int quoted = 0;
+  for (; *p && *p != '\n'; p++) {
+    if (*p == '"') {
+      quoted = !quoted;
+      keep = n;
+      continue;
+    }
+    if (!quoted && (*p == '#' || *p == ';'))
+      break;
+    if (*p == '\\' && p[1]) {
+      p++;
+      out[n++] = *p == 'n' ? '\n' : *p == 't' ? '\t' : *p;
+      keep = n;
+      continue;
+    }
+    out[n++] = *p;
+    if (quoted || !isspace((unsigned char)*p))
+      keep = n;
+  }
+  out[keep] = '\0';
+  *value = out;
+  return 0;
+}
+
+/**
+ * Read the whole config file.
+ *
+ * @return File contents (caller must free), or NULL if there is no file
+ */
+static char *read_config_file(void) {
+  FILE *f = fopen(CONFIG_FILE, "r");
+  if (!f)
+    return NULL;
+  char *data = NULL;
+  size_t size = 0;
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    data = realloc(data, size + n + 1);
+    memcpy(data + size, chunk, n);
+    size += n;
+  }
+  fclose(f);
+  if (!data)
+    data = calloc(1, 1);
+  data[size] = '\0';
+  return data;
+}
+
+/**
+ * Config Scan Result Structure
+ * Where a key was found while scanning the file.
+ */
+struct config_scan {
+  char *value;          // Last value of the key, or NULL
+  size_t value_start;   // Offset of the line holding that value
+  size_t value_end;     // Offset just after that line
+  size_t section_end;   // Offset after the last line of a matching section
+  int have_section;     // Whether a matching section exists
+};
+
+/**
+ * Scan config text for a key.
+ */
+static void scan_config(const char *data, const struct config_key *want,
+                        struct config_scan *scan) {
+  memset(scan, 0, sizeof(*scan));
+  struct config_key cur = {{0}, {0}, {0}};
+  int in_section = 0;
+
+  for (size_t pos = 0; data[pos];) {
+    const char *line = data + pos;
+    const char *nl = strchr(line, '\n');
+    size_t next = nl ? (size_t)(nl - data) + 1 : strlen(data);
+
+    const char *p = line;
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p == '[') {
+      in_section = parse_section(p, &cur) == 0 &&
+                   strcmp(cur.section, want->section) == 0 &&
+                   strcmp(cur.subsection, want->subsection) == 0;
+      if (in_section) {
+        scan->have_section = 1;
+        scan->section_end = next;
+      }
+    } else if (in_section) {
+      scan->section_end = next;
+      char name[sizeof(want->name)];
+      char *value;
+      if (*p != '#' && *p != ';' && *p != '\n' && *p &&
+          parse_variable(p, name, sizeof(name), &value) == 0) {
+        if (strcmp(name, want->name) == 0) {
+          free(scan->value);
+          scan->value = value;
+          scan->value_start = pos;
+          scan->value_end = next;
+        } else {
+          free(value);
+        }
+      }
+    }
+    pos = next;
+  }
+}
+
+/**
+ * Look up a config value.
+ * If a key is set more than once, the last value wins.
+ *
+ * @param key Key such as "remote.origin.url"
+ * @return Value (caller must free), or NULL if the key is not set
+ */
+char *config_get(const char *key) {
+  struct config_key k;
+  if (split_key(key, &k) != 0)
+    return NULL;
+  char *data = read_config_file();
+  if (!data)
+    return NULL;
+
+  struct config_scan scan;
+  scan_config(data, &k, &scan);
+  free(data);
+  return scan.value;
+}
+
+/**
+ * Look up a numeric config value. Like Git, a "k", "m" or "g" suffix
+ * scales the value by 1024, 1024^2 or 1024^3.
+ *
+ * @param key Key such as "core.objectCacheLimit"
+ * @param def Value returned if the key is not set
+ * @return Value, or def if the key is unset or not a valid number
+ */
+unsigned long config_get_ulong(const char *key, unsigned long def) {
+  char *value = config_get(key);
+  if (!value)
+    return def;
+
+  char *end;
+  errno = 0;
+  unsigned long n = strtoul(value, &end, 10);
+  int shift = 0;
+  switch (tolower((unsigned char)*end)) {
+  case 'g':
+    shift += 10;  // Fall through
+  case 'm':
+    shift += 10;  // Fall through
+  case 'k':
+    shift += 10;
+    end++;
+  }
+  int valid = end != value && *end == '\0' && value[0] != '-' && !errno &&
+              n <= (ULONG_MAX >> shift);
+  if (!valid)
+    fprintf(stderr, "Ignoring invalid value for %s: %s\n", key, value);
+  free(value);
+  return valid ? n << shift : def;
+}
+
+/**
+ * Set a config value, replacing its last occurrence or adding it to the
+ * end of its section. The file is replaced through config.lock.
+ *
+ * @param key Key such as "remote.origin.url"
+ * @param value New value
+ * @return 0 on success, 1 on error
+ */
+int config_set(const char *key, const char *value) {
+  struct config_key k;
+  if (split_key(key, &k) != 0) {
+    fprintf(stderr, "Invalid config key: %s\n", key);
+    return 1;
+  }
+  char *data = read_config_file();
+  if (!data)
+    data = calloc(1, 1);
+  struct config_scan scan;
+  scan_config(data, &k, &scan);
+  free(scan.value);
+
+  // Quote values that would not survive being read back as-is
+  size_t vlen = strlen(value);
+  int quote = vlen && (isspace((unsigned char)value[0]) ||
+                       isspace((unsigned char)value[vlen - 1]) ||
+                       strpbrk(value, "#;"));
+  char *escaped = malloc(vlen * 2 + 3);
+  size_t n = 0;
+  if (quote)
+    escaped[n++] = '"';
+  for (const char *p = value; *p; p++) {
+    if (*p == '\n' || *p == '\t' || *p == '"' || *p == '\\')
+      escaped[n++] = '\\';
+    escaped[n++] = *p == '\n' ? 'n' : *p == '\t' ? 't' : *p;
+  }
+  if (quote)
+    escaped[n++] = '"';
+  escaped[n] = '\0';
+
+  char line[PATH_MAX * 2];
+  snprintf(line, sizeof(line), "\t%s = %s\n", k.name, escaped);
+  free(escaped);
+
+  size_t head_end, tail_start;
+  char header[PATH_MAX + 160] = "";
+  if (scan.value_end) {
+    head_end = scan.value_start;
+    tail_start = scan.value_end;
+  } else if (scan.have_section) {
+    head_end = tail_start = scan.section_end;
+  } else {
+    head_end = tail_start = strlen(data);
+    if (k.subsection[0])
+      snprintf(header, sizeof(header), "[%s \"%s\"]\n", k.section,
+               k.subsection);
+    else
+      snprintf(header, sizeof(header), "[%s]\n", k.section);
+  }
+  // The insertion point must start a line
+  const char *sep = head_end && data[head_end - 1] != '\n' ? "\n" : "";
+
+  int fd = open(CONFIG_LOCK_FILE, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to lock %s: %s\n", CONFIG_FILE, strerror(errno));
+    free(data);
+    return 1;
+  }
+  int result = write_in_full(fd, data, head_end) ||
+               write_in_full(fd, sep, strlen(sep)) ||
+               write_in_full(fd, header, strlen(header)) ||
+               write_in_full(fd, line, strlen(line)) ||
+               write_in_full(fd, data + tail_start, strlen(data + tail_start));
+  result |= close(fd) != 0;
+  if (result == 0 && rename(CONFIG_LOCK_FILE, CONFIG_FILE) != 0)
+    result = 1;
+  if (result) {
+    fprintf(stderr, "Failed to write %s: %s\n", CONFIG_FILE, strerror(errno));
+    unlink(CONFIG_LOCK_FILE);
+  }
+  free(data);
+  return result;
+}
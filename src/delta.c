@@ -0,0 +1,554 @@
+/**
+ * delta.c - Delta Application, Delta Creation and Delta Base Cache
+ *
+ * This file implements reconstruction of deltified pack objects:
+ *   - The copy/insert instruction interpreter used by OFS_DELTA and
+ *     REF_DELTA entries
+ *   - Delta creation for the pack writer (repack.c): the base is indexed
+ *     by fixed-size blocks, and a rolling hash over the target finds the
+ *     data it shares with the base
+ *   - A bounded LRU cache of recently reconstructed objects, keyed by
+ *     pack offset (REF_DELTA bases are found through the pack index), so
+ *     long delta chains do not re-inflate and re-apply every ancestor for
+ *     each object
+ *
+ * Delta format:
+ *   - Base size and result size as little-endian base-128 varints
+ *   - Instructions: copy (MSB set, offset/size bytes selected by bits 0-6)
+ *     or insert (MSB clear, low 7 bits give the literal length)
+ */
+
+#include "git.h"
+
+#define DELTA_BLOCK_SIZE 16      // Bytes hashed per base block
+#define DELTA_HASH_MULT 0x01000193u  // Rolling hash multiplier
+#define DELTA_MAX_CHAIN 64       // Base blocks tried per target position
+#define DELTA_MAX_INSERT 127     // Longest insert instruction
+#define DELTA_MAX_COPY 0x10000   // Longest copy instruction Git emits
+
+/**
+ * Read a little-endian base-128 size from delta data.
+ *
+ * @param data Current position (advanced past the varint)
+ * @param end End of delta data
+ * @param size Output size value
+ * @return 0 on success, 1 if the varint runs past the end
+ */
+static int delta_read_size(const unsigned char **data,
+                           const unsigned char *end, size_t *size) {
+  size_t shift = 0;
+  unsigned char byte;
+  *size = 0;
+
+  do {
+    if (*data >= end || shift >= sizeof(size_t) * 8)
+      return 1;
+    byte = *(*data)++;
+    *size |= (size_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  return 0;
+}
+
+/**
+ * Read the size of the object a delta reconstructs.
+ * Only the two size varints at the start of the delta are needed, so a
+ * partially inflated delta is enough.
+ *
+ * @param delta Start of the delta data (inflated)
+ * @param delta_size Number of bytes available
+ * @param size Output result size
+ * @return 0 on success, 1 if the header is incomplete
+ */
+int delta_result_size(const unsigned char *delta, size_t delta_size,
+                      size_t *size) {
+  const unsigned char *end = delta + delta_size;
+  size_t base_size;
+  if (delta_read_size(&delta, end, &base_size) != 0)
+    return 1;
+  return delta_read_size(&delta, end, size);
+}
+
+/**
+ * Apply a delta to a base object.
+ * Interprets the copy/insert instruction stream and produces the target
+ * object. The result is null-terminated for convenience.
+ *
+ * @param base Base object content
+ * @param base_size Size of base content
+ * @param delta Delta data (inflated)
+ * @param delta_size Size of delta data
+ * @param out_size Output size of the reconstructed object
+ * @return Reconstructed object content, or NULL on error (caller must free)
+ */
+unsigned char *apply_delta(const unsigned char *base, size_t base_size,
+                           const unsigned char *delta, size_t delta_size,
+                           size_t *out_size) {
+  const unsigned char *pos = delta;
+  const unsigned char *end = delta + delta_size;
+  size_t src_size, dst_size;
+
+  // Header: expected base size followed by result size
+  if (delta_read_size(&pos, end, &src_size) != 0 ||
+      delta_read_size(&pos, end, &dst_size) != 0 || src_size != base_size)
+    return NULL;
+
+  unsigned char *out = malloc(dst_size + 1);
+  if (!out)
+    return NULL;
+  unsigned char *dst = out;
+  unsigned char *dst_end = out + dst_size;
+
+  while (pos < end) {
+    unsigned char op = *pos++;
+
+    if (op & 0x80) {
+      // Copy from base: bits 0-3 select offset bytes, bits 4-6 size bytes
+      size_t cp_off = 0, cp_size = 0;
+      for (int i = 0; i < 4; i++) {
+        if (op & (1 << i)) {
+          if (pos >= end)
+            goto corrupt;
+          cp_off |= (size_t)*pos++ << (i * 8);
+        }
+      }
+      for (int i = 0; i < 3; i++) {
+        if (op & (0x10 << i)) {
+          if (pos >= end)
+            goto corrupt;
+          cp_size |= (size_t)*pos++ << (i * 8);
+        }
+      }
+      if (cp_size == 0)
+        cp_size = 0x10000;
+
+      if (cp_off > base_size || cp_size > base_size - cp_off ||
+          cp_size > (size_t)(dst_end - dst))
+        goto corrupt;
+      memcpy(dst, base + cp_off, cp_size);
+      dst += cp_size;
+    } else if (op) {
+      // Insert literal bytes from the delta itself
+      if (op > end - pos || op > dst_end - dst)
+        goto corrupt;
+      memcpy(dst, pos, op);
+      dst += op;
+      pos += op;
+    } else {
+      // Opcode 0 is reserved
+      goto corrupt;
+    }
+  }
+
+  if (dst != dst_end)
+    goto corrupt;
+
+  *dst = '\0';
+  *out_size = dst_size;
+  return out;
+
+corrupt:
+  free(out);
+  return NULL;
+}
+
+/**
+ * Delta Index Structure
+ * The base object's blocks, hashed so that a target can be searched for
+ * data it shares with the base.
+ */
+struct delta_index {
+  const unsigned char *base;  // Base content (not owned)
+  size_t base_size;
+  uint32_t *heads;   // Per bucket: first block + 1, 0 if empty
+  uint32_t *next;    // Per block: next block in the bucket + 1
+  unsigned bits;     // log2 of the number of buckets
+};
+
+/**
+ * Hash of the DELTA_BLOCK_SIZE bytes at p, as updated by delta_roll().
+ */
+static uint32_t delta_hash(const unsigned char *p) {
+  uint32_t h = 0;
+  for (int i = 0; i < DELTA_BLOCK_SIZE; i++)
+    h = h * DELTA_HASH_MULT + p[i];
+  return h;
+}
+
+/**
+ * Slide a block hash one byte forward: drop out, take in.
+ */
+static uint32_t delta_roll(uint32_t h, unsigned char out, unsigned char in,
+                           uint32_t out_factor) {
+  return (h - out * out_factor) * DELTA_HASH_MULT + in;
+}
+
+static size_t delta_bucket(const struct delta_index *index, uint32_t h) {
+  return (uint32_t)(h * 0x9E3779B1u) >> (32 - index->bits);
+}
+
+/**
+ * Index a base object for create_delta(). Only whole blocks at multiples
+ * of DELTA_BLOCK_SIZE are indexed; matches found through them are then
+ * extended byte by byte in both directions.
+ *
+ * @param base Base object content (must outlive the index)
+ * @param base_size Size of base content (below 4 GiB)
+ * @return Index (free with free_delta_index()), or NULL if the base is
+ *         too small or too large to delta against
+ */
+struct delta_index *create_delta_index(const void *base, size_t base_size) {
+  size_t nr_blocks = base_size / DELTA_BLOCK_SIZE;
+  if (!nr_blocks || base_size > UINT32_MAX)
+    return NULL;
+
+  struct delta_index *index = malloc(sizeof(*index));
+  index->base = base;
+  index->base_size = base_size;
+  index->bits = 4;
+  while (index->bits < 31 && ((size_t)1 << index->bits) < nr_blocks)
+    index->bits++;
+  index->heads = calloc((size_t)1 << index->bits, sizeof(*index->heads));
+  index->next = malloc(nr_blocks * sizeof(*index->next));
+
+  // Insert back to front so that each chain starts at its earliest block
+  for (size_t i = nr_blocks; i-- > 0;) {
+    size_t b = delta_bucket(index, delta_hash(index->base +
+                                              i * DELTA_BLOCK_SIZE));
+    index->next[i] = index->heads[b];
+    index->heads[b] = i + 1;
+  }
+  return index;
+}
+
+/**
+ * Free a delta index. NULL is ignored.
+ */
+void free_delta_index(struct delta_index *index) {
+  if (!index)
+    return;
+  free(index->heads);
+  free(index->next);
+  free(index);
+}
+
+/**
+ * Delta Output Buffer
+ */
+struct delta_out {
+  unsigned char *buf;
+  size_t len, alloc;
+  size_t max_size;  // Give up beyond this size (0 = no limit)
+};
+
+/**
+ * Make room for n more bytes.
+ *
+ * @return 0 on success, 1 if the delta would exceed its maximum size
+ */
+static int delta_reserve(struct delta_out *out, size_t n) {
+  if (out->max_size && out->len + n > out->max_size)
+    return 1;
+  if (out->len + n > out->alloc) {
+    while (out->len + n > out->alloc)
+      out->alloc = out->alloc ? out->alloc * 2 : 256;
+    out->buf = realloc(out->buf, out->alloc);
+  }
+  return 0;
+}
+
+static int delta_put_size(struct delta_out *out, size_t size) {
+  if (delta_reserve(out, 10))
+    return 1;
+  do {
+    unsigned char byte = size & 0x7f;
+    size >>= 7;
+    out->buf[out->len++] = byte | (size ? 0x80 : 0);
+  } while (size);
+  return 0;
+}
+
+/**
+ * Emit literal bytes as insert instructions.
+ */
+static int delta_put_insert(struct delta_out *out, const unsigned char *data,
+                            size_t len) {
+  while (len) {
+    size_t n = len < DELTA_MAX_INSERT ? len : DELTA_MAX_INSERT;
+    if (delta_reserve(out, n + 1))
+      return 1;
+    out->buf[out->len++] = n;
+    memcpy(out->buf + out->len, data, n);
+    out->len += n;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * Emit copy instructions for a range of the base.
+ */
+static int delta_put_copy(struct delta_out *out, size_t offset, size_t len) {
+  while (len) {
+    size_t n = len < DELTA_MAX_COPY ? len : DELTA_MAX_COPY;
+    if (delta_reserve(out, 8))
+      return 1;
+    unsigned char *op = &out->buf[out->len++];
+    *op = 0x80;
+    // Only the non-zero bytes of offset and size are stored
+    for (int i = 0; i < 4; i++) {
+      if (offset >> (i * 8) & 0xff) {
+        *op |= 1 << i;
+        out->buf[out->len++] = offset >> (i * 8) & 0xff;
+      }
+    }
+    for (int i = 0; i < 3; i++) {
+      if (n >> (i * 8) & 0xff) {
+        *op |= 0x10 << i;
+        out->buf[out->len++] = n >> (i * 8) & 0xff;
+      }
+    }
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * Compute a delta that turns an indexed base into a target object.
+ * The target is scanned with a rolling hash over DELTA_BLOCK_SIZE bytes;
+ * wherever it matches a base block, the longest match is copied from the
+ * base and everything else is inserted literally.
+ *
+ * @param index Index of the base (see create_delta_index())
+ * @param target Target object content
+ * @param target_size Size of target content
+ * @param max_size Largest useful delta, or 0 for no limit
+ * @param delta_size Output size of the delta
+ * @return Delta data (caller must free), or NULL if it would be larger
+ *         than max_size
+ */
+unsigned char *create_delta(const struct delta_index *index,
+                            const void *target, size_t target_size,
+                            size_t max_size, size_t *delta_size) {
+  const unsigned char *trg = target;
+  const unsigned char *base = index->base;
+  struct delta_out out = {NULL, 0, 0, max_size};
+  if (delta_put_size(&out, index->base_size) ||
+      delta_put_size(&out, target_size))
+    goto fail;
+
+  // Factor by which the byte leaving the window was multiplied
+  uint32_t out_factor = 1;
+  for (int i = 1; i < DELTA_BLOCK_SIZE; i++)
+    out_factor *= DELTA_HASH_MULT;
+
+  size_t pos = 0, literal = 0;  // Bytes from literal to pos await insertion
+  uint32_t h = target_size >= DELTA_BLOCK_SIZE ? delta_hash(trg) : 0;
+  while (pos + DELTA_BLOCK_SIZE <= target_size) {
+    size_t best_off = 0, best_len = 0;
+    int tries = 0;
+    for (uint32_t e = index->heads[delta_bucket(index, h)];
+         e && tries < DELTA_MAX_CHAIN; e = index->next[e - 1], tries++) {
+      size_t off = (size_t)(e - 1) * DELTA_BLOCK_SIZE;
+      size_t len = 0;
+      while (off + len < index->base_size && pos + len < target_size &&
+             base[off + len] == trg[pos + len])
+        len++;
+      if (len > best_len) {
+        best_off = off;
+        best_len = len;
+      }
+    }
+
+    if (best_len < DELTA_BLOCK_SIZE) {
+      if (pos + DELTA_BLOCK_SIZE < target_size)
+        h = delta_roll(h, trg[pos], trg[pos + DELTA_BLOCK_SIZE], out_factor);
+      pos++;
+      continue;
+    }
+
+    // Take back literal bytes that the match also covers
+    while (best_off && pos > literal && base[best_off - 1] == trg[pos - 1]) {
+      best_off--;
+      best_len++;
+      pos--;
+    }
+    if (delta_put_insert(&out, trg + literal, pos - literal) ||
+        delta_put_copy(&out, best_off, best_len))
+      goto fail;
+    pos += best_len;
+    literal = pos;
+    if (pos + DELTA_BLOCK_SIZE <= target_size)
+      h = delta_hash(trg + pos);
+  }
+  if (delta_put_insert(&out, trg + literal, target_size - literal))
+    goto fail;
+
+  *delta_size = out.len;
+  return out.buf;
+
+fail:
+  free(out.buf);
+  return NULL;
+}
+
+/**
+ * Bucket index for an offset key.
+ */
+static size_t cache_offset_bucket(const void *pack, size_t offset) {
+  size_t key = offset ^ ((size_t)pack >> 4);
+  key ^= key >> 17;
+  key *= 0x9e3779b97f4a7c15ULL;
+  return (key >> 20) & (DELTA_CACHE_BUCKETS - 1);
+}
+
+/**
+ * Initialize an empty delta base cache.
+ *
+ * @param cache Cache to initialize
+ * @param limit Maximum number of content bytes to retain
+ */
+void delta_base_cache_init(struct delta_base_cache *cache, size_t limit) {
+  memset(cache, 0, sizeof(*cache));
+  cache->limit = limit;
+}
+
+/**
+ * Unlink an entry from the LRU list and its hash chain, then free it.
+ */
+static void cache_remove(struct delta_base_cache *cache,
+                         struct delta_base_entry *e) {
+  // LRU list
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    cache->lru_head = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    cache->lru_tail = e->lru_prev;
+
+  // Offset chain
+  struct delta_base_entry **p =
+      &cache->by_offset[cache_offset_bucket(e->pack, e->offset)];
+  while (*p != e)
+    p = &(*p)->offset_next;
+  *p = e->offset_next;
+
+  cache->size -= e->size;
+  cache->count--;
+  free(e->data);
+  free(e);
+}
+
+/**
+ * Move an entry to the most-recently-used end of the LRU list.
+ */
+static void cache_touch(struct delta_base_cache *cache,
+                        struct delta_base_entry *e) {
+  if (cache->lru_head == e)
+    return;
+
+  e->lru_prev->lru_next = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    cache->lru_tail = e->lru_prev;
+
+  e->lru_prev = NULL;
+  e->lru_next = cache->lru_head;
+  cache->lru_head->lru_prev = e;
+  cache->lru_head = e;
+}
+
+/**
+ * Look up a cached object by its position in a pack.
+ *
+ * @param cache Cache to search
+ * @param pack Identity of the pack the offset refers to
+ * @param offset Pack offset of the object
+ * @return Cached entry (owned by the cache), or NULL if absent
+ */
+const struct delta_base_entry *
+delta_base_cache_get_offset(struct delta_base_cache *cache, const void *pack,
+                            size_t offset) {
+  struct delta_base_entry *e =
+      cache->by_offset[cache_offset_bucket(pack, offset)];
+  for (; e; e = e->offset_next) {
+    if (e->pack == pack && e->offset == offset) {
+      cache_touch(cache, e);
+      cache->hits++;
+      trace_count(TRACE_DELTA_CACHE_HITS, 1);
+      return e;
+    }
+  }
+  cache->misses++;
+  trace_count(TRACE_DELTA_CACHE_MISSES, 1);
+  return NULL;
+}
+
+/**
+ * Insert a reconstructed object into the cache, evicting least recently
+ * used entries to stay within the byte limit. Ownership of data passes to
+ * the cache; objects larger than the whole limit are freed immediately.
+ * Previously returned entries may be evicted by this call.
+ *
+ * @param cache Cache to insert into
+ * @param pack Identity of the pack the offset refers to
+ * @param offset Pack offset of the object
+ * @param type Pack object type (OBJ_COMMIT..OBJ_TAG)
+ * @param data Object content (malloc'd; ownership transferred)
+ * @param size Size of content
+ */
+void delta_base_cache_put(struct delta_base_cache *cache, const void *pack,
+                          size_t offset, int type, unsigned char *data,
+                          size_t size) {
+  if (size > cache->limit) {
+    free(data);
+    return;
+  }
+
+  // Evict from the cold end until the new entry fits
+  while (cache->lru_tail && cache->size + size > cache->limit)
+    cache_remove(cache, cache->lru_tail);
+
+  struct delta_base_entry *e = malloc(sizeof(*e));
+  if (!e) {
+    free(data);
+    return;
+  }
+  e->pack = pack;
+  e->offset = offset;
+  e->type = type;
+  e->data = data;
+  e->size = size;
+
+  // Link into the hash chain and at the head of the LRU list
+  size_t ob = cache_offset_bucket(pack, offset);
+  e->offset_next = cache->by_offset[ob];
+  cache->by_offset[ob] = e;
+
+  e->lru_prev = NULL;
+  e->lru_next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->lru_prev = e;
+  cache->lru_head = e;
+  if (!cache->lru_tail)
+    cache->lru_tail = e;
+
+  cache->size += size;
+  cache->count++;
+}
+
+/**
+ * Drop every entry from the cache.
+ *
+ * @param cache Cache to clear
+ */
+void delta_base_cache_clear(struct delta_base_cache *cache) {
+  while (cache->lru_tail)
+    cache_remove(cache, cache->lru_tail);
+}
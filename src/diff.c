@@ -0,0 +1,506 @@
+/**
+ * diff.c - Tree Diffs
+ *
+ * This file compares two trees, or a tree and the work tree, reporting
+ * every path whose content or mode differs:
+ *   - diff_trees() walks both trees side by side. Entries are sorted the
+ *     same way in every tree (see compare_names()), so one merge pass over
+ *     two trees pairs up their entries. A pair with the same mode and
+ *     object ID is equal however much lies below it and is skipped
+ *     without being read, so comparing two snapshots that differ in a few
+ *     files reads only the trees on the paths to those files.
+ *   - diff_worktree() walks a tree against the directories on disk. Files
+ *     whose stat data still matches .git/index take their blob ID from
+ *     there, so on an unchanged work tree nothing but lstat() is done;
+ *     other files are hashed (not stored) and their entries refreshed.
+ */
+
+#include "git.h"
+#include <dirent.h>
+
+/*
+ * ============================================================================
+ * Tree Diffs
+ * ============================================================================
+ */
+
+/**
+ * Tree Diff State
+ */
+struct tree_diff {
+  int flags;             // DIFF_RECURSIVE
+  diff_fn fn;
+  void *data;
+  char path[PATH_MAX];   // Path of the entry being compared
+};
+
+/**
+ * Order entry names the way trees are sorted: by name bytes, with
+ * directories compared as if their name ended in '/' (see write-tree.c).
+ */
+static int compare_names(const char *a, size_t la, int a_dir, const char *b,
+                         size_t lb, int b_dir) {
+  int cmp = memcmp(a, b, la < lb ? la : lb);
+  if (cmp)
+    return cmp;
+  unsigned char ca = la > lb ? a[lb] : a_dir ? '/' : '\0';
+  unsigned char cb = lb > la ? b[la] : b_dir ? '/' : '\0';
+  return ca < cb ? -1 : ca > cb;
+}
+
+/**
+ * Append an entry name to the current path.
+ *
+ * @param len Length of the parent's path
+ * @return Length of the new path, or 0 if it is too long
+ */
+static size_t push_path(struct tree_diff *td, size_t len, const char *name,
+                        size_t name_len) {
+  size_t new_len = len + (len ? 1 : 0) + name_len;
+  if (new_len >= sizeof(td->path)) {
+    fprintf(stderr, "Path too long: %s/%.*s\n", td->path, (int)name_len,
+            name);
+    return 0;
+  }
+  if (len)
+    td->path[len++] = '/';
+  memcpy(td->path + len, name, name_len);
+  td->path[new_len] = '\0';
+  return new_len;
+}
+
+/**
+ * Read and parse a tree.
+ *
+ * @param obj Output: the object the tree points into (free after the tree)
+ * @return Parsed tree, or NULL (after reporting it) if it cannot be read
+ */
+static tree_object *read_tree(const struct object_id *oid, git_object **obj) {
+  *obj = odb_read_object(oid);
+  tree_object *tree = parse_tree_object(*obj);
+  if (!tree) {
+    char hex[GIT_HASH_LENGTH + 1];
+    fprintf(stderr, "Failed to read tree %s\n", oid_to_hex(oid, hex));
+    free_git_object(*obj);
+    *obj = NULL;
+  }
+  return tree;
+}
+
+/**
+ * Report one change at the current path.
+ */
+static int report_change(struct tree_diff *td, char status, unsigned old_mode,
+                         const struct object_id *old_oid, unsigned new_mode,
+                         const struct object_id *new_oid) {
+  struct diff_change c = {0};
+  c.status = status;
+  c.old_mode = old_mode;
+  c.new_mode = new_mode;
+  if (old_oid)
+    c.old_oid = *old_oid;
+  if (new_oid)
+    c.new_oid = *new_oid;
+  c.path = td->path;
+  return td->fn(&c, td->data);
+}
+
+static int diff_tree_entries(struct tree_diff *td, const struct object_id *a,
+                             const struct object_id *b, size_t len);
+
+/**
+ * Compare two entries with the same name; either may be NULL (absent).
+ * When both are present, both are trees or neither is.
+ */
+static int diff_entry_pair(struct tree_diff *td, const tree_entry *a,
+                           const tree_entry *b, size_t len) {
+  const tree_entry *e = a ? a : b;
+  size_t new_len = push_path(td, len, e->name, e->name_len);
+  if (!new_len)
+    return 1;
+
+  int result;
+  if ((td->flags & DIFF_RECURSIVE) && e->mode == TREE_MODE_DIR)
+    result = diff_tree_entries(td, a ? a->oid : NULL, b ? b->oid : NULL,
+                               new_len);
+  else if (!b)
+    result = report_change(td, 'D', a->mode, a->oid, 0, NULL);
+  else if (!a)
+    result = report_change(td, 'A', 0, NULL, b->mode, b->oid);
+  else
+    result = report_change(td, (a->mode ^ b->mode) & S_IFMT ? 'T' : 'M',
+                           a->mode, a->oid, b->mode, b->oid);
+  td->path[len] = '\0';
+  return result;
+}
+
+/**
+ * Merge-walk the entries of two trees. A NULL tree is empty, so every
+ * entry of the other one is reported (added or deleted).
+ *
+ * @param len Length of the trees' path in td->path
+ * @return 0 on success, 1 on error, or what the callback returned
+ */
+static int diff_tree_entries(struct tree_diff *td, const struct object_id *a,
+                             const struct object_id *b, size_t len) {
+  git_object *obj_a = NULL, *obj_b = NULL;
+  tree_object *ta = NULL, *tb = NULL;
+  if ((a && !(ta = read_tree(a, &obj_a))) ||
+      (b && !(tb = read_tree(b, &obj_b)))) {
+    free_tree_object(ta);
+    free_git_object(obj_a);
+    return 1;
+  }
+
+  size_t na = ta ? ta->count : 0, nb = tb ? tb->count : 0;
+  size_t i = 0, j = 0;
+  int result = 0;
+  while (result == 0 && (i < na || j < nb)) {
+    const tree_entry *ea = i < na ? &ta->entries[i] : NULL;
+    const tree_entry *eb = j < nb ? &tb->entries[j] : NULL;
+    int cmp = !ea   ? 1
+              : !eb ? -1
+                    : compare_names(ea->name, ea->name_len,
+                                    ea->mode == TREE_MODE_DIR, eb->name,
+                                    eb->name_len, eb->mode == TREE_MODE_DIR);
+    if (cmp < 0) {
+      result = diff_entry_pair(td, ea, NULL, len);
+      i++;
+    } else if (cmp > 0) {
+      result = diff_entry_pair(td, NULL, eb, len);
+      j++;
+    } else {
+      // Same mode and ID: equal, however large the subtree below
+      if (ea->mode != eb->mode || !oideq(ea->oid, eb->oid))
+        result = diff_entry_pair(td, ea, eb, len);
+      i++;
+      j++;
+    }
+  }
+
+  free_tree_object(ta);
+  free_tree_object(tb);
+  free_git_object(obj_a);
+  free_git_object(obj_b);
+  return result;
+}
+
+/**
+ * Report the paths that differ between two trees, in tree order.
+ * Without DIFF_RECURSIVE a changed subtree is reported as one entry;
+ * with it, the files that differ inside it are reported instead.
+ *
+ * @param old_tree Old tree, or NULL for an empty tree
+ * @param new_tree New tree, or NULL for an empty tree
+ * @param flags DIFF_RECURSIVE
+ * @param fn Callback; returning non-zero stops the diff
+ * @param data Passed to fn
+ * @return 0 on success, 1 if a tree cannot be read, or what fn returned
+ */
+int diff_trees(const struct object_id *old_tree,
+               const struct object_id *new_tree, int flags, diff_fn fn,
+               void *data) {
+  if (old_tree && new_tree && oideq(old_tree, new_tree))
+    return 0;
+  struct tree_diff td;
+  td.flags = flags;
+  td.fn = fn;
+  td.data = data;
+  td.path[0] = '\0';
+  return diff_tree_entries(&td, old_tree, new_tree, 0);
+}
+
+/*
+ * ============================================================================
+ * Work Tree Diffs
+ * ============================================================================
+ */
+
+/**
+ * Work Tree Diff State
+ */
+struct worktree_diff {
+  struct tree_diff td;           // Callback, and the path being compared
+  struct index_state old_index;  // Stat cache from the last run
+  struct index_state refreshed;  // Entries of the files hashed now
+  size_t alloc_refreshed;
+};
+
+/**
+ * Work Tree Entry Structure
+ * One entry of a directory on disk.
+ */
+struct work_entry {
+  char *name;
+  size_t name_len;
+  struct stat st;
+};
+
+static int compare_work_entries(const void *a, const void *b) {
+  const struct work_entry *wa = a, *wb = b;
+  return compare_names(wa->name, wa->name_len, S_ISDIR(wa->st.st_mode),
+                       wb->name, wb->name_len, S_ISDIR(wb->st.st_mode));
+}
+
+/**
+ * List a directory's files, subdirectories and symbolic links in tree
+ * order.
+ *
+ * @param path Directory relative to the top of the work tree ("" for it)
+ * @param nr Output number of entries
+ * @return Entries (free with free_work_entries())
+ */
+static struct work_entry *read_work_dir(const char *path, size_t *nr) {
+  struct work_entry *entries = NULL;
+  size_t alloc = 0;
+  *nr = 0;
+  DIR *dir = opendir(*path ? path : ".");
+  if (!dir)
+    return NULL;
+
+  struct dirent *de;
+  while ((de = readdir(dir))) {
+    char full_path[PATH_MAX];
+    snprintf(full_path, sizeof(full_path), "%s%s%s", path, *path ? "/" : "",
+             de->d_name);
+    struct stat st;
+    if (should_ignore_path(full_path) || lstat(full_path, &st) != 0 ||
+        !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode) || S_ISLNK(st.st_mode)))
+      continue;
+    if (*nr == alloc) {
+      alloc = alloc ? alloc * 2 : 16;
+      entries = realloc(entries, alloc * sizeof(*entries));
+    }
+    entries[*nr].name = strdup(de->d_name);
+    entries[*nr].name_len = strlen(de->d_name);
+    entries[(*nr)++].st = st;
+  }
+  closedir(dir);
+  qsort(entries, *nr, sizeof(*entries), compare_work_entries);
+  return entries;
+}
+
+static void free_work_entries(struct work_entry *entries, size_t nr) {
+  for (size_t i = 0; i < nr; i++)
+    free(entries[i].name);
+  free(entries);
+}
+
+/**
+ * Whether a directory holds any file, however deep. Empty directories
+ * are not recorded in trees, so they are not untracked either.
+ */
+static int has_work_files(const char *path) {
+  size_t nr;
+  struct work_entry *entries = read_work_dir(path, &nr);
+  int found = 0;
+  for (size_t i = 0; i < nr && !found; i++) {
+    if (!S_ISDIR(entries[i].st.st_mode)) {
+      found = 1;
+    } else {
+      char sub[PATH_MAX];
+      snprintf(sub, sizeof(sub), "%s/%s", path, entries[i].name);
+      found = has_work_files(sub);
+    }
+  }
+  free_work_entries(entries, nr);
+  return found;
+}
+
+/**
+ * The tree mode a work tree file is recorded with.
+ */
+static unsigned work_mode(const struct stat *st) {
+  if (S_ISDIR(st->st_mode))
+    return TREE_MODE_DIR;
+  if (S_ISLNK(st->st_mode))
+    return TREE_MODE_SYMLINK;
+  return st->st_mode & 0100 ? TREE_MODE_EXEC : TREE_MODE_FILE;
+}
+
+/**
+ * Normalize a tree entry's mode: regular files only record the
+ * executable bit (old trees may hold e.g. 100664).
+ */
+static unsigned canonical_mode(unsigned mode) {
+  if (S_ISREG(mode))
+    return mode & 0100 ? TREE_MODE_EXEC : TREE_MODE_FILE;
+  return mode;
+}
+
+/**
+ * Find the blob ID of the work tree file at the current path, from the
+ * stat cache if it is still valid and by hashing the file otherwise.
+ *
+ * @return 0 on success, 1 (after reporting it) if the file cannot be read
+ */
+static int work_file_oid(struct worktree_diff *wd, const struct stat *st,
+                         struct object_id *oid) {
+  const char *path = wd->td.path;
+  const struct index_entry *old = index_find(&wd->old_index, path);
+  if (S_ISREG(st->st_mode) && old &&
+      index_entry_uptodate(&wd->old_index, old, st)) {
+    *oid = old->oid;
+    return 0;
+  }
+  if (hash_blob_file(path, st, oid) != 0) {
+    fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (!S_ISREG(st->st_mode))
+    return 0;  // Only regular files are cached
+
+  if (wd->refreshed.nr == wd->alloc_refreshed) {
+    wd->alloc_refreshed = wd->alloc_refreshed ? wd->alloc_refreshed * 2 : 64;
+    wd->refreshed.entries = realloc(
+        wd->refreshed.entries, wd->alloc_refreshed * sizeof(struct index_entry));
+  }
+  struct index_entry *ie = &wd->refreshed.entries[wd->refreshed.nr++];
+  fill_index_stat(ie, st);
+  ie->oid = *oid;
+  ie->path = strdup(path);
+  return 0;
+}
+
+/**
+ * Compare a tree entry and a work tree entry with the same name, either
+ * of which may be absent.
+ */
+static int diff_work_pair(struct worktree_diff *wd, const tree_entry *te,
+                          struct work_entry *we, size_t len);
+
+/**
+ * Merge-walk a tree against the directory at the current path.
+ *
+ * @param tree Tree, or NULL if the directory is not in the tree
+ * @param len Length of the directory's path in wd->td.path
+ * @return 0 on success, 1 on error, or what the callback returned
+ */
+static int diff_work_dir(struct worktree_diff *wd,
+                         const struct object_id *tree, size_t len) {
+  git_object *obj = NULL;
+  tree_object *t = NULL;
+  if (tree && !(t = read_tree(tree, &obj)))
+    return 1;
+  size_t nr_work;
+  struct work_entry *work = read_work_dir(wd->td.path, &nr_work);
+
+  size_t nr_tree = t ? t->count : 0;
+  size_t i = 0, j = 0;
+  int result = 0;
+  while (result == 0 && (i < nr_tree || j < nr_work)) {
+    const tree_entry *te = i < nr_tree ? &t->entries[i] : NULL;
+    struct work_entry *we = j < nr_work ? &work[j] : NULL;
+    int cmp = !te   ? 1
+              : !we ? -1
+                    : compare_names(te->name, te->name_len,
+                                    te->mode == TREE_MODE_DIR, we->name,
+                                    we->name_len, S_ISDIR(we->st.st_mode));
+    result = diff_work_pair(wd, cmp <= 0 ? te : NULL, cmp >= 0 ? we : NULL,
+                            len);
+    i += cmp <= 0;
+    j += cmp >= 0;
+  }
+
+  free_work_entries(work, nr_work);
+  free_tree_object(t);
+  free_git_object(obj);
+  return result;
+}
+
+static int diff_work_pair(struct worktree_diff *wd, const tree_entry *te,
+                          struct work_entry *we, size_t len) {
+  struct tree_diff *td = &wd->td;
+  size_t new_len = te ? push_path(td, len, te->name, te->name_len)
+                      : push_path(td, len, we->name, we->name_len);
+  if (!new_len)
+    return 1;
+
+  int result = 0;
+  int work_dir = we && S_ISDIR(we->st.st_mode);
+  if (te && te->mode == TREE_MODE_GITLINK) {
+    // Submodules are not looked into
+  } else if (!we) {
+    result = te->mode == TREE_MODE_DIR
+                 ? diff_tree_entries(td, te->oid, NULL, new_len)
+                 : report_change(td, 'D', te->mode, te->oid, 0, NULL);
+  } else if (!te) {
+    // Untracked directories are reported as a whole, as "<dir>/"
+    if (work_dir && new_len + 1 < sizeof(td->path) &&
+        has_work_files(td->path)) {
+      strcat(td->path, "/");
+      result = report_change(td, '?', 0, NULL, TREE_MODE_DIR, NULL);
+    } else if (!work_dir) {
+      result = report_change(td, '?', 0, NULL, work_mode(&we->st), NULL);
+    }
+  } else if (work_dir) {
+    result = diff_work_dir(wd, te->oid, new_len);
+  } else {
+    struct object_id oid;
+    unsigned old_mode = canonical_mode(te->mode), mode = work_mode(&we->st);
+    if (work_file_oid(wd, &we->st, &oid) != 0)
+      result = 1;
+    else if ((old_mode ^ mode) & S_IFMT)
+      result = report_change(td, 'T', te->mode, te->oid, mode, &oid);
+    else if (old_mode != mode || !oideq(te->oid, &oid))
+      result = report_change(td, 'M', te->mode, te->oid, mode, &oid);
+  }
+  td->path[len] = '\0';
+  return result;
+}
+
+/**
+ * Write the stat data of the files hashed during the diff back to
+ * .git/index, keeping the entries of all other files.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int refresh_index(struct worktree_diff *wd) {
+  struct index_state *index = &wd->refreshed;
+  char *replaced = calloc(wd->old_index.nr + 1, 1);
+  for (size_t i = 0; i < index->nr; i++) {
+    const struct index_entry *old = index_find(&wd->old_index,
+                                               index->entries[i].path);
+    if (old)
+      replaced[old - wd->old_index.entries] = 1;
+  }
+  index->entries = realloc(index->entries, (index->nr + wd->old_index.nr) *
+                                               sizeof(struct index_entry));
+  for (size_t i = 0; i < wd->old_index.nr; i++) {
+    if (replaced[i])
+      continue;
+    index->entries[index->nr++] = wd->old_index.entries[i];
+    wd->old_index.entries[i].path = NULL;  // Now owned by the new index
+  }
+  free(replaced);
+  return write_index(index);
+}
+
+/**
+ * Report the paths in which the work tree differs from a tree, in tree
+ * order. Files and directories that are not in the tree are reported
+ * with status '?' (directories once, with a trailing '/'). Must be run
+ * from the top of the work tree.
+ *
+ * @param tree Tree to compare with, or NULL for an empty tree
+ * @param fn Callback; returning non-zero stops the diff
+ * @param data Passed to fn
+ * @return 0 on success, 1 on error, or what fn returned
+ */
+int diff_worktree(const struct object_id *tree, diff_fn fn, void *data) {
+  struct worktree_diff wd = {0};
+  wd.td.flags = DIFF_RECURSIVE;
+  wd.td.fn = fn;
+  wd.td.data = data;
+  if (read_index(&wd.old_index) != 0)
+    fprintf(stderr, "Ignoring unreadable %s\n", INDEX_FILE);
+
+  int result = diff_work_dir(&wd, tree, 0);
+  // Files hashed now need not be hashed next time
+  if (wd.refreshed.nr)
+    refresh_index(&wd);
+
+  discard_index(&wd.refreshed);
+  discard_index(&wd.old_index);
+  return result;
+}
@@ -0,0 +1,268 @@
+/**
+ * ewah.c - Bitmaps and EWAH Compression
+ *
+ * This file implements the bit sets that reachability bitmaps
+ * (pack-bitmap.c) are built from:
+ *   - struct bitmap: an uncompressed, growable bit set used while
+ *     computing and combining bitmaps
+ *   - ewah_encode()/ewah_decode(): the EWAH run-length compression they
+ *     are stored on disk with, in Git's serialization
+ *
+ * EWAH splits a bitmap into 64-bit words and stores it as a sequence of
+ * marker words, each announcing a run of all-zero or all-one words
+ * followed by a number of literal words copied verbatim. Reachability
+ * bitmaps are long runs of ones (old history shared by every commit) and
+ * zeros (objects not yet reachable), so they shrink to a small fraction
+ * of the uncompressed size.
+ *
+ * Serialized format (all integers big-endian):
+ *   - Size in bits(4), number of words(4)
+ *   - Words(8 each), starting with a marker word
+ *   - Index of the last marker word(4)
+ * Marker words hold the run bit in bit 0, the run length in words in bits
+ * 1-32 and the number of literal words that follow in bits 33-63.
+ */
+
+#include "git.h"
+#include <arpa/inet.h>
+
+#define RLW_RUN_MAX 0xFFFFFFFFu     // Longest run in one marker word
+#define RLW_LITERAL_MAX 0x7FFFFFFFu // Most literal words after one marker
+#define EWAH_HEADER_SIZE 8
+#define EWAH_FOOTER_SIZE 4
+
+/*
+ * ============================================================================
+ * Uncompressed Bitmaps
+ * ============================================================================
+ */
+
+/**
+ * Create an empty bitmap.
+ *
+ * @return Bitmap (free with bitmap_free())
+ */
+struct bitmap *bitmap_new(void) {
+  return calloc(1, sizeof(struct bitmap));
+}
+
+/**
+ * Free a bitmap. NULL is ignored.
+ */
+void bitmap_free(struct bitmap *b) {
+  if (!b)
+    return;
+  free(b->words);
+  free(b);
+}
+
+/**
+ * Make room for at least nr words, zeroing the new ones.
+ */
+static void bitmap_grow(struct bitmap *b, size_t nr) {
+  if (nr <= b->word_alloc)
+    return;
+  size_t alloc = b->word_alloc ? b->word_alloc : 16;
+  while (alloc < nr)
+    alloc *= 2;
+  b->words = realloc(b->words, alloc * sizeof(*b->words));
+  memset(b->words + b->word_alloc, 0,
+         (alloc - b->word_alloc) * sizeof(*b->words));
+  b->word_alloc = alloc;
+}
+
+/**
+ * Copy a bitmap.
+ *
+ * @return New bitmap (free with bitmap_free())
+ */
+struct bitmap *bitmap_dup(const struct bitmap *b) {
+  struct bitmap *copy = bitmap_new();
+  bitmap_grow(copy, b->word_alloc);
+  if (b->word_alloc)
+    memcpy(copy->words, b->words, b->word_alloc * sizeof(*b->words));
+  return copy;
+}
+
+/**
+ * Set a bit, growing the bitmap as needed.
+ */
+void bitmap_set(struct bitmap *b, size_t pos) {
+  bitmap_grow(b, pos / 64 + 1);
+  b->words[pos / 64] |= (uint64_t)1 << (pos % 64);
+}
+
+/**
+ * Test a bit; bits beyond the end of the bitmap are clear.
+ */
+int bitmap_get(const struct bitmap *b, size_t pos) {
+  return pos / 64 < b->word_alloc &&
+         (b->words[pos / 64] >> (pos % 64) & 1);
+}
+
+/**
+ * dst |= src
+ */
+void bitmap_or(struct bitmap *dst, const struct bitmap *src) {
+  bitmap_grow(dst, src->word_alloc);
+  for (size_t i = 0; i < src->word_alloc; i++)
+    dst->words[i] |= src->words[i];
+}
+
+/**
+ * dst ^= src
+ */
+void bitmap_xor(struct bitmap *dst, const struct bitmap *src) {
+  bitmap_grow(dst, src->word_alloc);
+  for (size_t i = 0; i < src->word_alloc; i++)
+    dst->words[i] ^= src->words[i];
+}
+
+/**
+ * dst &= ~src
+ */
+void bitmap_and_not(struct bitmap *dst, const struct bitmap *src) {
+  size_t nr = dst->word_alloc < src->word_alloc ? dst->word_alloc
+                                                : src->word_alloc;
+  for (size_t i = 0; i < nr; i++)
+    dst->words[i] &= ~src->words[i];
+}
+
+/**
+ * Number of set bits.
+ */
+size_t bitmap_popcount(const struct bitmap *b) {
+  size_t count = 0;
+  for (size_t i = 0; i < b->word_alloc; i++)
+    count += __builtin_popcountll(b->words[i]);
+  return count;
+}
+
+/*
+ * ============================================================================
+ * EWAH Serialization
+ * ============================================================================
+ */
+
+static unsigned char *put_be32(unsigned char *p, uint32_t v) {
+  v = htonl(v);
+  memcpy(p, &v, 4);
+  return p + 4;
+}
+
+static unsigned char *put_be64(unsigned char *p, uint64_t v) {
+  p = put_be32(p, v >> 32);
+  return put_be32(p, v & 0xffffffff);
+}
+
+static uint32_t get_be32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return ntohl(v);
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+  return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+/**
+ * Compress a bitmap. Trailing zero words are left out.
+ *
+ * @param b Bitmap to compress
+ * @param len Output: size of the serialized bitmap
+ * @return Serialized bitmap (caller must free)
+ */
+unsigned char *ewah_encode(const struct bitmap *b, size_t *len) {
+  size_t nr = b->word_alloc;
+  while (nr && !b->words[nr - 1])
+    nr--;
+
+  // At worst every word is a literal, plus one marker per literal batch
+  size_t max_words = nr + nr / RLW_LITERAL_MAX + 2;
+  unsigned char *out =
+      malloc(EWAH_HEADER_SIZE + max_words * 8 + EWAH_FOOTER_SIZE);
+  unsigned char *p = out + EWAH_HEADER_SIZE;
+  uint32_t nr_out = 0, last_marker = 0;
+
+  // Even an empty bitmap has one marker word
+  size_t i = 0;
+  do {
+    uint64_t fill = 0, run = 0, literals = 0;
+    if (i < nr && (b->words[i] == 0 || b->words[i] == ~(uint64_t)0)) {
+      fill = b->words[i];
+      while (i < nr && b->words[i] == fill && run < RLW_RUN_MAX) {
+        run++;
+        i++;
+      }
+    }
+    size_t first_literal = i;
+    while (i < nr && b->words[i] != 0 && b->words[i] != ~(uint64_t)0 &&
+           literals < RLW_LITERAL_MAX) {
+      literals++;
+      i++;
+    }
+
+    last_marker = nr_out;
+    p = put_be64(p, (fill & 1) | run << 1 | literals << 33);
+    nr_out++;
+    for (size_t k = first_literal; k < i; k++)
+      p = put_be64(p, b->words[k]);
+    nr_out += literals;
+  } while (i < nr);
+
+  put_be32(out, nr * 64);
+  put_be32(out + 4, nr_out);
+  p = put_be32(p, last_marker);
+  *len = p - out;
+  return out;
+}
+
+/**
+ * Size of a serialized bitmap, read from its header.
+ *
+ * @param buf Serialized bitmap
+ * @param len Bytes available at buf
+ * @return Size in bytes, or 0 if it is truncated
+ */
+size_t ewah_serialized_size(const unsigned char *buf, size_t len) {
+  if (len < EWAH_HEADER_SIZE)
+    return 0;
+  size_t size =
+      EWAH_HEADER_SIZE + (size_t)get_be32(buf + 4) * 8 + EWAH_FOOTER_SIZE;
+  return size <= len ? size : 0;
+}
+
+/**
+ * Decompress a serialized bitmap.
+ *
+ * @param buf Serialized bitmap
+ * @param len Bytes available at buf
+ * @return Bitmap (free with bitmap_free()), or NULL if it is corrupt
+ */
+struct bitmap *ewah_decode(const unsigned char *buf, size_t len) {
+  size_t size = ewah_serialized_size(buf, len);
+  if (!size)
+    return NULL;
+  size_t max_words = ((size_t)get_be32(buf) + 63) / 64;
+  size_t nr = get_be32(buf + 4);
+  const unsigned char *words = buf + EWAH_HEADER_SIZE;
+
+  struct bitmap *b = bitmap_new();
+  bitmap_grow(b, max_words);
+  size_t pos = 0;
+  for (size_t i = 0; i < nr;) {
+    uint64_t marker = get_be64(words + i++ * 8);
+    uint64_t run = marker >> 1 & RLW_RUN_MAX;
+    uint64_t literals = marker >> 33;
+    if (run + literals > max_words - pos || literals > nr - i) {
+      bitmap_free(b);
+      return NULL;
+    }
+    if (marker & 1)
+      memset(b->words + pos, 0xff, run * sizeof(*b->words));
+    pos += run;
+    for (uint64_t k = 0; k < literals; k++)
+      b->words[pos++] = get_be64(words + i++ * 8);
+  }
+  return b;
+}
@@ -11,6 +11,10 @@
 
 #include <curl/curl.h>
 #include <errno.h>
+#include <limits.h>
+#include <openssl/sha.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,12 +37,18 @@
 #define GIT_DIR ".git"
 #define OBJECTS_DIR ".git/objects"
 #define REFS_DIR ".git/refs"
+#define REMOTE_REFS_PREFIX "refs/remotes/origin/"
+#define REMOTE_FETCH_REFSPEC "+refs/heads/*:refs/remotes/origin/*"
+#define INDEX_FILE ".git/index"
+#define SHALLOW_FILE ".git/shallow"  // Commits whose parents were not fetched
+#define INDEX_LOCK_FILE ".git/index.lock"
 
 /*
  * Compression and Hashing Constants
  */
 #define HASH_LENGTH 40              // Length of hex-encoded SHA-1 hash
-#define COMPRESSED_CHUNK_SIZE 1024  // Chunk size for zlib operations
+#define STREAM_BUFFER_SIZE 65536    // Chunk size for streaming large objects
+#define BLOB_MMAP_THRESHOLD (1 << 20)  // Files this large are mmap'd
 
 /*
  * SHA-1 Hash Sizes
@@ -53,6 +63,13 @@
 #define GIT_MODE_TREE "040000"  // File mode for directories
 #define GIT_MODE_BLOB "100644"  // File mode for regular files
 
+// Numeric tree entry modes
+#define TREE_MODE_DIR 040000       // Subdirectory (tree)
+#define TREE_MODE_FILE 0100644     // Regular file
+#define TREE_MODE_EXEC 0100755     // Executable file
+#define TREE_MODE_SYMLINK 0120000  // Symbolic link
+#define TREE_MODE_GITLINK 0160000  // Submodule commit
+
 /*
  * Git Pack File Constants
  * Pack files are used for efficient storage and transfer of Git objects
@@ -60,6 +77,18 @@
 #define PACK_SIGNATURE 0x5041434B  // "PACK" in hex
 #define PACK_VERSION 2             // Pack file version
 #define PACK_HEADER_SIZE 12        // Size of pack header in bytes
+#define PACK_DIR ".git/objects/pack"  // Directory holding packs and indexes
+#define PACK_WINDOW_SIZE 65536     // Inflate window for streaming pack data
+#define PACK_ENTRY_HEADER_MAX 32   // Max bytes of an entry header + base ref
+
+/*
+ * Git Pack Index Constants
+ * Version-2 .idx files map object SHA-1s to offsets within a pack
+ */
+#define PACK_IDX_SIGNATURE 0xff744f63   // "\377tOc"
+#define PACK_IDX_VERSION 2              // Pack index version
+#define PACK_IDX_LARGE_OFFSET 0x80000000u  // Offset needs the 64-bit table
+#define PACK_IDX_MIN_SIZE (8 + 256 * 4 + 2 * SHA_DIGEST_LENGTH)
 
 /*
  * Object Types in Pack Files
@@ -94,25 +123,40 @@
  */
 #define INITIAL_BUFFER_SIZE 8192  // Initial allocation for dynamic buffers
 #define URL_BUFFER_SIZE 1024      // Maximum URL length
+#define LARGE_PACKET_MAX 65520    // Maximum pkt-line length
+#define FETCH_MAX_HAVES 256       // Local commits offered during fetch
+
+/**
+ * Object ID Structure
+ * A binary SHA-1 object name with value semantics (it can be assigned and
+ * passed by value). Raw 20-byte IDs inside object data, such as tree
+ * entries, may be viewed through a pointer to it.
+ */
+struct object_id {
+  unsigned char hash[SHA_DIGEST_LENGTH];
+};
 
 /**
  * Git Object Structure
  * Represents a decompressed Git object with its type, size, and content.
  */
 typedef struct {
-  char *type;      // Object type: "blob", "tree", or "commit"
-  size_t size;     // Size of content in bytes
-  char *content;   // Object content (null-terminated for text objects)
+  const char *type;  // Object type: "blob", "tree", "commit" or "tag" (static)
+  size_t size;       // Size of content in bytes
+  char *content;     // Object content (always followed by a null byte)
 } git_object;
 
 /**
  * Tree Entry Structure
  * Represents a single entry in a Git tree object (file or directory).
+ * Names and object IDs point into the parsed object's content, which
+ * must outlive the entry.
  */
 typedef struct {
-  char mode[7];   // File mode (e.g., "100644" for files, "040000" for dirs)
-  char *name;     // Entry name (filename or directory name)
-  char *hash;     // SHA-1 hash of the referenced object (40 hex chars)
+  unsigned int mode;         // File mode (e.g., TREE_MODE_FILE, TREE_MODE_DIR)
+  const char *name;          // Entry name (null-terminated, in the object)
+  size_t name_len;           // Length of name
+  const struct object_id *oid;  // Object ID (in the object)
 } tree_entry;
 
 /**
@@ -131,9 +175,56 @@ typedef struct {
  */
 
 /**
- * Compute SHA-1 hash of data and return as hex string.
+ * Hash Context Structure
+ * State of an incremental hash (see hash.c).
  */
-char *compute_sha1(const char *data, size_t len);
+struct git_hash_ctx {
+  SHA_CTX sha1;
+};
+
+/** Start an incremental hash. */
+void git_hash_init(struct git_hash_ctx *ctx);
+
+/** Add data to an incremental hash. */
+void git_hash_update(struct git_hash_ctx *ctx, const void *data, size_t len);
+
+/** Finish an incremental hash into SHA_DIGEST_LENGTH bytes. */
+void git_hash_final(unsigned char *hash, struct git_hash_ctx *ctx);
+
+/** Hash a buffer in one call. */
+void git_hash_buffer(const void *data, size_t len, unsigned char *hash);
+
+/** Compute an object's ID from its type name and content. */
+void git_hash_object(const char *type, const void *data, size_t len,
+                     struct object_id *oid);
+
+/** Refuse object formats other than SHA-1 (NULL: the default). */
+int check_object_format(const char *name, const char *where);
+
+/** Compute SHA-1 hash of data and return as hex string. */
+char *sha1_hash(const char *data, size_t len);
+
+/** Format a binary SHA-1 as a 40-character hex string. */
+char *sha_to_hex(const unsigned char *sha, char *hex);
+
+/** Format an object ID as a 40-character hex string. */
+char *oid_to_hex(const struct object_id *oid, char *hex);
+
+/** Parse 40 hex digits into a binary SHA-1 (0 on success, -1 if invalid). */
+int hex_to_sha(const char *hex, unsigned char *sha);
+
+/** Parse 40 hex digits into an object ID (0 on success, -1 if invalid). */
+int get_oid_hex(const char *hex, struct object_id *oid);
+
+/** Compare two object IDs like memcmp(). */
+static inline int oidcmp(const struct object_id *a, const struct object_id *b) {
+  return memcmp(a->hash, b->hash, SHA_DIGEST_LENGTH);
+}
+
+/** Whether two object IDs are equal. */
+static inline int oideq(const struct object_id *a, const struct object_id *b) {
+  return oidcmp(a, b) == 0;
+}
 
 /*
  * ============================================================================
@@ -150,14 +241,167 @@ void free_git_object(git_object *obj);
 /** Get filesystem path for an object given its hash. */
 char *get_object_path(const char *hash);
 
+/** Callback for for_each_loose_object(); non-zero stops the iteration. */
+typedef int (*each_loose_object_fn)(const struct object_id *oid,
+                                    const char *path, void *data);
+
+/** Call a function for every loose object. */
+int for_each_loose_object(each_loose_object_fn fn, void *data);
+
 /** Create a blob object from a file and store it. */
 char *create_blob_from_file(const char *filepath);
 
+/** Compute the blob ID of a work tree file without storing it. */
+int hash_blob_file(const char *path, const struct stat *st,
+                   struct object_id *oid);
+
 /** Store a Git object in the object database. */
 int store_object(const char *hash, const char *data, size_t len);
 
-/** Write compressed data to a file using zlib. */
-int write_compressed_object(const char *path, const char *data, size_t len);
+/** Store an object given as separate header and content. */
+int store_object_parts(const struct object_id *oid, const void *header,
+                       size_t header_len, const void *content, size_t len);
+
+/** Write a whole buffer to a file descriptor. */
+int write_in_full(int fd, const void *buf, size_t len);
+
+/** Get the calling thread's reusable inflate stream, freshly reset. */
+z_stream *get_inflate_stream(void);
+
+/*
+ * ============================================================================
+ * Compression (compress.c)
+ * ============================================================================
+ */
+
+/** zlib level for loose objects (core.looseCompression). */
+int loose_compression_level(void);
+
+/** zlib level for pack entries (pack.compression). */
+int pack_compression_level(void);
+
+/** Compress a buffer in zlib format (libdeflate if built with it). */
+unsigned char *compress_buffer(const void *data, size_t len, int level,
+                               size_t *out_len);
+
+/** Inflate a zlib stream to exactly out_len bytes (0 on success). */
+int uncompress_buffer(const unsigned char *in, size_t in_len, void *out,
+                      size_t out_len);
+
+/*
+ * ============================================================================
+ * Object Database Backends
+ * ============================================================================
+ */
+
+/**
+ * Object Database Backend
+ * A source of objects consulted by read_object(). Backends are queried in
+ * registration order until one of them has the requested object.
+ */
+struct odb_backend {
+  const char *name;  // Backend name for diagnostics
+  /** Return 1 if the backend holds the object, 0 otherwise. */
+  int (*has_object)(struct odb_backend *backend, const struct object_id *oid);
+  /** Read an object, or return NULL if the backend does not hold it. */
+  git_object *(*read_object)(struct odb_backend *backend,
+                             const struct object_id *oid);
+  /**
+   * Look up an object's type and size without reading its content.
+   * Return 0 on success, 1 if the backend does not hold the object.
+   * May be NULL, in which case read_object() is used.
+   */
+  int (*read_object_info)(struct odb_backend *backend,
+                          const struct object_id *oid, const char **type,
+                          size_t *size);
+  struct odb_backend *next;  // Next backend in lookup order
+};
+
+/** Loose objects under .git/objects/XX/ (objects.c). */
+extern struct odb_backend loose_odb_backend;
+
+/** Packed objects under .git/objects/pack (packfile.c). */
+extern struct odb_backend packed_odb_backend;
+
+/** Objects fetched on demand from a promisor remote (promisor.c). */
+extern struct odb_backend promisor_odb_backend;
+
+/** Append a backend to the lookup order. */
+void odb_add_backend(struct odb_backend *backend);
+
+/** Read an object by binary SHA-1 from the first backend that has it. */
+git_object *odb_read_object(const struct object_id *oid);
+
+/** Read an object that will not be read again, without caching it. */
+git_object *odb_read_object_once(const struct object_id *oid);
+
+/** Look up an object's type and size without reading its content. */
+int odb_read_object_info(const struct object_id *oid, const char **type,
+                         size_t *size);
+
+/** Start a bulk write session that remembers existing objects. */
+void odb_transaction_begin(void);
+
+/** End a bulk write session, flushing and installing its objects. */
+int odb_transaction_end(void);
+
+/** Whether a bulk write session is active. */
+int odb_in_transaction(void);
+
+/** Rename a written loose object into place (deferred in a transaction). */
+int odb_finalize_object(const char *tmp_path, const char *path);
+
+/** Whether an object is already stored and need not be written. */
+int odb_object_known(const struct object_id *oid);
+
+/** Record that an object has been stored. */
+void odb_object_stored(const struct object_id *oid);
+
+/*
+ * ============================================================================
+ * Object Cache (object-cache.c)
+ * ============================================================================
+ */
+
+#define OBJECT_CACHE_LIMIT (32 * 1024 * 1024)  // Default budget: trees etc.
+#define BLOB_CACHE_LIMIT (16 * 1024 * 1024)    // Default budget: blobs
+#define OBJECT_CACHE_BUCKETS 4096  // Hash buckets (power of two)
+
+/** Look up a recently read object (returns a copy the caller frees). */
+git_object *object_cache_get(const struct object_id *oid);
+
+/** Look up the type and size of a recently read object. */
+int object_cache_get_info(const struct object_id *oid, const char **type,
+                          size_t *size);
+
+/** Remember a copy of an object that was just read. */
+void object_cache_put(const struct object_id *oid, const git_object *obj);
+
+/**
+ * Object ID Set Structure
+ * Hash set of object IDs (not thread-safe).
+ */
+struct oid_set {
+  struct object_id *oids;  // Slots
+  unsigned char *used;  // Whether each slot is occupied
+  size_t size;          // Number of slots (power of two)
+  size_t nr;            // Number of members
+};
+
+/** Initialize an empty object ID set. */
+void oid_set_init(struct oid_set *set);
+
+/** Free an object ID set's storage. */
+void oid_set_clear(struct oid_set *set);
+
+/** Whether an object ID is in a set. */
+int oid_set_contains(const struct oid_set *set, const struct object_id *oid);
+
+/** Add an object ID to a set; returns 1 if it was not yet present. */
+int oid_set_insert(struct oid_set *set, const struct object_id *oid);
+
+/** Check whether any backend holds an object. */
+int odb_has_object(const struct object_id *oid);
 
 /*
  * ============================================================================
@@ -165,6 +409,9 @@ int write_compressed_object(const char *path, const char *data, size_t len);
  * ============================================================================
  */
 
+/** Type name of the object a tree entry mode refers to. */
+const char *tree_entry_type(unsigned int mode);
+
 /** Parse a git_object into a tree_object structure. */
 tree_object *parse_tree_object(git_object *obj);
 
@@ -174,12 +421,66 @@ void free_tree_object(tree_object *tree);
 /** Handle the write-tree command. */
 int handle_write_tree(void);
 
-/** Recursively create tree objects from a directory. */
-char *write_tree_recursive(const char *dir_path);
+/** Create tree objects for the working directory using the index cache. */
+char *write_working_tree(int workers);
 
 /** Check if a path should be ignored (e.g., .git directory). */
 int should_ignore_path(const char *path);
 
+/*
+ * ============================================================================
+ * Index Functions
+ * ============================================================================
+ */
+
+#define INDEX_SIGNATURE 0x44495243  // "DIRC"
+#define INDEX_VERSION 2             // Index version written
+
+/**
+ * Index Entry Structure
+ * Cached stat data and blob ID of one work tree file.
+ */
+struct index_entry {
+  uint32_t ctime_sec, ctime_nsec;
+  uint32_t mtime_sec, mtime_nsec;
+  uint32_t dev, ino;
+  uint32_t mode;          // S_IFREG | 0644 or 0755, or S_IFLNK
+  uint32_t uid, gid;
+  uint32_t size;          // File size (truncated to 32 bits)
+  struct object_id oid;   // Blob ID of the content
+  char *path;             // Path relative to the top of the work tree
+};
+
+/**
+ * Index State Structure
+ * In-memory copy of .git/index.
+ */
+struct index_state {
+  struct index_entry *entries;  // Entries sorted by path
+  size_t nr;
+  struct timespec mtime;        // When the index file was last written
+};
+
+/** Load .git/index (a missing index is empty). */
+int read_index(struct index_state *istate);
+
+/** Sort and atomically write an index to .git/index. */
+int write_index(struct index_state *istate);
+
+/** Free all entries of an index. */
+void discard_index(struct index_state *istate);
+
+/** Find the index entry for a path, or NULL. */
+const struct index_entry *index_find(const struct index_state *istate,
+                                     const char *path);
+
+/** Record a file's stat data in an index entry. */
+void fill_index_stat(struct index_entry *ie, const struct stat *st);
+
+/** Whether a file's stat data still matches its index entry. */
+int index_entry_uptodate(const struct index_state *istate,
+                         const struct index_entry *ie, const struct stat *st);
+
 /*
  * ============================================================================
  * Commit Object Functions
@@ -190,40 +491,723 @@ int should_ignore_path(const char *path);
 char *create_commit_object(const char *tree_sha, const char *parent_sha,
                            const char *message);
 
+/*
+ * ============================================================================
+ * HTTP Transport (transport.c)
+ * ============================================================================
+ */
+
+/** Persistent HTTP connection to one remote (opaque). */
+struct transport;
+
+/** libcurl write callback receiving response data. */
+typedef size_t (*transport_write_fn)(char *ptr, size_t size, size_t nmemb,
+                                     void *data);
+
+/** Shared transport for a repository URL, created on first use. */
+struct transport *transport_get(const char *url);
+
+/** Send a GET (body NULL) or POST request to a path below the URL. */
+int transport_request(struct transport *t, const char *path,
+                      const char *const *headers, const char *body,
+                      size_t body_len, transport_write_fn write_fn,
+                      void *data);
+
 /*
  * ============================================================================
  * Clone and Checkout Functions
  * ============================================================================
  */
 
-/** Recursively checkout a tree to the working directory. */
-int checkout_tree(const char *tree_hash, const char *prefix);
+/** Checkout a tree to the working directory using parallel writers. */
+int checkout_tree(const char *tree_hash, const char *prefix, int workers);
+
+/** Switch the work tree between trees, touching only the paths that differ. */
+int switch_tree(const struct object_id *old_tree,
+                const struct object_id *new_tree, int workers);
+
+/** Handle the clone command. */
+int handle_clone(int argc, char *argv[]);
+
+/** Handle the fetch command. */
+int handle_fetch(int argc, char *argv[]);
 
 /**
- * Pack File Structure
- * Holds pack file data and associated commit hash for clone operations.
+ * Fetch Options Structure
+ * Tunables for talking to a remote and fetching and indexing a pack.
  */
-struct PackFile {
-  char *data;         // Pack file data
-  size_t size;        // Size of pack file
-  char *commit_hash;  // Commit hash being cloned
+struct fetch_options {
+  int threads;  // Pack indexing threads (0 = online CPUs)
+  const char *const *ref_prefixes;  // NULL-terminated ref name prefixes to
+                                    // list, or NULL for every ref
+  int depth;           // Commits of history to fetch (0 = all)
+  const char *filter;  // Object filter such as "blob:none", or NULL
+  int promisor;        // Mark fetched packs as promisor packs
+  int verbosity;       // < 0 quiet, 0 normal, > 0 protocol details
+  int progress;        // Show progress meters on stderr
+  struct fetch_stats *stats;  // Output: counters of the fetch, or NULL
 };
 
-/** Handle the clone command. */
-int handle_clone(int argc, char *argv[]);
+/**
+ * Fetch Statistics Structure
+ * Counters filled in by fetch_pack().
+ */
+struct fetch_stats {
+  uint64_t bytes_received;  // Pack bytes received
+  uint32_t objects;         // Objects in the received pack
+  uint32_t deltas;          // Deltas resolved while indexing
+  uint32_t thin_objects;    // Local objects added to complete a thin pack
+  uint64_t elapsed_ns;      // Wall time from request to installed pack
+};
+
+/**
+ * Remote Ref Structure
+ * One ref from a remote's ref advertisement.
+ */
+struct remote_ref {
+  char *name;            // Full ref name, e.g. "refs/heads/main" or "HEAD"
+  struct object_id oid;  // Object the ref points at
+};
+
+/**
+ * Remote Refs Structure
+ * A remote's ref advertisement.
+ */
+struct remote_refs {
+  struct remote_ref *refs;
+  size_t nr, alloc;
+  struct transport *transport;  // Connection the refs were read over
+  int version;         // Protocol version the server speaks (0 or 2)
+  char *capabilities;  // v0: space-separated capabilities sent with the
+                       // first ref; v2: one capability per line; or NULL
+  char *head;          // Target of the remote HEAD symref, or NULL
+};
+
+/** Fetch a remote's capabilities and the refs matching opts->ref_prefixes. */
+int get_remote_refs(const char *url, const struct fetch_options *opts,
+                    struct remote_refs *remote);
+
+/** Free a ref advertisement. */
+void free_remote_refs(struct remote_refs *remote);
+
+/** Whether the remote advertised a capability. */
+int remote_supports(const struct remote_refs *remote, const char *capability);
+
+/** Whether a protocol v2 command (e.g. "fetch") supports a feature. */
+int remote_command_supports(const struct remote_refs *remote,
+                            const char *command, const char *feature);
+
+/** Find an advertised ref by name. */
+const struct remote_ref *find_remote_ref(const struct remote_refs *remote,
+                                         const char *name);
+
+/** Find the branch the remote HEAD points at (or HEAD itself). */
+const struct remote_ref *find_remote_head(const struct remote_refs *remote);
+
+/** Collect local commits to advertise as "have" during negotiation. */
+size_t collect_haves(struct object_id **haves);
+
+/** Read the commits listed in .git/shallow into a set. */
+size_t read_shallow(struct oid_set *shallow);
+
+/** Fetch the objects reachable from wants but not from haves. */
+int fetch_pack(const char *url, const struct remote_refs *remote,
+               const struct object_id *wants, size_t nr_wants,
+               const struct object_id *haves, size_t nr_haves,
+               const struct fetch_options *opts);
+
+/** Whether this repository is a partial clone with a promisor remote. */
+int has_promisor_remote(void);
+
+/** Fetch objects missing from a partial clone from its promisor remote. */
+int promisor_fetch_objects(const struct object_id *oids, size_t nr);
+
+/*
+ * ============================================================================
+ * References (refs.c)
+ * ============================================================================
+ */
+
+/** Callback for for_each_ref(); returning non-zero stops the iteration. */
+typedef int (*each_ref_fn)(const char *name, const struct object_id *oid,
+                           void *data);
+
+/** Resolve a ref to an object ID, following symbolic refs. */
+int read_ref(const char *name, struct object_id *oid);
+
+/** Point a ref at an object. */
+int update_ref(const char *name, const struct object_id *oid);
+
+/** Make a ref a symbolic ref to another ref. */
+int create_symref(const char *name, const char *target);
+
+/** Call a function for every ref below a prefix. */
+int for_each_ref(const char *prefix, each_ref_fn fn, void *data);
+
+/** Resolve an object ID or abbreviated ref name given by the user. */
+int resolve_revision(const char *name, struct object_id *oid);
+
+/** Return str past prefix if it starts with it, otherwise NULL. */
+static inline const char *skip_prefix(const char *str, const char *prefix) {
+  size_t len = strlen(prefix);
+  return strncmp(str, prefix, len) == 0 ? str + len : NULL;
+}
+
+/*
+ * ============================================================================
+ * Commits (commit.c) and the Commit-Graph (commit-graph.c)
+ * ============================================================================
+ */
+
+#define COMMIT_GRAPH_FILE ".git/objects/info/commit-graph"
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF  // Commit not in the graph
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF       // Largest stored generation
+#define WALK_TOPO_ORDER 0x1  // walk_commits(): no parent before its children
+
+/**
+ * Commit Info Structure
+ * The parts of a commit that history walks need.
+ */
+struct commit_info {
+  struct object_id tree;           // Root tree
+  size_t nr_parents;
+  struct object_id parents[2];     // First two parents
+  struct object_id *more_parents;  // Parents beyond the second, or NULL
+  uint64_t date;                   // Committer timestamp
+  uint32_t generation;             // GENERATION_NUMBER_INFINITY if unknown
+};
+
+/** Get a commit's i-th parent (0-based, i < nr_parents). */
+static inline const struct object_id *
+commit_parent(const struct commit_info *info, size_t i) {
+  return i < 2 ? &info->parents[i] : &info->more_parents[i - 2];
+}
+
+/** Callback for walk_commits(); returning non-zero stops the walk. */
+typedef int (*commit_fn)(const struct object_id *oid,
+                         const struct commit_info *info, void *data);
+
+/** Read a commit's tree, parents, date and generation. */
+int read_commit_info(const struct object_id *oid, struct commit_info *info);
+
+/** Free the memory held by a commit_info. */
+void commit_info_release(struct commit_info *info);
+
+/** Follow annotated tags to the commit they name. */
+int peel_to_commit(struct object_id *oid);
+
+/** Follow annotated tags and commits to the tree they name. */
+int peel_to_tree(struct object_id *oid);
+
+/** Walk the commits reachable from tips but not from excludes. */
+int walk_commits(const struct object_id *tips, size_t nr_tips,
+                 const struct object_id *excludes, size_t nr_excludes,
+                 int flags, commit_fn fn, void *data);
+
+/**
+ * Callback for object walks; type is OBJ_COMMIT..OBJ_TAG and path the
+ * tree or blob's path, if known. Returning non-zero stops the walk.
+ */
+typedef int (*object_fn)(const struct object_id *oid, int type,
+                         const char *path, void *data);
+
+/** Walk the commits, trees and blobs reachable from tips but not excludes. */
+int walk_objects(const struct object_id *tips, size_t nr_tips,
+                 const struct object_id *excludes, size_t nr_excludes,
+                 int flags, object_fn fn, void *data);
+
+/** Whether commit a is reachable from commit b (1), not (0), or error (-1). */
+int is_ancestor(const struct object_id *a, const struct object_id *b);
 
-/** libcurl write callback for receiving HTTP data. */
-size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata);
+/** Look up a commit in the commit-graph (0 if found). */
+int commit_graph_lookup(const struct object_id *oid, struct commit_info *info);
 
-/** Fetch remote repository references. */
-char *get_remote_refs(const char *url);
+/** Write the commit-graph for all commits reachable from the refs. */
+int write_commit_graph(void);
 
-/** Fetch pack file from remote repository. */
-struct PackFile *fetch_pack(const char *url);
+/** Unmap the commit-graph so that it is reloaded on next use. */
+void close_commit_graph(void);
 
-/** Process and extract objects from pack file. */
+/*
+ * ============================================================================
+ * Tree Diffs (diff.c)
+ * ============================================================================
+ */
+
+#define DIFF_RECURSIVE 0x1  // diff_trees(): report files inside subtrees
+
+/**
+ * Diff Change Structure
+ * One path that differs. A side without the path has mode 0 and a zero
+ * object ID.
+ */
+struct diff_change {
+  char status;  // 'A'dded, 'D'eleted, 'M'odified, 'T'ype changed, or '?'
+                // (diff_worktree(): not in the tree; directories end in '/')
+  unsigned old_mode, new_mode;
+  struct object_id old_oid, new_oid;
+  const char *path;  // Path relative to the top of the trees
+};
+
+/** Callback for diffs; returning non-zero stops the diff. */
+typedef int (*diff_fn)(const struct diff_change *change, void *data);
+
+/** Report the paths that differ between two trees (NULL: empty tree). */
+int diff_trees(const struct object_id *old_tree,
+               const struct object_id *new_tree, int flags, diff_fn fn,
+               void *data);
+
+/** Report the paths in which the work tree differs from a tree. */
+int diff_worktree(const struct object_id *tree, diff_fn fn, void *data);
+
+/*
+ * ============================================================================
+ * Bitmaps (ewah.c) and Reachability Bitmaps (pack-bitmap.c)
+ * ============================================================================
+ */
+
+/**
+ * Bitmap Structure
+ * An uncompressed bit set that grows as bits are set.
+ */
+struct bitmap {
+  uint64_t *words;    // Bit n is bit n % 64 of words[n / 64]
+  size_t word_alloc;  // Words allocated; bits beyond them are clear
+};
+
+/** Create an empty bitmap. */
+struct bitmap *bitmap_new(void);
+
+/** Free a bitmap (NULL is ignored). */
+void bitmap_free(struct bitmap *b);
+
+/** Copy a bitmap. */
+struct bitmap *bitmap_dup(const struct bitmap *b);
+
+/** Set a bit. */
+void bitmap_set(struct bitmap *b, size_t pos);
+
+/** Test a bit. */
+int bitmap_get(const struct bitmap *b, size_t pos);
+
+/** dst |= src */
+void bitmap_or(struct bitmap *dst, const struct bitmap *src);
+
+/** dst ^= src */
+void bitmap_xor(struct bitmap *dst, const struct bitmap *src);
+
+/** dst &= ~src */
+void bitmap_and_not(struct bitmap *dst, const struct bitmap *src);
+
+/** Number of set bits. */
+size_t bitmap_popcount(const struct bitmap *b);
+
+/** Compress a bitmap with EWAH in Git's serialization. */
+unsigned char *ewah_encode(const struct bitmap *b, size_t *len);
+
+/** Size of a serialized EWAH bitmap, or 0 if it is truncated. */
+size_t ewah_serialized_size(const unsigned char *buf, size_t len);
+
+/** Decompress a serialized EWAH bitmap (NULL if corrupt). */
+struct bitmap *ewah_decode(const unsigned char *buf, size_t len);
+
+/** Objects reachable from tips but not excludes, or NULL without bitmaps. */
+struct bitmap *bitmap_find_reachable(const struct object_id *tips,
+                                     size_t nr_tips,
+                                     const struct object_id *excludes,
+                                     size_t nr_excludes);
+
+/** Call fn for the objects (of one type, or all if 0) of a result. */
+int bitmap_for_each_object(const struct bitmap *objects, int type,
+                           object_fn fn, void *data);
+
+/** Count the objects (of one type, or all if 0) of a result. */
+size_t bitmap_count_objects(const struct bitmap *objects, int type);
+
+/** Write reachability bitmaps for a repository held in a single pack. */
+int write_pack_bitmap(void);
+
+/** Unload the bitmap index so that it is reloaded on next use. */
+void close_bitmap_index(void);
+
+/*
+ * ============================================================================
+ * Configuration (config.c)
+ * ============================================================================
+ */
+
+/** Look up a value in .git/config. */
+char *config_get(const char *key);
+
+/** Look up a numeric value (with optional k/m/g suffix) in .git/config. */
+unsigned long config_get_ulong(const char *key, unsigned long def);
+
+/** Set a value in .git/config. */
+int config_set(const char *key, const char *value);
+
+/*
+ * ============================================================================
+ * Pack File Functions
+ * ============================================================================
+ */
+
+/**
+ * Pack Stream Parser States
+ * The parser is a state machine advanced one input chunk at a time.
+ */
+enum pack_stream_state {
+  PACK_STATE_HEADER,      // Reading signature, version and object count
+  PACK_STATE_OBJ_HEADER,  // Reading an object's type/size varint
+  PACK_STATE_OFS,         // Reading an OFS_DELTA base offset
+  PACK_STATE_REF,         // Reading a REF_DELTA base SHA-1
+  PACK_STATE_DATA,        // Inflating an object's zlib stream
+  PACK_STATE_TRAILER,     // Reading the trailing pack checksum
+  PACK_STATE_DONE,        // Pack fully received and verified
+  PACK_STATE_ERROR        // Malformed or unsupported input
+};
+
+/*
+ * Delta Base Cache Constants
+ */
+#define DELTA_BASE_CACHE_LIMIT (96 * 1024 * 1024)  // Default byte budget
+#define DELTA_CACHE_BUCKETS 1024  // Hash buckets (power of two)
+
+/**
+ * Delta Base Cache Entry
+ * A reconstructed object, found by the pack and offset it was read from.
+ */
+struct delta_base_entry {
+  const void *pack;       // Pack the offset refers to
+  size_t offset;          // Offset of the object in that pack
+  int type;               // Pack object type (OBJ_COMMIT..OBJ_TAG)
+  unsigned char *data;    // Object content
+  size_t size;            // Size of content
+  struct delta_base_entry *offset_next;  // Offset hash chain
+  struct delta_base_entry *lru_prev;     // Towards most recently used
+  struct delta_base_entry *lru_next;     // Towards least recently used
+};
+
+/**
+ * Delta Base Cache Structure
+ * Bounded LRU cache of recently reconstructed delta bases.
+ */
+struct delta_base_cache {
+  struct delta_base_entry *by_offset[DELTA_CACHE_BUCKETS];
+  struct delta_base_entry *lru_head;  // Most recently used
+  struct delta_base_entry *lru_tail;  // Least recently used
+  size_t size;     // Bytes of content currently cached
+  size_t limit;    // Maximum bytes of content
+  size_t count;    // Number of entries
+  size_t hits;     // Successful lookups
+  size_t misses;   // Failed lookups
+};
+
+/** Apply a delta to a base object, returning the reconstructed content. */
+unsigned char *apply_delta(const unsigned char *base, size_t base_size,
+                           const unsigned char *delta, size_t delta_size,
+                           size_t *out_size);
+
+/** Read the size of the object a delta reconstructs from its header. */
+int delta_result_size(const unsigned char *delta, size_t delta_size,
+                      size_t *size);
+
+/** Hashed blocks of a delta base (opaque). */
+struct delta_index;
+
+/** Index a base object for create_delta() (NULL if it cannot be a base). */
+struct delta_index *create_delta_index(const void *base, size_t base_size);
+
+/** Free a delta index (NULL is ignored). */
+void free_delta_index(struct delta_index *index);
+
+/** Compute a delta from an indexed base, or NULL if over max_size. */
+unsigned char *create_delta(const struct delta_index *index,
+                            const void *target, size_t target_size,
+                            size_t max_size, size_t *delta_size);
+
+/** Initialize a delta base cache with the given byte budget. */
+void delta_base_cache_init(struct delta_base_cache *cache, size_t limit);
+
+/** Look up a cached object by pack and offset. */
+const struct delta_base_entry *
+delta_base_cache_get_offset(struct delta_base_cache *cache, const void *pack,
+                            size_t offset);
+
+/** Insert an object into the cache (takes ownership of data). */
+void delta_base_cache_put(struct delta_base_cache *cache, const void *pack,
+                          size_t offset, int type, unsigned char *data,
+                          size_t size);
+
+/** Remove every entry from the cache. */
+void delta_base_cache_clear(struct delta_base_cache *cache);
+
+/**
+ * Pack Entry Structure
+ * Per-object record kept while parsing, used to resolve deltas and to
+ * write the pack index.
+ */
+struct pack_entry {
+  size_t offset;          // Pack offset of the object header
+  uint32_t crc;           // CRC32 of the raw (compressed) entry
+  struct object_id oid;   // Object ID once resolved
+  unsigned char type;     // Type as stored in the pack (may be a delta)
+  unsigned char real_type;  // Resolved object type (OBJ_COMMIT..OBJ_TAG)
+  unsigned char resolved; // Whether oid/real_type are final
+  atomic_uchar claimed;   // REF_DELTA: taken by a resolver thread
+  size_t base_offset;     // OFS_DELTA: pack offset of the base
+  struct object_id base_oid;  // REF_DELTA: base object ID
+};
+
+/**
+ * Pack Stream Structure
+ * Incremental parser state for a pack file received in arbitrary chunks.
+ */
+struct pack_stream {
+  enum pack_stream_state state;
+  unsigned char hdr[PACK_HEADER_SIZE];  // Partial pack header
+  size_t hdr_len;         // Bytes collected for the current field
+  uint32_t version;       // Pack version from header
+  uint32_t num_objects;   // Object count from header
+  uint32_t objects_done;  // Objects fully parsed so far
+  size_t offset;          // Pack bytes consumed (excluding preamble)
+  struct git_hash_ctx pack_ctx;  // Running checksum of pack bytes
+  unsigned char trailer[SHA_DIGEST_LENGTH];  // Received pack checksum
+
+  // Output pack file
+  FILE *out;              // Temporary pack file being written
+  char *tmp_path;         // Path of the temporary pack file
+  int write_error;        // Set if writing the pack failed
+  char pack_name[GIT_HASH_LENGTH + 1];  // Hex checksum naming the pack
+
+  // Current object
+  size_t obj_offset;      // Pack offset of the object header
+  unsigned char type;     // Pack object type (OBJ_*)
+  size_t obj_size;        // Inflated size from object header
+  int shift;              // Bit shift for size varint
+  size_t base_offset;     // OFS_DELTA: pack offset of the base object
+  struct object_id base_oid;  // REF_DELTA: base object ID
+  uint32_t crc;           // CRC32 of the entry so far
+  struct git_hash_ctx obj_ctx;  // Running object ID of a base object
+  z_stream strm;          // Inflate state for the object data
+  int inflating;          // Whether strm is initialized
+  unsigned char *window;  // Scratch buffer for inflated output
+
+  struct pack_entry *entries;  // Objects seen so far, in offset order
+  size_t nr_entries, alloc_entries;
+
+  int threads;            // Delta resolution threads (0 = online CPUs)
+  int show_progress;      // Show progress meters on stderr
+  struct progress *progress;  // "Receiving objects" meter, while receiving
+
+  // Results of delta resolution
+  uint32_t nr_deltas;     // Deltas resolved
+  uint32_t nr_thin;       // Local objects appended to complete a thin pack
+};
+
+/**
+ * Raw Pack Entry Structure
+ * One inflated pack entry read back from disk, before delta resolution.
+ */
+struct pack_raw_entry {
+  int type;               // Type as stored in the pack
+  size_t size;            // Inflated size
+  size_t base_offset;     // OFS_DELTA: pack offset of the base
+  struct object_id base_oid;  // REF_DELTA: base object ID
+  unsigned char *data;    // Inflated content (or delta instructions)
+};
+
+/**
+ * Packed Git Structure
+ * A memory-mapped pack file and index, available for object lookup.
+ * Table pointers refer directly into the index mapping (network byte order).
+ */
+struct packed_git {
+  char *pack_path;        // Path of the .pack file
+  unsigned char *pack_map;  // Read-only mapping of the .pack file
+  size_t pack_size;       // Size of the .pack file
+  unsigned char *idx_map; // Read-only mapping of the .idx file
+  size_t idx_size;        // Size of the .idx file
+  uint32_t num_objects;   // Objects in the pack
+  const unsigned char *fanout;     // 256-entry fanout table
+  const unsigned char *shas;       // Sorted SHA-1 table
+  const unsigned char *offsets;    // 32-bit offset table
+  const unsigned char *offsets64;  // 64-bit offset table
+  struct packed_git *next;
+};
+
+/** Initialize a streaming pack parser writing to .git/objects/pack. */
+int pack_stream_init(struct pack_stream *ps);
+
+/** Feed the next chunk of pack data to the parser. */
+int pack_stream_feed(struct pack_stream *ps, const unsigned char *data,
+                     size_t len);
+
+/** Resolve deltas, index and install a completely received pack. */
+int pack_stream_finish(struct pack_stream *ps);
+
+/** Release resources held by a streaming pack parser. */
+void pack_stream_release(struct pack_stream *ps);
+
+/** Store and index an in-memory pack file. */
 int process_pack_file(const char *pack_data, size_t pack_size);
 
+/** Map a pack object type to its type name. */
+const char *pack_type_name(int type);
+
+/** Map an object type name to its pack object type. */
+int pack_type_from_name(const char *name);
+
+/** Encode a pack entry's type and size header; returns its length. */
+size_t encode_pack_entry_header(unsigned char *hdr, int type, size_t size);
+
+/** Compute the binary SHA-1 object ID of typed content. */
+void hash_object_data(int type, const unsigned char *data, size_t size,
+                      struct object_id *oid);
+
+/** Read and inflate one raw entry of a mapped pack file by offset. */
+int unpack_raw_entry(const unsigned char *map, size_t map_size, size_t offset,
+                     struct pack_raw_entry *raw);
+
+/** Read entry i of a pack's fanout table. */
+uint32_t pack_fanout(const struct packed_git *p, int i);
+
+/** Find an object's position in a pack index, or -1. */
+long find_pack_entry_pos(const struct packed_git *p,
+                         const struct object_id *oid);
+
+/** Pack offset of the object at an index position. */
+size_t pack_entry_offset(const struct packed_git *p, size_t pos);
+
+/** Type of the object at a pack offset (OBJ_COMMIT..OBJ_TAG), or -1. */
+int pack_object_type(const struct packed_git *p, size_t offset);
+
+/** The loaded packs (valid until reprepare_packed_git()). */
+struct packed_git *get_packed_git(void);
+
+/** Write a version-2 .idx file for a set of pack entries. */
+int write_pack_idx(const char *path, struct pack_entry *entries, size_t nr,
+                   const unsigned char *pack_sha);
+
+/** Drop loaded packs so newly installed ones are found. */
+void reprepare_packed_git(void);
+
+/*
+ * ============================================================================
+ * Repacking (repack.c)
+ * ============================================================================
+ */
+
+#define REPACK_ALL 0x1     // repack(): pack every reachable object
+#define REPACK_DELETE 0x2  // repack(): with REPACK_ALL, delete the old packs
+#define REPACK_KEEP_UNREACHABLE 0x4  // repack(): REPACK_ALL keeps the rest
+
+/** Pack objects into a new pack with delta compression. */
+int repack(int flags, int window, int depth, int threads, int show_progress);
+
+/** Delete the loose objects that are also in a pack. */
+int prune_packed_objects(void);
+
+/*
+ * ============================================================================
+ * Progress Meters (progress.c)
+ * ============================================================================
+ */
+
+/** One-line progress display on stderr (opaque; NULL means disabled). */
+struct progress;
+
+/** Start a progress meter; total is 0 if unknown. */
+struct progress *start_progress(const char *title, uint64_t total);
+
+/** Report the current count; redraws at most every 100 ms. Thread-safe. */
+void display_progress(struct progress *p, uint64_t n);
+
+/** Report bytes transferred so far, shown with the transfer rate. */
+void display_throughput(struct progress *p, uint64_t bytes);
+
+/** Draw the final line and free the meter, setting *p to NULL. */
+void stop_progress(struct progress **p, uint64_t n);
+
+/*
+ * ============================================================================
+ * Performance Tracing (trace.c)
+ * ============================================================================
+ */
+
+#define TRACE_ENVIRONMENT "GIT_TRACE_PERF"  // Path of the trace file
+
+/** Event counts, reported as counter tracks. */
+enum trace_counter {
+  TRACE_OBJECTS_READ,         // Objects read from a backend
+  TRACE_OBJECTS_WRITTEN,      // Loose objects, pack entries indexed or written
+  TRACE_NETWORK_BYTES_IN,     // HTTP response bytes
+  TRACE_NETWORK_BYTES_OUT,    // HTTP request body bytes
+  TRACE_OBJECT_CACHE_HITS,
+  TRACE_OBJECT_CACHE_MISSES,
+  TRACE_DELTA_CACHE_HITS,     // Delta base cache
+  TRACE_DELTA_CACHE_MISSES,
+  TRACE_NR_COUNTERS
+};
+
+/** Calls too frequent for regions, whose time is added up instead. */
+enum trace_timer {
+  TRACE_TIMER_INFLATE,
+  TRACE_TIMER_DEFLATE,
+  TRACE_TIMER_HASH,
+  TRACE_TIMER_OBJECT_WRITE,   // Writing a loose object, deflate included
+  TRACE_NR_TIMERS
+};
+
+/** Whether tracing is on (set once by trace_init()). */
+extern int trace_enabled;
+
+/** Start tracing if GIT_TRACE_PERF names a trace file. */
+void trace_init(int argc, char *argv[]);
+
+/** Begin a timed region on the calling thread. */
+void trace_region_enter(const char *category, const char *label);
+
+/** End the calling thread's innermost region. */
+void trace_region_leave(const char *category, const char *label);
+
+/** Add to a counter (use trace_count()). */
+void trace_counter_add(enum trace_counter counter, uint64_t n);
+
+/** Monotonic clock in nanoseconds. */
+uint64_t trace_now_ns(void);
+
+/** Add a timed call to a timer (use trace_timer_stop()). */
+void trace_timer_add(enum trace_timer timer, uint64_t start);
+
+/** Add to a counter if tracing is on. */
+static inline void trace_count(enum trace_counter counter, uint64_t n) {
+  if (trace_enabled)
+    trace_counter_add(counter, n);
+}
+
+/** Start timing a call: the time, or 0 if tracing is off. */
+static inline uint64_t trace_timer_start(void) {
+  return trace_enabled ? trace_now_ns() : 0;
+}
+
+/** Stop timing a call started with trace_timer_start(). */
+static inline void trace_timer_stop(enum trace_timer timer, uint64_t start) {
+  if (start)
+    trace_timer_add(timer, start);
+}
+
+/*
+ * ============================================================================
+ * Thread Utility Functions
+ * ============================================================================
+ */
+
+/** Number of processors currently online (at least 1). */
+int online_cpus(void);
+
+/** Run fn(arg) on nr_threads threads, including the caller, and wait. */
+int run_parallel(int nr_threads, void *(*fn)(void *), void *arg);
+
 /*
  * ============================================================================
  * Git Command Handler Functions
@@ -245,4 +1229,31 @@ int handle_ls_tree(int argc, char *argv[]);
 /** Create a commit object. */
 int handle_commit_tree(int argc, char *argv[]);
 
+/** Write or inspect the commit-graph file. */
+int handle_commit_graph(int argc, char *argv[]);
+
+/** List commits reachable from some commits but not others. */
+int handle_rev_list(int argc, char *argv[]);
+
+/** Check ancestry between two commits. */
+int handle_merge_base(int argc, char *argv[]);
+
+/** Compare two trees. */
+int handle_diff_tree(int argc, char *argv[]);
+
+/** Show how the work tree differs from HEAD. */
+int handle_status(int argc, char *argv[]);
+
+/** Switch the work tree and HEAD to another commit. */
+int handle_checkout(int argc, char *argv[]);
+
+/** Switch the work tree from one tree to another. */
+int handle_read_tree(int argc, char *argv[]);
+
+/** Pack loose (or all) objects with delta compression. */
+int handle_repack(int argc, char *argv[]);
+
+/** Repack everything and rewrite the commit-graph and bitmaps. */
+int handle_gc(int argc, char *argv[]);
+
 #endif // GIT_H
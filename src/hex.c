@@ -0,0 +1,84 @@
+/**
+ * hex.c - Object ID Hex Encoding and Decoding
+ *
+ * This file implements conversion between binary object IDs and their
+ * 40-character lowercase hex form. Both directions are table-driven, one
+ * byte (two digits) per step, instead of going through sprintf("%02x") or
+ * sscanf("%2x").
+ */
+
+#include "git.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * Value + 1 of each character as a hex digit. Entries are stored off by
+ * one so that the zero default marks characters that are not hex digits.
+ */
+static const unsigned char hex_value[256] = {
+    ['0'] = 0 + 1,  ['1'] = 1 + 1,  ['2'] = 2 + 1,  ['3'] = 3 + 1,
+    ['4'] = 4 + 1,  ['5'] = 5 + 1,  ['6'] = 6 + 1,  ['7'] = 7 + 1,
+    ['8'] = 8 + 1,  ['9'] = 9 + 1,  ['a'] = 10 + 1, ['b'] = 11 + 1,
+    ['c'] = 12 + 1, ['d'] = 13 + 1, ['e'] = 14 + 1, ['f'] = 15 + 1,
+    ['A'] = 10 + 1, ['B'] = 11 + 1, ['C'] = 12 + 1, ['D'] = 13 + 1,
+    ['E'] = 14 + 1, ['F'] = 15 + 1,
+};
+
+/**
+ * Format a binary SHA-1 as hex.
+ *
+ * @param sha 20-byte binary SHA-1
+ * @param hex Output buffer of at least GIT_HASH_LENGTH + 1 bytes
+ * @return hex (null-terminated)
+ */
+char *sha_to_hex(const unsigned char *sha, char *hex) {
+  for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
+    hex[i * 2] = hex_digits[sha[i] >> 4];
+    hex[i * 2 + 1] = hex_digits[sha[i] & 0xf];
+  }
+  hex[GIT_HASH_LENGTH] = '\0';
+  return hex;
+}
+
+/**
+ * Format an object ID as hex.
+ *
+ * @param oid Object ID
+ * @param hex Output buffer of at least GIT_HASH_LENGTH + 1 bytes
+ * @return hex (null-terminated)
+ */
+char *oid_to_hex(const struct object_id *oid, char *hex) {
+  return sha_to_hex(oid->hash, hex);
+}
+
+/**
+ * Parse 40 hex digits into a binary SHA-1.
+ * Trailing characters after the 40 digits are not examined.
+ *
+ * @param hex Hex string (upper or lower case)
+ * @param sha Output 20-byte binary SHA-1
+ * @return 0 on success, -1 if a character is not a hex digit
+ */
+int hex_to_sha(const char *hex, unsigned char *sha) {
+  for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
+    int hi = hex_value[(unsigned char)hex[i * 2]];
+    if (!hi)
+      return -1;
+    int lo = hex_value[(unsigned char)hex[i * 2 + 1]];
+    if (!lo)
+      return -1;
+    sha[i] = (unsigned char)((hi - 1) << 4 | (lo - 1));
+  }
+  return 0;
+}
+
+/**
+ * Parse 40 hex digits into an object ID.
+ *
+ * @param hex Hex string
+ * @param oid Output object ID
+ * @return 0 on success, -1 if the string is not a valid object ID
+ */
+int get_oid_hex(const char *hex, struct object_id *oid) {
+  return hex_to_sha(hex, oid->hash);
+}
@@ -0,0 +1,289 @@
+/**
+ * index.c - Index (Stat Cache) Reading and Writing
+ *
+ * This file implements the .git/index file used by write-tree to avoid
+ * re-hashing files that have not changed since the last run. Each entry
+ * records a path's stat data and blob ID; a file whose lstat() still
+ * matches its entry is assumed to have the recorded content.
+ *
+ * The file uses Git's index format (version 2, versions 2-3 are read), so
+ * indexes written here can be used by real Git and vice versa:
+ *   - Header: "DIRC" + version(4) + entry count(4)
+ *   - Entries sorted by path: ctime, mtime (seconds + nanoseconds), dev,
+ *     ino, mode, uid, gid, size (32 bits each), SHA-1, flags(2), path,
+ *     then 1-8 NUL bytes padding the entry to a multiple of 8
+ *   - Optional extensions (ignored here), then a SHA-1 of everything above
+ *
+ * A file modified within the same timestamp tick as the index was written
+ * cannot be told apart from an unmodified one ("racy" entries); such
+ * entries are always re-hashed.
+ */
+
+#include "git.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define INDEX_ENTRY_FIXED 62       // Entry size before the path
+#define INDEX_FLAG_EXTENDED 0x4000 // Version 3: extra 16-bit flags follow
+#define INDEX_NAME_MASK 0x0fff     // Path length field of the flags
+
+/**
+ * Read a big-endian 32-bit word from an unaligned position.
+ */
+static uint32_t get_be32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return ntohl(v);
+}
+
+/**
+ * Append a big-endian 32-bit word to a buffer.
+ */
+static unsigned char *put_be32(unsigned char *p, uint32_t v) {
+  v = htonl(v);
+  memcpy(p, &v, 4);
+  return p + 4;
+}
+
+static int cmp_index_entry(const void *a, const void *b) {
+  return strcmp(((const struct index_entry *)a)->path,
+                ((const struct index_entry *)b)->path);
+}
+
+/**
+ * Load .git/index. A missing index yields an empty one.
+ *
+ * @param istate Index to fill (must be zero-initialized or discarded)
+ * @return 0 on success, 1 if the index is unreadable or corrupt (istate is
+ *         left empty)
+ */
+int read_index(struct index_state *istate) {
+  memset(istate, 0, sizeof(*istate));
+
+  int fd = open(INDEX_FILE, O_RDONLY);
+  if (fd < 0)
+    return errno == ENOENT ? 0 : 1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < PACK_HEADER_SIZE + SHA_DIGEST_LENGTH) {
+    close(fd);
+    return 1;
+  }
+  size_t size = st.st_size;
+  unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 1;
+  istate->mtime = st.st_mtim;
+
+  // Header and trailing checksum
+  unsigned char sha[SHA_DIGEST_LENGTH];
+  git_hash_buffer(map, size - SHA_DIGEST_LENGTH, sha);
+  uint32_t version = get_be32(map + 4);
+  if (get_be32(map) != INDEX_SIGNATURE || version < 2 || version > 3 ||
+      memcmp(sha, map + size - SHA_DIGEST_LENGTH, SHA_DIGEST_LENGTH) != 0)
+    goto corrupt;
+
+  uint32_t nr = get_be32(map + 8);
+  if (nr > size / INDEX_ENTRY_FIXED)
+    goto corrupt;
+  const unsigned char *pos = map + PACK_HEADER_SIZE;
+  const unsigned char *end = map + size - SHA_DIGEST_LENGTH;
+  istate->entries = calloc(nr ? nr : 1, sizeof(struct index_entry));
+
+  for (uint32_t i = 0; i < nr; i++) {
+    if ((size_t)(end - pos) < INDEX_ENTRY_FIXED)
+      goto corrupt;
+    struct index_entry *ie = &istate->entries[i];
+    ie->ctime_sec = get_be32(pos);
+    ie->ctime_nsec = get_be32(pos + 4);
+    ie->mtime_sec = get_be32(pos + 8);
+    ie->mtime_nsec = get_be32(pos + 12);
+    ie->dev = get_be32(pos + 16);
+    ie->ino = get_be32(pos + 20);
+    ie->mode = get_be32(pos + 24);
+    ie->uid = get_be32(pos + 28);
+    ie->gid = get_be32(pos + 32);
+    ie->size = get_be32(pos + 36);
+    memcpy(ie->oid.hash, pos + 40, SHA_DIGEST_LENGTH);
+    uint16_t flags = (uint16_t)(pos[60] << 8 | pos[61]);
+
+    const unsigned char *name = pos + INDEX_ENTRY_FIXED;
+    if (flags & INDEX_FLAG_EXTENDED)
+      name += 2;
+    const unsigned char *nul = name < end ? memchr(name, '\0', end - name)
+                                          : NULL;
+    if (!nul)
+      goto corrupt;
+    ie->path = strndup((const char *)name, nul - name);
+    istate->nr = i + 1;
+
+    // Entries are padded with 1-8 NULs to a multiple of 8 bytes
+    size_t len = (nul - pos + 8) & ~(size_t)7;
+    if (len > (size_t)(end - pos))
+      goto corrupt;
+    pos += len;
+  }
+
+  munmap(map, size);
+  return 0;
+
+corrupt:
+  munmap(map, size);
+  discard_index(istate);
+  return 1;
+}
+
+/**
+ * Write an index to .git/index, replacing it atomically.
+ * Entries are sorted by path first.
+ *
+ * @param istate Index to write
+ * @return 0 on success, 1 on error
+ */
+int write_index(struct index_state *istate) {
+  qsort(istate->entries, istate->nr, sizeof(struct index_entry),
+        cmp_index_entry);
+
+  // Lay out the whole file in memory so it can be written in one go
+  size_t size = PACK_HEADER_SIZE + SHA_DIGEST_LENGTH;
+  for (size_t i = 0; i < istate->nr; i++)
+    size += (INDEX_ENTRY_FIXED + strlen(istate->entries[i].path) + 8) &
+            ~(size_t)7;
+  unsigned char *buf = calloc(1, size);
+  unsigned char *pos = buf;
+  pos = put_be32(pos, INDEX_SIGNATURE);
+  pos = put_be32(pos, INDEX_VERSION);
+  pos = put_be32(pos, istate->nr);
+
+  for (size_t i = 0; i < istate->nr; i++) {
+    const struct index_entry *ie = &istate->entries[i];
+    unsigned char *start = pos;
+    pos = put_be32(pos, ie->ctime_sec);
+    pos = put_be32(pos, ie->ctime_nsec);
+    pos = put_be32(pos, ie->mtime_sec);
+    pos = put_be32(pos, ie->mtime_nsec);
+    pos = put_be32(pos, ie->dev);
+    pos = put_be32(pos, ie->ino);
+    pos = put_be32(pos, ie->mode);
+    pos = put_be32(pos, ie->uid);
+    pos = put_be32(pos, ie->gid);
+    pos = put_be32(pos, ie->size);
+    memcpy(pos, ie->oid.hash, SHA_DIGEST_LENGTH);
+    pos += SHA_DIGEST_LENGTH;
+
+    size_t len = strlen(ie->path);
+    uint16_t flags = len < INDEX_NAME_MASK ? len : INDEX_NAME_MASK;
+    *pos++ = flags >> 8;
+    *pos++ = flags & 0xff;
+    memcpy(pos, ie->path, len);
+    pos = start + ((INDEX_ENTRY_FIXED + len + 8) & ~(size_t)7);
+  }
+  git_hash_buffer(buf, pos - buf, pos);
+
+  // Write to index.lock and rename over the old index
+  int fd = open(INDEX_LOCK_FILE, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to create %s: %s\n", INDEX_LOCK_FILE,
+            strerror(errno));
+    free(buf);
+    return 1;
+  }
+  int result = write_in_full(fd, buf, size);
+  result |= close(fd) != 0;
+  if (result == 0 && rename(INDEX_LOCK_FILE, INDEX_FILE) != 0)
+    result = 1;
+  if (result) {
+    fprintf(stderr, "Failed to write %s: %s\n", INDEX_FILE, strerror(errno));
+    unlink(INDEX_LOCK_FILE);
+  }
+  free(buf);
+  return result;
+}
+
+/**
+ * Free all entries of an index.
+ *
+ * @param istate Index to clear
+ */
+void discard_index(struct index_state *istate) {
+  for (size_t i = 0; i < istate->nr; i++)
+    free(istate->entries[i].path);
+  free(istate->entries);
+  istate->entries = NULL;
+  istate->nr = 0;
+}
+
+/**
+ * Find the entry for a path in an index read by read_index().
+ *
+ * @param istate Index to search (sorted by path)
+ * @param path Path relative to the top of the work tree
+ * @return Entry, or NULL if the path is not in the index
+ */
+const struct index_entry *index_find(const struct index_state *istate,
+                                     const char *path) {
+  size_t lo = 0, hi = istate->nr;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(istate->entries[mid].path, path);
+    if (cmp == 0)
+      return &istate->entries[mid];
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+/**
+ * Record a file's stat data in an index entry.
+ *
+ * @param ie Entry to update (oid and path are left untouched)
+ * @param st Result of lstat() on the file
+ */
+void fill_index_stat(struct index_entry *ie, const struct stat *st) {
+  ie->ctime_sec = st->st_ctim.tv_sec;
+  ie->ctime_nsec = st->st_ctim.tv_nsec;
+  ie->mtime_sec = st->st_mtim.tv_sec;
+  ie->mtime_nsec = st->st_mtim.tv_nsec;
+  ie->dev = st->st_dev;
+  ie->ino = st->st_ino;
+  if (S_ISLNK(st->st_mode))
+    ie->mode = S_IFLNK;
+  else
+    ie->mode = S_IFREG | ((st->st_mode & 0100) ? 0755 : 0644);
+  ie->uid = st->st_uid;
+  ie->gid = st->st_gid;
+  ie->size = st->st_size;
+}
+
+/**
+ * Check whether a file still matches its index entry.
+ *
+ * @param istate Index the entry was read from
+ * @param ie Entry for the file
+ * @param st Result of lstat() on the file
+ * @return 1 if the recorded object ID can be reused, 0 if it must be re-hashed
+ */
+int index_entry_uptodate(const struct index_state *istate,
+                         const struct index_entry *ie, const struct stat *st) {
+  struct index_entry now;
+  fill_index_stat(&now, st);
+  if (ie->mtime_sec != now.mtime_sec || ie->mtime_nsec != now.mtime_nsec ||
+      ie->ctime_sec != now.ctime_sec || ie->ctime_nsec != now.ctime_nsec ||
+      ie->ino != now.ino || ie->dev != now.dev || ie->mode != now.mode ||
+      ie->uid != now.uid || ie->gid != now.gid || ie->size != now.size)
+    return 0;
+
+  // Racily clean: the file may have changed after being hashed but
+  // within the same timestamp tick as the index was written
+  if ((time_t)ie->mtime_sec > istate->mtime.tv_sec ||
+      ((time_t)ie->mtime_sec == istate->mtime.tv_sec &&
+       (long)ie->mtime_nsec >= istate->mtime.tv_nsec))
+    return 0;
+  return 1;
+}
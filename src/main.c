@@ -12,6 +12,7 @@
  *   - write-tree: Create a tree object from the working directory
  *   - commit-tree: Create a new commit object
  *   - clone: Clone a remote repository
+ *   - fetch: Fetch new objects and branches from a remote
  */
 
 #include "git.h"
@@ -24,9 +25,6 @@
  * @return 0 on success, 1 on error
  */
 int main(int argc, char *argv[]) {
-  // Disable output buffering for immediate console feedback
-  setbuf(stdout, NULL);
-
   // Validate command-line arguments
   if (argc < 2) {
     fprintf(stderr, "Usage: %s <command> [<args>]\n", argv[0]);
@@ -35,6 +33,16 @@ int main(int argc, char *argv[]) {
 
   // Extract the command from arguments
   const char *command = argv[1];
+  trace_init(argc, argv);
+
+  // Object IDs are SHA-1 throughout; refuse other repositories up front
+  if (strcmp(command, "init") != 0 && strcmp(command, "clone") != 0) {
+    char *format = config_get("extensions.objectformat");
+    int unsupported = check_object_format(format, "This repository");
+    free(format);
+    if (unsupported)
+      return 1;
+  }
 
   // Route commands to their respective handler functions
   if (strcmp(command, "init") == 0) {
@@ -51,6 +59,26 @@ int main(int argc, char *argv[]) {
     return handle_commit_tree(argc - 1, argv + 1);
   } else if (strcmp(command, "clone") == 0) {
     return handle_clone(argc - 1, argv + 1);
+  } else if (strcmp(command, "fetch") == 0) {
+    return handle_fetch(argc - 1, argv + 1);
+  } else if (strcmp(command, "commit-graph") == 0) {
+    return handle_commit_graph(argc - 1, argv + 1);
+  } else if (strcmp(command, "rev-list") == 0) {
+    return handle_rev_list(argc - 1, argv + 1);
+  } else if (strcmp(command, "merge-base") == 0) {
+    return handle_merge_base(argc - 1, argv + 1);
+  } else if (strcmp(command, "diff-tree") == 0) {
+    return handle_diff_tree(argc - 1, argv + 1);
+  } else if (strcmp(command, "status") == 0) {
+    return handle_status(argc - 1, argv + 1);
+  } else if (strcmp(command, "checkout") == 0) {
+    return handle_checkout(argc - 1, argv + 1);
+  } else if (strcmp(command, "read-tree") == 0) {
+    return handle_read_tree(argc - 1, argv + 1);
+  } else if (strcmp(command, "repack") == 0) {
+    return handle_repack(argc - 1, argv + 1);
+  } else if (strcmp(command, "gc") == 0) {
+    return handle_gc(argc - 1, argv + 1);
   }
 
   // Handle unknown commands
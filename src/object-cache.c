@@ -0,0 +1,224 @@
+/**
+ * object-cache.c - In-Memory Object Cache
+ *
+ * This file implements a process-wide cache of recently read objects,
+ * consulted by odb_read_object() before any backend. Commands that walk
+ * the same trees and commits more than once (checkout, fetch negotiation,
+ * log-style walks) then find them in memory instead of opening a loose
+ * file or re-inflating (and re-applying the deltas of) a packed entry.
+ *
+ * Objects are split into two pools with separate byte budgets and LRU
+ * lists, so that reading a few large blobs cannot flush the small trees
+ * and commits that walks keep coming back to:
+ *   - core.objectCacheLimit: commits, trees and tags (default 32 MiB)
+ *   - core.blobCacheLimit: blobs (default 16 MiB)
+ * A budget of 0 disables its pool. An object larger than a quarter of its
+ * pool's budget is not cached.
+ *
+ * Objects are immutable, so entries never go stale. Callers own the
+ * objects they get back: a hit returns a copy, and insertion stores one.
+ * Readers that see each object once (checkout writing files, repack
+ * writing a pack) use odb_read_object_once(), which does not insert, so
+ * they neither pay for that copy nor flush what walks come back to.
+ * The cache is shared by all threads and guarded by a single lock.
+ */
+
+#include "git.h"
+#include <pthread.h>
+
+/**
+ * Cached Object Entry
+ */
+struct cached_object {
+  struct object_id oid;
+  const char *type;
+  size_t size;
+  char *content;                    // size + 1 bytes, null-terminated
+  struct cached_object *hash_next;  // Bucket chain
+  struct cached_object *lru_prev;   // Towards most recently used
+  struct cached_object *lru_next;   // Towards least recently used
+};
+
+/**
+ * Object Pool Structure
+ * One LRU list and byte budget.
+ */
+struct object_pool {
+  struct cached_object *lru_head;  // Most recently used
+  struct cached_object *lru_tail;  // Least recently used
+  size_t size;    // Bytes of content currently cached
+  size_t limit;   // Maximum bytes of content
+};
+
+enum { POOL_SMALL, POOL_BLOB, NR_POOLS };
+
+static struct cached_object *cache_buckets[OBJECT_CACHE_BUCKETS];
+static struct object_pool cache_pools[NR_POOLS];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Read the pool budgets from the config.
+ */
+static void object_cache_init(void) {
+  cache_pools[POOL_SMALL].limit =
+      config_get_ulong("core.objectCacheLimit", OBJECT_CACHE_LIMIT);
+  cache_pools[POOL_BLOB].limit =
+      config_get_ulong("core.blobCacheLimit", BLOB_CACHE_LIMIT);
+}
+
+static struct cached_object **cache_bucket(const struct object_id *oid) {
+  // SHA-1 bytes are uniformly distributed already
+  uint32_t h;
+  memcpy(&h, oid->hash, sizeof(h));
+  return &cache_buckets[h & (OBJECT_CACHE_BUCKETS - 1)];
+}
+
+static struct object_pool *cache_pool(const char *type) {
+  return &cache_pools[strcmp(type, "blob") == 0 ? POOL_BLOB : POOL_SMALL];
+}
+
+static void lru_unlink(struct object_pool *pool, struct cached_object *e) {
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    pool->lru_head = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    pool->lru_tail = e->lru_prev;
+}
+
+static void lru_push_front(struct object_pool *pool, struct cached_object *e) {
+  e->lru_prev = NULL;
+  e->lru_next = pool->lru_head;
+  if (pool->lru_head)
+    pool->lru_head->lru_prev = e;
+  pool->lru_head = e;
+  if (!pool->lru_tail)
+    pool->lru_tail = e;
+}
+
+/**
+ * Find an entry and mark it most recently used. Called with cache_lock
+ * held.
+ */
+static struct cached_object *cache_find(const struct object_id *oid) {
+  struct cached_object *e = *cache_bucket(oid);
+  while (e && !oideq(&e->oid, oid))
+    e = e->hash_next;
+  if (e) {
+    struct object_pool *pool = cache_pool(e->type);
+    lru_unlink(pool, e);
+    lru_push_front(pool, e);
+  }
+  return e;
+}
+
+/**
+ * Evict the least recently used entry of a pool. Called with cache_lock
+ * held.
+ */
+static void cache_evict(struct object_pool *pool) {
+  struct cached_object *e = pool->lru_tail;
+  struct cached_object **p = cache_bucket(&e->oid);
+  while (*p != e)
+    p = &(*p)->hash_next;
+  *p = e->hash_next;
+  lru_unlink(pool, e);
+  pool->size -= e->size;
+  free(e->content);
+  free(e);
+}
+
+/**
+ * Look up a recently read object.
+ *
+ * @param oid Object ID
+ * @return Copy of the object (free with free_git_object()), or NULL if it
+ *         is not cached
+ */
+git_object *object_cache_get(const struct object_id *oid) {
+  pthread_once(&cache_once, object_cache_init);
+
+  pthread_mutex_lock(&cache_lock);
+  struct cached_object *e = cache_find(oid);
+  git_object *obj = NULL;
+  if (e) {
+    obj = malloc(sizeof(*obj));
+    obj->type = e->type;
+    obj->size = e->size;
+    obj->content = malloc(e->size + 1);
+    memcpy(obj->content, e->content, e->size + 1);
+  }
+  pthread_mutex_unlock(&cache_lock);
+  trace_count(obj ? TRACE_OBJECT_CACHE_HITS : TRACE_OBJECT_CACHE_MISSES, 1);
+  return obj;
+}
+
+/**
+ * Look up the type and size of a recently read object.
+ *
+ * @param oid Object ID
+ * @param type Output: static type name
+ * @param size Output: content size
+ * @return 0 on success, 1 if the object is not cached
+ */
+int object_cache_get_info(const struct object_id *oid, const char **type,
+                          size_t *size) {
+  pthread_once(&cache_once, object_cache_init);
+
+  pthread_mutex_lock(&cache_lock);
+  struct cached_object *e = cache_find(oid);
+  if (e) {
+    *type = e->type;
+    *size = e->size;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return e ? 0 : 1;
+}
+
+/**
+ * Remember a copy of an object, evicting the least recently used objects
+ * of its pool to stay within the budget. Objects too large for the pool
+ * are ignored.
+ *
+ * @param oid Object ID
+ * @param obj Object as read from a backend (not taken over)
+ */
+void object_cache_put(const struct object_id *oid, const git_object *obj) {
+  pthread_once(&cache_once, object_cache_init);
+
+  struct object_pool *pool = cache_pool(obj->type);
+  if (obj->size > pool->limit / 4)
+    return;
+
+  // Copy outside the lock; another thread may have cached it meanwhile
+  struct cached_object *e = malloc(sizeof(*e));
+  e->oid = *oid;
+  e->type = obj->type;
+  e->size = obj->size;
+  e->content = malloc(obj->size + 1);
+  memcpy(e->content, obj->content, obj->size);
+  e->content[obj->size] = '\0';
+
+  pthread_mutex_lock(&cache_lock);
+  struct cached_object **bucket = cache_bucket(oid);
+  struct cached_object *old = *bucket;
+  while (old && !oideq(&old->oid, oid))
+    old = old->hash_next;
+  if (old) {
+    pthread_mutex_unlock(&cache_lock);
+    free(e->content);
+    free(e);
+    return;
+  }
+
+  while (pool->lru_tail && pool->size + e->size > pool->limit)
+    cache_evict(pool);
+  e->hash_next = *bucket;
+  *bucket = e;
+  lru_push_front(pool, e);
+  pool->size += e->size;
+  pthread_mutex_unlock(&cache_lock);
+}
@@ -15,9 +15,12 @@
  */
 
 #include "git.h"
-#include <dirent.h> // For DIR, struct dirent
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <limits.h> // For PATH_MAX
-#include <openssl/sha.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <time.h>
 
 /**
@@ -29,100 +32,295 @@
  * @return Dynamically allocated path string (caller must free)
  */
 char *get_object_path(const char *hash) {
-  char *path = malloc(strlen(OBJECTS_DIR) + HASH_LENGTH + 2);
+  // "<objects>/XX/" + the other 38 digits + NUL: the hash plus 3 bytes
+  char *path = malloc(strlen(OBJECTS_DIR) + HASH_LENGTH + 3);
   sprintf(path, "%s/%.2s/%s", OBJECTS_DIR, hash, hash + 2);
   return path;
 }
 
 /**
  * Read and decompress a Git object from the object database.
- * This function handles zlib decompression and parses the object header
- * to extract type, size, and content.
+ * The object is looked up through the registered object database backends
+ * (loose objects first, then packs).
  * 
  * @param hash 40-character SHA-1 hash of the object
  * @return Pointer to git_object structure, or NULL on error (caller must free)
  */
 git_object *read_object(const char *hash) {
-  // Get the filesystem path for this object
-  const char *path = get_object_path(hash);
-  if (!path)
+  // Convert the hex hash to the binary form used by the backends
+  struct object_id oid;
+  if (get_oid_hex(hash, &oid) != 0)
     return NULL;
+  return odb_read_object(&oid);
+}
 
-  // Open the compressed object file
-  FILE *file = fopen(path, "rb");
-  if (!file)
-    return NULL;
+/**
+ * Check whether an object is stored as a loose file.
+ */
+static int loose_has_object(struct odb_backend *backend,
+                            const struct object_id *oid) {
+  (void)backend;
+  char hex[GIT_HASH_LENGTH + 1];
+  oid_to_hex(oid, hex);
+  char *path = get_object_path(hex);
+  int exists = access(path, F_OK) == 0;
+  free(path);
+  return exists;
+}
 
-  // Allocate buffers for compression/decompression
-  unsigned char *in = malloc(COMPRESSED_CHUNK_SIZE);
-  unsigned char *out = malloc(COMPRESSED_CHUNK_SIZE);
-  z_stream strm = {0};
+/*
+ * ============================================================================
+ * Shared Inflate Streams
+ * ============================================================================
+ */
+
+static pthread_key_t inflate_key;
+static pthread_once_t inflate_once = PTHREAD_ONCE_INIT;
+
+static void free_inflate_stream(void *strm) {
+  inflateEnd(strm);
+  free(strm);
+}
+
+static void create_inflate_key(void) {
+  pthread_key_create(&inflate_key, free_inflate_stream);
+}
 
-  // Initialize zlib decompression
-  if (inflateInit(&strm) != Z_OK) {
-    free(in);
-    free(out);
-    fclose(file);
+/**
+ * Get the calling thread's inflate stream, reset for a new zlib stream.
+ * Each thread keeps one stream for its lifetime, so readers that look up
+ * many objects do not pay for inflateInit() and its window allocation on
+ * every object. The caller sets next_in/avail_in and must not call
+ * inflateEnd().
+ *
+ * @return Stream, or NULL if zlib could not be initialized
+ */
+z_stream *get_inflate_stream(void) {
+  pthread_once(&inflate_once, create_inflate_key);
+
+  z_stream *strm = pthread_getspecific(inflate_key);
+  if (strm)
+    return inflateReset(strm) == Z_OK ? strm : NULL;
+
+  strm = calloc(1, sizeof(*strm));
+  if (!strm || inflateInit(strm) != Z_OK) {
+    free(strm);
     return NULL;
   }
+  pthread_setspecific(inflate_key, strm);
+  return strm;
+}
 
-  git_object *obj = malloc(sizeof(git_object));
-  obj->type = NULL;
-  obj->content = NULL;
-  obj->size = 0;
+/**
+ * Inflate from a mapped buffer until the output is full or the stream ends.
+ * zlib counts in 32-bit quantities, so both sides are fed in pieces.
+ *
+ * @param strm Inflate stream reading from the map
+ * @param in_end End of the mapped input
+ * @param out Output buffer
+ * @param len Size of the output buffer
+ * @param done Output: number of bytes inflated into out
+ * @return Status of the last inflate() call
+ */
+static int inflate_span(z_stream *strm, const unsigned char *in_end,
+                        unsigned char *out, size_t len, size_t *done) {
+  uint64_t start = trace_timer_start();
+  int ret = Z_OK;
+  *done = 0;
+  while (ret == Z_OK && *done < len) {
+    if (strm->avail_in == 0) {
+      size_t left = in_end - (const unsigned char *)strm->next_in;
+      if (left == 0)
+        break;  // Truncated object file
+      strm->avail_in = left > UINT_MAX ? UINT_MAX : left;
+    }
+    size_t want = len - *done;
+    strm->next_out = out + *done;
+    strm->avail_out = want > UINT_MAX ? UINT_MAX : want;
+    uInt before = strm->avail_out;
+    ret = inflate(strm, Z_NO_FLUSH);
+    *done += before - strm->avail_out;
+  }
+  trace_timer_stop(TRACE_TIMER_INFLATE, start);
+  return ret;
+}
 
-  size_t total_size = 0;
-  unsigned char *buffer = NULL;
+/**
+ * Read a loose object from .git/objects/XX/.
+ * The compressed file is mapped and inflated in two steps: first just
+ * enough to parse the "<type> <size>\0" header, then (if the content is
+ * wanted) the rest straight into a buffer of the size the header announces.
+ *
+ * @param oid Object ID
+ * @param type Output: static type name
+ * @param size Output: content size
+ * @param content Output: content (caller must free), or NULL to read
+ *                only the header
+ * @return 0 on success, 1 if the object is missing or corrupt
+ */
+static int loose_read(const struct object_id *oid, const char **type,
+                      size_t *size, char **content) {
+  // Get the filesystem path for this object
+  char hex[GIT_HASH_LENGTH + 1];
+  oid_to_hex(oid, hex);
+  char *path = get_object_path(hex);
+  if (!path)
+    return 1;
 
-  // Decompress the object data in chunks
-  do {
-    strm.avail_in = fread(in, 1, COMPRESSED_CHUNK_SIZE, file);
-    strm.next_in = in;
+  // Map the compressed object file so zlib reads it in place
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd < 0)
+    return 1;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return 1;
+  }
+  size_t map_size = st.st_size;
+  unsigned char *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 1;
 
-    do {
-      strm.avail_out = COMPRESSED_CHUNK_SIZE;
-      strm.next_out = out;
-
-      // Inflate the next chunk of data
-      int ret = inflate(&strm, Z_NO_FLUSH);
-      if (ret != Z_OK && ret != Z_STREAM_END) {
-        free_git_object(obj);
-        free(buffer);
-        inflateEnd(&strm);
-        fclose(file);
-        return NULL;
-      }
+  z_stream *strm = get_inflate_stream();
+  if (!strm) {
+    munmap(map, map_size);
+    return 1;
+  }
+  strm->next_in = map;
+  strm->avail_in = 0;
+
+  // Inflate the header, plus whatever content fits behind it
+  int result = 1;
+  char *buf = NULL;
+  unsigned char header[GIT_HEADER_LENGTH];
+  size_t have;
+  int ret = inflate_span(strm, map + map_size, header, sizeof(header), &have);
+  if (ret != Z_OK && ret != Z_STREAM_END)
+    goto out;
 
-      // Append decompressed data to buffer
-      size_t have = COMPRESSED_CHUNK_SIZE - strm.avail_out;
-      buffer = realloc(buffer, total_size + have);
-      memcpy(buffer + total_size, out, have);
-      total_size += have;
+  // Parse object header: "<type> <size>\0<content>"
+  unsigned char *nul = memchr(header, '\0', have);
+  unsigned char *space = nul ? memchr(header, ' ', nul - header) : NULL;
+  if (!space || space + 1 == nul)
+    goto out;
+  *space = '\0';
+  *type = pack_type_name(pack_type_from_name((const char *)header));
+  if (strcmp(*type, (const char *)header) != 0)
+    goto out;  // Unknown object type
+  char *size_end;
+  errno = 0;
+  unsigned long long len = strtoull((const char *)space + 1, &size_end, 10);
+  if (errno || size_end != (char *)nul || !isdigit(space[1]) ||
+      len >= SIZE_MAX)
+    goto out;
+  *size = len;
+  if (!content) {
+    result = 0;
+    goto out;
+  }
 
-    } while (strm.avail_out == 0);
-  } while (strm.avail_in != 0);
+  // Allocate the content once, at its final size
+  size_t header_len = nul + 1 - header;
+  size_t got = have - header_len;
+  buf = malloc(len + 1);
+  if (!buf || got > len)
+    goto out;
+  memcpy(buf, header + header_len, got);
+
+  // One spare byte catches objects that are longer than their header says
+  if (ret != Z_STREAM_END) {
+    size_t n;
+    ret = inflate_span(strm, map + map_size, (unsigned char *)buf + got,
+                       len - got + 1, &n);
+    got += n;
+  }
+  if (ret != Z_STREAM_END || got != len)
+    goto out;
+  buf[len] = '\0';
+  *content = buf;
+  buf = NULL;
+  result = 0;
+
+out:
+  free(buf);
+  munmap(map, map_size);
+  return result;
+}
 
-  // Parse object header: "<type> <size>\0<content>"
-  char *space = memchr(buffer, ' ', total_size);
-  char *null = memchr(space + 1, 0, total_size - (space - (char *)buffer));
+/**
+ * Read and decompress a loose object.
+ * 
+ * @param backend Backend being queried (unused)
+ * @param oid Object ID
+ * @return Pointer to git_object structure, or NULL on error (caller must free)
+ */
+static git_object *loose_read_object(struct odb_backend *backend,
+                                     const struct object_id *oid) {
+  (void)backend;
+
+  const char *type;
+  size_t size;
+  char *content;
+  if (loose_read(oid, &type, &size, &content) != 0)
+    return NULL;
 
-  // Extract object type (blob, tree, or commit)
-  obj->type = strndup((char *)buffer, space - (char *)buffer);
-  // Extract object size
-  obj->size = atoi(space + 1);
+  git_object *obj = malloc(sizeof(git_object));
+  obj->type = type;
+  obj->size = size;
+  obj->content = content;
+  return obj;
+}
 
-  // Extract object content (everything after the null byte)
-  size_t header_size = null - (char *)buffer + 1;
-  obj->content = malloc(total_size - header_size);
-  memcpy(obj->content, buffer + header_size, total_size - header_size);
+/**
+ * Look up the type and size of a loose object from its header alone.
+ */
+static int loose_read_object_info(struct odb_backend *backend,
+                                  const struct object_id *oid,
+                                  const char **type, size_t *size) {
+  (void)backend;
+  return loose_read(oid, type, size, NULL);
+}
 
-  free(buffer);
-  inflateEnd(&strm);
-  fclose(file);
-  free(in);
-  free(out);
+struct odb_backend loose_odb_backend = {
+    "loose", loose_has_object, loose_read_object, loose_read_object_info,
+    NULL};
 
-  return obj;
+/**
+ * Call a function for every loose object, in object ID order. Files in
+ * .git/objects/XX/ that are not named like objects (e.g. temporary files)
+ * are skipped.
+ *
+ * @param fn Callback; returning non-zero stops the iteration
+ * @param data Passed to fn
+ * @return 0, or the first non-zero value returned by fn
+ */
+int for_each_loose_object(each_loose_object_fn fn, void *data) {
+  for (int i = 0; i < 256; i++) {
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s/%02x", OBJECTS_DIR, i);
+    struct dirent **names;
+    int nr = scandir(dir_path, &names, NULL, alphasort);
+    int result = 0;
+    for (int j = 0; j < nr; j++) {
+      char hex[GIT_HASH_LENGTH + 1];
+      struct object_id oid;
+      char path[PATH_MAX];
+      snprintf(hex, sizeof(hex), "%02x%s", i, names[j]->d_name);
+      if (!result && strlen(names[j]->d_name) == GIT_HASH_LENGTH - 2 &&
+          get_oid_hex(hex, &oid) == 0) {
+        snprintf(path, sizeof(path), "%s/%s", dir_path, names[j]->d_name);
+        result = fn(&oid, path, data);
+      }
+      free(names[j]);
+    }
+    if (nr >= 0)
+      free(names);
+    if (result)
+      return result;
+  }
+  return 0;
 }
 
 /**
@@ -132,7 +330,6 @@ git_object *read_object(const char *hash) {
  */
 void free_git_object(git_object *obj) {
   if (obj) {
-    free(obj->type);
     free(obj->content);
     free(obj);
   }
@@ -148,114 +345,390 @@ void free_git_object(git_object *obj) {
 char *sha1_hash(const char *data, size_t len) {
   // Compute SHA-1 hash (20 bytes)
   unsigned char hash[SHA_DIGEST_LENGTH];
-  SHA1((unsigned char *)data, len, hash);
+  git_hash_buffer(data, len, hash);
 
   // Convert binary hash to 40-character hexadecimal string
-  char *hex = malloc(41);
-  for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
-    sprintf(hex + (i * 2), "%02x", hash[i]);
-  }
-  return hex;
+  return sha_to_hex(hash, malloc(GIT_HASH_LENGTH + 1));
 }
 
 /**
- * Write data to a file with zlib compression.
- * Used to store Git objects in the compressed format.
- * 
- * @param path Filesystem path to write to
- * @param data Data to compress and write
+ * Write a buffer to a file descriptor, retrying short writes.
+ *
+ * @param fd File descriptor to write to
+ * @param buf Data to write
  * @param len Length of data
  * @return 0 on success, 1 on error
  */
-int write_compressed_object(const char *path, const char *data, size_t len) {
-  FILE *f = fopen(path, "wb");
-  if (!f)
+int write_in_full(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return 1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * Deflate one piece of an object into a file descriptor.
+ * Objects may be compressed from several pieces (e.g. header, then file
+ * content); only the last one finishes the zlib stream.
+ *
+ * @param strm Initialized deflate stream
+ * @param fd File descriptor to write compressed output to
+ * @param data Piece to compress
+ * @param len Length of the piece (may exceed zlib's 32-bit counters)
+ * @param finish Whether this is the last piece
+ * @return 0 on success, 1 on error
+ */
+static int deflate_to_fd(z_stream *strm, int fd, const void *data, size_t len,
+                         int finish) {
+  unsigned char out[STREAM_BUFFER_SIZE];
+  const unsigned char *in = data;
+
+  for (;;) {
+    uInt piece = len > UINT_MAX ? UINT_MAX : (uInt)len;
+    strm->next_in = (unsigned char *)in;
+    strm->avail_in = piece;
+    in += piece;
+    len -= piece;
+
+    int flush = finish && len == 0 ? Z_FINISH : Z_NO_FLUSH;
+    int ret;
+    do {
+      strm->avail_out = sizeof(out);
+      strm->next_out = out;
+      uint64_t start = trace_timer_start();
+      ret = deflate(strm, flush);
+      trace_timer_stop(TRACE_TIMER_DEFLATE, start);
+      if (ret == Z_STREAM_ERROR)
+        return 1;
+      size_t have = sizeof(out) - strm->avail_out;
+      if (write_in_full(fd, out, have) != 0)
+        return 1;
+    } while (strm->avail_out == 0 && ret != Z_STREAM_END);
+
+    if (len == 0)
+      return flush == Z_FINISH && ret != Z_STREAM_END;
+  }
+}
+
+/**
+ * Create a temporary object file in a directory.
+ *
+ * @param dir Directory (e.g. .git/objects/XX)
+ * @param tmp_path Output path of the created file (PATH_MAX bytes)
+ * @return File descriptor, or -1 on error
+ */
+static int create_tmp_object(const char *dir, char *tmp_path) {
+  snprintf(tmp_path, PATH_MAX, "%s/tmp_obj_XXXXXX", dir);
+  return mkstemp(tmp_path);
+}
+
+/**
+ * Make a completely deflated temporary object file durable (or leave that
+ * to the current transaction) and close it.
+ *
+ * @return 0 on success, 1 on error (the file is removed)
+ */
+static int close_tmp_object(int fd, const char *tmp_path, int result) {
+  // Loose objects are read-only, as in Git
+  if (result == 0 && fchmod(fd, 0444) != 0)
+    result = 1;
+  if (result == 0 && !odb_in_transaction() && fsync(fd) != 0)
+    result = 1;
+  if (close(fd) != 0)
+    result = 1;
+  if (result)
+    unlink(tmp_path);
+  return result;
+}
+
+/**
+ * Compress an object given as header + content into its loose file.
+ * The object is written to a temporary file in the same directory and
+ * renamed into place, so a crash never leaves a truncated object under
+ * its final name. Outside an object database transaction the file is
+ * fsync'd first; inside one the flush and rename are batched by
+ * odb_transaction_end().
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_object_parts(const char *path, const void *header,
+                              size_t header_len, const void *content,
+                              size_t len) {
+  // Temporary file next to the final path: .git/objects/XX/tmp_obj_XXXXXX
+  char dir[PATH_MAX], tmp_path[PATH_MAX];
+  const char *slash = strrchr(path, '/');
+  snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) : 1,
+           slash ? path : ".");
+  uint64_t start = trace_timer_start();
+  int fd = create_tmp_object(dir, tmp_path);
+  if (fd < 0)
     return 1;
 
   // Initialize zlib compression
   z_stream strm = {0};
-  if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
-    fclose(f);
+  if (deflateInit(&strm, loose_compression_level()) != Z_OK) {
+    close(fd);
+    unlink(tmp_path);
     return 1;
   }
+  int result = deflate_to_fd(&strm, fd, header, header_len, len == 0) ||
+               (len && deflate_to_fd(&strm, fd, content, len, 1));
+  deflateEnd(&strm);
 
-  unsigned char out[COMPRESSED_CHUNK_SIZE];
-  strm.next_in = (unsigned char *)data;
-  strm.avail_in = len;
+  result = close_tmp_object(fd, tmp_path, result) ||
+           odb_finalize_object(tmp_path, path);
+  trace_timer_stop(TRACE_TIMER_OBJECT_WRITE, start);
+  return result;
+}
 
-  // Compress and write data in chunks
-  do {
-    strm.avail_out = COMPRESSED_CHUNK_SIZE;
-    strm.next_out = out;
-    deflate(&strm, Z_FINISH);
-    size_t have = COMPRESSED_CHUNK_SIZE - strm.avail_out;
-    fwrite(out, 1, have, f);
-  } while (strm.avail_out == 0);
+/**
+ * Hash and store a file that cannot be mapped, reading it only once.
+ * The content is fed to the SHA-1 context and the deflate stream at the
+ * same time, into a temporary file that is renamed once the object ID is
+ * known (or discarded if the object already exists).
+ *
+ * @param fd Open file to read
+ * @param size Size of the file
+ * @param oid Output object ID
+ * @return 0 on success, 1 on error
+ */
+static int stream_blob_from_fd(int fd, size_t size, struct object_id *oid) {
+  char tmp_path[PATH_MAX];
+  int out = create_tmp_object(OBJECTS_DIR, tmp_path);
+  if (out < 0)
+    return 1;
 
+  z_stream strm = {0};
+  if (deflateInit(&strm, loose_compression_level()) != Z_OK) {
+    close(out);
+    unlink(tmp_path);
+    return 1;
+  }
+
+  char header[GIT_HEADER_LENGTH];
+  int header_len = sprintf(header, "blob %zu", size) + 1;
+  struct git_hash_ctx ctx;
+  git_hash_init(&ctx);
+  git_hash_update(&ctx, header, header_len);
+  int result = deflate_to_fd(&strm, out, header, header_len, size == 0);
+
+  unsigned char *buf = malloc(STREAM_BUFFER_SIZE);
+  size_t left = size;
+  while (result == 0 && left > 0) {
+    ssize_t n = read(fd, buf, left < STREAM_BUFFER_SIZE ? left
+                                                        : STREAM_BUFFER_SIZE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      result = 1;  // Error, or the file shrank while being read
+      break;
+    }
+    git_hash_update(&ctx, buf, n);
+    left -= n;
+    result = deflate_to_fd(&strm, out, buf, n, left == 0);
+  }
+  free(buf);
   deflateEnd(&strm);
-  fclose(f);
-  return 0;
+  git_hash_final(oid->hash, &ctx);
+
+  if (close_tmp_object(out, tmp_path, result) != 0)
+    return 1;
+
+  // Content-addressed: an existing copy makes this one redundant
+  if (odb_object_known(oid)) {
+    unlink(tmp_path);
+    return 0;
+  }
+  char hex[GIT_HASH_LENGTH + 1];
+  oid_to_hex(oid, hex);
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s/%.2s", OBJECTS_DIR, hex);
+  mkdir(dir, 0755); // OK if directory already exists
+  char *path = get_object_path(hex);
+  result = odb_finalize_object(tmp_path, path);
+  free(path);
+  if (result == 0)
+    odb_object_stored(oid);
+  return result;
+}
+
+/**
+ * Compute the blob ID a work tree file would get, without storing it.
+ * A symbolic link hashes as the path it points at, the way Git records it.
+ *
+ * @param path File to hash
+ * @param st lstat() data of the file
+ * @param oid Output blob ID
+ * @return 0 on success, 1 if the file cannot be read (or changed size
+ *         while being read)
+ */
+int hash_blob_file(const char *path, const struct stat *st,
+                   struct object_id *oid) {
+  char header[GIT_HEADER_LENGTH];
+  struct git_hash_ctx ctx;
+  git_hash_init(&ctx);
+
+  if (S_ISLNK(st->st_mode)) {
+    char target[PATH_MAX];
+    ssize_t len = readlink(path, target, sizeof(target));
+    if (len < 0)
+      return 1;
+    git_hash_update(&ctx, header, sprintf(header, "blob %zd", len) + 1);
+    git_hash_update(&ctx, target, len);
+    git_hash_final(oid->hash, &ctx);
+    return 0;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 1;
+  size_t left = st->st_size;
+  git_hash_update(&ctx, header, sprintf(header, "blob %zu", left) + 1);
+  unsigned char *buf = malloc(STREAM_BUFFER_SIZE);
+  int result = 0;
+  while (left > 0) {
+    ssize_t n = read(fd, buf, left < STREAM_BUFFER_SIZE ? left
+                                                        : STREAM_BUFFER_SIZE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      result = 1;
+      break;
+    }
+    git_hash_update(&ctx, buf, n);
+    left -= n;
+  }
+  free(buf);
+  close(fd);
+  git_hash_final(oid->hash, &ctx);
+  return result;
 }
 
 /**
  * Create a Git blob object from a file.
- * Reads file contents, creates blob header, computes SHA-1 hash,
- * and stores the compressed object in .git/objects.
+ * Computes the SHA-1 hash of "blob <size>\0<content>" and stores the
+ * compressed object in .git/objects, without holding the file in memory
+ * more than once:
+ *   - Small files are read into a single buffer behind the header
+ *   - Files of BLOB_MMAP_THRESHOLD bytes or more are mapped, hashed, and
+ *     (only if the object is new) deflated straight from the mapping
+ *   - Files that cannot be mapped are hashed and deflated in one
+ *     streaming pass
  * 
  * @param filepath Path to the file to create blob from
  * @return SHA-1 hash as 40-char hex string, or NULL on error (caller must free)
  */
 char *create_blob_from_file(const char *filepath) {
-  FILE *f = fopen(filepath, "rb");
-  if (!f) {
+  int fd = open(filepath, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
     fprintf(stderr, "Cannot open file\n");
+    if (fd >= 0)
+      close(fd);
     return NULL;
   }
-
-  // Determine file size
-  fseek(f, 0, SEEK_END);
-  size_t file_size = ftell(f);
-  fseek(f, 0, SEEK_SET);
-
-  // Read entire file into memory
-  char *content = malloc(file_size);
-  fread(content, 1, file_size, f);
-  fclose(f);
+  size_t file_size = st.st_size;
 
   // Create Git blob header: "blob <size>\0"
   char header[GIT_HEADER_LENGTH];
   int header_len = sprintf(header, "blob %zu", file_size);
   header[header_len++] = '\0';
 
-  // Combine header and content for hashing and storage
-  size_t total_len = header_len + file_size;
-  char *data = malloc(total_len);
-  memcpy(data, header, header_len);
-  memcpy(data + header_len, content, file_size);
-
-  // Calculate SHA-1 hash of the complete blob
-  unsigned char hash[SHA_DIGEST_LENGTH];
-  SHA1((unsigned char *)data, total_len, hash);
+  struct object_id oid;
+  int result = 0;
+  void *map = MAP_FAILED;
+  if (file_size >= BLOB_MMAP_THRESHOLD)
+    map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (map != MAP_FAILED) {
+    // Large file: hash and deflate directly from the page cache
+    struct git_hash_ctx ctx;
+    git_hash_init(&ctx);
+    git_hash_update(&ctx, header, header_len);
+    git_hash_update(&ctx, map, file_size);
+    git_hash_final(oid.hash, &ctx);
+    result = store_object_parts(&oid, header, header_len, map, file_size);
+    munmap(map, file_size);
+  } else if (file_size >= BLOB_MMAP_THRESHOLD) {
+    result = stream_blob_from_fd(fd, file_size, &oid);
+  } else {
+    // Small file: read it in place behind the header
+    char *data = malloc(header_len + file_size);
+    memcpy(data, header, header_len);
+    size_t got = 0;
+    while (got < file_size) {
+      ssize_t n = read(fd, data + header_len + got, file_size - got);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      got += n;
+    }
+    if (got == file_size) {
+      git_hash_buffer(data, header_len + file_size, oid.hash);
+      result = store_object_parts(&oid, data, header_len + file_size, NULL, 0);
+    } else {
+      result = 1;
+    }
+    free(data);
+  }
+  close(fd);
+  if (result != 0) {
+    fprintf(stderr, "Failed to store %s\n", filepath);
+    return NULL;
+  }
 
   // Convert binary hash to hexadecimal string
-  char *hex = malloc(GIT_HASH_LENGTH + 1);
-  for (int i = 0; i < 20; i++) {
-    sprintf(hex + (i * 2), "%02x", hash[i]);
-  }
+  return oid_to_hex(&oid, malloc(GIT_HASH_LENGTH + 1));
+}
 
-  // Store the compressed object in .git/objects
-  store_object(hex, data, total_len);
+/**
+ * Store an object given as header + content in the object database.
+ * Does nothing if the object is already present.
+ *
+ * @param oid Object ID
+ * @param header Object header ("<type> <size>\0")
+ * @param header_len Length of header
+ * @param content Object content (may be NULL if len is 0)
+ * @param len Length of content
+ * @return 0 on success, non-zero on error
+ */
+int store_object_parts(const struct object_id *oid, const void *header,
+                       size_t header_len, const void *content, size_t len) {
+  // Objects are content-addressed, so an existing copy is identical
+  if (odb_object_known(oid))
+    return 0;
 
-  // Cleanup
-  free(data);
-  free(content);
+  char hex[GIT_HASH_LENGTH + 1];
+  oid_to_hex(oid, hex);
+
+  // Create directory .git/objects/XX (where XX = first 2 chars of hash)
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s/%.2s", OBJECTS_DIR, hex);
+  mkdir(dir, 0755); // OK if directory already exists
 
-  return hex;
+  // Write the compressed object file
+  char *path = get_object_path(hex);
+  int result = write_object_parts(path, header, header_len, content, len);
+  free(path);
+
+  if (result == 0)
+    odb_object_stored(oid);
+  return result;
 }
 
 /**
  * Store a Git object in the object database.
- * Creates the necessary directory and writes the compressed object.
+ * Creates the necessary directory and writes the compressed object, unless
+ * the object is already present in the object database.
  * 
  * @param hash 40-character SHA-1 hash
  * @param data Object data (header + content)
@@ -263,23 +736,17 @@ char *create_blob_from_file(const char *filepath) {
  * @return 0 on success, non-zero on error
  */
 int store_object(const char *hash, const char *data, size_t len) {
-  // Create directory .git/objects/XX (where XX = first 2 chars of hash)
-  char *dir = malloc(strlen(OBJECTS_DIR) + 4);
-  sprintf(dir, "%s/%.2s", OBJECTS_DIR, hash);
-  mkdir(dir, 0755); // OK if directory already exists
-  free(dir);
-
-  // Write the compressed object file
-  char *path = get_object_path(hash);
-  int result = write_compressed_object(path, data, len);
-  free(path);
-
-  return result;
+  struct object_id oid;
+  if (get_oid_hex(hash, &oid) != 0)
+    return 1;
+  return store_object_parts(&oid, data, len, NULL, 0);
 }
 
 /**
  * Parse a Git tree object into a structured format.
  * Tree format: <mode> <name>\0<20-byte-sha1> (repeated for each entry)
+ * No per-entry allocations are made: entry names and SHA-1s point into
+ * obj->content, so the tree must be freed before the object.
  * 
  * @param obj Git object to parse (must be of type "tree")
  * @return Pointer to tree_object, or NULL on error (caller must free)
@@ -291,64 +758,54 @@ tree_object *parse_tree_object(git_object *obj) {
 
   tree_object *tree = malloc(sizeof(tree_object));
   tree->count = 0;
-  tree->entries = NULL;
 
-  const unsigned char *content = (const unsigned char *)obj->content;
-  size_t pos = 0;
+  const char *content = obj->content;
+  const char *end = content + obj->size;
+  const char *pos = content;
   // Start with space for 16 entries, dynamically expand as needed
   size_t max_entries = 16;
   tree->entries = malloc(sizeof(tree_entry) * max_entries);
 
   // Parse each tree entry
-  while (pos < obj->size) {
+  while (pos < end) {
     // Dynamically expand array if needed
     if (tree->count == max_entries) {
       max_entries *= 2;
       tree->entries = realloc(tree->entries, sizeof(tree_entry) * max_entries);
     }
-
-    // Read file mode (e.g., "100644" for files, "40000" for directories)
-    char mode[7];
-    int mode_pos = 0;
-    while (content[pos] != ' ' && mode_pos < 6) {
-      mode[mode_pos++] = content[pos++];
-    }
-    mode[mode_pos] = '\0';
-    pos++; // Skip space separator
-
-    // Read entry name (null-terminated string)
-    char *name_start = (char *)content + pos;
-    while (content[pos] != '\0')
-      pos++;
-    size_t name_len = ((char *)content + pos) - name_start;
-
-    // Allocate and copy name
-    tree->entries[tree->count].name = malloc(name_len + 1);
-    memcpy(tree->entries[tree->count].name, name_start, name_len);
-    tree->entries[tree->count].name[name_len] = '\0';
-
-    // Copy mode to entry
-    strcpy(tree->entries[tree->count].mode, mode);
-
-    // Skip null byte separator
-    pos++;
-
-    // Read 20-byte binary SHA-1 hash and convert to hex
-    tree->entries[tree->count].hash = malloc(41);
-    for (int i = 0; i < 20; i++) {
-      sprintf(tree->entries[tree->count].hash + (i * 2), "%02x",
-              content[pos + i]);
-    }
-    pos += 20;
+    tree_entry *te = &tree->entries[tree->count];
+
+    // Read octal file mode (e.g., "100644" for files, "40000" for dirs)
+    te->mode = 0;
+    while (pos < end && *pos >= '0' && *pos <= '7')
+      te->mode = (te->mode << 3) | (*pos++ - '0');
+    if (pos >= end || *pos++ != ' ')
+      goto corrupt;
+
+    // Entry name (null-terminated in the object)
+    const char *nul = memchr(pos, '\0', end - pos);
+    if (!nul || end - nul - 1 < SHA_DIGEST_LENGTH)
+      goto corrupt;
+    te->name = pos;
+    te->name_len = nul - pos;
+
+    // 20-byte binary object ID, referenced in place
+    te->oid = (const struct object_id *)(nul + 1);
+    pos = nul + 1 + SHA_DIGEST_LENGTH;
 
     tree->count++;
   }
 
   return tree;
+
+corrupt:
+  free_tree_object(tree);
+  return NULL;
 }
 
 /**
- * Free a tree_object structure and all its allocated members.
+ * Free memory allocated for a tree_object structure.
+ * The git_object it was parsed from is not affected.
  * 
  * @param tree Pointer to tree_object to free
  */
@@ -356,14 +813,24 @@ void free_tree_object(tree_object *tree) {
   if (!tree)
     return;
 
-  for (size_t i = 0; i < tree->count; i++) {
-    free(tree->entries[i].name);
-    free(tree->entries[i].hash);
-  }
   free(tree->entries);
   free(tree);
 }
 
+/**
+ * Type name of the object a tree entry refers to.
+ *
+ * @param mode Tree entry mode
+ * @return "tree", "commit" (submodules) or "blob"
+ */
+const char *tree_entry_type(unsigned int mode) {
+  if (mode == TREE_MODE_DIR)
+    return GIT_TREE;
+  if (mode == TREE_MODE_GITLINK)
+    return GIT_COMMIT;
+  return GIT_BLOB;
+}
+
 /**
  * Determine if a path should be ignored when creating tree objects.
  * Currently ignores .git directory and special entries (. and ..).
@@ -378,158 +845,6 @@ int should_ignore_path(const char *path) {
          strcmp(base, "..") == 0;
 }
 
-/**
- * Recursively create tree objects from a directory.
- * Traverses the directory structure, creates blob objects for files,
- * and recursively creates tree objects for subdirectories.
- * 
- * @param dir_path Path to the directory to process
- * @return SHA-1 hash of the created tree object (caller must free)
- */
-char *write_tree_recursive(const char *dir_path) {
-  DIR *dir = opendir(dir_path);
-  if (!dir)
-    return NULL;
-
-  struct dirent *entry;
-  size_t entries_capacity = 16;
-  size_t entries_count = 0;
-  tree_entry *entries = malloc(sizeof(tree_entry) * entries_capacity);
-
-  // First pass: collect all directory entries
-  while ((entry = readdir(dir))) {
-    char full_path[PATH_MAX];
-    snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-
-    // Skip .git and other ignored paths
-    if (should_ignore_path(full_path))
-      continue;
-
-    // Expand array if needed
-    if (entries_count == entries_capacity) {
-      entries_capacity *= 2;
-      entries = realloc(entries, sizeof(tree_entry) * entries_capacity);
-    }
-
-    // Get file/directory metadata
-    struct stat st;
-    if (lstat(full_path, &st) == -1)
-      continue;
-
-    entries[entries_count].name = strdup(entry->d_name);
-
-    // Handle directories recursively
-    if (S_ISDIR(st.st_mode)) {
-      strcpy(entries[entries_count].mode, "40000");
-      entries[entries_count].hash = write_tree_recursive(full_path);
-    } else if (S_ISREG(st.st_mode)) {
-      // Create blob for regular files
-      strcpy(entries[entries_count].mode, "100644");
-      entries[entries_count].hash = create_blob_from_file(full_path);
-    } else {
-      // Skip special files (symlinks, devices, etc.)
-      free(entries[entries_count].name);
-      continue;
-    }
-
-    entries_count++;
-  }
-  closedir(dir);
-
-  // Sort entries by name (Git requirement)
-  for (size_t i = 0; i < entries_count; i++) {
-    for (size_t j = i + 1; j < entries_count; j++) {
-      if (strcmp(entries[i].name, entries[j].name) > 0) {
-        tree_entry temp = entries[i];
-        entries[i] = entries[j];
-        entries[j] = temp;
-      }
-    }
-  }
-
-  // Calculate total size of tree content
-  size_t total_size = 0;
-  for (size_t i = 0; i < entries_count; i++) {
-    // mode + space + name + null + 20-byte hash
-    total_size +=
-        strlen(entries[i].mode) + 1 + strlen(entries[i].name) + 1 + 20;
-  }
-
-  // Build tree content in binary format
-  char *content = malloc(total_size);
-  size_t pos = 0;
-
-  for (size_t i = 0; i < entries_count; i++) {
-    // Write mode and space separator
-    pos += sprintf(content + pos, "%s ", entries[i].mode);
-
-    // Write filename and null separator
-    size_t name_len = strlen(entries[i].name);
-    memcpy(content + pos, entries[i].name, name_len);
-    pos += name_len;
-    content[pos++] = '\0';
-
-    // Convert hash from hex string to 20-byte binary and write
-    for (int j = 0; j < 40; j += 2) {
-      unsigned int byte;
-      sscanf(entries[i].hash + j, "%2x", &byte);
-      content[pos++] = byte;
-    }
-  }
-
-  // Create tree object header: "tree <size>\0"
-  char header[100];
-  int header_len = sprintf(header, "tree %zu", total_size);
-  header[header_len++] = '\0';
-
-  // Combine header and tree content
-  size_t full_size = header_len + total_size;
-  char *full_content = malloc(full_size);
-  memcpy(full_content, header, header_len);
-  memcpy(full_content + header_len, content, total_size);
-
-  // Calculate hash and store object
-  unsigned char hash[SHA_DIGEST_LENGTH];
-  SHA1((unsigned char *)full_content, full_size, hash);
-
-  char *hex_hash = malloc(41);
-  for (int i = 0; i < 20; i++) {
-    sprintf(hex_hash + (i * 2), "%02x", hash[i]);
-  }
-
-  store_object(hex_hash, full_content, full_size);
-
-  // Cleanup
-  free(full_content);
-  free(content);
-  for (size_t i = 0; i < entries_count; i++) {
-    free(entries[i].name);
-    free(entries[i].hash);
-  }
-  free(entries);
-
-  return hex_hash;
-}
-
-/**
- * Handler for the write-tree command.
- * Creates a tree object representing the current working directory.
- * 
- * @return 0 on success, 1 on error
- */
-int handle_write_tree(void) {
-  // Start recursive tree creation from current directory
-  char *hash = write_tree_recursive(".");
-  if (!hash) {
-    fprintf(stderr, "Failed to write tree\n");
-    return 1;
-  }
-
-  printf("%s\n", hash);
-  free(hash);
-  return 0;
-}
-
 /**
  * Create a Git commit object.
  * Generates a commit with tree reference, optional parent, author info,
@@ -566,80 +881,15 @@ char *create_commit_object(const char *tree_sha, const char *parent_sha,
   pos += sprintf(content + pos, "\n%s\n", message);
 
   // Create commit object header: "commit <size>\0"
-  char header[100];
+  char header[GIT_HEADER_LENGTH];
   int header_len = sprintf(header, "commit %d", pos);
   header[header_len++] = '\0';
 
-  // Combine header and commit content
-  size_t total_len = header_len + pos;
-  char *full_content = malloc(total_len);
-  memcpy(full_content, header, header_len);
-  memcpy(full_content + header_len, content, pos);
-
-  // Calculate SHA-1 hash of the complete commit object
-  unsigned char hash[SHA_DIGEST_LENGTH];
-  SHA1((unsigned char *)full_content, total_len, hash);
-
-  // Convert to hex
-  char *hex_hash = malloc(41);
-  for (int i = 0; i < 20; i++) {
-    sprintf(hex_hash + (i * 2), "%02x", hash[i]);
-  }
-
-  // Store object
-  store_object(hex_hash, full_content, total_len);
-
-  // Cleanup
+  // Hash and store header and content without joining them
+  struct object_id oid;
+  git_hash_object(GIT_COMMIT, content, pos, &oid);
+  store_object_parts(&oid, header, header_len, content, pos);
   free(content);
-  free(full_content);
-
-  return hex_hash;
-}
-
-/**
- * Recursively checkout a tree object to the working directory.
- * Extracts all files and subdirectories from a tree object,
- * creating the directory structure and writing file contents.
- * 
- * @param tree_hash SHA-1 hash of the tree to checkout
- * @param prefix Directory prefix for relative paths
- * @return 0 on success, 1 on error
- */
-int checkout_tree(const char *tree_hash, const char *prefix) {
-  git_object *tree_obj = read_object(tree_hash);
-  if (!tree_obj)
-    return 1;
-
-  tree_object *tree = parse_tree_object(tree_obj);
-  if (!tree) {
-    free_git_object(tree_obj);
-    return 1;
-  }
-
-  // Process each entry in the tree
-  for (size_t i = 0; i < tree->count; i++) {
-    char path[PATH_MAX];
-    snprintf(path, sizeof(path), "%s/%s", prefix, tree->entries[i].name);
 
-    if (strcmp(tree->entries[i].mode, "40000") == 0) {
-      // Recursively checkout subdirectory
-      mkdir(path, 0755);
-      checkout_tree(tree->entries[i].hash, path);
-    } else {
-      // Extract file from blob object
-      git_object *blob = read_object(tree->entries[i].hash);
-      if (blob) {
-        FILE *f = fopen(path, "wb");
-        if (f) {
-          fwrite(blob->content, 1, blob->size, f);
-          fclose(f);
-        }
-        free_git_object(blob);
-      }
-    }
-  }
-
-  free_tree_object(tree);
-  free_git_object(tree_obj);
-  return 0;
+  return oid_to_hex(&oid, malloc(GIT_HASH_LENGTH + 1));
 }
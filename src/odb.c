@@ -0,0 +1,412 @@
+/**
+ * odb.c - Object Database Backend Registry
+ *
+ * This file implements the pluggable object-store layer behind
+ * read_object(). Each backend knows how to find objects in one kind of
+ * storage; lookups try the registered backends in order:
+ *   - loose: zlib files under .git/objects/XX/ (objects.c)
+ *   - packed: mmap'd .pack/.idx pairs under .git/objects/pack (packfile.c)
+ *   - promisor: in a partial clone, objects fetched from the promisor
+ *     remote on demand (promisor.c)
+ *
+ * Further backends can be appended with odb_add_backend(); they are
+ * consulted after the local ones but before the promisor remote. Objects
+ * read recently are found in the object cache (object-cache.c) before
+ * any backend is asked.
+ *
+ * Bulk writers (e.g. write-tree) bracket their work with
+ * odb_transaction_begin()/odb_transaction_end(). Inside a transaction:
+ *   - The IDs of objects known to exist are remembered in memory, so
+ *     writing the same object again costs neither a filesystem lookup nor
+ *     a deflate
+ *   - New loose objects are written to temporary files but not fsync'd or
+ *     renamed into place; ending the transaction flushes them all with one
+ *     syncfs() and only then renames them, so an object never appears
+ *     under its final name before its contents are durable. Until then
+ *     they are not readable.
+ */
+
+#define _GNU_SOURCE  // syncfs()
+#include "git.h"
+#include <fcntl.h>
+#include <pthread.h>
+
+static struct odb_backend *odb_backends;
+static pthread_once_t odb_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Pending Object Structure
+ * A loose object written during a transaction, awaiting its rename.
+ */
+struct pending_object {
+  char *tmp_path;  // Temporary file holding the compressed object
+  char *path;      // Final .git/objects/XX/YYYY... path
+};
+
+static struct oid_set odb_known;  // Objects known to exist (in transaction)
+static struct pending_object *odb_pending;
+static size_t nr_pending, alloc_pending;
+static int odb_transaction;
+static pthread_mutex_t odb_known_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Register the built-in backends.
+ */
+static void odb_register_builtin(void) {
+  loose_odb_backend.next = &packed_odb_backend;
+  packed_odb_backend.next = &promisor_odb_backend;
+  promisor_odb_backend.next = NULL;
+  odb_backends = &loose_odb_backend;
+}
+
+/**
+ * Register the built-in backends on first use (thread-safe).
+ */
+static void odb_init(void) {
+  pthread_once(&odb_once, odb_register_builtin);
+}
+
+/**
+ * Append a backend to the lookup order.
+ *
+ * @param backend Backend to register (must outlive all lookups)
+ */
+void odb_add_backend(struct odb_backend *backend) {
+  // Built-in backends always come first; the network last
+  odb_init();
+
+  struct odb_backend **tail = &odb_backends;
+  while (*tail && *tail != &promisor_odb_backend)
+    tail = &(*tail)->next;
+  backend->next = *tail;
+  *tail = backend;
+}
+
+/**
+ * Read an object from the cache or the first backend that holds it.
+ *
+ * @param oid Object ID of the object
+ * @param cache Whether to cache an object read from a backend
+ * @return Pointer to git_object structure, or NULL if not found
+ */
+static git_object *read_object_from(const struct object_id *oid, int cache) {
+  odb_init();
+
+  git_object *obj = object_cache_get(oid);
+  if (obj)
+    return obj;
+  for (struct odb_backend *b = odb_backends; b; b = b->next) {
+    obj = b->read_object(b, oid);
+    if (obj) {
+      trace_count(TRACE_OBJECTS_READ, 1);
+      if (cache)
+        object_cache_put(oid, obj);
+      return obj;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Read an object from the first backend that holds it.
+ *
+ * @param oid Object ID of the object
+ * @return Pointer to git_object structure, or NULL if not found
+ */
+git_object *odb_read_object(const struct object_id *oid) {
+  return read_object_from(oid, 1);
+}
+
+/**
+ * Read an object the caller will not read again, such as a blob being
+ * checked out or written to a pack. A cached copy is still used, but an
+ * object read from a backend is not copied into the cache, where it would
+ * only push out objects that are read again.
+ *
+ * @param oid Object ID of the object
+ * @return Pointer to git_object structure, or NULL if not found
+ */
+git_object *odb_read_object_once(const struct object_id *oid) {
+  return read_object_from(oid, 0);
+}
+
+/**
+ * Look up an object's type and size without reading its content where the
+ * backend supports it.
+ *
+ * @param oid Object ID of the object
+ * @param type Output: static type name
+ * @param size Output: content size
+ * @return 0 on success, 1 if the object is not found
+ */
+int odb_read_object_info(const struct object_id *oid, const char **type,
+                         size_t *size) {
+  odb_init();
+
+  if (object_cache_get_info(oid, type, size) == 0)
+    return 0;
+  for (struct odb_backend *b = odb_backends; b; b = b->next) {
+    if (b->read_object_info) {
+      if (b->read_object_info(b, oid, type, size) == 0)
+        return 0;
+      continue;
+    }
+    git_object *obj = b->read_object(b, oid);
+    if (obj) {
+      *type = obj->type;
+      *size = obj->size;
+      free_git_object(obj);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Check whether any backend holds an object.
+ *
+ * @param oid Object ID of the object
+ * @return 1 if the object exists, 0 otherwise
+ */
+int odb_has_object(const struct object_id *oid) {
+  odb_init();
+
+  for (struct odb_backend *b = odb_backends; b; b = b->next) {
+    if (b->has_object(b, oid))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Start a bulk write session; see odb_object_known().
+ */
+void odb_transaction_begin(void) {
+  pthread_mutex_lock(&odb_known_lock);
+  if (odb_transaction++ == 0)
+    oid_set_init(&odb_known);
+  pthread_mutex_unlock(&odb_known_lock);
+}
+
+/**
+ * Make the objects written during a transaction durable, then move them
+ * to their final names. Called with odb_known_lock held.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int odb_flush_pending(void) {
+  if (!nr_pending)
+    return 0;
+
+  trace_region_enter("odb", "flush-objects");
+  int result = 0;
+  int fd = open(OBJECTS_DIR, O_RDONLY | O_DIRECTORY);
+  if (fd < 0 || syncfs(fd) != 0) {
+    fprintf(stderr, "Failed to sync objects: %s\n", strerror(errno));
+    result = 1;
+  }
+
+  for (size_t i = 0; i < nr_pending; i++) {
+    struct pending_object *po = &odb_pending[i];
+    if (result == 0 && rename(po->tmp_path, po->path) != 0) {
+      fprintf(stderr, "Failed to install %s: %s\n", po->path,
+              strerror(errno));
+      result = 1;
+    }
+    if (result)
+      unlink(po->tmp_path);
+    free(po->tmp_path);
+    free(po->path);
+  }
+  nr_pending = 0;
+
+  // The renames themselves are made durable in one more pass
+  if (fd >= 0) {
+    if (result == 0)
+      syncfs(fd);
+    close(fd);
+  }
+  trace_region_leave("odb", "flush-objects");
+  return result;
+}
+
+/**
+ * End a bulk write session: flush and install the objects written during
+ * it, then forget the remembered object IDs.
+ *
+ * @return 0 on success, 1 if written objects could not be installed
+ */
+int odb_transaction_end(void) {
+  int result = 0;
+  pthread_mutex_lock(&odb_known_lock);
+  if (--odb_transaction == 0) {
+    result = odb_flush_pending();
+    oid_set_clear(&odb_known);
+  }
+  pthread_mutex_unlock(&odb_known_lock);
+  return result;
+}
+
+/**
+ * Whether a bulk write session is active (object writes may skip fsync).
+ */
+int odb_in_transaction(void) {
+  pthread_mutex_lock(&odb_known_lock);
+  int active = odb_transaction > 0;
+  pthread_mutex_unlock(&odb_known_lock);
+  return active;
+}
+
+/**
+ * Move a completely written loose object to its final name. Inside a
+ * transaction the rename is deferred to odb_transaction_end(); otherwise
+ * the caller must already have fsync'd the file.
+ *
+ * @param tmp_path Temporary file holding the object
+ * @param path Final object path
+ * @return 0 on success, 1 on error
+ */
+int odb_finalize_object(const char *tmp_path, const char *path) {
+  pthread_mutex_lock(&odb_known_lock);
+  if (odb_transaction) {
+    if (nr_pending == alloc_pending) {
+      alloc_pending = alloc_pending ? alloc_pending * 2 : 64;
+      odb_pending =
+          realloc(odb_pending, alloc_pending * sizeof(struct pending_object));
+    }
+    odb_pending[nr_pending].tmp_path = strdup(tmp_path);
+    odb_pending[nr_pending].path = strdup(path);
+    nr_pending++;
+    pthread_mutex_unlock(&odb_known_lock);
+    trace_count(TRACE_OBJECTS_WRITTEN, 1);
+    return 0;
+  }
+  pthread_mutex_unlock(&odb_known_lock);
+
+  if (rename(tmp_path, path) != 0) {
+    fprintf(stderr, "Failed to install %s: %s\n", path, strerror(errno));
+    unlink(tmp_path);
+    return 1;
+  }
+  trace_count(TRACE_OBJECTS_WRITTEN, 1);
+  return 0;
+}
+
+/**
+ * Check whether an object is already stored, so it need not be written.
+ * Inside a transaction, positive answers are remembered.
+ *
+ * @param oid Object ID of the object
+ * @return 1 if the object exists, 0 otherwise
+ */
+int odb_object_known(const struct object_id *oid) {
+  pthread_mutex_lock(&odb_known_lock);
+  int known = odb_transaction && oid_set_contains(&odb_known, oid);
+  pthread_mutex_unlock(&odb_known_lock);
+  if (known)
+    return 1;
+
+  if (!odb_has_object(oid))
+    return 0;
+  odb_object_stored(oid);
+  return 1;
+}
+
+/**
+ * Remember that an object now exists (no-op outside a transaction).
+ *
+ * @param oid Object ID of the object
+ */
+void odb_object_stored(const struct object_id *oid) {
+  pthread_mutex_lock(&odb_known_lock);
+  if (odb_transaction)
+    oid_set_insert(&odb_known, oid);
+  pthread_mutex_unlock(&odb_known_lock);
+}
+
+/*
+ * ============================================================================
+ * Object ID Sets
+ * ============================================================================
+ */
+
+/**
+ * Slot for an object ID in a table of the given (power of two) size.
+ * SHA-1 bytes are uniformly distributed, so the first word is the hash.
+ */
+static size_t oid_set_slot(const struct object_id *oid, size_t size) {
+  size_t key;
+  memcpy(&key, oid->hash, sizeof(key));
+  return key & (size - 1);
+}
+
+/**
+ * Initialize an empty set.
+ *
+ * @param set Set to initialize
+ */
+void oid_set_init(struct oid_set *set) {
+  memset(set, 0, sizeof(*set));
+}
+
+/**
+ * Free a set's storage, leaving it empty.
+ *
+ * @param set Set to clear
+ */
+void oid_set_clear(struct oid_set *set) {
+  free(set->oids);
+  free(set->used);
+  oid_set_init(set);
+}
+
+/**
+ * Check whether an object ID is in a set.
+ *
+ * @param set Set to search
+ * @param oid Object ID
+ * @return 1 if present, 0 otherwise
+ */
+int oid_set_contains(const struct oid_set *set, const struct object_id *oid) {
+  if (!set->size)
+    return 0;
+  for (size_t i = oid_set_slot(oid, set->size); set->used[i];
+       i = (i + 1) & (set->size - 1)) {
+    if (oideq(&set->oids[i], oid))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Add an object ID to a set (open addressing, kept at most half full).
+ *
+ * @param set Set to insert into
+ * @param oid Object ID
+ * @return 1 if it was newly added, 0 if it was already present
+ */
+int oid_set_insert(struct oid_set *set, const struct object_id *oid) {
+  if (2 * (set->nr + 1) > set->size) {
+    struct oid_set old = *set;
+    set->size = old.size ? old.size * 2 : 64;
+    set->nr = 0;
+    set->oids = malloc(set->size * sizeof(struct object_id));
+    set->used = calloc(set->size, 1);
+    for (size_t i = 0; i < old.size; i++) {
+      if (old.used[i])
+        oid_set_insert(set, &old.oids[i]);
+    }
+    free(old.oids);
+    free(old.used);
+  }
+
+  size_t i = oid_set_slot(oid, set->size);
+  for (; set->used[i]; i = (i + 1) & (set->size - 1)) {
+    if (oideq(&set->oids[i], oid))
+      return 0;
+  }
+  set->oids[i] = *oid;
+  set->used[i] = 1;
+  set->nr++;
+  return 1;
+}
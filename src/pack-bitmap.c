@@ -0,0 +1,954 @@
+/**
+ * pack-bitmap.c - Reachability Bitmaps
+ *
+ * This file implements Git's pack bitmap index (pack-<sha>.bitmap, next
+ * to the .pack and .idx). For a selection of commits it stores the set of
+ * objects reachable from each as a bitmap over the pack's objects, bit n
+ * standing for the n-th object by pack offset. The objects reachable from
+ * some commits but not from others are then the OR of the bitmaps of
+ * their nearest selected ancestors, filled in with the few commits and
+ * trees in between, followed by one AND NOT: no walk over the trees of
+ * the whole history as walk_objects() does.
+ *
+ * Bitmaps are only valid for a pack holding every object its commits
+ * reach. They are written after a full clone, whose single pack has that
+ * property, and not in shallow or partial clones. Objects outside the
+ * bitmapped pack (such as those from later fetches) are given positions
+ * past its end as they are met, so the bitmaps keep answering as the
+ * repository grows.
+ *
+ * File format (version 1, as written by Git; big-endian integers):
+ *   - Header: "BITM", version(2), options(2) with BITMAP_OPT_FULL_DAG,
+ *     number of entries(4), checksum of the pack(20)
+ *   - Type bitmaps: the pack's commits, trees, blobs and tags
+ *   - Entries: the commit's position in the .idx(4), XOR offset(1),
+ *     flags(1), bitmap. With a non-zero XOR offset n, the bitmap is stored
+ *     XORed with that of the entry n before it. Git writes those; this
+ *     file reads them but writes plain bitmaps only.
+ *   - Trailer: SHA-1 of everything preceding it
+ * Every bitmap is EWAH-compressed (ewah.c). Data Git may add between the
+ * entries and the trailer (name-hash cache, lookup table) is ignored.
+ */
+
+#include "git.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+#define BITMAP_OPT_FULL_DAG 0x1  // Bitmaps are closed under reachability
+#define BITMAP_HEADER_SIZE (12 + SHA_DIGEST_LENGTH)
+#define BITMAP_ENTRY_HEADER_SIZE 6
+#define BITMAP_MAX_XOR_OFFSET 160
+#define BITMAP_COMMIT_INTERVAL 100  // Commits between selected commits
+#define NR_OBJECT_TYPES 4           // OBJ_COMMIT..OBJ_TAG
+
+/**
+ * Bitmap Entry Structure
+ * One commit's stored bitmap, still compressed in the mapping.
+ */
+struct bitmap_entry {
+  uint32_t idx_pos;           // Position of the commit in the .idx
+  unsigned xor_offset;        // Entries back to the XOR base, or 0
+  const unsigned char *ewah;  // Serialized bitmap
+  size_t ewah_size;
+};
+
+/**
+ * Bitmap Index Structure
+ * The bitmaps of one pack and the bit numbering they use: pack objects by
+ * offset, then objects outside the pack in the order they were met.
+ */
+struct bitmap_index {
+  struct packed_git *pack;
+  unsigned char *map;  // Mapping of the .bitmap file (NULL while writing)
+  size_t map_size;
+  uint32_t *pack_order;  // Bit -> .idx position
+  uint32_t *bit_of;      // .idx position -> bit
+  struct bitmap *types[NR_OBJECT_TYPES];  // Pack objects of each type
+  struct bitmap_entry *entries;           // In file order
+  uint32_t nr_entries;
+  struct entry_pos {
+    uint32_t idx_pos;
+    uint32_t entry;
+  } *by_idx_pos;  // Entries sorted by .idx position
+  int closed;     // Writing: every object must be in the pack
+
+  // Objects outside the pack, at bits num_objects + i
+  struct object_id *ext;
+  unsigned char *ext_type;
+  size_t nr_ext, alloc_ext;
+  uint32_t *ext_slots;  // Open addressing: ext index + 1, 0 if empty
+  size_t nr_ext_slots;
+};
+
+static struct bitmap_index *the_bitmap;
+static int bitmap_prepared;
+static pthread_mutex_t bitmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t get_be32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return ntohl(v);
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+  v = htonl(v);
+  memcpy(p, &v, 4);
+}
+
+/*
+ * ============================================================================
+ * Object Positions
+ * ============================================================================
+ */
+
+struct offset_pos {
+  uint64_t offset;
+  uint32_t idx_pos;
+};
+
+static int compare_offsets(const void *a, const void *b) {
+  uint64_t x = ((const struct offset_pos *)a)->offset;
+  uint64_t y = ((const struct offset_pos *)b)->offset;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Set up an empty bitmap index for a pack and number its objects in pack
+ * order.
+ */
+static struct bitmap_index *bitmap_index_new(struct packed_git *p) {
+  struct bitmap_index *bi = calloc(1, sizeof(*bi));
+  bi->pack = p;
+  uint32_t n = p->num_objects;
+  struct offset_pos *sorted = malloc((n ? n : 1) * sizeof(*sorted));
+  for (uint32_t i = 0; i < n; i++) {
+    sorted[i].offset = pack_entry_offset(p, i);
+    sorted[i].idx_pos = i;
+  }
+  qsort(sorted, n, sizeof(*sorted), compare_offsets);
+
+  bi->pack_order = malloc((n ? n : 1) * sizeof(*bi->pack_order));
+  bi->bit_of = malloc((n ? n : 1) * sizeof(*bi->bit_of));
+  for (uint32_t bit = 0; bit < n; bit++) {
+    bi->pack_order[bit] = sorted[bit].idx_pos;
+    bi->bit_of[sorted[bit].idx_pos] = bit;
+  }
+  free(sorted);
+  return bi;
+}
+
+static void free_bitmap_index(struct bitmap_index *bi) {
+  if (!bi)
+    return;
+  if (bi->map)
+    munmap(bi->map, bi->map_size);
+  free(bi->pack_order);
+  free(bi->bit_of);
+  for (int t = 0; t < NR_OBJECT_TYPES; t++)
+    bitmap_free(bi->types[t]);
+  free(bi->entries);
+  free(bi->by_idx_pos);
+  free(bi->ext);
+  free(bi->ext_type);
+  free(bi->ext_slots);
+  free(bi);
+}
+
+static size_t ext_slot(const struct bitmap_index *bi,
+                       const struct object_id *oid) {
+  uint32_t h;
+  memcpy(&h, oid->hash, sizeof(h));
+  size_t mask = bi->nr_ext_slots - 1;
+  size_t slot = h & mask;
+  while (bi->ext_slots[slot] &&
+         !oideq(&bi->ext[bi->ext_slots[slot] - 1], oid))
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+/**
+ * Bit position of an object, numbering it past the pack's objects if it
+ * is met for the first time outside the pack.
+ *
+ * @param bi Bitmap index
+ * @param oid Object
+ * @param type Type of the object (OBJ_COMMIT..OBJ_TAG)
+ * @return Position, or -1 if the object is outside a pack being bitmapped
+ */
+static long bitmap_position(struct bitmap_index *bi,
+                            const struct object_id *oid, int type) {
+  long idx_pos = find_pack_entry_pos(bi->pack, oid);
+  if (idx_pos >= 0)
+    return bi->bit_of[idx_pos];
+  if (bi->closed)
+    return -1;
+
+  // Keep the table at most half full
+  if (2 * (bi->nr_ext + 1) > bi->nr_ext_slots) {
+    uint32_t *old = bi->ext_slots;
+    size_t old_nr = bi->nr_ext_slots;
+    bi->nr_ext_slots = old_nr ? old_nr * 2 : 64;
+    bi->ext_slots = calloc(bi->nr_ext_slots, sizeof(*bi->ext_slots));
+    for (size_t i = 0; i < old_nr; i++) {
+      if (old[i])
+        bi->ext_slots[ext_slot(bi, &bi->ext[old[i] - 1])] = old[i];
+    }
+    free(old);
+  }
+  size_t slot = ext_slot(bi, oid);
+  if (!bi->ext_slots[slot]) {
+    if (bi->nr_ext == bi->alloc_ext) {
+      bi->alloc_ext = bi->alloc_ext ? bi->alloc_ext * 2 : 64;
+      bi->ext = realloc(bi->ext, bi->alloc_ext * sizeof(*bi->ext));
+      bi->ext_type = realloc(bi->ext_type, bi->alloc_ext);
+    }
+    bi->ext[bi->nr_ext] = *oid;
+    bi->ext_type[bi->nr_ext] = type;
+    bi->ext_slots[slot] = ++bi->nr_ext;
+  }
+  return (long)bi->pack->num_objects + bi->ext_slots[slot] - 1;
+}
+
+/**
+ * Find the stored bitmap of the commit at a bit position.
+ *
+ * @return Entry number, or -1 if the commit has none
+ */
+static long find_bitmap_entry(const struct bitmap_index *bi, long pos) {
+  if (pos >= (long)bi->pack->num_objects)
+    return -1;
+  uint32_t idx_pos = bi->pack_order[pos];
+  size_t lo = 0, hi = bi->nr_entries;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    uint32_t at = bi->by_idx_pos[mid].idx_pos;
+    if (at == idx_pos)
+      return bi->by_idx_pos[mid].entry;
+    if (at < idx_pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+/**
+ * Decompress the bitmap of an entry, undoing its XOR chain.
+ *
+ * @return Bitmap (free with bitmap_free()), or NULL if it is corrupt
+ */
+static struct bitmap *entry_bitmap(const struct bitmap_index *bi, uint32_t i) {
+  const struct bitmap_entry *e = &bi->entries[i];
+  struct bitmap *b = ewah_decode(e->ewah, e->ewah_size);
+  if (b && e->xor_offset) {
+    struct bitmap *base = entry_bitmap(bi, i - e->xor_offset);
+    if (base)
+      bitmap_xor(b, base);
+    else {
+      bitmap_free(b);
+      b = NULL;
+    }
+    bitmap_free(base);
+  }
+  return b;
+}
+
+/*
+ * ============================================================================
+ * Filling Bitmaps
+ * ============================================================================
+ */
+
+/**
+ * Object Stack Structure
+ * Objects waiting to be added to a bitmap.
+ */
+struct object_stack {
+  struct object_id *oids;
+  size_t nr, alloc;
+};
+
+static void object_stack_push(struct object_stack *s,
+                              const struct object_id *oid) {
+  if (s->nr == s->alloc) {
+    s->alloc = s->alloc ? s->alloc * 2 : 64;
+    s->oids = realloc(s->oids, s->alloc * sizeof(*s->oids));
+  }
+  s->oids[s->nr++] = *oid;
+}
+
+/**
+ * Whether an object is in a bitmap already or in the seen bitmap.
+ */
+static int bitmap_has(const struct bitmap *b, const struct bitmap *seen,
+                      long pos) {
+  return bitmap_get(b, pos) || (seen && bitmap_get(seen, pos));
+}
+
+/**
+ * Add a tree and everything below it to a bitmap. Trees found in b or in
+ * seen are skipped with all they contain: every bitmap built here covers
+ * everything its objects reach.
+ *
+ * @param bi Bitmap index
+ * @param root Tree to add
+ * @param b Bitmap to add to
+ * @param seen Objects to leave out, or NULL
+ * @return 0 on success, 1 on error
+ */
+static int fill_tree(struct bitmap_index *bi, const struct object_id *root,
+                     struct bitmap *b, const struct bitmap *seen) {
+  struct object_stack stack = {0};
+  object_stack_push(&stack, root);
+  int result = 0;
+  while (stack.nr && !result) {
+    struct object_id oid = stack.oids[--stack.nr];
+    long pos = bitmap_position(bi, &oid, OBJ_TREE);
+    if (pos < 0) {
+      result = 1;
+      break;
+    }
+    if (bitmap_has(b, seen, pos))
+      continue;
+    bitmap_set(b, pos);
+
+    git_object *obj = odb_read_object(&oid);
+    tree_object *tree = parse_tree_object(obj);
+    if (!tree) {
+      char hex[GIT_HASH_LENGTH + 1];
+      fprintf(stderr, "Failed to read tree %s\n", oid_to_hex(&oid, hex));
+      free_git_object(obj);
+      result = 1;
+      break;
+    }
+    for (size_t i = 0; i < tree->count && !result; i++) {
+      const tree_entry *te = &tree->entries[i];
+      if (te->mode == TREE_MODE_GITLINK)
+        continue;  // Submodule commits live in another repository
+      if (te->mode == TREE_MODE_DIR) {
+        object_stack_push(&stack, te->oid);
+        continue;
+      }
+      long blob = bitmap_position(bi, te->oid, OBJ_BLOB);
+      if (blob < 0)
+        result = 1;
+      else if (!bitmap_has(b, seen, blob))
+        bitmap_set(b, blob);
+    }
+    free_tree_object(tree);
+    free_git_object(obj);
+  }
+  free(stack.oids);
+  return result;
+}
+
+/**
+ * Add the objects reachable from some commits to a bitmap, walking
+ * commits only until ones with a stored bitmap or already in b or seen.
+ *
+ * @param bi Bitmap index
+ * @param tips Commits to start from
+ * @param nr_tips Number of tips
+ * @param b Bitmap to add to
+ * @param seen Objects to leave out, or NULL
+ * @return 0 on success, 1 on error
+ */
+static int fill_commits(struct bitmap_index *bi, const struct object_id *tips,
+                        size_t nr_tips, struct bitmap *b,
+                        const struct bitmap *seen) {
+  struct object_stack stack = {0};
+  for (size_t i = 0; i < nr_tips; i++)
+    object_stack_push(&stack, &tips[i]);
+
+  int result = 0;
+  while (stack.nr && !result) {
+    struct object_id oid = stack.oids[--stack.nr];
+    long pos = bitmap_position(bi, &oid, OBJ_COMMIT);
+    if (pos < 0 || bitmap_has(b, seen, pos))
+      continue;
+
+    long entry = find_bitmap_entry(bi, pos);
+    if (entry >= 0) {
+      struct bitmap *stored = entry_bitmap(bi, entry);
+      if (!stored) {
+        result = 1;
+        break;
+      }
+      bitmap_or(b, stored);
+      bitmap_free(stored);
+      continue;
+    }
+
+    struct commit_info info;
+    if (read_commit_info(&oid, &info) != 0) {
+      result = 1;
+      break;
+    }
+    bitmap_set(b, pos);
+    result = fill_tree(bi, &info.tree, b, seen);
+    for (size_t p = 0; p < info.nr_parents; p++)
+      object_stack_push(&stack, commit_parent(&info, p));
+    commit_info_release(&info);
+  }
+  free(stack.oids);
+  return result;
+}
+
+/*
+ * ============================================================================
+ * Reading
+ * ============================================================================
+ */
+
+static int compare_entry_pos(const void *a, const void *b) {
+  uint32_t x = ((const struct entry_pos *)a)->idx_pos;
+  uint32_t y = ((const struct entry_pos *)b)->idx_pos;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Map a pack's bitmap file and check its layout.
+ *
+ * @param p Pack the bitmap belongs to
+ * @param path Path of the .bitmap file
+ * @return Bitmap index, or NULL if the file is missing or invalid
+ */
+static struct bitmap_index *load_bitmap_index(struct packed_git *p,
+                                              const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < BITMAP_HEADER_SIZE + SHA_DIGEST_LENGTH) {
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  struct bitmap_index *bi = bitmap_index_new(p);
+  bi->map = map;
+  bi->map_size = st.st_size;
+  const unsigned char *data = bi->map;
+  const unsigned char *pack_sha = p->pack_map + p->pack_size -
+                                  SHA_DIGEST_LENGTH;
+  if (memcmp(data, BITMAP_SIGNATURE, 4) != 0 ||
+      (data[4] << 8 | data[5]) != BITMAP_VERSION ||
+      !((data[6] << 8 | data[7]) & BITMAP_OPT_FULL_DAG) ||
+      memcmp(data + 12, pack_sha, SHA_DIGEST_LENGTH) != 0) {
+    fprintf(stderr, "Ignoring unsupported or stale %s\n", path);
+    free_bitmap_index(bi);
+    return NULL;
+  }
+
+  size_t pos = BITMAP_HEADER_SIZE;
+  size_t end = bi->map_size - SHA_DIGEST_LENGTH;
+  int valid = 1;
+  for (int t = 0; t < NR_OBJECT_TYPES && valid; t++) {
+    size_t size = ewah_serialized_size(data + pos, end - pos);
+    bi->types[t] = size ? ewah_decode(data + pos, size) : NULL;
+    valid = bi->types[t] != NULL;
+    pos += size;
+  }
+
+  uint32_t nr = get_be32(data + 8);
+  bi->entries = malloc((nr ? nr : 1) * sizeof(*bi->entries));
+  for (uint32_t i = 0; i < nr && valid; i++) {
+    struct bitmap_entry *e = &bi->entries[i];
+    if (end - pos < BITMAP_ENTRY_HEADER_SIZE) {
+      valid = 0;
+      break;
+    }
+    e->idx_pos = get_be32(data + pos);
+    e->xor_offset = data[pos + 4];
+    pos += BITMAP_ENTRY_HEADER_SIZE;
+    e->ewah = data + pos;
+    e->ewah_size = ewah_serialized_size(e->ewah, end - pos);
+    valid = e->idx_pos < p->num_objects && e->xor_offset <= i &&
+            e->xor_offset <= BITMAP_MAX_XOR_OFFSET && e->ewah_size;
+    pos += e->ewah_size;
+    bi->nr_entries++;
+  }
+  if (!valid) {
+    fprintf(stderr, "Ignoring corrupt %s\n", path);
+    free_bitmap_index(bi);
+    return NULL;
+  }
+
+  bi->by_idx_pos = malloc((nr ? nr : 1) * sizeof(*bi->by_idx_pos));
+  for (uint32_t i = 0; i < nr; i++) {
+    bi->by_idx_pos[i].idx_pos = bi->entries[i].idx_pos;
+    bi->by_idx_pos[i].entry = i;
+  }
+  qsort(bi->by_idx_pos, nr, sizeof(*bi->by_idx_pos), compare_entry_pos);
+  return bi;
+}
+
+/**
+ * Get the bitmap index, loading it on first use (thread-safe). Only the
+ * first pack found with a bitmap is used.
+ */
+static struct bitmap_index *prepare_bitmap_index(void) {
+  pthread_mutex_lock(&bitmap_lock);
+  struct stat st;
+  if (!bitmap_prepared && stat(SHALLOW_FILE, &st) != 0 &&
+      !has_promisor_remote()) {
+    for (struct packed_git *p = get_packed_git(); p && !the_bitmap;
+         p = p->next) {
+      char path[PATH_MAX];
+      size_t len = strlen(p->pack_path) - strlen(".pack");
+      snprintf(path, sizeof(path), "%.*s.bitmap", (int)len, p->pack_path);
+      if (access(path, F_OK) == 0)
+        the_bitmap = load_bitmap_index(p, path);
+    }
+  }
+  bitmap_prepared = 1;
+  struct bitmap_index *bi = the_bitmap;
+  pthread_mutex_unlock(&bitmap_lock);
+  return bi;
+}
+
+/**
+ * Forget the loaded bitmap index; it is reloaded on next use. Called when
+ * the packs it refers to are closed.
+ */
+void close_bitmap_index(void) {
+  pthread_mutex_lock(&bitmap_lock);
+  free_bitmap_index(the_bitmap);
+  the_bitmap = NULL;
+  bitmap_prepared = 0;
+  pthread_mutex_unlock(&bitmap_lock);
+}
+
+/**
+ * Find the objects reachable from tips but not from excludes using the
+ * reachability bitmaps.
+ *
+ * @param tips Commits to start from
+ * @param nr_tips Number of tips
+ * @param excludes Commits whose objects are left out
+ * @param nr_excludes Number of excludes
+ * @return Objects (free with bitmap_free(); read with
+ *         bitmap_for_each_object() and bitmap_count_objects()), or NULL
+ *         if there are no usable bitmaps
+ */
+struct bitmap *bitmap_find_reachable(const struct object_id *tips,
+                                     size_t nr_tips,
+                                     const struct object_id *excludes,
+                                     size_t nr_excludes) {
+  struct bitmap_index *bi = prepare_bitmap_index();
+  if (!bi)
+    return NULL;
+
+  // Wanted objects already known to be excluded need no walk
+  struct bitmap *haves = bitmap_new();
+  struct bitmap *wants = bitmap_new();
+  if (fill_commits(bi, excludes, nr_excludes, haves, NULL) != 0 ||
+      fill_commits(bi, tips, nr_tips, wants, haves) != 0) {
+    bitmap_free(haves);
+    bitmap_free(wants);
+    return NULL;
+  }
+  bitmap_and_not(wants, haves);
+  bitmap_free(haves);
+  return wants;
+}
+
+/**
+ * Call fn for the pack objects of a type in a bitmap, in pack order, then
+ * for the objects of that type outside the pack.
+ */
+static int for_each_object_of_type(const struct bitmap_index *bi,
+                                   const struct bitmap *objects, int type,
+                                   object_fn fn, void *data) {
+  const struct bitmap *of_type = bi->types[type - 1];
+  size_t nr = objects->word_alloc < of_type->word_alloc
+                  ? objects->word_alloc
+                  : of_type->word_alloc;
+  for (size_t i = 0; i < nr; i++) {
+    uint64_t word = objects->words[i] & of_type->words[i];
+    while (word) {
+      size_t bit = i * 64 + __builtin_ctzll(word);
+      word &= word - 1;
+      if (bit >= bi->pack->num_objects)
+        break;
+      const struct object_id *oid =
+          (const struct object_id *)(bi->pack->shas +
+                                     (size_t)bi->pack_order[bit] *
+                                         SHA_DIGEST_LENGTH);
+      if (fn(oid, type, NULL, data) != 0)
+        return 1;
+    }
+  }
+  for (size_t k = 0; k < bi->nr_ext; k++) {
+    if (bi->ext_type[k] == type &&
+        bitmap_get(objects, bi->pack->num_objects + k) &&
+        fn(&bi->ext[k], type, NULL, data) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Call fn for each object of a bitmap from bitmap_find_reachable():
+ * commits, trees, blobs, then tags, each in pack order. Paths are not
+ * known.
+ *
+ * @param objects Objects to list
+ * @param type Only list objects of this type (OBJ_COMMIT..OBJ_TAG), or 0
+ * @param fn Callback; returning non-zero stops the iteration
+ * @param data Passed through to fn
+ * @return 0 on success, 1 if fn stopped
+ */
+int bitmap_for_each_object(const struct bitmap *objects, int type,
+                           object_fn fn, void *data) {
+  struct bitmap_index *bi = prepare_bitmap_index();
+  for (int t = OBJ_COMMIT; bi && t <= OBJ_TAG; t++) {
+    if ((!type || t == type) &&
+        for_each_object_of_type(bi, objects, t, fn, data) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Count the objects of a bitmap from bitmap_find_reachable().
+ *
+ * @param objects Objects to count
+ * @param type Only count objects of this type (OBJ_COMMIT..OBJ_TAG), or 0
+ * @return Number of objects
+ */
+size_t bitmap_count_objects(const struct bitmap *objects, int type) {
+  struct bitmap_index *bi = prepare_bitmap_index();
+  if (!type || !bi)
+    return bitmap_popcount(objects);
+
+  const struct bitmap *of_type = bi->types[type - 1];
+  size_t count = 0;
+  for (size_t i = 0; i < objects->word_alloc && i < of_type->word_alloc; i++)
+    count += __builtin_popcountll(objects->words[i] & of_type->words[i]);
+  for (size_t k = 0; k < bi->nr_ext; k++) {
+    if (bi->ext_type[k] == type &&
+        bitmap_get(objects, bi->pack->num_objects + k))
+      count++;
+  }
+  return count;
+}
+
+/*
+ * ============================================================================
+ * Writing
+ * ============================================================================
+ */
+
+/**
+ * Bitmap Writer Commit Structure
+ */
+struct bitmap_commit {
+  struct object_id oid;
+  struct commit_info info;  // Owned copy
+  uint32_t children;        // Children whose bitmap is not built yet
+  struct bitmap *bitmap;    // Reachable objects, while children remain
+};
+
+/**
+ * Bitmap Writer Structure
+ */
+struct bitmap_writer {
+  struct bitmap_index *bi;
+  struct object_id *tips;
+  size_t nr_tips, alloc_tips;
+  struct oid_set seen_tips;
+  struct bitmap_commit *commits;  // Topological order, children first
+  size_t nr, alloc;
+  struct commit_pos {
+    struct object_id oid;
+    size_t nr;
+  } *by_oid;  // Commit numbers sorted by object ID
+
+  // Bitmaps of the selected commits, in the order they are written
+  struct selected_bitmap {
+    uint32_t idx_pos;
+    unsigned char *ewah;
+    size_t ewah_size;
+  } *selected;
+  size_t nr_selected, alloc_selected;
+};
+
+static int collect_bitmap_tip(const char *name, const struct object_id *oid,
+                              void *data) {
+  (void)name;
+  struct bitmap_writer *w = data;
+  struct object_id commit = *oid;
+  if (peel_to_commit(&commit) == 0 && oid_set_insert(&w->seen_tips, &commit)) {
+    if (w->nr_tips == w->alloc_tips) {
+      w->alloc_tips = w->alloc_tips ? w->alloc_tips * 2 : 64;
+      w->tips = realloc(w->tips, w->alloc_tips * sizeof(*w->tips));
+    }
+    w->tips[w->nr_tips++] = commit;
+  }
+  return 0;
+}
+
+static int collect_bitmap_commit(const struct object_id *oid,
+                                 const struct commit_info *info, void *data) {
+  struct bitmap_writer *w = data;
+  if (w->nr == w->alloc) {
+    w->alloc = w->alloc ? w->alloc * 2 : 256;
+    w->commits = realloc(w->commits, w->alloc * sizeof(*w->commits));
+  }
+  struct bitmap_commit *c = &w->commits[w->nr++];
+  memset(c, 0, sizeof(*c));
+  c->oid = *oid;
+  c->info = *info;
+  if (info->nr_parents > 2) {
+    size_t size = (info->nr_parents - 2) * sizeof(*info->more_parents);
+    c->info.more_parents = malloc(size);
+    memcpy(c->info.more_parents, info->more_parents, size);
+  }
+  return 0;
+}
+
+static int compare_writer_oids(const void *a, const void *b) {
+  return oidcmp(&((const struct commit_pos *)a)->oid,
+                &((const struct commit_pos *)b)->oid);
+}
+
+/**
+ * Number of a collected commit.
+ *
+ * @return Commit number, or -1 if it was not collected
+ */
+static long writer_find(const struct bitmap_writer *w,
+                        const struct object_id *oid) {
+  size_t lo = 0, hi = w->nr;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = oidcmp(&w->by_oid[mid].oid, oid);
+    if (cmp == 0)
+      return w->by_oid[mid].nr;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+/**
+ * Look up the type of every object of the pack.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int build_type_bitmaps(struct bitmap_index *bi) {
+  for (int t = 0; t < NR_OBJECT_TYPES; t++)
+    bi->types[t] = bitmap_new();
+  for (uint32_t bit = 0; bit < bi->pack->num_objects; bit++) {
+    int type = pack_object_type(
+        bi->pack, pack_entry_offset(bi->pack, bi->pack_order[bit]));
+    if (type < OBJ_COMMIT || type > OBJ_TAG)
+      return 1;
+    bitmap_set(bi->types[type - 1], bit);
+  }
+  return 0;
+}
+
+/**
+ * Compute the bitmap of every collected commit, parents first, keeping
+ * those of the selected commits. A commit's bitmap starts from its
+ * parents' (taken over from the last child to need it) plus its own tree,
+ * so each tree of the history is read once.
+ *
+ * @return 0 on success, 1 on error (including objects missing from the
+ *         pack)
+ */
+static int build_commit_bitmaps(struct bitmap_writer *w) {
+  for (size_t i = 0; i < w->nr; i++) {
+    const struct commit_info *info = &w->commits[i].info;
+    for (size_t p = 0; p < info->nr_parents; p++) {
+      long j = writer_find(w, commit_parent(info, p));
+      if (j < 0)
+        return 1;
+      w->commits[j].children++;
+    }
+  }
+
+  int result = 0;
+  for (size_t k = w->nr; k-- > 0 && !result;) {
+    struct bitmap_commit *c = &w->commits[k];
+    struct bitmap *b = NULL;
+    for (size_t p = 0; p < c->info.nr_parents; p++) {
+      struct bitmap_commit *parent =
+          &w->commits[writer_find(w, commit_parent(&c->info, p))];
+      if (!b && parent->children == 1) {
+        b = parent->bitmap;
+        parent->bitmap = NULL;
+      } else if (!b) {
+        b = bitmap_dup(parent->bitmap);
+      } else {
+        bitmap_or(b, parent->bitmap);
+      }
+      if (--parent->children == 0) {
+        bitmap_free(parent->bitmap);
+        parent->bitmap = NULL;
+      }
+    }
+    if (!b)
+      b = bitmap_new();
+
+    long pos = bitmap_position(w->bi, &c->oid, OBJ_COMMIT);
+    if (pos < 0) {
+      bitmap_free(b);
+      return 1;
+    }
+    bitmap_set(b, pos);
+    result = fill_tree(w->bi, &c->info.tree, b, NULL);
+
+    // Tips, and every so often a commit of the history below them
+    if (!result && (k % BITMAP_COMMIT_INTERVAL == 0 ||
+                    oid_set_contains(&w->seen_tips, &c->oid))) {
+      if (w->nr_selected == w->alloc_selected) {
+        w->alloc_selected = w->alloc_selected ? w->alloc_selected * 2 : 64;
+        w->selected =
+            realloc(w->selected, w->alloc_selected * sizeof(*w->selected));
+      }
+      struct selected_bitmap *s = &w->selected[w->nr_selected++];
+      s->idx_pos = w->bi->pack_order[pos];
+      s->ewah = ewah_encode(b, &s->ewah_size);
+    }
+    if (c->children)
+      c->bitmap = b;
+    else
+      bitmap_free(b);
+  }
+  return result;
+}
+
+static int bitmap_write(int fd, struct git_hash_ctx *ctx, const void *buf,
+                        size_t len) {
+  git_hash_update(ctx, buf, len);
+  return write_in_full(fd, buf, len);
+}
+
+static int write_ewah(int fd, struct git_hash_ctx *ctx,
+                      const struct bitmap *b) {
+  size_t len;
+  unsigned char *ewah = ewah_encode(b, &len);
+  int err = bitmap_write(fd, ctx, ewah, len);
+  free(ewah);
+  return err;
+}
+
+/**
+ * Write the bitmap file for the selected commits of a writer.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_bitmap_file(struct bitmap_writer *w, const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0444);
+  if (fd < 0)
+    return 1;
+
+  const struct packed_git *p = w->bi->pack;
+  struct git_hash_ctx ctx;
+  git_hash_init(&ctx);
+  unsigned char header[BITMAP_HEADER_SIZE];
+  memcpy(header, BITMAP_SIGNATURE, 4);
+  header[4] = 0;
+  header[5] = BITMAP_VERSION;
+  header[6] = 0;
+  header[7] = BITMAP_OPT_FULL_DAG;
+  put_be32(header + 8, w->nr_selected);
+  memcpy(header + 12, p->pack_map + p->pack_size - SHA_DIGEST_LENGTH,
+         SHA_DIGEST_LENGTH);
+  int err = bitmap_write(fd, &ctx, header, sizeof(header));
+
+  for (int t = 0; t < NR_OBJECT_TYPES && !err; t++)
+    err = write_ewah(fd, &ctx, w->bi->types[t]);
+
+  for (size_t i = 0; i < w->nr_selected && !err; i++) {
+    unsigned char entry[BITMAP_ENTRY_HEADER_SIZE] = {0};
+    put_be32(entry, w->selected[i].idx_pos);  // No XOR base, no flags
+    err = bitmap_write(fd, &ctx, entry, sizeof(entry)) ||
+          bitmap_write(fd, &ctx, w->selected[i].ewah,
+                       w->selected[i].ewah_size);
+  }
+
+  unsigned char trailer[SHA_DIGEST_LENGTH];
+  git_hash_final(trailer, &ctx);
+  err = err || write_in_full(fd, trailer, sizeof(trailer));
+  err |= close(fd) != 0;
+  return err;
+}
+
+/**
+ * Write reachability bitmaps for the commits reachable from the refs.
+ * This needs a repository whose objects are all in a single pack; for any
+ * other (and in shallow and partial clones) nothing is written.
+ *
+ * @return 0 on success (or if bitmaps do not apply), 1 on error
+ */
+int write_pack_bitmap(void) {
+  struct stat st;
+  struct packed_git *p = get_packed_git();
+  if (stat(SHALLOW_FILE, &st) == 0 || has_promisor_remote() || !p || p->next)
+    return 0;
+
+  close_bitmap_index();
+  struct bitmap_writer w = {0};
+  w.bi = bitmap_index_new(p);
+  w.bi->closed = 1;
+  oid_set_init(&w.seen_tips);
+  struct object_id head;
+  if (read_ref("HEAD", &head) == 0)
+    collect_bitmap_tip("HEAD", &head, &w);
+  for_each_ref("refs", collect_bitmap_tip, &w);
+
+  int result = build_type_bitmaps(w.bi) ||
+               walk_commits(w.tips, w.nr_tips, NULL, 0, WALK_TOPO_ORDER,
+                            collect_bitmap_commit, &w);
+  if (result == 0) {
+    w.by_oid = malloc((w.nr ? w.nr : 1) * sizeof(*w.by_oid));
+    for (size_t i = 0; i < w.nr; i++) {
+      w.by_oid[i].oid = w.commits[i].oid;
+      w.by_oid[i].nr = i;
+    }
+    qsort(w.by_oid, w.nr, sizeof(*w.by_oid), compare_writer_oids);
+    result = build_commit_bitmaps(&w);
+  }
+
+  char path[PATH_MAX], tmp_path[PATH_MAX];
+  size_t len = strlen(p->pack_path) - strlen(".pack");
+  snprintf(path, sizeof(path), "%.*s.bitmap", (int)len, p->pack_path);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.lock", path);
+  if (result == 0) {
+    result = write_bitmap_file(&w, tmp_path);
+    if (result == 0 && rename(tmp_path, path) != 0)
+      result = 1;
+    if (result)
+      unlink(tmp_path);
+  }
+  if (result)
+    fprintf(stderr, "Failed to write %s\n", path);
+
+  for (size_t i = 0; i < w.nr; i++) {
+    commit_info_release(&w.commits[i].info);
+    bitmap_free(w.commits[i].bitmap);
+  }
+  for (size_t i = 0; i < w.nr_selected; i++)
+    free(w.selected[i].ewah);
+  free(w.commits);
+  free(w.by_oid);
+  free(w.selected);
+  free(w.tips);
+  oid_set_clear(&w.seen_tips);
+  free_bitmap_index(w.bi);
+  return result;
+}
@@ -0,0 +1,894 @@
+/**
+ * pack.c - Streaming Pack File Parser and Indexer
+ *
+ * This file implements an incremental parser for the Git pack format.
+ * Instead of buffering an entire pack in memory, bytes are fed to the
+ * parser as they arrive (e.g. from the libcurl write callback). The pack
+ * is written unchanged to .git/objects/pack while each object is inflated
+ * just far enough to hash it and learn where it ends.
+ *
+ * Pack format:
+ *   - Header: "PACK" + version(4) + num_objects(4) (network byte order)
+ *   - Objects: type/size varint header, optional delta base, zlib data
+ *   - Trailer: 20-byte SHA-1 of everything preceding it
+ *
+ * Once the whole pack has arrived, deltas are resolved by walking each
+ * base object's tree of dependent deltas (see delta.c), and a version-2
+ * .idx file is written next to the pack. No loose objects are created.
+ *
+ * Memory use is bounded by the per-object bookkeeping and the longest
+ * delta chain rather than by the size of the pack itself.
+ *
+ * With show_progress set, both phases are reported on stderr as Git's
+ * "Receiving objects" and "Resolving deltas" meters (see progress.c).
+ */
+
+#include "git.h"
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+/**
+ * Initialize a pack stream parser.
+ * The parser expects the pack itself, starting with the "PACK" signature;
+ * protocol framing (pkt-lines, side-band) must already be removed (see
+ * clone.c). Received pack bytes are written to a temporary file in
+ * .git/objects/pack.
+ *
+ * @param ps Parser state to initialize
+ * @return 0 on success, 1 on error
+ */
+int pack_stream_init(struct pack_stream *ps) {
+  memset(ps, 0, sizeof(*ps));
+  ps->state = PACK_STATE_HEADER;
+  git_hash_init(&ps->pack_ctx);
+
+  mkdir(PACK_DIR, 0755); // OK if directory already exists
+  ps->tmp_path = strdup(PACK_DIR "/tmp_pack_XXXXXX");
+  int fd = mkstemp(ps->tmp_path);
+  if (fd < 0 || !(ps->out = fdopen(fd, "w+b"))) {
+    fprintf(stderr, "Failed to create temporary pack: %s\n", strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    free(ps->tmp_path);
+    ps->tmp_path = NULL;
+    ps->state = PACK_STATE_ERROR;
+    return 1;
+  }
+
+  ps->window = malloc(PACK_WINDOW_SIZE);
+  return 0;
+}
+
+/**
+ * Release all resources held by a pack stream parser.
+ * The temporary pack is removed unless pack_stream_finish() succeeded.
+ *
+ * @param ps Parser state to release
+ */
+void pack_stream_release(struct pack_stream *ps) {
+  if (ps->inflating)
+    inflateEnd(&ps->strm);
+  ps->inflating = 0;
+
+  if (ps->out)
+    fclose(ps->out);
+  ps->out = NULL;
+  if (ps->tmp_path)
+    unlink(ps->tmp_path);
+  free(ps->tmp_path);
+  ps->tmp_path = NULL;
+
+  free(ps->window);
+  ps->window = NULL;
+  free(ps->progress);  // Abandoned without a final line
+  ps->progress = NULL;
+  free(ps->entries);
+  ps->entries = NULL;
+  ps->nr_entries = ps->alloc_entries = 0;
+}
+
+/**
+ * Account for bytes that belong to the pack (everything before the trailer).
+ * Keeps the running pack checksum, the per-object CRC32 and the current
+ * pack offset up to date, and appends the bytes to the pack file.
+ */
+static void pack_consume(struct pack_stream *ps, const unsigned char *data,
+                         size_t len) {
+  git_hash_update(&ps->pack_ctx, data, len);
+  if (ps->state != PACK_STATE_HEADER)
+    ps->crc = crc32(ps->crc, data, len);
+  if (fwrite(data, 1, len, ps->out) != len)
+    ps->write_error = 1;
+  ps->offset += len;
+}
+
+/**
+ * Map a pack object type to its Git object type string.
+ */
+const char *pack_type_name(int type) {
+  return type == OBJ_COMMIT ? GIT_COMMIT
+         : type == OBJ_TREE ? GIT_TREE
+         : type == OBJ_BLOB ? GIT_BLOB
+                            : "tag";
+}
+
+/**
+ * Map a Git object type string to its pack object type.
+ */
+int pack_type_from_name(const char *name) {
+  return strcmp(name, GIT_COMMIT) == 0 ? OBJ_COMMIT
+         : strcmp(name, GIT_TREE) == 0 ? OBJ_TREE
+         : strcmp(name, GIT_BLOB) == 0 ? OBJ_BLOB
+                                       : OBJ_TAG;
+}
+
+/**
+ * Compute the object ID of reconstructed content.
+ *
+ * @param type Pack object type (OBJ_COMMIT..OBJ_TAG)
+ * @param data Object content
+ * @param size Size of content
+ * @param oid Output object ID
+ */
+void hash_object_data(int type, const unsigned char *data, size_t size,
+                      struct object_id *oid) {
+  git_hash_object(pack_type_name(type), data, size, oid);
+}
+
+/**
+ * Record a fully parsed object and prepare for the next one.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int pack_finish_object(struct pack_stream *ps) {
+  // Record the object so deltas can be resolved and the index written
+  if (ps->nr_entries == ps->alloc_entries) {
+    ps->alloc_entries = ps->alloc_entries ? ps->alloc_entries * 2 : 64;
+    ps->entries =
+        realloc(ps->entries, sizeof(struct pack_entry) * ps->alloc_entries);
+    if (!ps->entries)
+      return 1;
+  }
+  struct pack_entry *e = &ps->entries[ps->nr_entries++];
+  memset(e, 0, sizeof(*e));
+  e->offset = ps->obj_offset;
+  e->crc = ps->crc;
+  e->type = ps->type;
+
+  switch (ps->type) {
+  case OBJ_COMMIT:
+  case OBJ_TREE:
+  case OBJ_BLOB:
+  case OBJ_TAG:
+    // Base objects were hashed while they were inflated
+    git_hash_final(e->oid.hash, &ps->obj_ctx);
+    e->real_type = ps->type;
+    e->resolved = 1;
+    break;
+
+  case OBJ_OFS_DELTA:
+    e->base_offset = ps->base_offset;
+    break;
+
+  case OBJ_REF_DELTA:
+    e->base_oid = ps->base_oid;
+    break;
+  }
+
+  inflateEnd(&ps->strm);
+  ps->inflating = 0;
+
+  ps->objects_done++;
+  ps->state = ps->objects_done == ps->num_objects ? PACK_STATE_TRAILER
+                                                  : PACK_STATE_OBJ_HEADER;
+  display_throughput(ps->progress, ps->offset);
+  display_progress(ps->progress, ps->objects_done);
+  return 0;
+}
+
+/**
+ * Prepare to inflate the current object's zlib stream.
+ * Base objects are hashed incrementally, so their header goes in first.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int pack_begin_data(struct pack_stream *ps) {
+  memset(&ps->strm, 0, sizeof(ps->strm));
+  if (inflateInit(&ps->strm) != Z_OK)
+    return 1;
+  ps->inflating = 1;
+
+  if (ps->type >= OBJ_COMMIT && ps->type <= OBJ_TAG) {
+    char header[GIT_HEADER_LENGTH];
+    int header_len =
+        sprintf(header, "%s %zu", pack_type_name(ps->type), ps->obj_size);
+    git_hash_init(&ps->obj_ctx);
+    git_hash_update(&ps->obj_ctx, header, header_len + 1);
+  }
+
+  ps->state = PACK_STATE_DATA;
+  return 0;
+}
+
+/**
+ * Feed a chunk of bytes to the pack parser.
+ * May be called any number of times with arbitrarily split input; each
+ * object is hashed as soon as its compressed data has been received.
+ *
+ * @param ps Parser state
+ * @param data Next chunk of input
+ * @param len Length of chunk
+ * @return 0 on success, 1 on error (parser enters PACK_STATE_ERROR)
+ */
+int pack_stream_feed(struct pack_stream *ps, const unsigned char *data,
+                     size_t len) {
+  size_t pos = 0;
+
+  while (pos < len && ps->state != PACK_STATE_ERROR) {
+    switch (ps->state) {
+    case PACK_STATE_HEADER: {
+      // Collect the 12-byte pack header, which may span chunks
+      size_t want = PACK_HEADER_SIZE - ps->hdr_len;
+      size_t n = len - pos < want ? len - pos : want;
+      memcpy(ps->hdr + ps->hdr_len, data + pos, n);
+      ps->hdr_len += n;
+      pos += n;
+      if (ps->hdr_len < PACK_HEADER_SIZE)
+        break;
+
+      uint32_t signature, version, num_objects;
+      memcpy(&signature, ps->hdr, 4);
+      if (ntohl(signature) != PACK_SIGNATURE) {
+        fprintf(stderr, "Received data is not a pack\n");
+        ps->state = PACK_STATE_ERROR;
+        break;
+      }
+      pack_consume(ps, ps->hdr, PACK_HEADER_SIZE);
+      memcpy(&version, ps->hdr + 4, 4);
+      memcpy(&num_objects, ps->hdr + 8, 4);
+      ps->version = ntohl(version);
+      ps->num_objects = ntohl(num_objects);
+      if (ps->version != PACK_VERSION && ps->version != 3) {
+        fprintf(stderr, "Unsupported pack version %u\n", ps->version);
+        ps->state = PACK_STATE_ERROR;
+        break;
+      }
+      ps->state = ps->num_objects ? PACK_STATE_OBJ_HEADER : PACK_STATE_TRAILER;
+      ps->hdr_len = 0;
+      if (ps->show_progress)
+        ps->progress = start_progress("Receiving objects", ps->num_objects);
+      break;
+    }
+
+    case PACK_STATE_OBJ_HEADER: {
+      // Read object type and size (variable-length encoding)
+      unsigned char byte = data[pos];
+      if (ps->hdr_len == 0)
+        ps->crc = crc32(0L, Z_NULL, 0);
+      pack_consume(ps, data + pos, 1);
+      pos++;
+
+      if (ps->hdr_len == 0) {
+        ps->obj_offset = ps->offset - 1;
+        ps->type = (byte & TYPE_MASK) >> TYPE_SHIFT;
+        ps->obj_size = byte & SIZE_MASK;
+        ps->shift = 4;
+      } else {
+        ps->obj_size |= (size_t)(byte & 0x7f) << ps->shift;
+        ps->shift += SIZE_SHIFT;
+      }
+      ps->hdr_len++;
+      if (byte & 0x80)
+        break;  // MSB indicates more bytes
+
+      ps->hdr_len = 0;
+      if (ps->type == OBJ_OFS_DELTA) {
+        ps->base_offset = 0;
+        ps->state = PACK_STATE_OFS;
+      } else if (ps->type == OBJ_REF_DELTA) {
+        ps->state = PACK_STATE_REF;
+      } else if (ps->type >= OBJ_COMMIT && ps->type <= OBJ_TAG) {
+        if (pack_begin_data(ps) != 0)
+          ps->state = PACK_STATE_ERROR;
+      } else {
+        fprintf(stderr, "Invalid object type %d in pack\n", ps->type);
+        ps->state = PACK_STATE_ERROR;
+      }
+      break;
+    }
+
+    case PACK_STATE_OFS: {
+      // Negative offset to the base object, using git's offset encoding
+      // where each continuation byte adds one before shifting
+      unsigned char byte = data[pos];
+      pack_consume(ps, data + pos, 1);
+      pos++;
+
+      if (ps->hdr_len++ > 0)
+        ps->base_offset += 1;
+      ps->base_offset = (ps->base_offset << 7) | (byte & 0x7f);
+      if (byte & 0x80)
+        break;
+
+      ps->hdr_len = 0;
+      if (ps->base_offset == 0 || ps->base_offset > ps->obj_offset) {
+        fprintf(stderr, "Invalid delta base offset in pack\n");
+        ps->state = PACK_STATE_ERROR;
+        break;
+      }
+      ps->base_offset = ps->obj_offset - ps->base_offset;
+      if (pack_begin_data(ps) != 0)
+        ps->state = PACK_STATE_ERROR;
+      break;
+    }
+
+    case PACK_STATE_REF: {
+      // 20-byte SHA-1 of the base object
+      size_t want = SHA_DIGEST_LENGTH - ps->hdr_len;
+      size_t n = len - pos < want ? len - pos : want;
+      memcpy(ps->base_oid.hash + ps->hdr_len, data + pos, n);
+      pack_consume(ps, data + pos, n);
+      ps->hdr_len += n;
+      pos += n;
+      if (ps->hdr_len < SHA_DIGEST_LENGTH)
+        break;
+
+      ps->hdr_len = 0;
+      if (pack_begin_data(ps) != 0)
+        ps->state = PACK_STATE_ERROR;
+      break;
+    }
+
+    case PACK_STATE_DATA: {
+      // Inflate as much of the object as this chunk provides, through a
+      // fixed window so memory does not grow with object size
+      int is_base = ps->type >= OBJ_COMMIT && ps->type <= OBJ_TAG;
+      int ret;
+      ps->strm.next_in = (unsigned char *)data + pos;
+      ps->strm.avail_in = len - pos;
+      do {
+        ps->strm.next_out = ps->window;
+        ps->strm.avail_out = PACK_WINDOW_SIZE;
+        uint64_t start = trace_timer_start();
+        ret = inflate(&ps->strm, Z_NO_FLUSH);
+        trace_timer_stop(TRACE_TIMER_INFLATE, start);
+        if (is_base)
+          git_hash_update(&ps->obj_ctx, ps->window,
+                      PACK_WINDOW_SIZE - ps->strm.avail_out);
+      } while (ret == Z_OK && ps->strm.avail_out == 0);
+
+      size_t used = (len - pos) - ps->strm.avail_in;
+      pack_consume(ps, data + pos, used);
+      pos += used;
+
+      if (ps->strm.total_out > ps->obj_size ||
+          (ret == Z_STREAM_END && ps->strm.total_out != ps->obj_size)) {
+        fprintf(stderr, "Object size mismatch in pack\n");
+        ps->state = PACK_STATE_ERROR;
+      } else if (ret == Z_STREAM_END) {
+        if (pack_finish_object(ps) != 0)
+          ps->state = PACK_STATE_ERROR;
+      } else if (ret != Z_OK &&
+                 !(ret == Z_BUF_ERROR && ps->strm.avail_in == 0)) {
+        fprintf(stderr, "Failed to inflate pack object\n");
+        ps->state = PACK_STATE_ERROR;
+      }
+      break;
+    }
+
+    case PACK_STATE_TRAILER: {
+      // Trailing SHA-1 checksum of the whole pack
+      size_t want = SHA_DIGEST_LENGTH - ps->hdr_len;
+      size_t n = len - pos < want ? len - pos : want;
+      memcpy(ps->trailer + ps->hdr_len, data + pos, n);
+      ps->hdr_len += n;
+      pos += n;
+      if (ps->hdr_len < SHA_DIGEST_LENGTH)
+        break;
+
+      unsigned char expected[SHA_DIGEST_LENGTH];
+      git_hash_final(expected, &ps->pack_ctx);
+      if (memcmp(expected, ps->trailer, SHA_DIGEST_LENGTH) != 0) {
+        fprintf(stderr, "Pack checksum mismatch\n");
+        ps->state = PACK_STATE_ERROR;
+        break;
+      }
+      if (fwrite(ps->trailer, 1, SHA_DIGEST_LENGTH, ps->out) !=
+          SHA_DIGEST_LENGTH)
+        ps->write_error = 1;
+      ps->state = PACK_STATE_DONE;
+      display_throughput(ps->progress, ps->offset + SHA_DIGEST_LENGTH);
+      stop_progress(&ps->progress, ps->objects_done);
+      break;
+    }
+
+    case PACK_STATE_DONE:
+      // Ignore anything the server sends after the pack
+      pos = len;
+      break;
+
+    case PACK_STATE_ERROR:
+      break;
+    }
+  }
+
+  if (ps->write_error && ps->state != PACK_STATE_ERROR) {
+    fprintf(stderr, "Failed to write pack: %s\n", strerror(errno));
+    ps->state = PACK_STATE_ERROR;
+  }
+  return ps->state == PACK_STATE_ERROR;
+}
+
+/*
+ * Delta resolution
+ *
+ * After the pack has been received, every delta is resolved by starting
+ * from a base object and walking the tree of deltas that (transitively)
+ * depend on it. Each object is inflated exactly once and each delta is
+ * applied exactly once, with only the current chain held in memory.
+ *
+ * The trees below different base objects are independent, so they are
+ * handed out to a pool of worker threads. Workers share only the read-only
+ * pack mapping and the entry table, where each delta is written by exactly
+ * one worker.
+ *
+ * A thin pack (as sent to fetch) may base REF_DELTA entries on objects the
+ * receiver already has. Such bases are read from the object database and
+ * appended to the pack as whole objects, so the stored pack is
+ * self-contained, as Git's "index-pack --fix-thin" does.
+ */
+
+/**
+ * Context for resolving the deltas of one pack.
+ */
+struct delta_resolver {
+  struct pack_stream *ps;
+  const unsigned char *map;  // Mapping of the pack being resolved
+  size_t map_size;
+  size_t *ofs_children;  // OFS_DELTA entries sorted by base offset
+  size_t nr_ofs;
+  size_t *ref_children;  // REF_DELTA entries sorted by base SHA-1
+  size_t nr_ref;
+  size_t *bases;         // Base objects that have dependent deltas
+  size_t nr_bases;
+  atomic_size_t next_base;  // Next base to hand to a worker
+  atomic_size_t resolved;   // Number of deltas resolved so far
+  atomic_int failed;        // Set when any worker hits an error
+  struct progress *progress;  // "Resolving deltas" meter, or NULL
+};
+
+static struct pack_entry *sort_entries;  // qsort context
+
+static int cmp_base_offset(const void *a, const void *b) {
+  size_t oa = sort_entries[*(const size_t *)a].base_offset;
+  size_t ob = sort_entries[*(const size_t *)b].base_offset;
+  return oa < ob ? -1 : oa > ob;
+}
+
+static int cmp_base_oid(const void *a, const void *b) {
+  return oidcmp(&sort_entries[*(const size_t *)a].base_oid,
+                &sort_entries[*(const size_t *)b].base_oid);
+}
+
+/**
+ * Find the ranges of OFS_DELTA and REF_DELTA entries based on an object.
+ */
+static void find_children(const struct delta_resolver *r, size_t parent,
+                          size_t *ofs_lo, size_t *ofs_hi, size_t *ref_lo,
+                          size_t *ref_hi) {
+  const struct pack_entry *entries = r->ps->entries;
+  const struct pack_entry *p = &entries[parent];
+
+  // OFS_DELTA children whose base is this entry (lower bound search)
+  size_t lo = 0, hi = r->nr_ofs;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (entries[r->ofs_children[mid]].base_offset < p->offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *ofs_lo = lo;
+  while (lo < r->nr_ofs && entries[r->ofs_children[lo]].base_offset ==
+                               p->offset)
+    lo++;
+  *ofs_hi = lo;
+
+  // REF_DELTA children naming this entry's SHA-1
+  lo = 0, hi = r->nr_ref;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (oidcmp(&entries[r->ref_children[mid]].base_oid, &p->oid) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *ref_lo = lo;
+  while (lo < r->nr_ref &&
+         oideq(&entries[r->ref_children[lo]].base_oid, &p->oid))
+    lo++;
+  *ref_hi = lo;
+}
+
+/**
+ * Apply one delta to its (already reconstructed) base and recurse into
+ * the deltas that depend on the result.
+ */
+static int resolve_children(struct delta_resolver *r, size_t parent,
+                            const unsigned char *data, size_t size);
+
+static int resolve_one(struct delta_resolver *r, size_t child, int type,
+                       const unsigned char *base, size_t base_size) {
+  struct pack_entry *e = &r->ps->entries[child];
+  struct pack_raw_entry raw;
+  if (unpack_raw_entry(r->map, r->map_size, e->offset, &raw) != 0)
+    return 1;
+
+  size_t size;
+  unsigned char *data = apply_delta(base, base_size, raw.data, raw.size, &size);
+  free(raw.data);
+  if (!data) {
+    fprintf(stderr, "Failed to apply delta at offset %zu\n", e->offset);
+    return 1;
+  }
+
+  hash_object_data(type, data, size, &e->oid);
+  e->real_type = type;
+  e->resolved = 1;
+  display_progress(r->progress, atomic_fetch_add(&r->resolved, 1) + 1);
+
+  int result = resolve_children(r, child, data, size);
+  free(data);
+  return result;
+}
+
+static int resolve_children(struct delta_resolver *r, size_t parent,
+                            const unsigned char *data, size_t size) {
+  struct pack_entry *entries = r->ps->entries;
+  int type = entries[parent].real_type;
+  size_t ofs_lo, ofs_hi, ref_lo, ref_hi;
+  find_children(r, parent, &ofs_lo, &ofs_hi, &ref_lo, &ref_hi);
+
+  for (size_t i = ofs_lo; i < ofs_hi; i++) {
+    if (resolve_one(r, r->ofs_children[i], type, data, size) != 0)
+      return 1;
+  }
+
+  // A REF_DELTA may name a base that occurs more than once; the first
+  // worker to claim it resolves it
+  for (size_t i = ref_lo; i < ref_hi; i++) {
+    struct pack_entry *child = &entries[r->ref_children[i]];
+    if (atomic_exchange(&child->claimed, 1))
+      continue;
+    if (resolve_one(r, r->ref_children[i], type, data, size) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Worker thread: resolve the delta trees of bases until none are left.
+ */
+static void *resolve_worker(void *arg) {
+  struct delta_resolver *r = arg;
+
+  while (!atomic_load(&r->failed)) {
+    size_t i = atomic_fetch_add(&r->next_base, 1);
+    if (i >= r->nr_bases)
+      break;
+
+    size_t base = r->bases[i];
+    struct pack_raw_entry raw;
+    if (unpack_raw_entry(r->map, r->map_size, r->ps->entries[base].offset,
+                         &raw) != 0) {
+      atomic_store(&r->failed, 1);
+      break;
+    }
+
+    int result = resolve_children(r, base, raw.data, raw.size);
+    free(raw.data);
+    if (result != 0) {
+      atomic_store(&r->failed, 1);
+      break;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Encode the type and size varint that starts a pack entry, as parsed in
+ * PACK_STATE_OBJ_HEADER.
+ *
+ * @param hdr Output buffer (at least PACK_ENTRY_HEADER_MAX bytes)
+ * @param type Pack object type (OBJ_COMMIT..OBJ_REF_DELTA)
+ * @param size Size of the (inflated) entry data
+ * @return Number of bytes written
+ */
+size_t encode_pack_entry_header(unsigned char *hdr, int type, size_t size) {
+  size_t len = 0;
+  size_t left = size >> 4;
+  hdr[len++] = (unsigned char)(type << TYPE_SHIFT | (size & SIZE_MASK));
+  while (left) {
+    hdr[len - 1] |= 0x80;
+    hdr[len++] = left & 0x7f;
+    left >>= SIZE_SHIFT;
+  }
+  return len;
+}
+
+/**
+ * Append a whole object to the end of the received pack.
+ * The pack header and trailer are fixed up afterwards by
+ * pack_fix_header_trailer().
+ *
+ * @return Index of the new entry, or (size_t)-1 on error
+ */
+static size_t pack_append_object(struct pack_stream *ps, int type,
+                                 const void *data, size_t size,
+                                 const struct object_id *oid) {
+  if (ps->nr_entries == ps->alloc_entries) {
+    ps->alloc_entries = ps->alloc_entries ? ps->alloc_entries * 2 : 64;
+    ps->entries =
+        realloc(ps->entries, sizeof(struct pack_entry) * ps->alloc_entries);
+    if (!ps->entries)
+      return (size_t)-1;
+  }
+
+  unsigned char hdr[PACK_ENTRY_HEADER_MAX];
+  size_t hdr_len = encode_pack_entry_header(hdr, type, size);
+
+  size_t zlen;
+  unsigned char *zdata =
+      compress_buffer(data, size, pack_compression_level(), &zlen);
+  if (!zdata)
+    return (size_t)-1;
+
+  int err = fseeko(ps->out, ps->offset, SEEK_SET) != 0 ||
+            fwrite(hdr, 1, hdr_len, ps->out) != hdr_len ||
+            fwrite(zdata, 1, zlen, ps->out) != zlen;
+  if (err) {
+    fprintf(stderr, "Failed to write pack: %s\n", strerror(errno));
+    free(zdata);
+    return (size_t)-1;
+  }
+
+  struct pack_entry *e = &ps->entries[ps->nr_entries];
+  memset(e, 0, sizeof(*e));
+  e->offset = ps->offset;
+  e->crc = crc32(crc32(0L, hdr, hdr_len), zdata, zlen);
+  e->oid = *oid;
+  e->type = e->real_type = type;
+  e->resolved = 1;
+  ps->offset += hdr_len + zlen;
+  free(zdata);
+  return ps->nr_entries++;
+}
+
+/**
+ * Rewrite the object count and trailing checksum of a pack that had
+ * objects appended. The checksum covers the whole file, so it is
+ * recomputed by reading the pack back.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int pack_fix_header_trailer(struct pack_stream *ps) {
+  uint32_t count = htonl(ps->nr_entries);
+  if (fseeko(ps->out, 8, SEEK_SET) != 0 ||
+      fwrite(&count, 1, 4, ps->out) != 4 || fflush(ps->out) != 0 ||
+      fseeko(ps->out, 0, SEEK_SET) != 0)
+    goto fail;
+
+  struct git_hash_ctx ctx;
+  git_hash_init(&ctx);
+  for (size_t left = ps->offset; left;) {
+    size_t want = left < PACK_WINDOW_SIZE ? left : PACK_WINDOW_SIZE;
+    if (fread(ps->window, 1, want, ps->out) != want)
+      goto fail;
+    git_hash_update(&ctx, ps->window, want);
+    left -= want;
+  }
+  git_hash_final(ps->trailer, &ctx);
+
+  if (fseeko(ps->out, ps->offset, SEEK_SET) != 0 ||
+      fwrite(ps->trailer, 1, SHA_DIGEST_LENGTH, ps->out) !=
+          SHA_DIGEST_LENGTH ||
+      fflush(ps->out) != 0 || fsync(fileno(ps->out)) != 0)
+    goto fail;
+  ps->num_objects = ps->nr_entries;
+  return 0;
+
+fail:
+  fprintf(stderr, "Failed to complete thin pack: %s\n", strerror(errno));
+  return 1;
+}
+
+/**
+ * Resolve the REF_DELTA entries whose base is not in the pack, appending
+ * each such base (read from the object database) to the pack.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int pack_complete_thin(struct delta_resolver *r) {
+  struct pack_stream *ps = r->ps;
+  size_t appended = 0;
+
+  for (size_t i = 0; i < r->nr_ref; i++) {
+    // Children of a base are adjacent; resolving the first one found
+    // resolves the whole group (and any deltas based on those)
+    struct pack_entry *child = &ps->entries[r->ref_children[i]];
+    if (child->resolved)
+      continue;
+
+    // A base that is not local may still be a delta later in this loop
+    struct object_id base_oid = child->base_oid;
+    git_object *base = odb_read_object(&base_oid);
+    if (!base)
+      continue;
+    size_t pos = pack_append_object(ps, pack_type_from_name(base->type),
+                                    base->content, base->size, &base_oid);
+    int result = pos == (size_t)-1 ||
+                 resolve_children(r, pos, (unsigned char *)base->content,
+                                  base->size);
+    free_git_object(base);
+    if (result)
+      return 1;
+    appended++;
+  }
+
+  ps->nr_thin = appended;
+  if (!appended)
+    return 0;
+  return pack_fix_header_trailer(ps);
+}
+
+/**
+ * Resolve every delta in the received pack.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int pack_resolve_deltas(struct pack_stream *ps) {
+  // Map the received pack so entries are inflated in place
+  size_t map_size = ps->offset + SHA_DIGEST_LENGTH;
+  void *map =
+      mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fileno(ps->out), 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Failed to map pack: %s\n", strerror(errno));
+    return 1;
+  }
+
+  struct delta_resolver r = {.ps = ps, .map = map, .map_size = map_size};
+  r.ofs_children = malloc(sizeof(size_t) * (ps->nr_entries + 1));
+  r.ref_children = malloc(sizeof(size_t) * (ps->nr_entries + 1));
+  r.bases = malloc(sizeof(size_t) * (ps->nr_entries + 1));
+  for (size_t i = 0; i < ps->nr_entries; i++) {
+    if (ps->entries[i].type == OBJ_OFS_DELTA)
+      r.ofs_children[r.nr_ofs++] = i;
+    else if (ps->entries[i].type == OBJ_REF_DELTA)
+      r.ref_children[r.nr_ref++] = i;
+  }
+  size_t nr_deltas = r.nr_ofs + r.nr_ref;
+
+  sort_entries = ps->entries;
+  qsort(r.ofs_children, r.nr_ofs, sizeof(size_t), cmp_base_offset);
+  qsort(r.ref_children, r.nr_ref, sizeof(size_t), cmp_base_oid);
+
+  // Only base objects with dependents need to be inflated again
+  for (size_t i = 0; i < ps->nr_entries && nr_deltas; i++) {
+    if (ps->entries[i].type == OBJ_OFS_DELTA ||
+        ps->entries[i].type == OBJ_REF_DELTA)
+      continue;
+    size_t ofs_lo, ofs_hi, ref_lo, ref_hi;
+    find_children(&r, i, &ofs_lo, &ofs_hi, &ref_lo, &ref_hi);
+    if (ofs_lo != ofs_hi || ref_lo != ref_hi)
+      r.bases[r.nr_bases++] = i;
+  }
+
+  // Walk the delta trees on the worker pool
+  if (ps->show_progress && nr_deltas)
+    r.progress = start_progress("Resolving deltas", nr_deltas);
+  int threads = ps->threads > 0 ? ps->threads : online_cpus();
+  if ((size_t)threads > r.nr_bases)
+    threads = r.nr_bases ? r.nr_bases : 1;
+  run_parallel(threads, resolve_worker, &r);
+
+  int result = atomic_load(&r.failed);
+  if (result == 0 && atomic_load(&r.resolved) != nr_deltas)
+    result = pack_complete_thin(&r);
+  size_t resolved = atomic_load(&r.resolved);
+  stop_progress(&r.progress, resolved);
+  ps->nr_deltas = resolved;
+  if (result == 0 && resolved != nr_deltas) {
+    fprintf(stderr, "%zu deltas could not be resolved\n",
+            nr_deltas - resolved);
+    result = 1;
+  }
+
+  free(r.ofs_children);
+  free(r.ref_children);
+  free(r.bases);
+  munmap(map, map_size);
+  return result;
+}
+
+/**
+ * Complete a received pack: resolve deltas, write the .idx and move both
+ * files to their final pack-<checksum> names in .git/objects/pack.
+ *
+ * @param ps Parser state
+ * @return 0 if the pack was complete and indexed, 1 otherwise
+ */
+int pack_stream_finish(struct pack_stream *ps) {
+  if (ps->state != PACK_STATE_DONE) {
+    if (ps->state != PACK_STATE_ERROR)
+      fprintf(stderr, "Pack stream ended early (%u of %u objects)\n",
+              ps->objects_done, ps->num_objects);
+    return 1;
+  }
+
+  // One fsync covers every object in the pack
+  if (fflush(ps->out) != 0 || fsync(fileno(ps->out)) != 0) {
+    fprintf(stderr, "Failed to write pack: %s\n", strerror(errno));
+    return 1;
+  }
+  trace_region_enter("pack", "resolve-deltas");
+  int result = pack_resolve_deltas(ps);
+  trace_region_leave("pack", "resolve-deltas");
+  if (result != 0)
+    return 1;
+
+  // Packs are named after their trailing checksum
+  sha_to_hex(ps->trailer, ps->pack_name);
+  char pack_path[PATH_MAX], idx_path[PATH_MAX], tmp_idx[PATH_MAX];
+  snprintf(pack_path, sizeof(pack_path), "%s/pack-%s.pack", PACK_DIR,
+           ps->pack_name);
+  snprintf(idx_path, sizeof(idx_path), "%s/pack-%s.idx", PACK_DIR,
+           ps->pack_name);
+  snprintf(tmp_idx, sizeof(tmp_idx), "%s.idx", ps->tmp_path);
+
+  trace_region_enter("pack", "write-index");
+  result = write_pack_idx(tmp_idx, ps->entries, ps->nr_entries, ps->trailer);
+  trace_region_leave("pack", "write-index");
+  if (result != 0) {
+    unlink(tmp_idx);
+    return 1;
+  }
+
+  // The pack goes into place first so the index never points at nothing
+  fclose(ps->out);
+  ps->out = NULL;
+  chmod(ps->tmp_path, 0444);
+  chmod(tmp_idx, 0444);
+  if (rename(ps->tmp_path, pack_path) != 0 || rename(tmp_idx, idx_path) != 0) {
+    fprintf(stderr, "Failed to install pack: %s\n", strerror(errno));
+    unlink(tmp_idx);
+    return 1;
+  }
+  free(ps->tmp_path);
+  ps->tmp_path = NULL;
+  trace_count(TRACE_OBJECTS_WRITTEN, ps->nr_entries);
+
+  // Make the new pack visible to read_object()
+  reprepare_packed_git();
+  return 0;
+}
+
+/**
+ * Process an in-memory Git pack file: store it in .git/objects/pack and
+ * index it. Thin wrapper that feeds the whole buffer to the streaming parser.
+ *
+ * @param pack_data Pack file data
+ * @param pack_size Size of pack file
+ * @return 0 on success, 1 on error
+ */
+int process_pack_file(const char *pack_data, size_t pack_size) {
+  trace_region_enter("pack", "index-pack");
+  struct pack_stream ps;
+  int result = pack_stream_init(&ps) ||
+               pack_stream_feed(&ps, (const unsigned char *)pack_data,
+                                pack_size) ||
+               pack_stream_finish(&ps);
+  pack_stream_release(&ps);
+  trace_region_leave("pack", "index-pack");
+  return result;
+}
@@ -0,0 +1,675 @@
+/**
+ * packfile.c - Pack Index Writing and Packed Object Access
+ *
+ * This file implements the on-disk side of pack files:
+ *   - Writing version-2 .idx files for received packs
+ *   - Reading individual entries from a memory-mapped .pack by offset
+ *   - The "packed" object database backend, which looks up objects by
+ *     SHA-1 in the mmap'd indexes under .git/objects/pack
+ *
+ * Lookups may run on several threads at once (e.g. parallel checkout); the
+ * pack list and the delta base cache are guarded by packed_lock, while
+ * inflating and applying deltas happens outside the lock.
+ *
+ * Index (.idx) version 2 format:
+ *   - Magic "\377tOc" + version(4)
+ *   - Fanout table: 256 cumulative object counts by first SHA-1 byte
+ *   - Sorted SHA-1 list, CRC32 list, 32-bit offset list
+ *   - 64-bit offsets for entries beyond 2 GiB
+ *   - Pack checksum + index checksum
+ */
+
+#include "git.h"
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * ============================================================================
+ * Raw Entry Access
+ * ============================================================================
+ */
+
+/**
+ * Parse the header of one entry of a memory-mapped pack file: type,
+ * inflated size and delta base reference. raw->data is left untouched.
+ *
+ * @param map Start of the mapped pack
+ * @param map_size Size of the mapping
+ * @param offset Offset of the entry header within the pack
+ * @param raw Output entry
+ * @return Offset of the entry's zlib stream, or 0 on error
+ */
+static size_t parse_entry_header(const unsigned char *map, size_t map_size,
+                                 size_t offset, struct pack_raw_entry *raw) {
+  if (offset >= map_size)
+    return 0;
+  const unsigned char *hdr = map + offset;
+  size_t n = map_size - offset;
+
+  // Object type and size (variable-length encoding)
+  size_t pos = 0;
+  unsigned char byte = hdr[pos++];
+  raw->type = (byte & TYPE_MASK) >> TYPE_SHIFT;
+  raw->size = byte & SIZE_MASK;
+  int shift = 4;
+  while (byte & 0x80) {
+    if (pos >= n || shift > 60)
+      return 0;
+    byte = hdr[pos++];
+    raw->size |= (size_t)(byte & 0x7f) << shift;
+    shift += SIZE_SHIFT;
+  }
+
+  // Delta base reference
+  if (raw->type == OBJ_OFS_DELTA) {
+    size_t rel = 0;
+    // Each continuation byte adds one before shifting (git's encoding)
+    do {
+      if (pos >= n)
+        return 0;
+      byte = hdr[pos++];
+      rel = (rel << 7) | (byte & 0x7f);
+      if (byte & 0x80)
+        rel++;
+    } while (byte & 0x80);
+    if (rel == 0 || rel > offset)
+      return 0;
+    raw->base_offset = offset - rel;
+  } else if (raw->type == OBJ_REF_DELTA) {
+    if (pos + SHA_DIGEST_LENGTH > n)
+      return 0;
+    memcpy(raw->base_oid.hash, hdr + pos, SHA_DIGEST_LENGTH);
+    pos += SHA_DIGEST_LENGTH;
+  } else if (raw->type < OBJ_COMMIT || raw->type > OBJ_TAG) {
+    return 0;
+  }
+
+  return offset + pos;
+}
+
+/**
+ * Read and inflate one entry of a memory-mapped pack file.
+ * The zlib stream is inflated in place from the mapping, so no copy of the
+ * compressed data is made. Delta entries are returned as-is (inflated delta
+ * instructions plus base reference); no delta resolution happens here.
+ *
+ * @param map Start of the mapped pack
+ * @param map_size Size of the mapping
+ * @param offset Offset of the entry header within the pack
+ * @param raw Output entry (raw->data must be freed by caller)
+ * @return 0 on success, 1 on error
+ */
+int unpack_raw_entry(const unsigned char *map, size_t map_size, size_t offset,
+                     struct pack_raw_entry *raw) {
+  size_t pos = parse_entry_header(map, map_size, offset, raw);
+  if (!pos)
+    return 1;
+
+  // Inflate directly from the mapping into a right-sized buffer
+  raw->data = malloc(raw->size + 1);
+  if (!raw->data)
+    return 1;
+  if (uncompress_buffer(map + pos, map_size - pos, raw->data, raw->size) !=
+      0) {
+    free(raw->data);
+    return 1;
+  }
+  raw->data[raw->size] = '\0';
+  return 0;
+}
+
+/*
+ * ============================================================================
+ * Index Writing
+ * ============================================================================
+ */
+
+static int cmp_entry_oid(const void *a, const void *b) {
+  const struct pack_entry *ea = *(const struct pack_entry *const *)a;
+  const struct pack_entry *eb = *(const struct pack_entry *const *)b;
+  return oidcmp(&ea->oid, &eb->oid);
+}
+
+/**
+ * Write data to the index file while updating its running checksum.
+ */
+static int idx_write(FILE *f, struct git_hash_ctx *ctx, const void *data,
+                     size_t len) {
+  git_hash_update(ctx, data, len);
+  return fwrite(data, 1, len, f) != len;
+}
+
+/**
+ * Write a version-2 pack index for a set of pack entries.
+ *
+ * @param path Path of the .idx file to create
+ * @param entries Pack entries with final SHA-1, CRC32 and offset
+ * @param nr Number of entries
+ * @param pack_sha Trailing checksum of the pack being indexed
+ * @return 0 on success, 1 on error
+ */
+int write_pack_idx(const char *path, struct pack_entry *entries, size_t nr,
+                   const unsigned char *pack_sha) {
+  // Index tables are ordered by SHA-1
+  struct pack_entry **sorted = malloc(sizeof(*sorted) * (nr + 1));
+  if (!sorted)
+    return 1;
+  for (size_t i = 0; i < nr; i++)
+    sorted[i] = &entries[i];
+  qsort(sorted, nr, sizeof(*sorted), cmp_entry_oid);
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    free(sorted);
+    return 1;
+  }
+
+  struct git_hash_ctx ctx;
+  git_hash_init(&ctx);
+  int err = 0;
+
+  // Header
+  uint32_t header[2] = {htonl(PACK_IDX_SIGNATURE), htonl(PACK_IDX_VERSION)};
+  err |= idx_write(f, &ctx, header, sizeof(header));
+
+  // Fanout: number of objects whose first byte is <= i
+  uint32_t fanout[256];
+  size_t j = 0;
+  for (int i = 0; i < 256; i++) {
+    while (j < nr && sorted[j]->oid.hash[0] <= i)
+      j++;
+    fanout[i] = htonl(j);
+  }
+  err |= idx_write(f, &ctx, fanout, sizeof(fanout));
+
+  // Sorted object names
+  for (size_t i = 0; i < nr; i++)
+    err |= idx_write(f, &ctx, sorted[i]->oid.hash, SHA_DIGEST_LENGTH);
+
+  // CRC32 of each packed (compressed) entry
+  for (size_t i = 0; i < nr; i++) {
+    uint32_t crc = htonl(sorted[i]->crc);
+    err |= idx_write(f, &ctx, &crc, sizeof(crc));
+  }
+
+  // 32-bit offsets; large offsets index into the 64-bit table
+  uint32_t nr_large = 0;
+  for (size_t i = 0; i < nr; i++) {
+    uint32_t off = sorted[i]->offset < PACK_IDX_LARGE_OFFSET
+                       ? (uint32_t)sorted[i]->offset
+                       : PACK_IDX_LARGE_OFFSET | nr_large++;
+    off = htonl(off);
+    err |= idx_write(f, &ctx, &off, sizeof(off));
+  }
+  for (size_t i = 0; i < nr; i++) {
+    if (sorted[i]->offset < PACK_IDX_LARGE_OFFSET)
+      continue;
+    uint64_t off = sorted[i]->offset;
+    uint32_t words[2] = {htonl(off >> 32), htonl(off & 0xffffffff)};
+    err |= idx_write(f, &ctx, words, sizeof(words));
+  }
+
+  // Trailer: pack checksum followed by the checksum of the index itself
+  err |= idx_write(f, &ctx, pack_sha, SHA_DIGEST_LENGTH);
+  unsigned char idx_sha[SHA_DIGEST_LENGTH];
+  git_hash_final(idx_sha, &ctx);
+  err |= fwrite(idx_sha, 1, SHA_DIGEST_LENGTH, f) != SHA_DIGEST_LENGTH;
+
+  // The index must be durable before it is renamed into place
+  err |= fflush(f) != 0 || fsync(fileno(f)) != 0;
+  err |= fclose(f) != 0;
+  free(sorted);
+  if (err)
+    fprintf(stderr, "Failed to write pack index %s\n", path);
+  return err;
+}
+
+/*
+ * ============================================================================
+ * Packed Object Lookup
+ * ============================================================================
+ */
+
+static struct packed_git *packed_git_list;
+static int packed_git_prepared;
+static struct delta_base_cache packed_cache;
+static int packed_cache_ready;
+static pthread_mutex_t packed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Map a whole file read-only.
+ *
+ * @param path File to map
+ * @param size Output size of the mapping
+ * @return Mapping, or NULL on error
+ */
+static unsigned char *map_file(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping stays valid after the descriptor is closed
+  if (map == MAP_FAILED)
+    return NULL;
+
+  *size = st.st_size;
+  return map;
+}
+
+/**
+ * Unmap a pack and free its structure.
+ */
+static void close_packed_git(struct packed_git *p) {
+  if (p->idx_map)
+    munmap(p->idx_map, p->idx_size);
+  if (p->pack_map)
+    munmap(p->pack_map, p->pack_size);
+  free(p->pack_path);
+  free(p);
+}
+
+/**
+ * Open a pack and its index by mapping both into memory.
+ * The index tables are used in place; nothing is copied.
+ *
+ * @param idx_path Path of the .idx file
+ * @return Loaded pack, or NULL on error
+ */
+static struct packed_git *open_packed_git(const char *idx_path) {
+  struct packed_git *p = calloc(1, sizeof(*p));
+  if (!p)
+    return NULL;
+
+  p->idx_map = map_file(idx_path, &p->idx_size);
+  if (!p->idx_map || p->idx_size < PACK_IDX_MIN_SIZE) {
+    close_packed_git(p);
+    return NULL;
+  }
+
+  uint32_t words[2];
+  memcpy(words, p->idx_map, sizeof(words));
+  if (ntohl(words[0]) != PACK_IDX_SIGNATURE ||
+      ntohl(words[1]) != PACK_IDX_VERSION) {
+    fprintf(stderr, "Unsupported pack index %s\n", idx_path);
+    close_packed_git(p);
+    return NULL;
+  }
+
+  p->fanout = p->idx_map + 8;
+  p->num_objects = pack_fanout(p, 255);
+  p->shas = p->fanout + 256 * 4;
+  p->offsets = p->shas + (size_t)p->num_objects * (SHA_DIGEST_LENGTH + 4);
+  p->offsets64 = p->offsets + (size_t)p->num_objects * 4;
+
+  // Reject truncated indexes before trusting any table in them
+  size_t min_size = PACK_IDX_MIN_SIZE +
+                    (size_t)p->num_objects * (SHA_DIGEST_LENGTH + 4 + 4);
+  if (p->idx_size < min_size) {
+    fprintf(stderr, "Truncated pack index %s\n", idx_path);
+    close_packed_git(p);
+    return NULL;
+  }
+
+  // The pack lives next to its index: pack-<sha>.idx -> pack-<sha>.pack
+  size_t len = strlen(idx_path);
+  p->pack_path = malloc(len + 2);
+  memcpy(p->pack_path, idx_path, len - 4);
+  strcpy(p->pack_path + len - 4, ".pack");
+  p->pack_map = map_file(p->pack_path, &p->pack_size);
+
+  // The pack trailer must match the checksum recorded in the index
+  const unsigned char *idx_pack_sha =
+      p->idx_map + p->idx_size - 2 * SHA_DIGEST_LENGTH;
+  if (!p->pack_map || p->pack_size < PACK_HEADER_SIZE + SHA_DIGEST_LENGTH ||
+      memcmp(p->pack_map, "PACK", 4) != 0 ||
+      memcmp(p->pack_map + p->pack_size - SHA_DIGEST_LENGTH, idx_pack_sha,
+             SHA_DIGEST_LENGTH) != 0) {
+    fprintf(stderr, "Pack %s does not match its index\n", p->pack_path);
+    close_packed_git(p);
+    return NULL;
+  }
+  return p;
+}
+
+/**
+ * Forget the current list of packs; they are re-scanned on next lookup.
+ * Called after a new pack has been installed.
+ */
+void reprepare_packed_git(void) {
+  close_bitmap_index();  // Refers to the packs being closed
+  pthread_mutex_lock(&packed_lock);
+  while (packed_git_list) {
+    struct packed_git *next = packed_git_list->next;
+    close_packed_git(packed_git_list);
+    packed_git_list = next;
+  }
+  if (packed_cache_ready)
+    delta_base_cache_clear(&packed_cache);
+  packed_git_prepared = 0;
+  pthread_mutex_unlock(&packed_lock);
+}
+
+/**
+ * Scan .git/objects/pack for pack indexes (once).
+ */
+static void prepare_packed_git(void) {
+  pthread_mutex_lock(&packed_lock);
+  if (packed_git_prepared) {
+    pthread_mutex_unlock(&packed_lock);
+    return;
+  }
+  packed_git_prepared = 1;
+
+  DIR *dir = opendir(PACK_DIR);
+  if (!dir) {
+    pthread_mutex_unlock(&packed_lock);
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    size_t len = strlen(entry->d_name);
+    if (len < 5 || strcmp(entry->d_name + len - 4, ".idx") != 0)
+      continue;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", PACK_DIR, entry->d_name);
+    struct packed_git *p = open_packed_git(path);
+    if (p) {
+      p->next = packed_git_list;
+      packed_git_list = p;
+    }
+  }
+  closedir(dir);
+  pthread_mutex_unlock(&packed_lock);
+}
+
+/**
+ * Get the loaded packs, scanning .git/objects/pack on first use. The list
+ * stays valid until reprepare_packed_git().
+ *
+ * @return First pack, or NULL if there are none
+ */
+struct packed_git *get_packed_git(void) {
+  prepare_packed_git();
+  return packed_git_list;
+}
+
+/**
+ * Read entry i of a pack's fanout table.
+ */
+uint32_t pack_fanout(const struct packed_git *p, int i) {
+  uint32_t count;
+  memcpy(&count, p->fanout + i * 4, 4);
+  return ntohl(count);
+}
+
+/**
+ * Find the position of an object in a pack's sorted SHA-1 table.
+ * The fanout table narrows the search to objects sharing the first byte.
+ *
+ * @return Index position, or -1 if the pack does not contain the object
+ */
+long find_pack_entry_pos(const struct packed_git *p,
+                         const struct object_id *oid) {
+  unsigned char first = oid->hash[0];
+  size_t lo = first ? pack_fanout(p, first - 1) : 0;
+  size_t hi = pack_fanout(p, first);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = oidcmp(
+        (const struct object_id *)(p->shas + mid * SHA_DIGEST_LENGTH), oid);
+    if (cmp == 0)
+      return mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+/**
+ * Pack offset of the object at an index position.
+ */
+size_t pack_entry_offset(const struct packed_git *p, size_t pos) {
+  uint32_t off;
+  memcpy(&off, p->offsets + pos * 4, 4);
+  off = ntohl(off);
+  if (!(off & PACK_IDX_LARGE_OFFSET))
+    return off;
+
+  uint32_t words[2];
+  memcpy(words, p->offsets64 + (size_t)(off & ~PACK_IDX_LARGE_OFFSET) * 8, 8);
+  return ((uint64_t)ntohl(words[0]) << 32) | ntohl(words[1]);
+}
+
+/**
+ * Reconstruct the object stored at a pack offset, resolving deltas.
+ * Delta bases are kept in a delta base cache so that reading several
+ * objects from the same chain does not re-apply every ancestor.
+ *
+ * @param p Pack to read from
+ * @param offset Offset of the entry
+ * @param type Output object type (OBJ_COMMIT..OBJ_TAG)
+ * @param size Output content size
+ * @param as_base Whether the result will be used as a delta base
+ * @return Object content (caller must free), or NULL on error
+ */
+static unsigned char *unpack_packed_object(struct packed_git *p, size_t offset,
+                                           int *type, size_t *size,
+                                           int as_base) {
+  pthread_mutex_lock(&packed_lock);
+  if (!packed_cache_ready) {
+    delta_base_cache_init(&packed_cache, DELTA_BASE_CACHE_LIMIT);
+    packed_cache_ready = 1;
+  }
+
+  // Entries may be evicted by other threads, so copy while locked
+  const struct delta_base_entry *cached =
+      delta_base_cache_get_offset(&packed_cache, p, offset);
+  if (cached) {
+    unsigned char *copy = malloc(cached->size + 1);
+    memcpy(copy, cached->data, cached->size + 1);
+    *type = cached->type;
+    *size = cached->size;
+    pthread_mutex_unlock(&packed_lock);
+    return copy;
+  }
+  pthread_mutex_unlock(&packed_lock);
+
+  struct pack_raw_entry raw;
+  if (unpack_raw_entry(p->pack_map, p->pack_size, offset, &raw) != 0)
+    return NULL;
+
+  unsigned char *data;
+  if (raw.type == OBJ_OFS_DELTA || raw.type == OBJ_REF_DELTA) {
+    // Reconstruct the base first, then apply this delta on top of it
+    unsigned char *base = NULL;
+    size_t base_size;
+    if (raw.type == OBJ_OFS_DELTA) {
+      base = unpack_packed_object(p, raw.base_offset, type, &base_size, 1);
+    } else {
+      long pos = find_pack_entry_pos(p, &raw.base_oid);
+      if (pos >= 0)
+        base = unpack_packed_object(p, pack_entry_offset(p, pos), type,
+                                    &base_size, 1);
+    }
+    if (!base) {
+      free(raw.data);
+      return NULL;
+    }
+    data = apply_delta(base, base_size, raw.data, raw.size, size);
+    free(base);
+    free(raw.data);
+    if (!data)
+      return NULL;
+  } else {
+    data = raw.data;
+    *type = raw.type;
+    *size = raw.size;
+  }
+
+  if (as_base) {
+    unsigned char *copy = malloc(*size + 1);
+    memcpy(copy, data, *size + 1);
+    pthread_mutex_lock(&packed_lock);
+    delta_base_cache_put(&packed_cache, p, offset, *type, copy, *size);
+    pthread_mutex_unlock(&packed_lock);
+  }
+  return data;
+}
+
+/*
+ * ============================================================================
+ * Packed Object Backend
+ * ============================================================================
+ */
+
+/**
+ * Check whether any pack contains an object.
+ */
+static int packed_has_object(struct odb_backend *backend,
+                             const struct object_id *oid) {
+  (void)backend;
+  prepare_packed_git();
+
+  for (struct packed_git *p = packed_git_list; p; p = p->next) {
+    if (find_pack_entry_pos(p, oid) >= 0)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Read an object from the packs in .git/objects/pack.
+ *
+ * @param backend Backend being queried (unused)
+ * @param oid Object ID
+ * @return Pointer to git_object structure, or NULL if not found
+ */
+static git_object *packed_read_object(struct odb_backend *backend,
+                                      const struct object_id *oid) {
+  (void)backend;
+  prepare_packed_git();
+
+  for (struct packed_git *p = packed_git_list; p; p = p->next) {
+    long pos = find_pack_entry_pos(p, oid);
+    if (pos < 0)
+      continue;
+
+    int type;
+    size_t size;
+    unsigned char *data =
+        unpack_packed_object(p, pack_entry_offset(p, pos), &type, &size, 0);
+    if (!data)
+      return NULL;
+
+    git_object *obj = malloc(sizeof(git_object));
+    obj->type = pack_type_name(type);
+    obj->size = size;
+    obj->content = (char *)data;
+    return obj;
+  }
+  return NULL;
+}
+
+/**
+ * Type of the object stored at a pack offset: for a delta, that of the
+ * non-delta object at the end of its base chain. Only entry headers are
+ * read.
+ *
+ * @param p Pack to read from
+ * @param offset Offset of the entry
+ * @return OBJ_COMMIT..OBJ_TAG, or -1 on error
+ */
+int pack_object_type(const struct packed_git *p, size_t offset) {
+  struct pack_raw_entry raw;
+  // Bounds the walk in case a corrupt pack has a cycle of deltas
+  for (uint32_t depth = 0; depth <= p->num_objects; depth++) {
+    if (!parse_entry_header(p->pack_map, p->pack_size, offset, &raw))
+      return -1;
+    if (raw.type == OBJ_OFS_DELTA) {
+      offset = raw.base_offset;
+    } else if (raw.type == OBJ_REF_DELTA) {
+      long base = find_pack_entry_pos(p, &raw.base_oid);
+      if (base < 0)
+        return -1;
+      offset = pack_entry_offset(p, base);
+    } else {
+      return raw.type;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Look up the type and size of a packed object without reconstructing it.
+ * A delta's size is read from the start of its instructions; its type is
+ * that of the non-delta object at the end of its base chain.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int packed_object_info(const struct packed_git *p, size_t offset,
+                              const char **type, size_t *size) {
+  struct pack_raw_entry raw;
+  size_t pos = parse_entry_header(p->pack_map, p->pack_size, offset, &raw);
+  if (!pos)
+    return 1;
+  if (raw.type != OBJ_OFS_DELTA && raw.type != OBJ_REF_DELTA) {
+    *type = pack_type_name(raw.type);
+    *size = raw.size;
+    return 0;
+  }
+
+  // Two size varints of at most 10 bytes each start the delta
+  unsigned char head[20];
+  z_stream *strm = get_inflate_stream();
+  if (!strm)
+    return 1;
+  size_t n = p->pack_size - pos;
+  strm->next_in = (unsigned char *)p->pack_map + pos;
+  strm->avail_in = n > UINT_MAX ? UINT_MAX : n;
+  strm->next_out = head;
+  strm->avail_out = sizeof(head);
+  int ret = inflate(strm, Z_SYNC_FLUSH);
+  if ((ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) ||
+      delta_result_size(head, sizeof(head) - strm->avail_out, size) != 0)
+    return 1;
+
+  int real_type = pack_object_type(p, offset);
+  if (real_type < 0)
+    return 1;
+  *type = pack_type_name(real_type);
+  return 0;
+}
+
+/**
+ * Look up an object's type and size in the packs.
+ */
+static int packed_read_object_info(struct odb_backend *backend,
+                                   const struct object_id *oid,
+                                   const char **type, size_t *size) {
+  (void)backend;
+  prepare_packed_git();
+
+  for (struct packed_git *p = packed_git_list; p; p = p->next) {
+    long pos = find_pack_entry_pos(p, oid);
+    if (pos >= 0)
+      return packed_object_info(p, pack_entry_offset(p, pos), type, size);
+  }
+  return 1;
+}
+
+struct odb_backend packed_odb_backend = {
+    "packed", packed_has_object, packed_read_object, packed_read_object_info,
+    NULL};
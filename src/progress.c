@@ -0,0 +1,147 @@
+/**
+ * progress.c - Progress Meters
+ *
+ * This file implements the one-line progress displays shown on stderr
+ * during long operations, in Git's format:
+ *
+ *   Receiving objects:  45% (4500/10000), 1.20 MiB | 3.40 MiB/s
+ *   Resolving deltas: 100% (812/812), done.
+ *
+ * Callers report progress as often as they like (e.g. once per object);
+ * the line is redrawn at most once every PROGRESS_INTERVAL_MS, so the
+ * cost in the hot path is a clock read. A NULL meter is valid and does
+ * nothing, which is how disabled progress is represented.
+ *
+ * display_progress() may be called from several threads at once; a
+ * thread that finds another one drawing simply skips its update.
+ */
+
+#include "git.h"
+#include <time.h>
+
+#define PROGRESS_INTERVAL_MS 100  // Minimum time between redraws
+
+/**
+ * Progress Meter Structure
+ */
+struct progress {
+  const char *title;        // E.g. "Receiving objects"
+  uint64_t total;           // Expected count, or 0 if unknown
+  atomic_uint_fast64_t last_draw_ns;  // When the line was last drawn
+  atomic_flag drawing;      // Held by the thread redrawing the line
+  uint64_t start_ns;        // When the meter was started
+  uint64_t count;           // Last count drawn
+  uint64_t bytes;           // Bytes transferred (0 = no throughput)
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Format a byte count the way Git does ("512 bytes", "1.20 MiB").
+ */
+static void humanize(char *buf, size_t size, double bytes, const char *suffix) {
+  static const char *const units[] = {"bytes", "KiB", "MiB", "GiB"};
+  int unit = 0;
+  while (bytes >= 1024 && unit < 3) {
+    bytes /= 1024;
+    unit++;
+  }
+  if (unit == 0)
+    snprintf(buf, size, "%.0f %s%s", bytes, units[0], suffix);
+  else
+    snprintf(buf, size, "%.2f %s%s", bytes, units[unit], suffix);
+}
+
+/**
+ * Draw the progress line.
+ *
+ * @param done Whether this is the final update
+ */
+static void draw(struct progress *p, uint64_t now, int done) {
+  char counts[64], rate[64] = "";
+  if (p->total)
+    snprintf(counts, sizeof(counts), "%3u%% (%llu/%llu)",
+             (unsigned)(p->count * 100 / p->total),
+             (unsigned long long)p->count, (unsigned long long)p->total);
+  else
+    snprintf(counts, sizeof(counts), "%llu", (unsigned long long)p->count);
+
+  if (p->bytes) {
+    char total[32], speed[32];
+    double seconds = (now - p->start_ns) / 1e9;
+    humanize(total, sizeof(total), p->bytes, "");
+    humanize(speed, sizeof(speed), seconds > 0 ? p->bytes / seconds : 0, "/s");
+    snprintf(rate, sizeof(rate), ", %s | %s", total, speed);
+  }
+  fprintf(stderr, "\r%s: %s%s%s", p->title, counts, rate,
+          done ? ", done.\n" : "");
+}
+
+/**
+ * Start a progress meter.
+ *
+ * @param title Label shown before the counts
+ * @param total Expected final count, or 0 if unknown
+ * @return Meter (pass to stop_progress() when finished)
+ */
+struct progress *start_progress(const char *title, uint64_t total) {
+  struct progress *p = calloc(1, sizeof(*p));
+  p->title = title;
+  p->total = total;
+  p->start_ns = now_ns();
+  atomic_init(&p->last_draw_ns, p->start_ns);  // First draw after an interval
+  atomic_flag_clear(&p->drawing);
+  return p;
+}
+
+/**
+ * Report the current count, redrawing the line if it is due.
+ *
+ * @param p Meter, or NULL
+ * @param n Items completed so far
+ */
+void display_progress(struct progress *p, uint64_t n) {
+  if (!p)
+    return;
+  uint64_t now = now_ns();
+  if (now - atomic_load(&p->last_draw_ns) < PROGRESS_INTERVAL_MS * 1000000u)
+    return;
+  if (atomic_flag_test_and_set(&p->drawing))
+    return;
+  p->count = n;
+  draw(p, now, 0);
+  atomic_store(&p->last_draw_ns, now);
+  atomic_flag_clear(&p->drawing);
+}
+
+/**
+ * Record the number of bytes transferred so far, shown with the transfer
+ * rate. Takes effect at the next redraw.
+ *
+ * @param p Meter, or NULL (single-threaded use only)
+ * @param bytes Total bytes so far
+ */
+void display_throughput(struct progress *p, uint64_t bytes) {
+  if (p)
+    p->bytes = bytes;
+}
+
+/**
+ * Draw the final line (", done.") and free a meter.
+ *
+ * @param pp Meter to stop; set to NULL. May point to NULL.
+ * @param n Final count
+ */
+void stop_progress(struct progress **pp, uint64_t n) {
+  struct progress *p = *pp;
+  if (!p)
+    return;
+  p->count = n;
+  draw(p, now_ns(), 1);
+  free(p);
+  *pp = NULL;
+}
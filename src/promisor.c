@@ -0,0 +1,113 @@
+/**
+ * promisor.c - Partial Clone Object Fetching
+ *
+ * A clone made with --filter (e.g. blob:none) leaves objects on the
+ * remote, which promises to supply them later; the clone records it as a
+ * promisor remote (remote.origin.promisor = true). This file keeps that
+ * promise on the reading side:
+ *   - promisor_fetch_objects() fetches a batch of missing objects in one
+ *     request, so checkout can ask for all the blobs of a tree at once
+ *   - promisor_odb_backend, last in the lookup order, fetches a single
+ *     object on demand when no other backend has it
+ *
+ * Fetches are serialized by a lock. Objects another thread fetched while
+ * we waited for it are not requested again.
+ */
+
+#include "git.h"
+#include <pthread.h>
+
+static pthread_mutex_t promisor_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set while this thread is fetching, so lookups made by the fetch itself
+// (e.g. for thin pack bases) do not start another one
+static _Thread_local int promisor_fetching;
+
+/**
+ * Whether this repository is a partial clone whose missing objects can be
+ * fetched from its origin remote.
+ *
+ * @return 1 if origin is a promisor remote, 0 otherwise
+ */
+int has_promisor_remote(void) {
+  char *value = config_get("remote.origin.promisor");
+  int promisor = value && strcmp(value, "true") == 0;
+  free(value);
+  return promisor;
+}
+
+/**
+ * Fetch objects missing from a partial clone from its promisor remote.
+ * Objects that are already present are skipped.
+ *
+ * @param oids Objects to fetch
+ * @param nr Number of objects
+ * @return 0 on success (or if nothing was missing), 1 on error
+ */
+int promisor_fetch_objects(const struct object_id *oids, size_t nr) {
+  static const char *const head_only[] = {"HEAD", NULL};
+  if (!has_promisor_remote())
+    return 1;
+  char *url = config_get("remote.origin.url");
+  if (!url)
+    return 1;
+
+  pthread_mutex_lock(&promisor_lock);
+  promisor_fetching = 1;
+
+  struct object_id *missing = malloc((nr ? nr : 1) * sizeof(*missing));
+  size_t nr_missing = 0;
+  for (size_t i = 0; i < nr; i++) {
+    if (!odb_has_object(&oids[i]))
+      missing[nr_missing++] = oids[i];
+  }
+
+  // The objects are wanted by ID; the ref listing is only needed for the
+  // server's capabilities
+  int result = 0;
+  if (nr_missing) {
+    struct fetch_options opts = {0};
+    opts.ref_prefixes = head_only;
+    opts.promisor = 1;
+    struct remote_refs remote;
+    result = get_remote_refs(url, &opts, &remote) ||
+             fetch_pack(url, &remote, missing, nr_missing, NULL, 0, &opts);
+    free_remote_refs(&remote);
+    if (result)
+      fprintf(stderr, "Failed to fetch %zu missing objects from %s\n",
+              nr_missing, url);
+  }
+
+  free(missing);
+  promisor_fetching = 0;
+  pthread_mutex_unlock(&promisor_lock);
+  free(url);
+  return result;
+}
+
+/**
+ * A promisor remote is never known to hold an object without asking it.
+ */
+static int promisor_has_object(struct odb_backend *backend,
+                               const struct object_id *oid) {
+  (void)backend;
+  (void)oid;
+  return 0;
+}
+
+/**
+ * Fetch an object no other backend holds, then read it from the pack it
+ * arrived in.
+ */
+static git_object *promisor_read_object(struct odb_backend *backend,
+                                        const struct object_id *oid) {
+  (void)backend;
+  if (promisor_fetching || !has_promisor_remote())
+    return NULL;
+  if (promisor_fetch_objects(oid, 1) != 0)
+    return NULL;
+  return packed_odb_backend.read_object(&packed_odb_backend, oid);
+}
+
+struct odb_backend promisor_odb_backend = {
+    "promisor", promisor_has_object, promisor_read_object, NULL, NULL};
@@ -0,0 +1,185 @@
+/**
+ * refs.c - Reference Reading and Writing
+ *
+ * This file implements the loose refs stored as files under .git:
+ *   - HEAD, usually a symbolic ref ("ref: refs/heads/main")
+ *   - refs/heads/<branch> and refs/remotes/<remote>/<branch>, each holding
+ *     a 40-character object ID and a newline
+ *
+ * Refs are replaced atomically by writing <ref>.lock and renaming it over
+ * the old file, the same locking convention Git uses. Packed refs
+ * (.git/packed-refs) are not read; every ref written here is loose.
+ */
+
+#include "git.h"
+#include <dirent.h>
+#include <fcntl.h>
+
+#define SYMREF_PREFIX "ref: "
+#define MAX_SYMREF_DEPTH 5  // Symbolic refs followed before giving up
+
+/**
+ * Create the parent directories of a ref file.
+ *
+ * @param path Path of the ref file below .git
+ */
+static void create_leading_dirs(const char *path) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", path);
+  for (char *slash = strchr(dir + strlen(GIT_DIR) + 1, '/'); slash;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(dir, 0755);  // OK if the directory already exists
+    *slash = '/';
+  }
+}
+
+/**
+ * Resolve a ref to an object ID, following symbolic refs.
+ *
+ * @param name Ref name, e.g. "HEAD" or "refs/heads/main"
+ * @param oid Output object ID
+ * @return 0 on success, 1 if the ref does not exist or is malformed
+ */
+int read_ref(const char *name, struct object_id *oid) {
+  char ref[PATH_MAX];
+  snprintf(ref, sizeof(ref), "%s", name);
+
+  for (int depth = 0; depth < MAX_SYMREF_DEPTH; depth++) {
+    char path[PATH_MAX], buf[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", GIT_DIR, ref);
+    FILE *f = fopen(path, "r");
+    if (!f)
+      return 1;
+    int ok = fgets(buf, sizeof(buf), f) != NULL;
+    fclose(f);
+    if (!ok)
+      return 1;
+    buf[strcspn(buf, "\n")] = '\0';
+
+    if (strncmp(buf, SYMREF_PREFIX, strlen(SYMREF_PREFIX)) != 0)
+      return strlen(buf) != GIT_HASH_LENGTH || get_oid_hex(buf, oid) != 0;
+    snprintf(ref, sizeof(ref), "%s", buf + strlen(SYMREF_PREFIX));
+  }
+  return 1;
+}
+
+/**
+ * Write the contents of a ref file through its lock file.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_ref_file(const char *name, const char *content) {
+  char path[PATH_MAX], lock[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", GIT_DIR, name);
+  snprintf(lock, sizeof(lock), "%s.lock", path);
+  create_leading_dirs(path);
+
+  int fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to lock %s: %s\n", name, strerror(errno));
+    return 1;
+  }
+  int result = write_in_full(fd, content, strlen(content));
+  result |= close(fd) != 0;
+  if (result == 0 && rename(lock, path) != 0)
+    result = 1;
+  if (result) {
+    fprintf(stderr, "Failed to update %s: %s\n", name, strerror(errno));
+    unlink(lock);
+  }
+  return result;
+}
+
+/**
+ * Point a ref at an object, creating it if needed.
+ *
+ * @param name Ref name, e.g. "refs/remotes/origin/main"
+ * @param oid New value
+ * @return 0 on success, 1 on error
+ */
+int update_ref(const char *name, const struct object_id *oid) {
+  char content[GIT_HASH_LENGTH + 2];
+  oid_to_hex(oid, content);
+  content[GIT_HASH_LENGTH] = '\n';
+  content[GIT_HASH_LENGTH + 1] = '\0';
+  return write_ref_file(name, content);
+}
+
+/**
+ * Make a ref a symbolic ref to another ref.
+ *
+ * @param name Ref name, usually "HEAD"
+ * @param target Ref pointed to, e.g. "refs/heads/main"
+ * @return 0 on success, 1 on error
+ */
+int create_symref(const char *name, const char *target) {
+  char content[PATH_MAX];
+  snprintf(content, sizeof(content), SYMREF_PREFIX "%s\n", target);
+  return write_ref_file(name, content);
+}
+
+/**
+ * Call a function for every ref below a prefix.
+ * Iteration stops early if fn returns non-zero.
+ *
+ * @param prefix Directory of refs to walk, e.g. "refs" or "refs/heads"
+ * @param fn Callback receiving the full ref name and its value
+ * @param data Passed through to fn
+ * @return 0, or the first non-zero value returned by fn
+ */
+int for_each_ref(const char *prefix, each_ref_fn fn, void *data) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", GIT_DIR, prefix);
+  DIR *d = opendir(path);
+  if (!d)
+    return 0;
+
+  int result = 0;
+  struct dirent *entry;
+  while (result == 0 && (entry = readdir(d))) {
+    const char *base = entry->d_name;
+    size_t len = strlen(base);
+    if (base[0] == '.' || (len > 5 && strcmp(base + len - 5, ".lock") == 0))
+      continue;
+
+    char ref[PATH_MAX], full[PATH_MAX];
+    snprintf(ref, sizeof(ref), "%s/%s", prefix, base);
+    snprintf(full, sizeof(full), "%s/%s", GIT_DIR, ref);
+    struct stat st;
+    if (stat(full, &st) != 0)
+      continue;
+
+    struct object_id oid;
+    if (S_ISDIR(st.st_mode))
+      result = for_each_ref(ref, fn, data);
+    else if (read_ref(ref, &oid) == 0)
+      result = fn(ref, &oid, data);
+  }
+  closedir(d);
+  return result;
+}
+
+
+/**
+ * Resolve a revision given on the command line: a full object ID, or a
+ * ref name as Git abbreviates them ("main", "origin/main", "v1.0").
+ *
+ * @param name Revision name
+ * @param oid Output object ID
+ * @return 0 on success, 1 if the name matches no object or ref
+ */
+int resolve_revision(const char *name, struct object_id *oid) {
+  static const char *const rules[] = {"%s", "refs/%s", "refs/tags/%s",
+                                      "refs/heads/%s", "refs/remotes/%s",
+                                      NULL};
+  if (strlen(name) == GIT_HASH_LENGTH && get_oid_hex(name, oid) == 0)
+    return 0;
+  for (const char *const *rule = rules; *rule; rule++) {
+    char ref[PATH_MAX];
+    snprintf(ref, sizeof(ref), *rule, name);
+    if (read_ref(ref, oid) == 0)
+      return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,713 @@
+/**
+ * repack.c - Pack Writing with Delta Compression (repack / gc)
+ *
+ * This file moves objects into a new pack file:
+ *   - The objects are collected: the loose objects not yet in a pack
+ *     (those written locally by hash-object, write-tree and commit-tree),
+ *     or with -a every object reachable from the refs (-A: every object)
+ *   - Candidates are sorted by type, path name hash and size, and each one
+ *     is tried as a delta against the objects in a sliding window before
+ *     it. Versions of the same file then meet in the window, largest
+ *     first, so most deltas only describe what was added
+ *   - The sorted list is cut into segments that worker threads search
+ *     independently
+ *   - Objects are written as OFS_DELTA entries (bases before their
+ *     deltas) or whole, and the .idx is written next to the pack
+ * Once the new pack is in place, the loose objects it holds are deleted;
+ * with -a -d (or -A -d) the packs it replaces are deleted too.
+ *
+ * Window and chain depth come from pack.window (default 10) and
+ * pack.depth (default 50), worker threads from pack.threads (default: one
+ * per processor).
+ */
+
+#include "git.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#define REPACK_WINDOW 10           // Default objects tried as delta bases
+#define REPACK_DEPTH 50            // Default longest delta chain
+#define REPACK_MIN_DELTA_SIZE 50   // Smaller objects are stored whole
+#define REPACK_MAX_DELTA_SIZE (512 * 1024 * 1024)  // Larger ones too
+#define REPACK_MIN_SEGMENT 1024    // Fewest objects per thread work unit
+
+/**
+ * Pack Object Structure
+ * An object going into the new pack.
+ */
+struct pack_object {
+  struct object_id oid;
+  int type;                // OBJ_COMMIT..OBJ_TAG
+  size_t size;             // Size of content
+  uint32_t name_hash;      // Hash of the object's path (0 if unknown)
+  size_t base;             // Delta base (index + 1), or 0 if stored whole
+  unsigned char *delta;    // Delta against the base
+  size_t delta_size;
+  unsigned depth;          // Deltas between this object and a whole one
+  size_t offset;           // Offset in the new pack, 0 until written
+  uint32_t crc;            // CRC32 of the written entry
+};
+
+/**
+ * Repack State
+ */
+struct repack {
+  struct pack_object *objects;  // In the order they are written
+  size_t nr, alloc;
+  struct oid_set seen;          // Objects already in the list
+  struct object_id *tips;       // Commits the refs point at
+  size_t nr_tips, alloc_tips;
+
+  unsigned window;              // Delta search window
+  unsigned depth;               // Longest delta chain
+  int threads;                  // Delta search threads
+  int show_progress;
+
+  // Delta search: segments of the sorted list, one work unit each
+  size_t *sorted;               // Delta candidates, by compare_candidate_order()
+  size_t *segments;             // nr_segments + 1 boundaries in sorted
+  size_t nr_segments;
+  atomic_size_t next_segment;   // Next segment to search
+  atomic_size_t nr_searched;    // Candidates searched so far
+  struct progress *progress;
+};
+
+/*
+ * ============================================================================
+ * Collecting Objects
+ * ============================================================================
+ */
+
+/**
+ * Hash a path the way Git does for delta candidate sorting: the last
+ * characters (the file name, mostly) weigh most, so files with the same
+ * name in different directories sort together.
+ */
+static uint32_t pack_name_hash(const char *name) {
+  uint32_t hash = 0;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    if (!isspace(*p))
+      hash = (hash >> 2) + ((uint32_t)*p << 24);
+  }
+  return hash;
+}
+
+/**
+ * Add an object to the pack unless it is in already.
+ *
+ * @param type Pack object type, or 0 to look it up
+ * @param path Path of the tree or blob, or NULL
+ * @return 0 on success, 1 if the object cannot be found
+ */
+static int add_object(struct repack *r, const struct object_id *oid, int type,
+                      const char *path) {
+  if (!oid_set_insert(&r->seen, oid))
+    return 0;
+
+  const char *type_name;
+  size_t size;
+  if (odb_read_object_info(oid, &type_name, &size) != 0) {
+    char hex[GIT_HASH_LENGTH + 1];
+    fprintf(stderr, "Object %s is missing\n", oid_to_hex(oid, hex));
+    return 1;
+  }
+  if (!type)
+    type = pack_type_from_name(type_name);
+
+  if (r->nr == r->alloc) {
+    r->alloc = r->alloc ? r->alloc * 2 : 1024;
+    r->objects = realloc(r->objects, r->alloc * sizeof(*r->objects));
+  }
+  struct pack_object *po = &r->objects[r->nr++];
+  memset(po, 0, sizeof(*po));
+  po->oid = *oid;
+  po->type = type;
+  po->size = size;
+  po->name_hash = path ? pack_name_hash(path) : 0;
+  display_progress(r->progress, r->nr);
+  return 0;
+}
+
+/**
+ * Check whether any pack holds an object.
+ */
+static int in_pack(const struct object_id *oid) {
+  for (struct packed_git *p = get_packed_git(); p; p = p->next) {
+    if (find_pack_entry_pos(p, oid) >= 0)
+      return 1;
+  }
+  return 0;
+}
+
+static int collect_loose_object(const struct object_id *oid, const char *path,
+                                void *data) {
+  (void)path;
+  return in_pack(oid) ? 0 : add_object(data, oid, 0, NULL);
+}
+
+/**
+ * Record what a ref points at: annotated tags are packed themselves, and
+ * the commit they lead to becomes a tip of the object walk.
+ */
+static int collect_ref_objects(const char *name, const struct object_id *oid,
+                               void *data) {
+  struct repack *r = data;
+  struct object_id cur = *oid;
+  for (int depth = 0; depth < 32; depth++) {
+    git_object *obj = odb_read_object(&cur);
+    if (!obj) {
+      fprintf(stderr, "Ref %s points at a missing object\n", name);
+      return 1;
+    }
+    int is_tag = strcmp(obj->type, "tag") == 0;
+    int is_commit = strcmp(obj->type, GIT_COMMIT) == 0;
+    int result = 0;
+    if (is_tag) {
+      result = add_object(r, &cur, OBJ_TAG, NULL) ||
+               strncmp(obj->content, "object ", 7) != 0 ||
+               get_oid_hex(obj->content + 7, &cur) != 0;
+    } else if (is_commit) {
+      if (r->nr_tips == r->alloc_tips) {
+        r->alloc_tips = r->alloc_tips ? r->alloc_tips * 2 : 64;
+        r->tips = realloc(r->tips, r->alloc_tips * sizeof(*r->tips));
+      }
+      r->tips[r->nr_tips++] = cur;
+    } else if (strcmp(obj->type, GIT_BLOB) == 0) {
+      result = add_object(r, &cur, OBJ_BLOB, NULL);
+    } else {
+      result = 1;  // Trees are only reached from commits
+    }
+    free_git_object(obj);
+    if (result) {
+      fprintf(stderr, "Cannot repack ref %s\n", name);
+      return 1;
+    }
+    if (!is_tag)
+      return 0;
+  }
+  fprintf(stderr, "Tag chain of %s is too long\n", name);
+  return 1;
+}
+
+static int collect_walk_object(const struct object_id *oid, int type,
+                               const char *path, void *data) {
+  return add_object(data, oid, type, path);
+}
+
+/**
+ * Collect every object reachable from HEAD and the refs, in the order
+ * rev-list --objects lists them.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int collect_reachable(struct repack *r) {
+  struct object_id head;
+  if (read_ref("HEAD", &head) == 0 && collect_ref_objects("HEAD", &head, r))
+    return 1;
+  if (for_each_ref("refs", collect_ref_objects, r))
+    return 1;
+  return walk_objects(r->tips, r->nr_tips, NULL, 0, 0, collect_walk_object,
+                      r);
+}
+
+static int collect_any_loose_object(const struct object_id *oid,
+                                    const char *path, void *data) {
+  (void)path;
+  return add_object(data, oid, 0, NULL);
+}
+
+/**
+ * Collect the objects that are not reachable as well: everything in the
+ * existing packs and everything loose. They go last, after all reachable
+ * objects.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int collect_unreachable(struct repack *r) {
+  for (struct packed_git *p = get_packed_git(); p; p = p->next) {
+    for (uint32_t i = 0; i < p->num_objects; i++) {
+      struct object_id oid;
+      memcpy(oid.hash, p->shas + (size_t)i * SHA_DIGEST_LENGTH,
+             SHA_DIGEST_LENGTH);
+      if (add_object(r, &oid, 0, NULL))
+        return 1;
+    }
+  }
+  return for_each_loose_object(collect_any_loose_object, r);
+}
+
+/*
+ * ============================================================================
+ * Delta Search
+ * ============================================================================
+ */
+
+/**
+ * Delta Candidate Structure
+ * An object to sort for the delta search, with its index.
+ */
+struct candidate {
+  const struct pack_object *po;
+  size_t nr;
+};
+
+/**
+ * Sort order of delta candidates: by type, then name hash, then size
+ * (largest first), then collection order.
+ */
+static int compare_candidate_order(const void *a, const void *b) {
+  const struct candidate *ca = a, *cb = b;
+  if (ca->po->type != cb->po->type)
+    return ca->po->type < cb->po->type ? -1 : 1;
+  if (ca->po->name_hash != cb->po->name_hash)
+    return ca->po->name_hash < cb->po->name_hash ? -1 : 1;
+  if (ca->po->size != cb->po->size)
+    return ca->po->size > cb->po->size ? -1 : 1;
+  return ca->nr < cb->nr ? -1 : ca->nr > cb->nr;
+}
+
+/**
+ * Sort the delta candidates and cut them into segments for the worker
+ * threads. A segment never ends between objects of the same type and
+ * name hash, so versions of one file are searched together.
+ */
+static void prepare_delta_search(struct repack *r) {
+  struct candidate *list = malloc((r->nr ? r->nr : 1) * sizeof(*list));
+  size_t nr = 0;
+  for (size_t i = 0; i < r->nr; i++) {
+    const struct pack_object *po = &r->objects[i];
+    if (po->size >= REPACK_MIN_DELTA_SIZE &&
+        po->size <= REPACK_MAX_DELTA_SIZE) {
+      list[nr].po = po;
+      list[nr++].nr = i;
+    }
+  }
+  qsort(list, nr, sizeof(*list), compare_candidate_order);
+  r->sorted = malloc((nr ? nr : 1) * sizeof(*r->sorted));
+  for (size_t i = 0; i < nr; i++)
+    r->sorted[i] = list[i].nr;
+  free(list);
+
+  size_t per_segment = nr / ((size_t)r->threads * 4) + 1;
+  if (per_segment < REPACK_MIN_SEGMENT)
+    per_segment = REPACK_MIN_SEGMENT;
+  r->segments = malloc((nr / per_segment + 2) * sizeof(*r->segments));
+  r->nr_segments = 0;
+  r->segments[0] = 0;
+  for (size_t end = 0; end < nr;) {
+    end = end + per_segment < nr ? end + per_segment : nr;
+    while (end < nr) {
+      const struct pack_object *last = &r->objects[r->sorted[end - 1]];
+      const struct pack_object *next = &r->objects[r->sorted[end]];
+      if (last->type != next->type || last->name_hash != next->name_hash)
+        break;
+      end++;
+    }
+    r->segments[++r->nr_segments] = end;
+  }
+}
+
+/**
+ * Window Entry Structure
+ * A recent candidate, kept in memory as a possible delta base.
+ */
+struct window_entry {
+  size_t nr;                  // Index in r->objects
+  git_object *obj;            // Content, or NULL if the slot is empty
+  struct delta_index *index;  // Built the first time it is tried
+};
+
+/**
+ * Try object nr as a delta against the entries of the window, keeping the
+ * smallest delta found.
+ *
+ * @param win Window, with the most recent entry just before slot pos
+ */
+static void try_deltas(struct repack *r, struct window_entry *win,
+                       size_t pos, size_t nr, const git_object *obj) {
+  struct pack_object *po = &r->objects[nr];
+  for (unsigned k = 1; k <= r->window; k++) {
+    struct window_entry *w = &win[(pos + r->window - k) % r->window];
+    if (!w->obj)
+      break;
+    struct pack_object *base = &r->objects[w->nr];
+    // Candidates are sorted by type, so older entries differ as well
+    if (base->type != po->type)
+      break;
+    // A much smaller base cannot hold most of the target
+    if (base->depth >= r->depth || base->size < po->size / 32)
+      continue;
+
+    // Anything larger than half the object is not worth a delta
+    size_t max_size = po->delta ? po->delta_size - 1 : po->size / 2 - 20;
+    if (!w->index)
+      w->index = create_delta_index(w->obj->content, w->obj->size);
+    if (!w->index)
+      continue;
+    size_t delta_size;
+    unsigned char *delta = create_delta(w->index, obj->content, obj->size,
+                                        max_size, &delta_size);
+    if (!delta)
+      continue;
+    free(po->delta);
+    po->delta = delta;
+    po->delta_size = delta_size;
+    po->base = w->nr + 1;
+    po->depth = base->depth + 1;
+  }
+}
+
+/**
+ * Search one segment of the sorted candidates for deltas.
+ */
+static void find_deltas(struct repack *r, size_t begin, size_t end) {
+  struct window_entry *win = calloc(r->window, sizeof(*win));
+  size_t pos = 0;  // Slot the next entry goes into
+  for (size_t i = begin; i < end; i++) {
+    size_t nr = r->sorted[i];
+    // Unreadable objects are reported when they are written
+    git_object *obj = odb_read_object(&r->objects[nr].oid);
+    if (obj) {
+      try_deltas(r, win, pos, nr, obj);
+      struct window_entry *w = &win[pos];
+      free_git_object(w->obj);
+      free_delta_index(w->index);
+      w->nr = nr;
+      w->obj = obj;
+      w->index = NULL;
+      pos = (pos + 1) % r->window;
+    }
+    display_progress(r->progress, ++r->nr_searched);
+  }
+  for (unsigned k = 0; k < r->window; k++) {
+    free_git_object(win[k].obj);
+    free_delta_index(win[k].index);
+  }
+  free(win);
+}
+
+static void *delta_search_worker(void *arg) {
+  struct repack *r = arg;
+  for (;;) {
+    size_t seg = r->next_segment++;
+    if (seg >= r->nr_segments)
+      break;
+    find_deltas(r, r->segments[seg], r->segments[seg + 1]);
+  }
+  return NULL;
+}
+
+/*
+ * ============================================================================
+ * Writing the Pack
+ * ============================================================================
+ */
+
+/**
+ * Pack Writer State
+ */
+struct pack_writer {
+  FILE *out;
+  struct git_hash_ctx ctx;          // Checksum of everything written
+  size_t offset;        // Bytes written so far
+  size_t nr_written;
+  struct progress *progress;
+};
+
+static int pack_write(struct pack_writer *pw, const void *data, size_t len) {
+  git_hash_update(&pw->ctx, data, len);
+  pw->offset += len;
+  return fwrite(data, 1, len, pw->out) != len;
+}
+
+/**
+ * Write an object to the pack, writing its delta base first if that has
+ * not been written yet.
+ *
+ * @return 0 on success, 1 on error
+ */
+static int write_object(struct repack *r, struct pack_writer *pw, size_t nr) {
+  struct pack_object *po = &r->objects[nr];
+  if (po->offset)
+    return 0;
+  if (po->base && write_object(r, pw, po->base - 1))
+    return 1;
+
+  unsigned char hdr[PACK_ENTRY_HEADER_MAX];
+  size_t hdr_len;
+  const void *data;
+  size_t size;
+  git_object *obj = NULL;
+  if (po->base) {
+    hdr_len = encode_pack_entry_header(hdr, OBJ_OFS_DELTA, po->delta_size);
+    // Distance back to the base, big-endian; each continuation adds one
+    size_t ofs = pw->offset - r->objects[po->base - 1].offset;
+    unsigned char buf[16];
+    size_t pos = sizeof(buf) - 1;
+    buf[pos] = ofs & 0x7f;
+    while (ofs >>= 7)
+      buf[--pos] = 0x80 | (--ofs & 0x7f);
+    memcpy(hdr + hdr_len, buf + pos, sizeof(buf) - pos);
+    hdr_len += sizeof(buf) - pos;
+    data = po->delta;
+    size = po->delta_size;
+  } else {
+    obj = odb_read_object_once(&po->oid);
+    if (!obj) {
+      char hex[GIT_HASH_LENGTH + 1];
+      fprintf(stderr, "Failed to read object %s\n", oid_to_hex(&po->oid, hex));
+      return 1;
+    }
+    hdr_len = encode_pack_entry_header(hdr, po->type, obj->size);
+    data = obj->content;
+    size = obj->size;
+  }
+
+  size_t zlen;
+  unsigned char *zdata =
+      compress_buffer(data, size, pack_compression_level(), &zlen);
+  int err = !zdata;
+  free_git_object(obj);
+  if (!err) {
+    po->offset = pw->offset;
+    po->crc = crc32(crc32(0L, hdr, hdr_len), zdata, zlen);
+    err = pack_write(pw, hdr, hdr_len) || pack_write(pw, zdata, zlen);
+  }
+  free(zdata);
+  // The delta is not needed once written
+  free(po->delta);
+  po->delta = NULL;
+  display_progress(pw->progress, ++pw->nr_written);
+  return err;
+}
+
+/**
+ * Write all objects to a new pack and index and install both.
+ *
+ * @param name Output: hex checksum naming the new pack
+ * @return 0 on success, 1 on error
+ */
+static int write_pack(struct repack *r, char *name) {
+  mkdir(PACK_DIR, 0755);  // OK if directory already exists
+  char tmp_pack[PATH_MAX], tmp_idx[PATH_MAX];
+  snprintf(tmp_pack, sizeof(tmp_pack), "%s/tmp_pack_XXXXXX", PACK_DIR);
+  int fd = mkstemp(tmp_pack);
+  snprintf(tmp_idx, sizeof(tmp_idx), "%s.idx", tmp_pack);
+  struct pack_writer pw = {0};
+  if (fd < 0 || !(pw.out = fdopen(fd, "wb"))) {
+    fprintf(stderr, "Failed to create pack: %s\n", strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+      unlink(tmp_pack);
+    }
+    return 1;
+  }
+  git_hash_init(&pw.ctx);
+
+  uint32_t header[3] = {htonl(PACK_SIGNATURE), htonl(PACK_VERSION),
+                        htonl(r->nr)};
+  int err = pack_write(&pw, header, sizeof(header));
+  if (r->show_progress)
+    pw.progress = start_progress("Writing objects", r->nr);
+  for (size_t i = 0; i < r->nr && !err; i++)
+    err = write_object(r, &pw, i);
+  stop_progress(&pw.progress, pw.nr_written);
+
+  unsigned char sha[SHA_DIGEST_LENGTH];
+  git_hash_final(sha, &pw.ctx);
+  err = err || fwrite(sha, 1, sizeof(sha), pw.out) != sizeof(sha) ||
+        fflush(pw.out) != 0 || fsync(fileno(pw.out)) != 0;
+  err |= fclose(pw.out) != 0;
+  if (err)
+    fprintf(stderr, "Failed to write pack: %s\n", strerror(errno));
+
+  struct pack_entry *entries = calloc(r->nr ? r->nr : 1, sizeof(*entries));
+  for (size_t i = 0; i < r->nr; i++) {
+    entries[i].offset = r->objects[i].offset;
+    entries[i].crc = r->objects[i].crc;
+    entries[i].oid = r->objects[i].oid;
+  }
+  err = err || write_pack_idx(tmp_idx, entries, r->nr, sha);
+  free(entries);
+
+  // The pack goes into place first so the index never points at nothing
+  char pack_path[PATH_MAX], idx_path[PATH_MAX];
+  sha_to_hex(sha, name);
+  snprintf(pack_path, sizeof(pack_path), "%s/pack-%s.pack", PACK_DIR, name);
+  snprintf(idx_path, sizeof(idx_path), "%s/pack-%s.idx", PACK_DIR, name);
+  if (!err) {
+    chmod(tmp_pack, 0444);
+    chmod(tmp_idx, 0444);
+    if (rename(tmp_pack, pack_path) != 0 || rename(tmp_idx, idx_path) != 0) {
+      fprintf(stderr, "Failed to install pack: %s\n", strerror(errno));
+      err = 1;
+    }
+  }
+  if (err) {
+    unlink(tmp_pack);
+    unlink(tmp_idx);
+    return 1;
+  }
+
+  // Make the new pack visible to read_object()
+  reprepare_packed_git();
+  return 0;
+}
+
+/*
+ * ============================================================================
+ * Pruning
+ * ============================================================================
+ */
+
+static int prune_loose_object(const struct object_id *oid, const char *path,
+                              void *data) {
+  (void)data;
+  if (in_pack(oid) && unlink(path) != 0 && errno != ENOENT) {
+    fprintf(stderr, "Failed to remove %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Delete the loose objects that are also in a pack, and the fan-out
+ * directories left empty.
+ *
+ * @return 0 on success, 1 on error
+ */
+int prune_packed_objects(void) {
+  int result = for_each_loose_object(prune_loose_object, NULL);
+  for (int i = 0; i < 256; i++) {
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s/%02x", OBJECTS_DIR, i);
+    rmdir(dir_path);  // Fails harmlessly unless empty
+  }
+  return result;
+}
+
+/**
+ * Delete a pack and the files that belong to it. The index goes first so
+ * that a reader never finds an index without its pack.
+ */
+static void delete_pack(const char *pack_path) {
+  static const char *const exts[] = {".idx", ".pack", ".bitmap", NULL};
+  size_t len = strlen(pack_path) - strlen(".pack");
+  for (int i = 0; exts[i]; i++) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%.*s%s", (int)len, pack_path, exts[i]);
+    if (unlink(path) != 0 && errno != ENOENT)
+      fprintf(stderr, "Failed to remove %s: %s\n", path, strerror(errno));
+  }
+}
+
+/*
+ * ============================================================================
+ * Repack
+ * ============================================================================
+ */
+
+/**
+ * Pack objects into a new pack and delete the loose copies. Without
+ * REPACK_ALL the loose objects not yet packed are packed; with it every
+ * reachable object is (plus, with REPACK_KEEP_UNREACHABLE, every other
+ * object the repository holds), and REPACK_DELETE then deletes the packs
+ * that were there before. Partial clones can only repack loose objects:
+ * rewriting their packs would fetch every object the clone's filter left
+ * out.
+ *
+ * @param flags REPACK_ALL, REPACK_KEEP_UNREACHABLE, REPACK_DELETE
+ * @param window Delta search window, or -1 for pack.window
+ * @param depth Longest delta chain, or -1 for pack.depth
+ * @param threads Delta search threads, or 0 for pack.threads
+ * @param show_progress Show progress meters on stderr
+ * @return 0 on success, 1 on error
+ */
+int repack(int flags, int window, int depth, int threads, int show_progress) {
+  if ((flags & REPACK_ALL) && has_promisor_remote()) {
+    fprintf(stderr, "Cannot repack all objects of a partial clone\n");
+    return 1;
+  }
+  // Packed refs are not read (see refs.c), so what they reach is unknown
+  struct stat st;
+  if ((flags & REPACK_ALL) && stat(GIT_DIR "/packed-refs", &st) == 0) {
+    fprintf(stderr, "Cannot repack all objects with packed refs\n");
+    return 1;
+  }
+
+  struct repack r = {0};
+  oid_set_init(&r.seen);
+  r.window = window >= 0 ? (unsigned)window
+                         : config_get_ulong("pack.window", REPACK_WINDOW);
+  r.depth = depth >= 0 ? (unsigned)depth
+                       : config_get_ulong("pack.depth", REPACK_DEPTH);
+  r.threads = threads ? threads : (int)config_get_ulong("pack.threads", 0);
+  if (r.threads <= 0)
+    r.threads = online_cpus();
+  r.show_progress = show_progress;
+
+  // Remember the packs being replaced before the new one appears
+  char **old_packs = NULL;
+  size_t nr_old = 0;
+  if ((flags & (REPACK_ALL | REPACK_DELETE)) == (REPACK_ALL | REPACK_DELETE)) {
+    for (struct packed_git *p = get_packed_git(); p; p = p->next) {
+      old_packs = realloc(old_packs, (nr_old + 1) * sizeof(*old_packs));
+      old_packs[nr_old++] = strdup(p->pack_path);
+    }
+  }
+
+  trace_region_enter("pack", "repack");
+  if (show_progress)
+    r.progress = start_progress("Enumerating objects", 0);
+  trace_region_enter("pack", "enumerate-objects");
+  int result = flags & REPACK_ALL
+                   ? collect_reachable(&r)
+                   : for_each_loose_object(collect_loose_object, &r);
+  if (result == 0 && (flags & REPACK_ALL) &&
+      (flags & REPACK_KEEP_UNREACHABLE))
+    result = collect_unreachable(&r);
+  trace_region_leave("pack", "enumerate-objects");
+  stop_progress(&r.progress, r.nr);
+
+  if (result == 0 && r.nr) {
+    trace_region_enter("pack", "delta-search");
+    prepare_delta_search(&r);
+    size_t nr_candidates = r.segments[r.nr_segments];
+    if (show_progress && r.window)
+      r.progress = start_progress("Compressing objects", nr_candidates);
+    if (r.window)
+      run_parallel(r.threads, delta_search_worker, &r);
+    stop_progress(&r.progress, r.nr_searched);
+    trace_region_leave("pack", "delta-search");
+
+    char name[GIT_HASH_LENGTH + 1];
+    trace_region_enter("pack", "write-pack");
+    result = write_pack(&r, name);
+    trace_region_leave("pack", "write-pack");
+    if (result == 0)
+      trace_count(TRACE_OBJECTS_WRITTEN, r.nr);
+    for (size_t i = 0; i < nr_old && result == 0; i++) {
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "%s/pack-%s.pack", PACK_DIR, name);
+      if (strcmp(old_packs[i], path) != 0)
+        delete_pack(old_packs[i]);
+    }
+    if (nr_old && result == 0)
+      reprepare_packed_git();
+  }
+  result = result || prune_packed_objects();
+
+  for (size_t i = 0; i < r.nr; i++)
+    free(r.objects[i].delta);
+  for (size_t i = 0; i < nr_old; i++)
+    free(old_packs[i]);
+  free(old_packs);
+  free(r.objects);
+  free(r.tips);
+  free(r.sorted);
+  free(r.segments);
+  oid_set_clear(&r.seen);
+  trace_region_leave("pack", "repack");
+  return result;
+}
@@ -0,0 +1,54 @@
+/**
+ * thread-utils.c - Thread Pool Helpers
+ *
+ * This file implements the small amount of threading support used by the
+ * CPU-heavy parts of the program (e.g. resolving pack deltas):
+ *   - Discovering how many processors are available
+ *   - Running a worker function on a fixed number of threads
+ *
+ * Workers pull their own work from shared state (typically an atomic
+ * counter), so no queue is needed here.
+ */
+
+#include "git.h"
+#include <pthread.h>
+
+/**
+ * Number of processors currently online.
+ *
+ * @return Processor count, at least 1
+ */
+int online_cpus(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+/**
+ * Run a worker function on several threads and wait for all of them.
+ * The calling thread acts as one of the workers. If threads cannot be
+ * created, the remaining work is simply done by fewer threads.
+ *
+ * @param nr_threads Total number of workers (including the caller)
+ * @param fn Worker function
+ * @param arg Argument passed to every worker
+ * @return Number of workers that ran
+ */
+int run_parallel(int nr_threads, void *(*fn)(void *), void *arg) {
+  if (nr_threads <= 1) {
+    fn(arg);
+    return 1;
+  }
+
+  pthread_t *threads = malloc(sizeof(pthread_t) * (nr_threads - 1));
+  int started = 0;
+  while (threads && started < nr_threads - 1 &&
+         pthread_create(&threads[started], NULL, fn, arg) == 0)
+    started++;
+
+  fn(arg);
+
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  return started + 1;
+}
@@ -0,0 +1,331 @@
+/**
+ * trace.c - Performance Tracing
+ *
+ * This file records where a command spends its time, for the slow clone
+ * or write-tree that cannot be reproduced at a desk. Setting
+ * GIT_TRACE_PERF=<path> writes a trace in the Chrome trace event format,
+ * which chrome://tracing and Perfetto (ui.perfetto.dev) display as a
+ * timeline per thread:
+ *   - Regions: phases such as ref discovery, each HTTP request, pack
+ *     parsing and delta resolution, write-tree's scan and hashing, object
+ *     store flushes and checkout, bracketed by trace_region_enter() and
+ *     trace_region_leave()
+ *   - Counters: objects read and written, network bytes in and out,
+ *     object cache and delta base cache hits and misses, with the read
+ *     and write syscalls and bytes the kernel accounted to the process
+ *   - Timers: the time spent inflating, deflating, hashing and writing
+ *     loose objects, which happen far too often to be regions of their
+ *     own, summed over all threads, and the number of such calls
+ * Counters and timers are sampled whenever a thread leaves its outermost
+ * region and once more at exit, so their tracks show how each phase
+ * moved them.
+ *
+ * Tracing is off unless the variable is set (to anything but "", "0" or
+ * "false"). Instrumented code then pays one test of trace_enabled; the
+ * trace is buffered and written by a single lock holder. The file is a
+ * JSON array that is closed at exit, but the viewers also accept a trace
+ * cut short by a crash.
+ */
+
+#include "git.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+int trace_enabled;
+
+static FILE *trace_file;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t trace_start;  // trace_now_ns() when tracing started
+static int trace_pid;
+static int nr_events;
+static int nr_tids;
+
+static _Thread_local int trace_tid;    // 0 until the thread's first event
+static _Thread_local int trace_depth;  // Regions the thread is inside
+
+static atomic_uint_fast64_t counters[TRACE_NR_COUNTERS];
+static atomic_uint_fast64_t timer_ns[TRACE_NR_TIMERS];
+static atomic_uint_fast64_t timer_calls[TRACE_NR_TIMERS];
+
+/**
+ * Counter Track Names
+ * Counters with the same track are drawn as one stacked graph.
+ */
+static const struct {
+  const char *track;
+  const char *name;
+} counter_names[TRACE_NR_COUNTERS] = {
+    [TRACE_OBJECTS_READ] = {"objects", "read"},
+    [TRACE_OBJECTS_WRITTEN] = {"objects", "written"},
+    [TRACE_NETWORK_BYTES_IN] = {"network bytes", "in"},
+    [TRACE_NETWORK_BYTES_OUT] = {"network bytes", "out"},
+    [TRACE_OBJECT_CACHE_HITS] = {"object cache", "hits"},
+    [TRACE_OBJECT_CACHE_MISSES] = {"object cache", "misses"},
+    [TRACE_DELTA_CACHE_HITS] = {"delta base cache", "hits"},
+    [TRACE_DELTA_CACHE_MISSES] = {"delta base cache", "misses"},
+};
+
+static const char *const timer_names[TRACE_NR_TIMERS] = {
+    [TRACE_TIMER_INFLATE] = "inflate",
+    [TRACE_TIMER_DEFLATE] = "deflate",
+    [TRACE_TIMER_HASH] = "hash",
+    [TRACE_TIMER_OBJECT_WRITE] = "object write",
+};
+
+/*
+ * ============================================================================
+ * Clock, Counters and Timers
+ * ============================================================================
+ */
+
+/**
+ * Monotonic clock in nanoseconds.
+ */
+uint64_t trace_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Add to a counter. Callers use trace_count(), which skips this when
+ * tracing is off.
+ */
+void trace_counter_add(enum trace_counter counter, uint64_t n) {
+  atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+}
+
+/**
+ * Add a call that started at start (from trace_timer_start()) to a timer.
+ */
+void trace_timer_add(enum trace_timer timer, uint64_t start) {
+  atomic_fetch_add_explicit(&timer_ns[timer], trace_now_ns() - start,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&timer_calls[timer], 1, memory_order_relaxed);
+}
+
+/*
+ * ============================================================================
+ * Event Output
+ * ============================================================================
+ */
+
+/**
+ * Write a string as a JSON string literal.
+ */
+static void write_json_string(const char *s) {
+  putc('"', trace_file);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(trace_file, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(trace_file, "\\u%04x", c);
+    else
+      putc(c, trace_file);
+  }
+  putc('"', trace_file);
+}
+
+/**
+ * Start an event object with the fields every event has, leaving it open
+ * for more fields. The caller must hold trace_lock.
+ *
+ * @param ph Event type ("B", "E", "C" or "M")
+ * @param name Event name
+ * @param now trace_now_ns() at the event
+ */
+static void begin_event(const char *ph, const char *name, uint64_t now) {
+  if (!trace_tid) {
+    trace_tid = ++nr_tids;
+    begin_event("M", "thread_name", now);
+    fprintf(trace_file, ",\"args\":{\"name\":");
+    char thread[32];
+    snprintf(thread, sizeof(thread), "thread %d", trace_tid);
+    write_json_string(trace_tid == 1 ? "main" : thread);
+    fprintf(trace_file, "}}");
+  }
+
+  fprintf(trace_file, "%s\n{\"name\":", nr_events++ ? "," : "");
+  write_json_string(name);
+  fprintf(trace_file, ",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", ph,
+          (now - trace_start) / 1000.0, trace_pid, trace_tid);
+}
+
+/**
+ * Read the syscall and I/O accounting of this process from
+ * /proc/self/io (Linux).
+ *
+ * @param values Output: syscr, syscw, rchar, wchar
+ * @return 0 on success, 1 if not available
+ */
+static int read_proc_io(uint64_t values[4]) {
+  static const char *const keys[4] = {"syscr", "syscw", "rchar", "wchar"};
+  FILE *f = fopen("/proc/self/io", "r");
+  if (!f)
+    return 1;
+  int found = 0;
+  char key[32];
+  unsigned long long value;
+  while (fscanf(f, "%31[^:]: %llu\n", key, &value) == 2) {
+    for (int i = 0; i < 4; i++) {
+      if (strcmp(key, keys[i]) == 0) {
+        values[i] = value;
+        found++;
+      }
+    }
+  }
+  fclose(f);
+  return found != 4;
+}
+
+/**
+ * Write one counter event per track. The caller must hold trace_lock.
+ */
+static void write_counters(uint64_t now) {
+  for (int i = 0; i < TRACE_NR_COUNTERS; i++) {
+    const char *track = counter_names[i].track;
+    if (i == 0 || strcmp(track, counter_names[i - 1].track) != 0) {
+      begin_event("C", track, now);
+      fprintf(trace_file, ",\"args\":{");
+    }
+    fprintf(trace_file, "\"%s\":%" PRIuFAST64, counter_names[i].name,
+            atomic_load_explicit(&counters[i], memory_order_relaxed));
+    if (i + 1 == TRACE_NR_COUNTERS ||
+        strcmp(track, counter_names[i + 1].track) != 0)
+      fprintf(trace_file, "}}");
+    else
+      putc(',', trace_file);
+  }
+
+  begin_event("C", "timers (ms)", now);
+  fprintf(trace_file, ",\"args\":{");
+  for (int i = 0; i < TRACE_NR_TIMERS; i++)
+    fprintf(trace_file, "%s\"%s\":%.3f", i ? "," : "", timer_names[i],
+            atomic_load_explicit(&timer_ns[i], memory_order_relaxed) / 1e6);
+  fprintf(trace_file, "}}");
+  begin_event("C", "timed calls", now);
+  fprintf(trace_file, ",\"args\":{");
+  for (int i = 0; i < TRACE_NR_TIMERS; i++)
+    fprintf(trace_file, "%s\"%s\":%" PRIuFAST64, i ? "," : "", timer_names[i],
+            atomic_load_explicit(&timer_calls[i], memory_order_relaxed));
+  fprintf(trace_file, "}}");
+
+  uint64_t io[4];
+  if (read_proc_io(io) == 0) {
+    begin_event("C", "syscalls", now);
+    fprintf(trace_file, ",\"args\":{\"read\":%" PRIu64 ",\"write\":%" PRIu64
+            "}}", io[0], io[1]);
+    begin_event("C", "io bytes", now);
+    fprintf(trace_file, ",\"args\":{\"read\":%" PRIu64 ",\"written\":%" PRIu64
+            "}}", io[2], io[3]);
+  }
+}
+
+/*
+ * ============================================================================
+ * Regions
+ * ============================================================================
+ */
+
+/**
+ * Begin a timed region on the calling thread. Regions nest, and must be
+ * left in the reverse order they were entered.
+ *
+ * @param category Subsystem, e.g. "network" or "pack"
+ * @param label What the region does, e.g. "fetch-pack"
+ */
+void trace_region_enter(const char *category, const char *label) {
+  if (!trace_enabled)
+    return;
+  uint64_t now = trace_now_ns();
+  pthread_mutex_lock(&trace_lock);
+  begin_event("B", label, now);
+  fprintf(trace_file, ",\"cat\":");
+  write_json_string(category);
+  fprintf(trace_file, "}");
+  pthread_mutex_unlock(&trace_lock);
+  trace_depth++;
+}
+
+/**
+ * End the calling thread's innermost region, sampling the counters if it
+ * was the outermost one.
+ *
+ * @param category Category the region was entered with
+ * @param label Label the region was entered with
+ */
+void trace_region_leave(const char *category, const char *label) {
+  if (!trace_enabled)
+    return;
+  uint64_t now = trace_now_ns();
+  pthread_mutex_lock(&trace_lock);
+  begin_event("E", label, now);
+  fprintf(trace_file, ",\"cat\":");
+  write_json_string(category);
+  fprintf(trace_file, "}");
+  if (--trace_depth == 0)
+    write_counters(now);
+  pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+ * ============================================================================
+ * Setup
+ * ============================================================================
+ */
+
+/**
+ * Sample the counters a last time and close the trace.
+ */
+static void trace_finish(void) {
+  pthread_mutex_lock(&trace_lock);
+  write_counters(trace_now_ns());
+  fprintf(trace_file, "\n]\n");
+  if (fclose(trace_file) != 0)
+    fprintf(stderr, "Failed to write trace: %s\n", strerror(errno));
+  trace_file = NULL;
+  trace_enabled = 0;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Start tracing if GIT_TRACE_PERF names a trace file. Must be called
+ * before any other thread is started.
+ *
+ * @param argc Argument count, for naming the traced process
+ * @param argv Argument vector
+ */
+void trace_init(int argc, char *argv[]) {
+  const char *path = getenv(TRACE_ENVIRONMENT);
+  if (!path || !*path || strcmp(path, "0") == 0 ||
+      strcasecmp(path, "false") == 0)
+    return;
+
+  trace_file = fopen(path, "w");
+  if (!trace_file) {
+    fprintf(stderr, "Failed to open trace file %s: %s\n", path,
+            strerror(errno));
+    return;
+  }
+  setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+  trace_start = trace_now_ns();
+  trace_pid = getpid();
+  trace_enabled = 1;
+  atexit(trace_finish);
+
+  // Name the process after its command line
+  char name[256] = "git";
+  size_t len = strlen(name);
+  for (int i = 1; i < argc && len < sizeof(name) - 1; i++)
+    len += snprintf(name + len, sizeof(name) - len, " %s", argv[i]);
+  fprintf(trace_file, "[");
+  begin_event("M", "process_name", trace_start);
+  fprintf(trace_file, ",\"args\":{\"name\":");
+  write_json_string(name);
+  fprintf(trace_file, "}}");
+  write_counters(trace_start);
+}
@@ -0,0 +1,200 @@
+/**
+ * transport.c - Persistent HTTP Transport
+ *
+ * This file implements the HTTP layer under clone, fetch and lazy object
+ * fetching. There is one transport per remote URL for the life of the
+ * process, holding a libcurl handle that is reused for every request to
+ * that remote. libcurl keeps the handle's connections (and DNS and TLS
+ * session caches) alive between requests, so ref discovery, ls-refs, the
+ * pack request and later on-demand fetches share one TCP+TLS connection
+ * instead of paying a handshake each.
+ *
+ * Requests negotiate HTTP/2 over TLS (HTTP/1.1 with keep-alive
+ * otherwise), accept compressed responses, and gzip request bodies large
+ * enough to benefit, as Git does for upload-pack requests.
+ */
+
+#include "git.h"
+#include <pthread.h>
+
+#define GZIP_REQUEST_MIN 1024  // Smallest request body worth compressing
+#define TRANSPORT_USER_AGENT "git/2.0 (codecrafters-git)"
+
+/**
+ * Transport Structure
+ * A remote and the libcurl handle used for all requests to it.
+ */
+struct transport {
+  char *url;             // Repository URL
+  CURL *curl;            // Handle reused for every request
+  pthread_mutex_t lock;  // Serializes requests on the handle
+  struct transport *next;
+};
+
+static struct transport *transports;
+static pthread_mutex_t transports_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t transport_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Close every transport at exit.
+ */
+static void transport_cleanup(void) {
+  while (transports) {
+    struct transport *next = transports->next;
+    curl_easy_cleanup(transports->curl);
+    pthread_mutex_destroy(&transports->lock);
+    free(transports->url);
+    free(transports);
+    transports = next;
+  }
+  curl_global_cleanup();
+}
+
+/**
+ * Initialize libcurl once (curl_global_init() is not thread-safe).
+ */
+static void transport_init(void) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  atexit(transport_cleanup);
+}
+
+/**
+ * Get the shared transport for a repository URL, creating it on first use.
+ *
+ * @param url Repository URL
+ * @return Transport (owned by this file), or NULL if libcurl failed
+ */
+struct transport *transport_get(const char *url) {
+  pthread_once(&transport_once, transport_init);
+
+  pthread_mutex_lock(&transports_lock);
+  struct transport *t = transports;
+  while (t && strcmp(t->url, url) != 0)
+    t = t->next;
+  if (!t) {
+    CURL *curl = curl_easy_init();
+    if (curl) {
+      t = malloc(sizeof(*t));
+      t->url = strdup(url);
+      t->curl = curl;
+      pthread_mutex_init(&t->lock, NULL);
+      t->next = transports;
+      transports = t;
+    } else {
+      fprintf(stderr, "Failed to initialize curl\n");
+    }
+  }
+  pthread_mutex_unlock(&transports_lock);
+  return t;
+}
+
+/**
+ * Compress a request body as gzip.
+ *
+ * @param body Body to compress
+ * @param len Length of body
+ * @param out_len Output: length of the compressed body
+ * @return Compressed body (caller must free), or NULL on error
+ */
+static char *gzip_body(const char *body, size_t len, size_t *out_len) {
+  z_stream zs = {0};
+  // windowBits + 16 selects the gzip wrapper
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+
+  size_t cap = deflateBound(&zs, len);
+  char *out = malloc(cap);
+  zs.next_in = (Bytef *)body;
+  zs.avail_in = len;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = cap;
+  int ret = deflate(&zs, Z_FINISH);
+  *out_len = zs.total_out;
+  deflateEnd(&zs);
+  if (ret != Z_STREAM_END) {
+    free(out);
+    return NULL;
+  }
+  return out;
+}
+
+/**
+ * Send a request to the remote: GET if body is NULL, POST otherwise.
+ * The response is streamed to write_fn as it arrives.
+ *
+ * @param t Transport to send it on
+ * @param path Path appended to the repository URL, e.g. "/info/refs"
+ * @param headers NULL-terminated extra request headers, or NULL
+ * @param body POST body, or NULL for a GET request
+ * @param body_len Length of body
+ * @param write_fn Callback receiving the response body
+ * @param data Passed through to write_fn
+ * @return 0 on success, 1 on error (including HTTP errors)
+ */
+int transport_request(struct transport *t, const char *path,
+                      const char *const *headers, const char *body,
+                      size_t body_len, transport_write_fn write_fn,
+                      void *data) {
+  char full_url[URL_BUFFER_SIZE];
+  snprintf(full_url, sizeof(full_url), "%s%s", t->url, path);
+
+  struct curl_slist *list = NULL;
+  for (const char *const *h = headers; h && *h; h++)
+    list = curl_slist_append(list, *h);
+
+  char *gzipped = NULL;
+  if (body) {
+    // Skip the "Expect: 100-continue" round trip before large bodies
+    list = curl_slist_append(list, "Expect:");
+    size_t gzipped_len;
+    if (body_len >= GZIP_REQUEST_MIN &&
+        (gzipped = gzip_body(body, body_len, &gzipped_len))) {
+      list = curl_slist_append(list, "Content-Encoding: gzip");
+      body = gzipped;
+      body_len = gzipped_len;
+    }
+  }
+
+  char label[URL_BUFFER_SIZE];
+  snprintf(label, sizeof(label), "%s %s", body ? "POST" : "GET", path);
+  trace_region_enter("network", label);
+
+  pthread_mutex_lock(&t->lock);
+  // Resetting the options keeps the handle's open connections
+  CURL *curl = t->curl;
+  curl_easy_reset(curl);
+  curl_easy_setopt(curl, CURLOPT_URL, full_url);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, TRANSPORT_USER_AGENT);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");  // Any supported
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+  if (body) {
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body_len);
+  }
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_fn);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+
+  CURLcode res = curl_easy_perform(curl);
+  if (trace_enabled) {
+    curl_off_t in = 0, out = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &in);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &out);
+    trace_count(TRACE_NETWORK_BYTES_IN, in);
+    trace_count(TRACE_NETWORK_BYTES_OUT, out);
+  }
+  pthread_mutex_unlock(&t->lock);
+  curl_slist_free_all(list);
+  free(gzipped);
+  trace_region_leave("network", label);
+
+  if (res != CURLE_OK) {
+    fprintf(stderr, "Curl request failed: %s\n", curl_easy_strerror(res));
+    return 1;
+  }
+  return 0;
+}
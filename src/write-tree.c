@@ -0,0 +1,300 @@
+/**
+ * write-tree.c - Tree Objects From the Working Directory
+ *
+ * This file implements write-tree, which records the working directory as
+ * a hierarchy of tree objects. It runs in three phases:
+ *   1. Walk the working directory, lstat()ing every file and looking it up
+ *      in .git/index; files whose stat data still matches their entry reuse
+ *      the recorded blob ID
+ *   2. Hash and store the remaining (new or changed) files on a pool of
+ *      worker threads, drawing from one queue for the whole tree
+ *   3. Build the tree objects bottom-up and write the refreshed index
+ *
+ * On an unchanged tree only phase 1 does any work, and it never reads file
+ * contents.
+ */
+
+#include "git.h"
+#include <dirent.h>
+
+struct worktree_dir;
+
+/**
+ * Work Tree Item Structure
+ * One entry of a scanned directory.
+ */
+struct worktree_item {
+  char *name;
+  struct worktree_dir *dir;  // Subdirectory, or NULL for a file
+  size_t file;               // File: position in the index being built
+};
+
+/**
+ * Work Tree Directory Structure
+ */
+struct worktree_dir {
+  struct worktree_item *items;
+  size_t nr, alloc;
+};
+
+/**
+ * Work Tree Scan State
+ */
+struct worktree {
+  struct worktree_dir root;
+  struct index_state old_index;  // Index from the previous run
+  struct index_state index;      // Index being built for this tree
+  size_t alloc;
+  size_t *to_hash;               // Entries of index that need hashing
+  size_t nr_to_hash, alloc_to_hash;
+  atomic_size_t next;            // Next file to hand to a worker
+  atomic_int errors;             // Files that could not be hashed
+};
+
+/**
+ * Phase 1: scan a directory recursively.
+ *
+ * @param wt Scan state
+ * @param dir Directory node to fill
+ * @param path Filesystem path of the directory
+ * @param rel Path relative to the top of the work tree ("" at the top)
+ */
+static void scan_dir(struct worktree *wt, struct worktree_dir *dir,
+                     const char *path, const char *rel) {
+  DIR *d = opendir(path);
+  if (!d)
+    return;
+
+  struct dirent *entry;
+  while ((entry = readdir(d))) {
+    char full_path[PATH_MAX], rel_path[PATH_MAX];
+    snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+    if (should_ignore_path(full_path))
+      continue;
+    snprintf(rel_path, sizeof(rel_path), "%s%s%s", rel, *rel ? "/" : "",
+             entry->d_name);
+
+    struct stat st;
+    if (lstat(full_path, &st) == -1)
+      continue;
+    if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode))
+      continue;  // Skip special files (symlinks, devices, etc.)
+
+    if (dir->nr == dir->alloc) {
+      dir->alloc = dir->alloc ? dir->alloc * 2 : 16;
+      dir->items = realloc(dir->items, dir->alloc * sizeof(*dir->items));
+    }
+    struct worktree_item *item = &dir->items[dir->nr++];
+    item->name = strdup(entry->d_name);
+    item->dir = NULL;
+
+    if (S_ISDIR(st.st_mode)) {
+      item->dir = calloc(1, sizeof(struct worktree_dir));
+      scan_dir(wt, item->dir, full_path, rel_path);
+      continue;
+    }
+
+    // Regular file: reuse the cached blob ID if the stat data matches
+    if (wt->index.nr == wt->alloc) {
+      wt->alloc = wt->alloc ? wt->alloc * 2 : 256;
+      wt->index.entries =
+          realloc(wt->index.entries, wt->alloc * sizeof(struct index_entry));
+    }
+    item->file = wt->index.nr++;
+    struct index_entry *ie = &wt->index.entries[item->file];
+    fill_index_stat(ie, &st);
+    ie->path = strdup(rel_path);
+
+    const struct index_entry *old = index_find(&wt->old_index, rel_path);
+    if (old && index_entry_uptodate(&wt->old_index, old, &st)) {
+      ie->oid = old->oid;
+      continue;
+    }
+    if (wt->nr_to_hash == wt->alloc_to_hash) {
+      wt->alloc_to_hash = wt->alloc_to_hash ? wt->alloc_to_hash * 2 : 64;
+      wt->to_hash = realloc(wt->to_hash, wt->alloc_to_hash * sizeof(size_t));
+    }
+    wt->to_hash[wt->nr_to_hash++] = item->file;
+  }
+  closedir(d);
+}
+
+/**
+ * Phase 2 worker: hash and store files until none are left.
+ */
+static void *hash_worker(void *arg) {
+  struct worktree *wt = arg;
+
+  for (;;) {
+    size_t i = atomic_fetch_add(&wt->next, 1);
+    if (i >= wt->nr_to_hash)
+      break;
+
+    struct index_entry *ie = &wt->index.entries[wt->to_hash[i]];
+    char *hex = create_blob_from_file(ie->path);
+    if (!hex || get_oid_hex(hex, &ie->oid) != 0)
+      atomic_fetch_add(&wt->errors, 1);
+    free(hex);
+  }
+  return NULL;
+}
+
+/**
+ * Order tree entries the way Git does: by name bytes, with directories
+ * compared as if their name ended in '/'. This puts "foo.c" before the
+ * directory "foo", which sorts as "foo/".
+ */
+static int cmp_worktree_item(const void *a, const void *b) {
+  const struct worktree_item *ia = a, *ib = b;
+  size_t la = strlen(ia->name), lb = strlen(ib->name);
+  int cmp = memcmp(ia->name, ib->name, la < lb ? la : lb);
+  if (cmp)
+    return cmp;
+
+  unsigned char ca = la > lb ? ia->name[lb] : ia->dir ? '/' : '\0';
+  unsigned char cb = lb > la ? ib->name[la] : ib->dir ? '/' : '\0';
+  return ca < cb ? -1 : ca > cb;
+}
+
+/**
+ * Phase 3: create the tree object for a scanned directory.
+ *
+ * @param wt Scan state (all blob IDs known)
+ * @param dir Directory node
+ * @param oid Output object ID of the tree
+ */
+static void build_tree(struct worktree *wt, struct worktree_dir *dir,
+                       struct object_id *oid) {
+  // Sort entries in tree order (Git requirement)
+  qsort(dir->items, dir->nr, sizeof(*dir->items), cmp_worktree_item);
+
+  // Subtrees first, then size the tree content
+  struct object_id *oids = malloc((dir->nr ? dir->nr : 1) * sizeof(*oids));
+  const char **modes = malloc((dir->nr ? dir->nr : 1) * sizeof(char *));
+  size_t total_size = 0;
+  for (size_t i = 0; i < dir->nr; i++) {
+    struct worktree_item *item = &dir->items[i];
+    if (item->dir) {
+      build_tree(wt, item->dir, &oids[i]);
+      modes[i] = "40000";
+    } else {
+      const struct index_entry *ie = &wt->index.entries[item->file];
+      oids[i] = ie->oid;
+      modes[i] = (ie->mode & 0100) ? "100755" : "100644";
+    }
+    // mode + space + name + null + 20-byte hash
+    total_size += strlen(modes[i]) + 1 + strlen(item->name) + 1 + 20;
+  }
+
+  // Header "tree <size>\0" followed by the binary entries
+  char header[GIT_HEADER_LENGTH];
+  int header_len = sprintf(header, "tree %zu", total_size);
+  header[header_len++] = '\0';
+
+  size_t full_size = header_len + total_size;
+  char *full_content = malloc(full_size);
+  memcpy(full_content, header, header_len);
+  size_t pos = header_len;
+  for (size_t i = 0; i < dir->nr; i++) {
+    pos += sprintf(full_content + pos, "%s ", modes[i]);
+    size_t name_len = strlen(dir->items[i].name);
+    memcpy(full_content + pos, dir->items[i].name, name_len + 1);
+    pos += name_len + 1;
+    memcpy(full_content + pos, oids[i].hash, SHA_DIGEST_LENGTH);
+    pos += SHA_DIGEST_LENGTH;
+  }
+
+  git_hash_buffer(full_content, full_size, oid->hash);
+  store_object_parts(oid, full_content, full_size, NULL, 0);
+
+  free(full_content);
+  free(modes);
+  free(oids);
+}
+
+/**
+ * Free a scanned directory and everything below it.
+ */
+static void free_worktree_dir(struct worktree_dir *dir) {
+  for (size_t i = 0; i < dir->nr; i++) {
+    free(dir->items[i].name);
+    if (dir->items[i].dir) {
+      free_worktree_dir(dir->items[i].dir);
+      free(dir->items[i].dir);
+    }
+  }
+  free(dir->items);
+}
+
+/**
+ * Create tree objects for the working directory.
+ * Must be run from the top of the work tree, since paths are recorded in
+ * .git/index relative to it.
+ *
+ * @param workers Number of hashing threads (0 = online CPUs)
+ * @return SHA-1 hash of the top-level tree (caller must free), or NULL
+ */
+char *write_working_tree(int workers) {
+  trace_region_enter("write-tree", "write-tree");
+  struct worktree wt = {0};
+  if (read_index(&wt.old_index) != 0)
+    fprintf(stderr, "Ignoring unreadable %s\n", INDEX_FILE);
+
+  odb_transaction_begin();
+  trace_region_enter("write-tree", "scan");
+  scan_dir(&wt, &wt.root, ".", "");
+  trace_region_leave("write-tree", "scan");
+
+  if (workers <= 0)
+    workers = online_cpus();
+  if ((size_t)workers > wt.nr_to_hash)
+    workers = wt.nr_to_hash ? wt.nr_to_hash : 1;
+  trace_region_enter("write-tree", "hash-files");
+  run_parallel(workers, hash_worker, &wt);
+  trace_region_leave("write-tree", "hash-files");
+
+  struct object_id oid;
+  int ok = atomic_load(&wt.errors) == 0;
+  if (ok) {
+    trace_region_enter("write-tree", "build-trees");
+    build_tree(&wt, &wt.root, &oid);
+    trace_region_leave("write-tree", "build-trees");
+  }
+
+  // Flush and install the new objects before anything refers to them
+  ok = odb_transaction_end() == 0 && ok;
+
+  char *hex = NULL;
+  if (ok) {
+    hex = oid_to_hex(&oid, malloc(GIT_HASH_LENGTH + 1));
+
+    // Only rewrite the cache when something was re-hashed or removed
+    if (wt.nr_to_hash || wt.index.nr != wt.old_index.nr)
+      write_index(&wt.index);
+  }
+
+  free_worktree_dir(&wt.root);
+  free(wt.to_hash);
+  discard_index(&wt.index);
+  discard_index(&wt.old_index);
+  trace_region_leave("write-tree", "write-tree");
+  return hex;
+}
+
+/**
+ * Handler for the write-tree command.
+ * Creates a tree object representing the current working directory.
+ *
+ * @return 0 on success, 1 on error
+ */
+int handle_write_tree(void) {
+  char *hash = write_working_tree(0);
+  if (!hash) {
+    fprintf(stderr, "Failed to write tree\n");
+    return 1;
+  }
+
+  printf("%s\n", hash);
+  free(hash);
+  return 0;
+}